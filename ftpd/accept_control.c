@@ -34,13 +34,13 @@ void print_banner(struct context *ctx)
     }
 }
 
-#ifdef WITH_LWRES
+#ifdef WITH_DNS
 static void set_reverse(struct context *ctx, char *hostname)
 {
     if (hostname)
 	strset(&ctx->reverse, hostname);
 }
-#endif				/* WITH_LWRES */
+#endif				/* WITH_DNS */
 
 
 
@@ -107,10 +107,10 @@ void accept_control_raw(int s, struct scm_data_accept *sd)
 	Debug((DEBUG_NET, "- %s: getsockname failure\n", __func__));
 	return;
     }
-#ifdef WITH_LWRES
+#ifdef WITH_DNS
     if (idc)
 	io_dns_add(idc, &ctx->sa_c_remote, (void *) set_reverse, ctx);
-#endif				/* WITH_LWRES */
+#endif				/* WITH_DNS */
 
     su_ptoh(&ctx->sa_c_remote, &ctx->in6_remote);
     su_ptoh(&ctx->sa_c_local, &ctx->in6_local);
@@ -155,11 +155,14 @@ void accept_control_raw(int s, struct scm_data_accept *sd)
 void accept_control(struct context *ctx, int cur __attribute__((unused)))
 {
     int s = -1;
-    struct scm_data_accept sd;
+    union {
+	struct scm_data_accept sd;
+	struct scm_data_tls_keys tk;
+    } u;
 
     DebugIn(DEBUG_NET);
 
-    if (common_data.scm_recv_msg(ctx->cfn, &sd, sizeof(sd), &s)) {
+    if (common_data.scm_recv_msg(ctx->cfn, &u.sd, sizeof(u), &s)) {
 	logerr("scm_recv_msg");
 	Debug((DEBUG_NET, "- %s: scm_recv_msg failure\n", __func__));
 	cleanup(ctx, ctx->cfn);
@@ -167,10 +170,15 @@ void accept_control(struct context *ctx, int cur __attribute__((unused)))
 	return;
     }
 
-    switch (sd.type) {
+    switch (u.sd.type) {
     case SCM_MAY_DIE:
 	if (common_data.users_cur == 0) {
 	    Debug((DEBUG_PROC, "exiting -- process out of use\n"));
+	    list_cache_report(1);
+	    hot_file_report(1);
+#ifdef WITH_ZLIB
+	    deflate_pool_report(1);
+#endif
 	    mavis_drop(mcx);
 	    logmsg("Terminating, no longer needed.");
 	    exit(EX_OK);
@@ -178,8 +186,15 @@ void accept_control(struct context *ctx, int cur __attribute__((unused)))
 	die_when_idle = -1;
 	break;
     case SCM_ACCEPT:
-	accept_control_raw(s, &sd);
+	accept_control_raw(s, &u.sd);
+	break;
+#ifdef WITH_SSL
+    case SCM_TLS_KEYS:
+	if (ssl_ctx)
+	    ssl_add_ticket_key(ssl_ctx, u.tk.keyrev, u.tk.key, sizeof(u.tk.key));
+	memset(&u, 0, sizeof(u));
 	break;
+#endif
     default:
 	if (s > -1)
 	    close(s);
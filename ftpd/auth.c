@@ -10,6 +10,7 @@
 
 #include "headers.h"
 #include "mavis/groups.h"
+#include "misc/crc32.h"
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
@@ -140,8 +141,8 @@ static void auth_mavis_sync(struct context *ctx, av_ctx * avc)
 	(t = av_get(avc, AV_A_UID)) &&
 	(ctx->uid = (uid_t) strtoul(t, NULL, 10)) &&
 	(t = av_get(avc, AV_A_GID)) &&
-	(ctx->gid = (gid_t) strtoul(t, NULL, 10)) && (cwd = av_get(avc, AV_A_HOME)) && (u = av_get(avc, AV_A_ROOT)) && (strlen(u) < sizeof(ctx->root)))
-	strcpy(ctx->root, u);
+	(ctx->gid = (gid_t) strtoul(t, NULL, 10)) && (cwd = av_get(avc, AV_A_HOME)) && (u = av_get(avc, AV_A_ROOT)) && (strlen(u) <= PATH_MAX))
+	ctx_path_set(&ctx->root, u);
     else {
 	if (r) {
 	    char *er = av_get(avc, AV_A_USER_RESPONSE);
@@ -180,10 +181,18 @@ static void auth_mavis_sync(struct context *ctx, av_ctx * avc)
 	    ctx->incoming = Xcalloc(1, sizeof(regex_t));
 	if (regcomp(ctx->incoming, t, REG_EXTENDED | common_data.regex_posix_flags | REG_NOSUB))
 	    logerr("regcomp(%s) failed", t);
+	ctx->incoming_crc = crc32_update(INITCRC32, (u_char *) t, (off_t) strlen(t));
     }
 
-    if ((t = av_get(avc, AV_A_GIDS)))
+    if ((t = av_get(avc, AV_A_GIDS))) {
+	char *c;
+	for (i = 1, c = t; *c; c++)
+	    if (*c == ',')
+		i++;
+	Xfree(&ctx->gids);
+	ctx->gids = Xcalloc(i, sizeof(gid_t));
 	groups_ascii2list(t, &(ctx->gids_size), ctx->gids);
+    }
 
     if ((t = av_get(avc, AV_A_UMASK))
 	&& (1 == sscanf(t, "%o", &ctx->umask)))
@@ -218,7 +227,7 @@ static void auth_mavis_sync(struct context *ctx, av_ctx * avc)
     ctx->root_dev = st.st_dev, ctx->root_ino = st.st_ino;
 
     hd = buildpath(ctx, cwd);
-    if (!hd || (ctx->cwdlen = (u_int) strlen(hd)) >= sizeof(ctx->cwd)) {
+    if (!hd || (ctx->cwdlen = (u_int) strlen(hd)) > PATH_MAX) {
 	logerr("buffer too small in %s:%d (%s/%s)", __FILE__, __LINE__, ctx->user, hd);
 	reply(ctx, MSG_551_Internal_error);
 	ctx->state = ST_conn;
@@ -228,14 +237,14 @@ static void auth_mavis_sync(struct context *ctx, av_ctx * avc)
     }
 
     if (hd[0] == '/' && !hd[1])
-	ctx->cwd[0] = 0, ctx->cwdlen = 0;
+	ctx_path_set(&ctx->cwd, NULL), ctx->cwdlen = 0;
     else
-	strcpy(ctx->cwd, hd);
+	ctx_path_set(&ctx->cwd, hd);
 
-    strcpy(ctx->home, ctx->cwd);
+    ctx_path_set(&ctx->home, ctx->cwd);
     ctx->homelen = ctx->cwdlen;
 
-    hd = ctx->cwd + ctx->rootlen + 1;
+    hd = (ctx->cwdlen > ctx->rootlen) ? ctx->cwd + ctx->rootlen + 1 : "";
     if (*hd && chdir(hd)) {
 	logerr("chdir: %s (%s)", hd, ctx->user);
 	reply(ctx, MSG_550_No_access_to_homedir);
@@ -251,7 +260,7 @@ static void auth_mavis_sync(struct context *ctx, av_ctx * avc)
 	strset(&ctx->email, av_get(avc, AV_A_EMAIL));
 
     ctx->state = ST_pass;
-    ctx->filename[0] = 0;
+    ctx_path_set(&ctx->filename, NULL);
     ctx->bytecount = 0;
     ctx->filesize = 0;
     ctx->io_offset = 0;
@@ -10,6 +10,9 @@
 #include "headers.h"
 #include <sys/uio.h>
 #include "misc/mysendfile.h"
+#ifdef WITH_SSL
+#include "misc/ssl_init.h"
+#endif
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
@@ -48,6 +51,20 @@ void buffer2socket(struct context *ctx, int cur __attribute__((unused)))
 
     ctx->buffer_filled = 0;
 
+#ifdef WITH_ZLIB
+    if (ctx->filename[0] && !ctx->zstream && !ctx->deflate_pooled && (ctx->conversion == CONV_GZ || ctx->mode == 'z'))
+	deflate_pool_start(ctx);
+
+    if (ctx->deflate_pooled) {
+	if (ctx->zpool && deflate_pool_pull(ctx))
+	    goto fatal;
+	if (!ctx->dbuf) {
+	    /* waiting for the compression workers */
+	    Debug((DEBUG_BUFFER, "- %s: deflate pool\n", __func__));
+	    return;
+	}
+    } else
+#endif
     if (ctx->iomode == IOMODE_read
 #ifdef WITH_MMAP
 	|| ctx->iomode == IOMODE_mmap
@@ -61,12 +78,14 @@ void buffer2socket(struct context *ctx, int cur __attribute__((unused)))
 	    return;
 	}
 
+    if (ctx->liststream)
+	list_pull(ctx);
+
     db = ctx->dbufi;
 
 #ifdef WITH_ZLIB
     if (ctx->mode == 'z' && ctx->dbufi && !ctx->filename[0]) {
 	struct buffer *out, *in;
-	ctx->deflate_level = 9;
 	ctx->zstream = Xcalloc(1, sizeof(z_stream));
 	Debug((DEBUG_PROC, "deflate_level = %d\n", ctx->deflate_level));
 	if (Z_OK != deflateInit2(ctx->zstream, ctx->deflate_level, Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY)) {
@@ -158,6 +177,12 @@ void buffer2socket(struct context *ctx, int cur __attribute__((unused)))
 
 	Debug((DEBUG_PROC, "sendfile (%d, %d, %lld, %lld)\n", ctx->dfn, ctx->ffn, (long long) ctx->offset, (long long) min));
 
+#ifdef WITH_SSL
+	/* without kTLS, encryption happens in user space */
+	if (ctx->ssl_d && !ssl_ktls_send(ctx->ssl_d))
+	    l = -1, errno = EOPNOTSUPP;
+	else
+#endif				/* WITH_SSL */
 	if (min > 0)
 	    l = mysendfile(ctx->dfn, ctx->ffn, (off_t *) & ctx->offset, min);
 	else
@@ -176,11 +201,14 @@ void buffer2socket(struct context *ctx, int cur __attribute__((unused)))
 	    return;
 	}
 	ctx->iomode_fixed = 1, ctx->remaining -= l;
+	hot_file_advance(ctx, ctx->offset);
     }				/* IOMODE_sendfile */
     else
 #endif				/* WITH_SENDFILE */
 #ifdef WITH_ZLIB
-    if (ctx->conversion == CONV_GZ || (ctx->mode == 'z' && ctx->filename[0])) {
+    if (ctx->deflate_pooled)
+	db = ctx->dbuf;
+    else if (ctx->conversion == CONV_GZ || (ctx->mode == 'z' && ctx->filename[0])) {
 	struct buffer *b;
 	char trailer[8];
 	int res;
@@ -286,7 +314,7 @@ void buffer2socket(struct context *ctx, int cur __attribute__((unused)))
     /* ascii */
     if (db) {
 #ifdef WITH_SSL
-	if (ctx->ssl_d) {
+	if (ctx->ssl_d && !ssl_ktls_send(ctx->ssl_d)) {
 	    l = io_SSL_write(ctx->ssl_d, db->buf + db->offset, db->length - db->offset, ctx->io, ctx->dfn, (void *) buffer2socket);
 	} else
 #endif				/* WITH_SSL */
@@ -330,7 +358,7 @@ void buffer2socket(struct context *ctx, int cur __attribute__((unused)))
     if (!ctx->remaining)
 	cleanup_file(ctx, ctx->ffn);
 
-    if (!ctx->remaining && !ctx->dbufi && !ctx->dbuf
+    if (!ctx->remaining && !ctx->dbufi && !ctx->dbuf && !ctx->liststream
 #ifdef WITH_ZLIB
 	&& !ctx->zstream
 #endif
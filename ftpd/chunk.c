@@ -13,6 +13,20 @@
 static const char rcsid[]
     __attribute__((used)) = "$Id$";
 
+/*
+ * Reports the read position of a download to the hot file registry, and
+ * detaches from it once the file is closed and the buffers are drained.
+ */
+static void chunk_advance(struct context *ctx)
+{
+    if (!ctx->hot)
+	return;
+    if (ctx->ffn < 0)
+	hot_file_close(ctx);
+    else if (!ctx->dbufi || !ctx->dbufi->next)
+	hot_file_advance(ctx, ctx->offset - (off_t) ctx->chunk_length);
+}
+
 int chunk_get(struct context *ctx, off_t * offset)
 {
     int result = 0;
@@ -30,14 +44,17 @@ int chunk_get(struct context *ctx, off_t * offset)
 		b->offset = (size_t) (*offset - ctx->offset);
 		ctx->remaining -= *offset;
 	    }
-	    if (bufsize_mmap)
-		b->length = (size_t) (MIN((off_t) b->offset + ctx->remaining, (off_t) bufsize_mmap));
+	    if (bufsize_mmap || ctx->hot)
+		b->length = (size_t) (MIN((off_t) b->offset + ctx->remaining, (off_t) (bufsize_mmap ? bufsize_mmap : bufsize_readahead)));
 	    else
 		b->length = (size_t) (b->offset + (off_t) ctx->remaining);
 
 	    b->size = b->length;
 
-	    b->buf = (char *) mmap(0, b->length, PROT_READ, MAP_SHARED, ctx->ffn, ctx->offset);
+	    if ((b->buf = hot_file_map(ctx, ctx->offset, b->length)))
+		b->mmapped = BUFFER_MMAP_SHARED;
+	    else
+		b->buf = (char *) mmap(0, b->length, PROT_READ, MAP_SHARED, ctx->ffn, ctx->offset);
 
 	    if (b->buf == MAP_FAILED) {
 		if (offset && *offset) {
@@ -56,7 +73,8 @@ int chunk_get(struct context *ctx, off_t * offset)
 		    *offset = 0;
 		ctx->iomode_fixed = 1;
 		ctx->dbufi = buffer_append(ctx->dbufi, b);
-		madvise(b->buf, b->length, MADV_SEQUENTIAL);
+		if (b->mmapped != BUFFER_MMAP_SHARED)
+		    madvise(b->buf, b->length, MADV_SEQUENTIAL);
 		ctx->remaining -= b->length - b->offset, ctx->offset += b->length;
 		if (!ctx->dbufi || ctx->dbufi->length == 0)
 		    result = -1;
@@ -89,6 +107,7 @@ int chunk_get(struct context *ctx, off_t * offset)
 	ctx->chunk_start = NULL;
 	ctx->chunk_length = 0;
     }
+    chunk_advance(ctx);
     DebugOut(DEBUG_BUFFER);
     return result;
 }
@@ -105,6 +124,7 @@ int chunk_release(struct context *ctx, off_t len)
 	ctx->chunk_start = NULL;
 	ctx->chunk_length = 0;
     }
+    chunk_advance(ctx);
     DebugOut(DEBUG_BUFFER);
     return 0;
 }
@@ -7,6 +7,10 @@
  *
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* fallocate(2) */
+#endif
+
 #include "headers.h"
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
@@ -192,6 +196,9 @@ void cleanup_data(struct context *ctx, int cur __attribute__((unused)))
 	if (ctx->ffn < 0 || outgoing_data) {
 	    ctx->dbuf = buffer_free_all(ctx->dbuf);
 	    ctx->dbufi = buffer_free_all(ctx->dbufi);
+	    hot_file_close(ctx);
+	    if (!ctx->list_to_cc)
+		list_free(ctx);
 	}
 
 	/* reset remote data CEP to defaults */
@@ -222,6 +229,11 @@ int cleanup_file(struct context *ctx, int cur __attribute__((unused)))
 
     DebugIn(DEBUG_PROC);
 
+    checksum_cancel(ctx);
+#ifdef WITH_ZLIB
+    deflate_pool_free(ctx);
+#endif
+
     if (ctx->ffn > -1) {
 	Debug((DEBUG_PROC, "  ctx->ffn: %d\n", ctx->ffn));
 
@@ -234,8 +246,22 @@ int cleanup_file(struct context *ctx, int cur __attribute__((unused)))
 	    fstat(ctx->ffn, &st);
 	    quota_add(ctx, st.st_size - ctx->quota_filesize_before_stor);
 	}
+#ifdef WITH_FALLOCATE
+	if (ctx->allo_end) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+	    struct stat st;
+	    if (!fstat(ctx->ffn, &st) && st.st_size < ctx->allo_end)
+		fallocate(ctx->ffn, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, st.st_size, ctx->allo_end - st.st_size);
+#endif
+	    ctx->allo_end = 0;
+	}
+#endif
+	splice_free(ctx);
+	hot_file_close(ctx);
 
 	result = close(ctx->ffn);
+	if (!ctx->outgoing_data)
+	    list_cache_flush();
 
 	ctx->ffn = -1;
 	cleanup_context(ctx, -1);
@@ -264,6 +290,11 @@ static void cleanup_context(struct context *ctx, int cur __attribute__((unused))
 	common_data.users_cur--;
 	if (common_data.users_cur == 0 && die_when_idle) {
 	    Debug((DEBUG_PROC, "exiting -- process out of use\n"));
+	    list_cache_report(1);
+	    hot_file_report(1);
+#ifdef WITH_ZLIB
+	    deflate_pool_report(1);
+#endif
 	    mavis_drop(mcx);
 	    logmsg("Terminating, no longer needed.");
 	    exit(EX_OK);
@@ -273,12 +304,12 @@ static void cleanup_context(struct context *ctx, int cur __attribute__((unused))
     if (ctx->ifn > -1)
 	cleanup_ident(ctx, ctx->ifn);
 
-#ifdef WITH_LWRES
+#ifdef WITH_DNS
     if (ctx->reverse)
 	Xfree(&ctx->reverse);
     else
 	io_dns_cancel(idc, ctx);
-#endif				/* WITH_LWRES */
+#endif				/* WITH_DNS */
 
 #ifdef WITH_SSL
     Xfree(&ctx->certsubj);
@@ -286,6 +317,7 @@ static void cleanup_context(struct context *ctx, int cur __attribute__((unused))
 #endif
 
     ctx->pst_valid = 0;
+    pickystat_flush(ctx);
 
     Xfree(&ctx->ident_buf);
     Xfree(&ctx->ident_user);
@@ -303,7 +335,7 @@ static void cleanup_context(struct context *ctx, int cur __attribute__((unused))
     }
 #endif
 
-    RB_tree_delete(ctx->filelist);
+    list_free(ctx);
 
     while (io_sched_pop(ctx->io, ctx));
 
@@ -316,11 +348,17 @@ static void cleanup_context(struct context *ctx, int cur __attribute__((unused))
     }
 
     Xfree(&ctx->quota_path);
+    Xfree(&ctx->gids);
+    ctx_path_set(&ctx->root, NULL);
+    ctx_path_set(&ctx->cwd, NULL);
+    ctx_path_set(&ctx->home, NULL);
+    ctx_path_set(&ctx->filename, NULL);
 
     buffer_free_all(ctx->cbufi);
     buffer_free_all(ctx->cbufo);
     buffer_free_all(ctx->dbuf);
-    buffer_free_all(ctx->dbufi);
+    ctx->dbufi = buffer_free_all(ctx->dbufi);
+    hot_file_close(ctx);
     free(ctx);
 
     set_proctitle(die_when_idle ? ACCEPT_NEVER : ACCEPT_YES);
@@ -341,7 +379,11 @@ void cleanup(struct context *ctx, int cur __attribute__((unused)))
 
     if (dfn > -1 && io_get_ctx(io, dfn))
 	cleanup_data(ctx, dfn);
-    if (ffn > -1 && io_get_ctx(io, ffn))
+    if (ffn > -1 && (io_get_ctx(io, ffn) || ctx->checksum_fn > -1
+#ifdef WITH_ZLIB
+		     || ctx->zpool
+#endif
+	))
 	cleanup_file(ctx, ffn);
     if (cfn > -1 && io_get_ctx(io, cfn))
 	cleanup_control(ctx, cfn);
@@ -353,6 +395,11 @@ void cleanup_spawnd(struct context *ctx __attribute__((unused)), int cur __attri
 {
     if (common_data.users_cur == 0) {
 	Debug((DEBUG_PROC, "exiting -- process out of use\n"));
+	list_cache_report(1);
+	hot_file_report(1);
+#ifdef WITH_ZLIB
+	deflate_pool_report(1);
+#endif
 	mavis_drop(mcx);
 	logmsg("Terminating, no longer needed.");
 	exit(EX_OK);
@@ -32,7 +32,11 @@ struct acl_element {
     enum ftp_acl_type type;
     u_int negate:1;
     u_int caseless:1;
+    u_int literal_prefix:1;
+    u_int in_trie:1;		/* covered by the expression's trie */
     u_int line:16;
+    char *literal;		/* regex reduced to a literal string or prefix */
+    size_t literal_len;
     union {
 	enum token token;
 	struct in6_cidr *c;
@@ -63,9 +67,26 @@ struct ftp_acl_expr {
     u_int state_secure_check:1;
     u_int state_authen:1;
     u_int state_authen_check:1;
+    struct acl_trie *user_trie;
+    struct acl_trie *path_trie;
+    struct acl_trie *host_trie;
+    struct acl_trie *arg_trie;
     struct ftp_acl_expr *next;
 };
 
+/*
+ * Non-negated literal elements (and regular expressions that reduce to
+ * an anchored literal or prefix) of an element list are merged into a
+ * trie, so the list is checked with a single pass over the subject.
+ */
+struct acl_trie {
+    struct acl_trie *child;
+    struct acl_trie *sibling;
+    u_char c;
+    u_int exact:1;		/* a literal ends here */
+    u_int prefix:1;		/* a prefix ends here */
+};
+
 struct ftp_acl {
     struct ftp_acl_expr *expr;
     char name[1];
@@ -114,11 +135,157 @@ static int acl_add_cmd(char *cmd, int action, struct ftp_acl *acl, int site, int
 
 static void acl_conf_set_defaults(void);
 
+static void acl_trie_add(struct acl_trie **root, char *s, size_t len, int prefix)
+{
+    struct acl_trie *n;
+
+    if (!*root)
+	*root = Xcalloc(1, sizeof(struct acl_trie));
+    n = *root;
+
+    for (; len; s++, len--) {
+	struct acl_trie **c = &n->child;
+	while (*c && (*c)->c != (u_char) * s)
+	    c = &(*c)->sibling;
+	if (!*c) {
+	    *c = Xcalloc(1, sizeof(struct acl_trie));
+	    (*c)->c = (u_char) * s;
+	}
+	n = *c;
+    }
+    if (prefix)
+	n->prefix = 1;
+    else
+	n->exact = 1;
+}
+
+static int acl_trie_match(struct acl_trie *n, char *s)
+{
+    for (; !n->prefix && *s; s++) {
+	for (n = n->child; n && n->c != (u_char) * s; n = n->sibling);
+	if (!n)
+	    return 0;
+    }
+    return n->prefix || n->exact;
+}
+
+/*
+ * Reduces "^literal", "^literal.*" and "^literal$" to literal prefix or
+ * string comparisons. Case-insensitive expressions are left alone.
+ */
+static void acl_regex_literal(struct acl_element *e)
+{
+    char *s = e->string, *t;
+
+    if (e->caseless || !s || *s != '^')
+	return;
+
+    t = e->literal = Xcalloc(1, strlen(s));
+    e->literal_prefix = 1;
+
+    for (s++; *s; s++) {
+	if (*s == '\\' && s[1] && !isalnum((int) (u_char) s[1]))
+	    s++;
+	else if (!strcmp(s, "$")) {
+	    e->literal_prefix = 0;
+	    break;
+	} else if (!strcmp(s, ".*"))
+	    break;
+	else if (strchr(".[]()*+?{}|\\$^", *s)) {
+	    Xfree(&e->literal);
+	    return;
+	}
+	*t++ = *s;
+    }
+    e->literal_len = (size_t) (t - e->literal);
+}
+
+static void acl_compile_list(struct acl_element *e, struct acl_trie **trie, int caseless_strings)
+{
+    struct acl_element *f;
+    int count = 0;
+
+    for (f = e; f; f = f->next)
+	if (f->type == T_regex_posix || f->type == T_regex_pcre)
+	    acl_regex_literal(f);
+
+    for (f = e; f; f = f->next)
+	if (!f->negate && ((f->type == T_string && !(caseless_strings && f->caseless)) || f->literal))
+	    count++;
+
+    if (count < 2)
+	return;
+
+    for (f = e; f; f = f->next)
+	if (!f->negate && f->type == T_string && !(caseless_strings && f->caseless)) {
+	    acl_trie_add(trie, f->string, strlen(f->string), 0);
+	    f->in_trie = 1;
+	} else if (!f->negate && f->literal) {
+	    acl_trie_add(trie, f->literal, f->literal_len, f->literal_prefix);
+	    f->in_trie = 1;
+	}
+}
+
+static int acl_memo_enabled = 1;
+
+/*
+ * ACL elements that depend on session attributes. The memo key records
+ * which of them match, not the attributes themselves.
+ */
+enum acl_input_type { ACL_INPUT_NET, ACL_INPUT_USER, ACL_INPUT_HOST };
+
+struct acl_input {
+    struct acl_element *e;
+    enum acl_input_type type;
+};
+
+static struct acl_input *acl_inputs = NULL;
+static int acl_inputs_count = 0;
+static size_t acl_inputs_words = 0;
+static u_int64_t *acl_inputs_match = NULL;
+
+static void acl_add_inputs(struct acl_element *e, enum acl_input_type type)
+{
+    for (; e; e = e->next) {
+	acl_inputs = Xrealloc(acl_inputs, (acl_inputs_count + 1) * sizeof(struct acl_input));
+	acl_inputs[acl_inputs_count].e = e;
+	acl_inputs[acl_inputs_count].type = type;
+	acl_inputs_count++;
+    }
+}
+
+static void acl_compile(void)
+{
+    rb_node_t *rbn;
+
+    for (rbn = RB_first(acltable); rbn; rbn = RB_next(rbn)) {
+	struct ftp_acl_expr *r;
+	for (r = ((struct ftp_acl *) RB_payload_get(rbn))->expr; r; r = r->next) {
+	    acl_compile_list(r->user, &r->user_trie, 1);
+	    acl_compile_list(r->path, &r->path_trie, 0);
+	    acl_compile_list(r->host, &r->host_trie, 0);
+	    acl_compile_list(r->arg, &r->arg_trie, 0);
+	    acl_add_inputs(r->src, ACL_INPUT_NET);
+	    acl_add_inputs(r->dst, ACL_INPUT_NET);
+	    acl_add_inputs(r->user, ACL_INPUT_USER);
+	    acl_add_inputs(r->host, ACL_INPUT_HOST);
+	    /* Results depending on the time of day can't be memoized. */
+	    if (r->time)
+		acl_memo_enabled = 0;
+	}
+    }
+
+    acl_inputs_words = (size_t) (acl_inputs_count + 63) / 64;
+    acl_inputs_match = Xcalloc(acl_inputs_words ? acl_inputs_words : 1, sizeof(u_int64_t));
+}
+
 void acl_finish()
 {
     int i;
     struct service_req *cmds = requests;
 
+    acl_compile();
+
     for (i = 0; cmds->cmd; i++, cmds++) {
 	requests_aclset[i] = Xcalloc(1, sizeof(struct acl_set));
 	requests_aclset[i]->acl = lookup_acl(NULL, cmds->acl_default_name);
@@ -155,6 +322,38 @@ static int match_regex(void *reg, char *txt, enum ftp_acl_type tat)
     }
 }
 
+/* Match a single element, ignoring negation. */
+static int match_element(struct acl_element *e, char *txt, int caseless_strings, int nl)
+{
+    if (e->type == T_string)
+	return !((caseless_strings && e->caseless) ? strcasecmp(txt, e->string) : strcmp(txt, e->string));
+    if (e->literal && !nl)
+	return !(e->literal_prefix ? strncmp(txt, e->literal, e->literal_len) : strcmp(txt, e->literal));
+    return match_regex(e->blob.r, txt, e->type);
+}
+
+static int match_list(struct acl_element *e, struct acl_trie *trie, char *txt, int caseless_strings)
+{
+    /* Literal shortcuts don't implement multi-line anchors. */
+    int nl = (strchr(txt, '\n') != NULL);
+
+    if (trie && !nl && acl_trie_match(trie, txt))
+	return -1;
+
+    for (; e; e = e->next) {
+	int match;
+	if (e->in_trie && !nl)
+	    continue;
+	match = match_element(e, txt, caseless_strings, nl);
+
+	if (e->negate)
+	    match = !match;
+	if (match)
+	    return -1;
+    }
+    return 0;
+}
+
 enum token eval_ftp_acl(struct context *ctx, struct ftp_acl *acl, char *arg, char *path)
 {
     if (acl) {
@@ -246,45 +445,18 @@ enum token eval_ftp_acl(struct context *ctx, struct ftp_acl *acl, char *arg, cha
 	    match = 0;
 
 	    if (r->user) {
-		struct acl_element *e = r->user;
 		if (!ctx->user)
 		    return S_unknown;
-
-		while (e) {
-		    if (e->type == T_string)
-			match = !(e->caseless ? strcasecmp(ctx->user, e->string) : strcmp(ctx->user, e->string));
-		    else
-			match = match_regex(e->blob.r, ctx->user, e->type);
-
-		    if (e->negate)
-			match = !match;
-		    if (match)
-			break;
-		    e = e->next;
-		}
-		if (!match)
+		if (!match_list(r->user, r->user_trie, ctx->user, 1))
 		    continue;
 	    }
 	    Debug((DEBUG_ACL, "user acl matched\n"));
 	    match = 0;
 
 	    if (r->path) {
-		struct acl_element *e = r->path;
 		if (!path)
 		    return S_unknown;
-		while (e) {
-		    if (e->type == T_string)
-			match = !strcmp(path, e->string);
-		    else
-			match = match_regex(e->blob.r, path, e->type);
-
-		    if (e->negate)
-			match = !match;
-		    if (match)
-			break;
-		    e = e->next;
-		}
-		if (!match)
+		if (!match_list(r->path, r->path_trie, path, 0))
 		    continue;
 	    }
 	    Debug((DEBUG_ACL, "path acl matched\n"));
@@ -292,43 +464,15 @@ enum token eval_ftp_acl(struct context *ctx, struct ftp_acl *acl, char *arg, cha
 
 	    if (r->arg && !arg)
 		return S_unknown;
-	    if (r->arg) {
-		struct acl_element *e = r->arg;
-		while (e) {
-		    if (e->type == T_string)
-			match = !strcmp(arg, e->string);
-		    else
-			match = match_regex(e->blob.r, arg, e->type);
-
-		    if (e->negate)
-			match = !match;
-		    if (match)
-			break;
-		    e = e->next;
-		}
-		if (!match)
-		    continue;
-	    }
+	    if (r->arg && !match_list(r->arg, r->arg_trie, arg, 0))
+		continue;
 	    Debug((DEBUG_ACL, "arg acl matched\n"));
 	    match = 0;
 
 	    if (r->host) {
-		struct acl_element *e = r->host;
 		if (!ctx->hostname)
 		    return S_unknown;
-		while (e) {
-		    if (e->type == T_string)
-			match = !strcmp(ctx->hostname, e->string);
-		    else
-			match = match_regex(e->blob.r, ctx->hostname, e->type);
-
-		    if (e->negate)
-			match = !match;
-		    if (match)
-			break;
-		    e = e->next;
-		}
-		if (!match)
+		if (!match_list(r->host, r->host_trie, ctx->hostname, 0))
 		    continue;
 	    }
 	    Debug((DEBUG_ACL, "user acl matched\n"));
@@ -366,7 +510,101 @@ enum token eval_ftp_acl(struct context *ctx, struct ftp_acl *acl, char *arg, cha
 
 static void acl_conf_copy(struct context *);
 
-void acl_calc(struct context *ctx)
+/*
+ * Command permissions only depend on the session state flags and on
+ * which ACL inputs match (as long as no ACL refers to a time
+ * specification), so they're memoized across sessions.
+ */
+#define ACL_MEMO_SIZE 1024
+
+struct acl_memo {
+    u_int flags;
+    u_int64_t *match;		/* bit per acl_inputs[] element */
+    set64 requests;
+    set64 requests_dunno;
+    set64 requests_site;
+    set64 requests_site_dunno;
+    set64 requests_log;
+    set64 requests_site_log;
+    struct acl_memo *prev;	/* LRU list */
+    struct acl_memo *next;
+};
+
+static rb_tree_t *acl_memo = NULL;
+static struct acl_memo *acl_memo_head = NULL, *acl_memo_tail = NULL;
+
+static int acl_memo_compare(const void *a, const void *b)
+{
+    const struct acl_memo *x = (const struct acl_memo *) a, *y = (const struct acl_memo *) b;
+
+    if (x->flags != y->flags)
+	return x->flags < y->flags ? -1 : 1;
+    return memcmp(x->match, y->match, acl_inputs_words * sizeof(u_int64_t));
+}
+
+static void acl_memo_unlink(struct acl_memo *m)
+{
+    if (m->prev)
+	m->prev->next = m->next;
+    else
+	acl_memo_head = m->next;
+    if (m->next)
+	m->next->prev = m->prev;
+    else
+	acl_memo_tail = m->prev;
+    m->prev = m->next = NULL;
+}
+
+static void acl_memo_push(struct acl_memo *m)
+{
+    m->prev = NULL;
+    m->next = acl_memo_head;
+    if (acl_memo_head)
+	acl_memo_head->prev = m;
+    acl_memo_head = m;
+    if (!acl_memo_tail)
+	acl_memo_tail = m;
+}
+
+static void acl_memo_free(void *payload)
+{
+    struct acl_memo *m = (struct acl_memo *) payload;
+    acl_memo_unlink(m);
+    free(m->match);
+    free(m);
+}
+
+static int acl_input_match(struct context *ctx, struct acl_input *in)
+{
+    switch (in->type) {
+    case ACL_INPUT_NET:
+	return in->e->type == T_cidr && v6_contains(&in->e->blob.c->addr, in->e->blob.c->mask, &ctx->in6_remote);
+    case ACL_INPUT_USER:
+	return ctx->user && match_element(in->e, ctx->user, 1, strchr(ctx->user, '\n') != NULL);
+    case ACL_INPUT_HOST:
+	return ctx->hostname && match_element(in->e, ctx->hostname, 0, strchr(ctx->hostname, '\n') != NULL);
+    }
+    return 0;
+}
+
+static void acl_memo_key(struct context *ctx, struct acl_memo *m)
+{
+    int i;
+
+    memset(m, 0, sizeof(struct acl_memo));
+    m->flags = ctx->anonymous | ctx->real << 1 | (ctx->user ? 1 << 3 : 0) | (ctx->hostname ? 1 << 4 : 0)
+#ifdef WITH_SSL
+	| (ctx->ssl_c ? 1 << 2 : 0)
+#endif
+	;
+    memset(acl_inputs_match, 0, acl_inputs_words * sizeof(u_int64_t));
+    for (i = 0; i < acl_inputs_count; i++)
+	if (acl_input_match(ctx, &acl_inputs[i]))
+	    acl_inputs_match[i / 64] |= (u_int64_t) 1 << (i % 64);
+    m->match = acl_inputs_match;
+}
+
+static void acl_calc_requests(struct context *ctx)
 {
     int i;
     struct service_req *cmds = requests;
@@ -427,6 +665,48 @@ void acl_calc(struct context *ctx)
 		    SET64_SET(i, ctx->requests_site_log);
 	    }
 	}
+}
+
+void acl_calc(struct context *ctx)
+{
+    struct acl_memo k, *m = NULL;
+
+    if (acl_memo_enabled) {
+	acl_memo_key(ctx, &k);
+	if (!acl_memo)
+	    acl_memo = RB_tree_new(acl_memo_compare, acl_memo_free);
+	m = RB_lookup(acl_memo, &k);
+    }
+
+    if (m) {
+	acl_memo_unlink(m);
+	acl_memo_push(m);
+	ctx->requests = m->requests;
+	ctx->requests_dunno = m->requests_dunno;
+	ctx->requests_site = m->requests_site;
+	ctx->requests_site_dunno = m->requests_site_dunno;
+	ctx->requests_log = m->requests_log;
+	ctx->requests_site_log = m->requests_site_log;
+    } else {
+	acl_calc_requests(ctx);
+
+	if (acl_memo_enabled) {
+	    m = Xcalloc(1, sizeof(struct acl_memo));
+	    *m = k;
+	    m->match = Xcalloc(acl_inputs_words ? acl_inputs_words : 1, sizeof(u_int64_t));
+	    memcpy(m->match, k.match, acl_inputs_words * sizeof(u_int64_t));
+	    m->requests = ctx->requests;
+	    m->requests_dunno = ctx->requests_dunno;
+	    m->requests_site = ctx->requests_site;
+	    m->requests_site_dunno = ctx->requests_site_dunno;
+	    m->requests_log = ctx->requests_log;
+	    m->requests_site_log = ctx->requests_site_log;
+	    acl_memo_push(m);
+	    RB_insert(acl_memo, m);
+	    if (RB_count(acl_memo) > ACL_MEMO_SIZE)
+		RB_search_and_delete(acl_memo, acl_memo_tail);
+	}
+    }
 
     acl_conf_copy(ctx);
 }
@@ -959,6 +1239,7 @@ static void parse_ftp_acl_expr(struct sym *sym, struct ftp_acl_expr **e)
 		}
 		(*r)->string = strdup(sym->buf);
 		(*r)->type = T_string;
+		sym_get(sym);
 	    }
 	    sym->flag_parse_pcre = 0;
 	    break;
@@ -1234,6 +1515,25 @@ void parse_decls(struct sym *sym)
 	    parse(sym, S_filesonly);
 	    nlst_files_only = -1;
 	    continue;
+	case S_sort_listing:
+	    //sort-listing = ( all | list | none )
+	    sym_get(sym);
+	    parse(sym, S_equal);
+	    switch (sym->code) {
+	    case S_all:
+		sort_listing = SORT_LISTING_ALL;
+		break;
+	    case S_list:
+		sort_listing = SORT_LISTING_LIST;
+		break;
+	    case S_none:
+		sort_listing = SORT_LISTING_NONE;
+		break;
+	    default:
+		parse_error_expect(sym, S_all, S_list, S_none, S_unknown);
+	    }
+	    sym_get(sym);
+	    continue;
 	case S_hideversion:
 	    // hide-version = (permit|deny)
 	    sym_get(sym);
@@ -1375,8 +1675,16 @@ void parse_decls(struct sym *sym)
 	    use_sendfile = parse_bool(sym);
 	    continue;
 #endif				/* WITH_MMAP */
+#ifdef WITH_SPLICE
+	case S_usesplice:
+	    //use-splice = (yes|no)
+	    sym_get(sym);
+	    parse(sym, S_equal);
+	    use_splice = parse_bool(sym);
+	    continue;
+#endif				/* WITH_SPLICE */
 	case S_buffer:{
-		// buffer (size|mmap-size) = ...
+		// buffer (size|mmap-size|write-behind|readahead) = ...
 		char c;
 		int b;
 		sym_get(sym);
@@ -1423,15 +1731,117 @@ void parse_decls(struct sym *sym)
 			bufsize_mmap = parse_int(sym);
 		    break;
 #endif				/* WITH_MMAP */
+		case S_writebehind:
+		    sym_get(sym);
+		    parse(sym, S_equal);
+
+		    if (2 == sscanf(sym->buf, "%d%c", &b, &c)) {
+			bufsize_writebehind = (size_t) b;
+			switch (c) {
+			case 'k':
+			case 'K':
+			    bufsize_writebehind <<= 10;
+			    break;
+			case 'm':
+			case 'M':
+			    bufsize_writebehind <<= 20;
+			    break;
+			}
+			sym_get(sym);
+		    } else
+			bufsize_writebehind = parse_int(sym);
+		    break;
+		case S_readahead:
+		    sym_get(sym);
+		    parse(sym, S_equal);
+
+		    if (2 == sscanf(sym->buf, "%d%c", &b, &c)) {
+			bufsize_readahead = (size_t) b;
+			switch (c) {
+			case 'k':
+			case 'K':
+			    bufsize_readahead <<= 10;
+			    break;
+			case 'm':
+			case 'M':
+			    bufsize_readahead <<= 20;
+			    break;
+			}
+			sym_get(sym);
+		    } else
+			bufsize_readahead = parse_int(sym);
+		    break;
 		default:
 		    parse_error_expect(sym, S_size,
 #ifdef WITH_MMAP
 				       S_mmapsize,
 #endif
-				       S_unknown);
+				       S_writebehind, S_readahead, S_unknown);
+		}
+		continue;
+	    }
+	case S_listing_cache:{
+		// listing-cache (size|timeout) = ...
+		char c;
+		int b;
+		sym_get(sym);
+		switch (sym->code) {
+		case S_size:
+		    sym_get(sym);
+		    parse(sym, S_equal);
+
+		    if (2 == sscanf(sym->buf, "%d%c", &b, &c)) {
+			list_cache_size = (size_t) b;
+			switch (c) {
+			case 'k':
+			case 'K':
+			    list_cache_size <<= 10;
+			    break;
+			case 'm':
+			case 'M':
+			    list_cache_size <<= 20;
+			    break;
+			}
+			sym_get(sym);
+		    } else
+			list_cache_size = (size_t) parse_int(sym);
+		    break;
+		case S_timeout:
+		    sym_get(sym);
+		    parse(sym, S_equal);
+		    list_cache_timeout = (time_t) parse_int(sym);
+		    break;
+		default:
+		    parse_error_expect(sym, S_size, S_timeout, S_unknown);
 		}
 		continue;
 	    }
+	case S_checksum:
+	    // checksum workers = <n>
+	    // checksum cache = (yes|no)
+	    sym_get(sym);
+	    switch (sym->code) {
+	    case S_workers:
+		sym_get(sym);
+		parse(sym, S_equal);
+		checksum_workers = parse_int(sym);
+		break;
+	    case S_cache:
+		sym_get(sym);
+		parse(sym, S_equal);
+		checksum_cache = parse_bool(sym);
+		break;
+	    default:
+		parse_error_expect(sym, S_workers, S_cache, S_unknown);
+	    }
+	    continue;
+	case S_deflate:
+	    // deflate workers = <n>
+	    sym_get(sym);
+	    parse(sym, S_workers);
+	    parse(sym, S_equal);
+	    deflate_workers = parse_int(sym);
+	    continue;
 	case S_retire:
 	    sym_get(sym);
 	    parse(sym, S_limit);
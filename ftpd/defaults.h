@@ -40,3 +40,15 @@
 #define DEFAULT_HOSTNAME		"misconfigured.host"
 #define DEFAULT_BINARY_ONLY		0
 #define DEFAULT_UMASK			022
+#define DEFAULT_LIST_CACHE_SIZE		(16 << 20)
+#define DEFAULT_LIST_CACHE_TIMEOUT	10
+#define DEFAULT_WRITEBEHIND		(8 << 20)
+#define DEFAULT_READAHEAD		(4 << 20)
+#define HOT_FILE_LINGER			30
+#define HOT_FILE_IDLE_MAX		32
+#define DEFAULT_CHECKSUM_WORKERS	2
+#define CHECKSUM_OFFLOAD_SIZE		(1 << 20)
+#define DEFAULT_DEFLATE_WORKERS		2
+#define DEFLATE_POOL_MAX		16
+#define DEFLATE_POOL_BLOCK		(256 << 10)
+#define DEFLATE_POOL_MIN		(1 << 20)
@@ -0,0 +1,382 @@
+/*
+ * deflate_pool.c
+ *
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ * All rights reserved.
+ *
+ * Parallel compression for MODE Z and on-the-fly gzip downloads. The
+ * file is split into blocks which are deflated independently by worker
+ * processes, each using the preceding 32 kB of the file as preset
+ * dictionary. Block i is handled by worker i % n, so reading the worker
+ * pipes round-robin yields the compressed stream in order. Workers block
+ * on their pipes as long as the data connection doesn't keep up.
+ *
+ * $Id$
+ *
+ */
+
+#include "headers.h"
+#include <sys/resource.h>
+
+static const char rcsid[] __attribute__((used)) = "$Id$";
+
+#ifdef WITH_ZLIB
+
+#define DEFLATE_POOL_DICT	32768
+#define DEFLATE_POOL_REPORT	3600	/* seconds between statistics log lines */
+
+#define DEFLATE_BLOCK_LAST	1
+#define DEFLATE_BLOCK_ERROR	2
+
+struct deflate_block {
+    u_int clen;			/* compressed length, payload follows */
+    u_int ulen;			/* uncompressed length */
+    u_int check;		/* adler32 or crc32 of uncompressed data */
+    u_int cpu_ms;		/* worker CPU time so far */
+    u_int level;		/* compression level used */
+    u_int flags;
+};
+
+struct deflate_pool {
+    int workers;
+    int cur;			/* worker producing the next block */
+    int fn[DEFLATE_POOL_MAX];
+    pid_t pid[DEFLATE_POOL_MAX];
+    u_int cpu_ms[DEFLATE_POOL_MAX];
+    struct deflate_block hdr;
+    size_t hdr_len;		/* header bytes read so far */
+    size_t need;		/* payload bytes outstanding */
+    uLong check;
+    unsigned long long total_in;
+    unsigned long long total_out;
+    u_int finished:1;
+};
+
+static int deflate_workers_busy = 0;
+
+static unsigned long long stat_in = 0, stat_out = 0, stat_cpu_ms = 0, stat_transfers = 0;
+static unsigned long long stat_transfers_reported = 0;
+static time_t stat_last_report = 0;
+
+static u_int cpu_ms(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (u_int) (ru.ru_utime.tv_sec * 1000 + ru.ru_utime.tv_usec / 1000 + ru.ru_stime.tv_sec * 1000 + ru.ru_stime.tv_usec / 1000);
+}
+
+static long long elapsed_us(struct timespec *a, struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1000000LL + (b->tv_nsec - a->tv_nsec) / 1000;
+}
+
+/*
+ * Compresses every n-th block of [start, end). The level is raised while
+ * the worker spends more time waiting for its pipe than compressing (the
+ * data connection is the bottleneck) and lowered while it doesn't have
+ * to wait at all or the system is out of CPU capacity.
+ */
+static void __attribute__((noreturn)) deflate_worker(struct context *ctx, int k, int n, off_t start, off_t end, int fd)
+{
+    size_t bound = DEFLATE_POOL_BLOCK + DEFLATE_POOL_BLOCK / 8 + 1024;
+    char *in = malloc(DEFLATE_POOL_DICT + DEFLATE_POOL_BLOCK), *out = malloc(bound);
+    int level = ctx->deflate_level, zlevel = -1;
+    int lmin = MAX(ctx->deflate_level_min, 1), lmax = ctx->deflate_level_max;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    struct deflate_block hdr;
+    z_stream z;
+    off_t i;
+
+    setup_worker(ctx->ffn, fd);
+
+    memset(&z, 0, sizeof(z));
+
+    for (i = k; in && out && start + i * DEFLATE_POOL_BLOCK < end; i += n) {
+	off_t off = start + i * DEFLATE_POOL_BLOCK;
+	size_t len = (size_t) MIN((off_t) DEFLATE_POOL_BLOCK, end - off);
+	size_t dlen = (size_t) MIN((off_t) DEFLATE_POOL_DICT, off - start);
+	struct timespec t0, t1, t2;
+	double la;
+	int res;
+
+	memset(&hdr, 0, sizeof(hdr));
+	if (off + (off_t) len == end)
+	    hdr.flags |= DEFLATE_BLOCK_LAST;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	if (pread(ctx->ffn, in, dlen + len, off - (off_t) dlen) != (ssize_t) (dlen + len))
+	    break;
+
+	if (level != zlevel) {
+	    if (zlevel > -1)
+		deflateEnd(&z);
+	    if (Z_OK != deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY))
+		break;
+	    zlevel = level;
+	} else if (Z_OK != deflateReset(&z))
+	    break;
+
+	if (dlen && Z_OK != deflateSetDictionary(&z, (u_char *) in, (uInt) dlen))
+	    break;
+
+	z.next_in = (u_char *) in + dlen;
+	z.avail_in = (uInt) len;
+	z.next_out = (u_char *) out;
+	z.avail_out = (uInt) bound;
+
+	/* A sync flush terminates the block on a byte boundary, so the blocks can simply be concatenated. */
+	res = deflate(&z, (hdr.flags & DEFLATE_BLOCK_LAST) ? Z_FINISH : Z_SYNC_FLUSH);
+	if (z.avail_in || (res != Z_OK && res != Z_STREAM_END))
+	    break;
+
+	hdr.clen = (u_int) (bound - z.avail_out);
+	hdr.ulen = (u_int) len;
+	if (ctx->mode == 'z')
+	    hdr.check = (u_int) adler32(adler32(0, NULL, 0), (u_char *) in + dlen, (uInt) len);
+	else
+	    hdr.check = (u_int) crc32(crc32(0, NULL, 0), (u_char *) in + dlen, (uInt) len);
+	hdr.cpu_ms = cpu_ms();
+	hdr.level = (u_int) level;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || write(fd, out, hdr.clen) != (ssize_t) hdr.clen)
+	    _exit(EX_IOERR);
+
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	if (level > 0) {
+	    if (elapsed_us(&t1, &t2) > elapsed_us(&t0, &t1))
+		level++;
+	    else if (20 * elapsed_us(&t1, &t2) < elapsed_us(&t0, &t1))
+		level--;
+	    if (ncpu > 0 && getloadavg(&la, 1) == 1 && la > (double) ncpu)
+		level = MIN(level, zlevel - 1);
+	    level = MAX(MIN(level, lmax), lmin);
+	}
+    }
+
+    if (in && out && start + i * DEFLATE_POOL_BLOCK >= end)
+	_exit(EX_OK);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.flags = DEFLATE_BLOCK_ERROR;
+    if (write(fd, &hdr, sizeof(hdr)) < 0)
+	_exit(EX_IOERR);
+    _exit(EX_SOFTWARE);
+}
+
+static void deflate_pool_ready(struct context *ctx, int cur)
+{
+    io_clr_i(ctx->io, cur);
+    if (ctx->dfn > -1)
+	io_set_o(ctx->io, ctx->dfn);
+}
+
+/*
+ * Starts compression workers for the file in ctx->ffn. Returns -1 if the
+ * file should be compressed inline.
+ */
+int deflate_pool_start(struct context *ctx)
+{
+    struct deflate_pool *p;
+    off_t start = ctx->io_offset, end = ctx->remaining;
+    int i, n;
+
+    n = MIN(deflate_workers - deflate_workers_busy, DEFLATE_POOL_MAX);
+    if (n < 1 || ctx->ffn < 0 || ctx->use_ascii || end - start < DEFLATE_POOL_MIN)
+	return -1;
+    if (ctx->iomode != IOMODE_read
+#ifdef WITH_MMAP
+	&& ctx->iomode != IOMODE_mmap
+#endif				/* WITH_MMAP */
+	)
+	return -1;
+
+    acl_set_deflate_level(ctx);
+
+    p = Xcalloc(1, sizeof(struct deflate_pool));
+
+    for (i = 0; i < n; i++) {
+	int fds[2];
+	if (pipe(fds))
+	    break;
+	switch ((p->pid[i] = fork())) {
+	case -1:
+	    close(fds[0]);
+	    close(fds[1]);
+	    break;
+	case 0:
+	    close(fds[0]);
+	    deflate_worker(ctx, i, n, start, end, fds[1]);
+	default:
+	    close(fds[1]);
+#ifdef F_SETPIPE_SZ
+	    fcntl(fds[0], F_SETPIPE_SZ, DEFLATE_POOL_BLOCK);
+#endif
+	    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	    p->fn[i] = fds[0];
+	    io_register(ctx->io, p->fn[i], ctx);
+	    io_set_cb_i(ctx->io, p->fn[i], (void *) deflate_pool_ready);
+	    io_set_cb_e(ctx->io, p->fn[i], (void *) deflate_pool_ready);
+	    io_set_cb_h(ctx->io, p->fn[i], (void *) deflate_pool_ready);
+	    p->workers++;
+	    continue;
+	}
+	break;
+    }
+
+    if (p->workers < n) {
+	/* Block assignment depends on the worker count, start over inline. */
+	ctx->zpool = p;
+	deflate_pool_free(ctx);
+	return -1;
+    }
+
+    deflate_workers_busy += n;
+    ctx->zpool = p;
+    ctx->deflate_pooled = 1;
+    ctx->remaining = end - start;
+    ctx->io_offset = 0;
+
+    if (ctx->mode == 'z') {
+	p->check = adler32(0, NULL, 0);
+	ctx->dbuf = buffer_write(ctx->dbuf, "\170\234", 2);
+    } else {
+	p->check = crc32(0, NULL, 0);
+	ctx->dbuf = buffer_write(ctx->dbuf, "\037\213\010\0\0\0\0\0\0\03", 10);
+    }
+
+    Debug((DEBUG_PROC, "deflate_pool_start: %d workers, level %d\n", n, ctx->deflate_level));
+    return 0;
+}
+
+static void deflate_pool_trailer(struct context *ctx)
+{
+    struct deflate_pool *p = ctx->zpool;
+    u_char t[8];
+
+    if (ctx->mode == 'z') {
+	t[0] = 0xff & (p->check >> 24);
+	t[1] = 0xff & (p->check >> 16);
+	t[2] = 0xff & (p->check >> 8);
+	t[3] = 0xff & (p->check);
+	ctx->dbuf = buffer_write(ctx->dbuf, (char *) t, 4);
+    } else {
+	t[0] = 0xff & (p->check);
+	t[1] = 0xff & (p->check >> 8);
+	t[2] = 0xff & (p->check >> 16);
+	t[3] = 0xff & (p->check >> 24);
+	t[4] = 0xff & (p->total_in);
+	t[5] = 0xff & (p->total_in >> 8);
+	t[6] = 0xff & (p->total_in >> 16);
+	t[7] = 0xff & (p->total_in >> 24);
+	ctx->dbuf = buffer_write(ctx->dbuf, (char *) t, 8);
+    }
+}
+
+/*
+ * Moves compressed data from the workers to the data buffer. If there's
+ * nothing to send yet, output is suspended until the worker responsible
+ * for the next block has produced something. Returns -1 on failure.
+ */
+int deflate_pool_pull(struct context *ctx)
+{
+    struct deflate_pool *p = ctx->zpool;
+    ssize_t l = -1;
+
+    while (!p->finished && buffer_getlen(ctx->dbuf) < bufsize) {
+	int fd = p->fn[p->cur];
+
+	if (p->hdr_len < sizeof(p->hdr)) {
+	    l = read(fd, (char *) &p->hdr + p->hdr_len, sizeof(p->hdr) - p->hdr_len);
+	    if (l > 0 && (p->hdr_len += (size_t) l) == sizeof(p->hdr)) {
+		if (p->hdr.flags & DEFLATE_BLOCK_ERROR)
+		    return -1;
+		p->need = p->hdr.clen;
+		p->cpu_ms[p->cur] = p->hdr.cpu_ms;
+	    }
+	} else if (p->need) {
+	    struct buffer *b = ctx->dbuf;
+	    while (b && b->next)
+		b = b->next;
+	    if (!b || b->length == b->size)
+		ctx->dbuf = buffer_append(ctx->dbuf, b = buffer_get());
+	    l = read(fd, b->buf + b->length, MIN(p->need, b->size - b->length));
+	    if (l > 0)
+		b->length += (size_t) l, p->need -= (size_t) l;
+	} else {
+	    if (ctx->mode == 'z')
+		p->check = adler32_combine(p->check, p->hdr.check, (z_off_t) p->hdr.ulen);
+	    else
+		p->check = crc32_combine(p->check, p->hdr.check, (z_off_t) p->hdr.ulen);
+	    p->total_in += p->hdr.ulen;
+	    p->total_out += p->hdr.clen;
+	    ctx->remaining -= p->hdr.ulen;
+	    ctx->deflate_level = (int) p->hdr.level;
+	    p->hdr_len = 0;
+	    if (p->hdr.flags & DEFLATE_BLOCK_LAST) {
+		deflate_pool_trailer(ctx);
+		p->finished = 1;
+	    }
+	    p->cur = (p->cur + 1) % p->workers;
+	    continue;
+	}
+
+	if (l == 0 || (l < 0 && errno != EAGAIN))
+	    return -1;
+	if (l < 0) {
+	    if (!ctx->dbuf) {
+		io_clr_o(ctx->io, ctx->dfn);
+		io_set_i(ctx->io, fd);
+	    }
+	    break;
+	}
+    }
+    return 0;
+}
+
+void deflate_pool_free(struct context *ctx)
+{
+    struct deflate_pool *p = ctx->zpool;
+    int i;
+
+    if (!p)
+	return;
+
+    for (i = 0; i < p->workers; i++) {
+	io_close(ctx->io, p->fn[i]);
+	/* Workers exit on their own after their last block. */
+	if (!p->finished && p->pid[i] > 0)
+	    kill(p->pid[i], SIGTERM);
+	stat_cpu_ms += p->cpu_ms[i];
+    }
+
+    if (ctx->deflate_pooled) {
+	deflate_workers_busy -= p->workers;
+	stat_in += p->total_in;
+	stat_out += p->total_out;
+	stat_transfers++;
+	if (!stat_last_report)
+	    stat_last_report = io_now.tv_sec;
+    }
+
+    Xfree(&ctx->zpool);
+}
+
+void deflate_pool_report(int force)
+{
+    if (stat_transfers == stat_transfers_reported)
+	return;
+    if (!force && stat_last_report + DEFLATE_POOL_REPORT > io_now.tv_sec)
+	return;
+
+    logmsg("deflate workers: %llu transfers, %llu bytes in, %llu bytes out (%llu%%), %llu kB/s per core",
+	   stat_transfers, stat_in, stat_out, stat_in ? 100 * stat_out / stat_in : 0ULL, stat_cpu_ms ? stat_in / stat_cpu_ms : 0ULL);
+
+    stat_transfers_reported = stat_transfers;
+    stat_last_report = io_now.tv_sec;
+}
+#endif				/* WITH_ZLIB */
@@ -0,0 +1,31 @@
+/*
+ * h_allo.c
+ *
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ * All rights reserved.
+ *
+ * $Id$
+ *
+ */
+
+#include "headers.h"
+
+static const char rcsid[] __attribute__((used)) = "$Id$";
+
+void h_allo(struct context *ctx, char *arg)
+{
+    unsigned long long size;
+    int record;
+    char c;
+
+    DebugIn(DEBUG_COMMAND);
+
+    /* ALLO <decimal-integer> [R <decimal-integer>], see RFC 959 */
+    if (1 == sscanf(arg, "%llu%c", &size, &c) || 2 == sscanf(arg, "%llu R %d%c", &size, &record, &c)) {
+	ctx->allo_size = (off_t) size;
+	replyf(ctx, MSG_200_Allocated, size);
+    } else
+	replyf(ctx, MSG_501_Syntax, MSG_ALLO);
+
+    DebugOut(DEBUG_COMMAND);
+}
@@ -36,13 +36,13 @@ void h_cwd(struct context *ctx, char *arg)
 	if ((st.st_mode & S_IXOTH) || ((st.st_mode & S_IXUSR) && (st.st_uid == ctx->uid)) || ((st.st_mode & S_IXGRP) && check_gids(ctx, st.st_gid))) {
 	    u_int l = (u_int) strlen(t);
 
-	    if (ctx->cwdlen >= sizeof(ctx->cwd)) {
+	    if (l > PATH_MAX) {
 		logerr("buffer too small in %s:%d (%s/%s)", __FILE__, __LINE__, ctx->user, t);
 		reply(ctx, MSG_551_Internal_error);
 		DebugOut(DEBUG_COMMAND);
 		return;
 	    }
-	    strcpy(ctx->cwd, t);
+	    ctx_path_set(&ctx->cwd, t);
 	    ctx->cwdlen = l;
 	    acl_conf_readme(ctx);
 	    file2control(ctx, "250", ctx->readme);
@@ -19,6 +19,8 @@ void h_dele(struct context *ctx, char *arg)
 
     if ((t = buildpath(ctx, arg)) && (!pickystat(ctx, &st, t)) && S_ISREG(st.st_mode) && !unlink(t)) {
 	quota_add(ctx, -st.st_size);
+	pickystat_flush(ctx);
+	list_cache_flush();
 	reply(ctx, MSG_250_File_removed);
     } else
 	reply(ctx, MSG_550_Permission_denied);
@@ -21,7 +21,7 @@ static void xlist(struct context *ctx, char *arg, enum list_mode mode)
     else {
 	ctx->transfer_in_progress = 1;
 	ctx->conversion = CONV_NONE;
-	ctx->filename[0] = 0;
+	ctx_path_set(&ctx->filename, NULL);
 	ctx->io_offset = 0;
 	ctx->bytecount = 0;
 	ctx->filesize = 0;
@@ -94,6 +94,7 @@ void h_mff(struct context *ctx, char *arg)
 		    ut.actime = st.st_atime;
 		    ut.modtime = modify;
 		    utime(t, &ut);
+		    list_cache_flush();
 		}
 
 		if (flags & ~flag_modify) {
@@ -111,7 +112,8 @@ void h_mff(struct context *ctx, char *arg)
 				fchmod(fn, unix_mode | (S_ISDIR(st.st_mode)
 							? ctx->chmod_dirmask : ctx->chmod_filemask));
 			    fstat(fn, &st);
-
+			    pickystat_flush(ctx);
+			    list_cache_flush();
 			}
 			close(fn);
 		    }
@@ -49,6 +49,7 @@ void h_mfmt(struct context *ctx, char *arg)
 	    else {
 		struct stat sst;
 		char u[40];
+		list_cache_flush();
 		if (stat(t, &sst))
 		    sst.st_mtime = ut.modtime;
 		strftime(u, sizeof(u), "213 Modify=%Y%m%d%H%M%S; ", gmtime(&sst.st_mtime));
@@ -70,6 +70,7 @@ void h_rein(struct context *ctx, char *arg __attribute__((unused)))
 	regfree(ctx->incoming);
 	free(ctx->incoming);
 	ctx->incoming = NULL;
+	ctx->incoming_crc = 0;
     }
 
     ctx->multiline_banners = 1;
@@ -78,12 +79,14 @@ void h_rein(struct context *ctx, char *arg __attribute__((unused)))
     ctx->io_offset = 0;
     ctx->io_offset_start = 0;
     ctx->io_offset_end = -1;
+    ctx->allo_size = 0;
     ctx->state = ST_conn;
     ctx->uid = -1;
     ctx->gid = -1;
     ctx->mlst_facts = MLST_fact_size | MLST_fact_modify | MLST_fact_type | MLST_fact_unique | MLST_fact_perm;
 
     ctx->pst_valid = 0;
+    pickystat_flush(ctx);
     ctx->mode = 's';
 
     ctx->md_method_hash = ctx->md_method_checksum = md_method_find(md_methods, "SHA-1");
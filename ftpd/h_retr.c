@@ -74,14 +74,14 @@ void h_retr(struct context *ctx, char *arg)
 	}
 	ctx->ffn = f;
 
-	if (strlen(t) >= sizeof(ctx->filename)) {
+	if (strlen(t) > PATH_MAX) {
 	    logerr("buffer too small in %s:%d (%s/%s)", __FILE__, __LINE__, ctx->user, t);
 	    reply(ctx, MSG_551_Internal_error);
 	    cleanup_data_reuse(ctx, ctx->dfn);
 	    DebugOut(DEBUG_COMMAND);
 	    return;
 	}
-	strcpy(ctx->filename, t);
+	ctx_path_set(&ctx->filename, t);
 	ctx->filesize = st.st_size;
 	ctx->remaining = st.st_size;
 	if ((ctx->io_offset_end != -1)
@@ -91,8 +91,12 @@ void h_retr(struct context *ctx, char *arg)
 	ctx->bytecount = 0;
 	ctx->count_files++;
 	ctx->iomode_fixed = 0;
+#ifdef WITH_ZLIB
+	ctx->deflate_pooled = 0;
+#endif
 #ifdef WITH_SENDFILE
-	if (!ctx->use_tls_d && use_sendfile && !ctx->use_ascii && ctx->conversion == CONV_NONE && ctx->mode != 'z')
+	/* with TLS, sendfile(2) requires kTLS, see buffer2socket() */
+	if (use_sendfile && !ctx->use_ascii && ctx->conversion == CONV_NONE && ctx->mode != 'z')
 	    ctx->iomode = IOMODE_sendfile;
 	else
 #endif				/* WITH_SENDFILE */
@@ -103,6 +107,8 @@ void h_retr(struct context *ctx, char *arg)
 #endif				/* WITH_MMAP */
 	    ctx->iomode = IOMODE_read, ctx->iomode_fixed = 1;
 
+	hot_file_open(ctx, &st);
+
 	if (io_get_cb_o(ctx->io, ctx->dfn) == (void *) buffer2socket) {
 	    /* already connected */
 	    if (ctx->conversion == CONV_MD5 || ctx->conversion == CONV_CRC)
@@ -19,9 +19,11 @@ void h_rmd(struct context *ctx, char *arg)
 
     DebugIn(DEBUG_COMMAND);
 
-    if ((t = buildpath(ctx, arg)) && (strlen(t) > ctx->rootlen) && !pickystat(ctx, &st, t) && S_ISDIR(st.st_mode) && !rmdir(t))
+    if ((t = buildpath(ctx, arg)) && (strlen(t) > ctx->rootlen) && !pickystat(ctx, &st, t) && S_ISDIR(st.st_mode) && !rmdir(t)) {
+	pickystat_flush(ctx);
+	list_cache_flush();
 	reply(ctx, MSG_250_Directory_removed);
-    else
+    } else
 	reply(ctx, MSG_550_Permission_denied);
 
     DebugOut(DEBUG_COMMAND);
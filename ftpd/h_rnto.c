@@ -25,8 +25,10 @@ void h_rnto(struct context *ctx, char *arg)
 	if (S_ISREG(st.st_mode))
 	    quota_add(ctx, -st.st_size);
 
+	pickystat_flush(ctx);
+	list_cache_flush();
 	reply(ctx, MSG_250_File_renamed);
-	ctx->filename[0] = 0;
+	ctx_path_set(&ctx->filename, NULL);
     } else
 	reply(ctx, MSG_550_Permission_denied);
 
@@ -84,6 +84,50 @@ static void md_evp_init(struct context *ctx)
 }
 #endif
 
+static int checksum_workers_busy = 0;
+
+static void checksum_free(struct context *ctx __attribute__((unused)), struct md_method *m __attribute__((unused)))
+{
+#ifdef WITH_SSL
+    if (m->init == md_evp_init && ctx->checksum.mdctx) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+	EVP_MD_CTX_destroy(ctx->checksum.mdctx);
+#else
+	EVP_MD_CTX_free(ctx->checksum.mdctx);
+#endif
+	ctx->checksum.mdctx = NULL;
+    }
+#endif
+}
+
+static void checksum_reply(struct context *ctx, struct md_method *m, char *digest)
+{
+    if (!strcmp(m->ftp_name, "CRC32")) {
+	if (ctx->md_hash) {
+	    replyf(ctx, "213 %s %llu-%llu %s %s\r\n", m->ftp_name,
+		   (unsigned long long) ctx->io_offset_start, (unsigned long long) ctx->offset, digest, ctx->filename + ctx->rootlen);
+	} else
+	    replyf(ctx, "200 %s %llu %s\r\n", digest, (unsigned long long) ctx->offset, ctx->filename + ctx->rootlen);
+    } else if (ctx->md_hash) {
+	replyf(ctx, "213 %s %llu-%llu %s %s\r\n", m->ftp_name,
+	       (unsigned long long) ctx->io_offset_start, (unsigned long long) ctx->offset, digest, ctx->filename + ctx->rootlen);
+    } else
+	replyf(ctx, "200 %s  %s\r\n", digest, ctx->filename + ctx->rootlen);
+}
+
+static void checksum_finish(struct context *ctx, struct md_method *m, char *digest)
+{
+    if (digest) {
+	checksum_reply(ctx, m, digest);
+	md_cache_put(ctx, m, digest);
+    } else
+	reply(ctx, MSG_451_Internal_error);
+    ctx->offset = 0;
+    checksum_free(ctx, m);
+    cleanup_file(ctx, ctx->ffn);
+    ctx->dbufi = buffer_free_all(ctx->dbufi);
+}
+
 static void getchecksum(struct context *ctx)
 {
     size_t len;
@@ -94,8 +138,10 @@ static void getchecksum(struct context *ctx)
     sigbus_cur = ctx->cfn;
 
     if (chunk_get(ctx, &ctx->io_offset)) {
-	reply(ctx, MSG_451_Internal_error);
-	goto bye;
+	io_sched_pop(ctx->io, ctx);
+	checksum_finish(ctx, m, NULL);
+	DebugOut(DEBUG_BUFFER);
+	return;
     }
 
     if (chunk_remaining(ctx)) {
@@ -107,34 +153,153 @@ static void getchecksum(struct context *ctx)
     if (chunk_remaining(ctx))
 	io_sched_renew_proc(ctx->io, ctx, (void *) getchecksum);
     else {
-	if (!strcmp(m->ftp_name, "CRC32")) {
-	    if (ctx->md_hash) {
-		replyf(ctx, "213 %s %llu-%llu %s %s\r\n", m->ftp_name,
-		       (unsigned long long) ctx->io_offset_start, (unsigned long long) ctx->offset, m->final(ctx), ctx->filename + ctx->rootlen);
-	    } else
-		replyf(ctx, "200 %s %llu %s\r\n", m->final(ctx), (unsigned long long) ctx->offset, ctx->filename + ctx->rootlen);
-	} else if (ctx->md_hash) {
-	    replyf(ctx, "213 %s %llu-%llu %s %s\r\n", m->ftp_name,
-		   (unsigned long long) ctx->io_offset_start, (unsigned long long) ctx->offset, m->final(ctx), ctx->filename + ctx->rootlen);
-	} else
-	    replyf(ctx, "200 %s  %s\r\n", m->final(ctx), ctx->filename + ctx->rootlen);
-      bye:
 	io_sched_pop(ctx->io, ctx);
-	ctx->offset = 0;
-	cleanup_file(ctx, ctx->ffn);
-	ctx->dbufi = buffer_free_all(ctx->dbufi);
-#ifdef WITH_SSL
-#if OPENSSL_VERSION_NUMBER < 0x10100000
-	EVP_MD_CTX_destroy(ctx->checksum.mdctx);
-#else
-	EVP_MD_CTX_free(ctx->checksum.mdctx);
-#endif
-#endif
+	checksum_finish(ctx, m, m->final(ctx));
+    }
+
+    DebugOut(DEBUG_BUFFER);
+}
+
+/*
+ * Hashing large files would block all other sessions of this process,
+ * so this is delegated to a child process. The result is returned as
+ * "<offset> <digest>\n" via a pipe.
+ */
+static void checksum_worker(struct context *ctx, struct md_method *m, int fd)
+{
+    size_t size = 1 << 20;
+    char *buf = malloc(size), res[300];
+    off_t off = ctx->io_offset, end = ctx->remaining;
+    ssize_t l = 0;
+    int len;
+
+    setup_worker(ctx->ffn, fd);
+
+    while (buf && off < end && (l = pread(ctx->ffn, buf, (size_t) MIN((off_t) size, end - off), off)) > 0) {
+	m->update(ctx, (u_char *) buf, (size_t) l);
+	off += l;
+    }
+    ctx->offset = off;
+
+    if (buf && l > -1) {
+	len = snprintf(res, sizeof(res), "%llu %s\n", (unsigned long long) off, m->final(ctx));
+	if (write(fd, res, (size_t) len) != len)
+	    _exit(EX_IOERR);
     }
+    _exit(EX_OK);
+}
+
+/*
+ * A worker counts as busy until its end of the pipe is closed, i.e. until
+ * it has actually exited, even if the session has lost interest already.
+ */
+static void checksum_reap(struct io_context *io, int cur)
+{
+    char buf[300];
+    ssize_t l;
+
+    while ((l = read(cur, buf, sizeof(buf))) > 0);
+    if (l < 0 && errno == EAGAIN)
+	return;
+    io_close(io, cur);
+    checksum_workers_busy--;
+}
+
+void checksum_cancel(struct context *ctx)
+{
+    if (ctx->checksum_fn > -1) {
+	if (ctx->checksum_pid > 0)
+	    kill(ctx->checksum_pid, SIGKILL);
+	ctx->checksum_pid = 0;
+	io_unregister(ctx->io, ctx->checksum_fn);
+	io_register(ctx->io, ctx->checksum_fn, ctx->io);
+	io_set_cb_i(ctx->io, ctx->checksum_fn, (void *) checksum_reap);
+	io_set_cb_e(ctx->io, ctx->checksum_fn, (void *) checksum_reap);
+	io_set_cb_h(ctx->io, ctx->checksum_fn, (void *) checksum_reap);
+	io_set_i(ctx->io, ctx->checksum_fn);
+	ctx->checksum_fn = -1;
+    }
+}
+
+static void checksum_done(struct context *ctx, int cur)
+{
+    char buf[300], *digest = NULL, *t;
+    unsigned long long off;
+    ssize_t l;
+    int n = 0;
+    struct md_method *m = ctx->md_hash ? ctx->md_method_hash : ctx->md_method_checksum;
+
+    DebugIn(DEBUG_BUFFER);
+
+    l = read(cur, buf, sizeof(buf) - 1);
+    if (l < 0 && errno == EAGAIN) {
+	DebugOut(DEBUG_BUFFER);
+	return;
+    }
+
+    /* the worker has finished, don't kill(2) a possibly reused pid */
+    ctx->checksum_pid = 0;
+    checksum_cancel(ctx);
+
+    if (l > 0) {
+	buf[l] = 0;
+	if ((t = strchr(buf, '\n')))
+	    *t = 0;
+	if (1 == sscanf(buf, "%llu %n", &off, &n) && n && buf[n]) {
+	    ctx->offset = (off_t) off;
+	    digest = buf + n;
+	}
+    }
+    if (!digest)
+	logmsg("%s: checksum worker failed for %s", ctx->user, ctx->filename);
+
+    checksum_finish(ctx, m, digest);
 
     DebugOut(DEBUG_BUFFER);
 }
 
+static int checksum_offload(struct context *ctx, struct md_method *m)
+{
+    int p[2];
+    pid_t pid;
+
+    if (checksum_workers_busy >= checksum_workers || ctx->remaining - ctx->io_offset < CHECKSUM_OFFLOAD_SIZE)
+	return -1;
+
+    if (pipe(p))
+	return -1;
+
+    switch ((pid = fork())) {
+    case -1:
+	close(p[0]);
+	close(p[1]);
+	return -1;
+    case 0:
+	close(p[0]);
+	checksum_worker(ctx, m, p[1]);
+    default:
+	break;
+    }
+
+    close(p[1]);
+    fcntl(p[0], F_SETFL, O_NONBLOCK);
+    fcntl(p[0], F_SETFD, FD_CLOEXEC);
+
+    /* The worker has its own copy of the digest context. */
+    checksum_free(ctx, m);
+
+    ctx->checksum_fn = p[0];
+    ctx->checksum_pid = pid;
+    checksum_workers_busy++;
+
+    io_register(ctx->io, ctx->checksum_fn, ctx);
+    io_set_cb_i(ctx->io, ctx->checksum_fn, (void *) checksum_done);
+    io_set_cb_e(ctx->io, ctx->checksum_fn, (void *) checksum_done);
+    io_set_cb_h(ctx->io, ctx->checksum_fn, (void *) checksum_done);
+    io_set_i(ctx->io, ctx->checksum_fn);
+    return 0;
+}
+
 struct md_method *md_method_find(struct md_method *m, char *s)
 {
     while (m && strcasecmp(s, m->ftp_name))
@@ -197,25 +362,41 @@ static void checksum_start(struct context *ctx, char *arg)
     if (!S_ISREG(st.st_mode))
 	reply(ctx, MSG_550_Not_plain_file);
     else if ((ctx->ffn = open(t, O_RDONLY | O_LARGEFILE)) > -1) {
-	fcntl(ctx->ffn, F_SETFD, FD_CLOEXEC);
-	if (t != ctx->filename)
-	    strcpy(ctx->filename, t);
-	m->init(ctx);
+	char *digest;
 
-#ifdef WITH_MMAP
-	if (use_mmap)
-	    ctx->iomode = IOMODE_mmap;
-	else
-#endif				/* WITH_MMAP */
-	    ctx->iomode = IOMODE_read, ctx->iomode_fixed = 1;
+	fcntl(ctx->ffn, F_SETFD, FD_CLOEXEC);
+	ctx_path_set(&ctx->filename, t);
 
-	io_sched_add(ctx->io, ctx, (void *) getchecksum, 0, 0);
 	ctx->quota_update_on_close = 0;
 	ctx->offset = ctx->io_offset;
 	ctx->remaining = st.st_size;
 	if ((ctx->io_offset_end != -1)
 	    && (ctx->remaining > ctx->io_offset_end + 1))
 	    ctx->remaining = ctx->io_offset_end + 1;
+	ctx->md_cacheable = !ctx->io_offset && ctx->remaining == st.st_size;
+	ctx->transferstart = io_now.tv_sec;
+
+	if (ctx->md_cacheable && !fstat(ctx->ffn, &st) && (digest = md_cache_get(ctx, m, &st))) {
+	    ctx->offset = st.st_size;
+	    checksum_reply(ctx, m, digest);
+	    ctx->offset = 0;
+	    cleanup_file(ctx, ctx->ffn);
+	    DebugOut(DEBUG_COMMAND);
+	    return;
+	}
+
+	m->init(ctx);
+
+	if (checksum_offload(ctx, m)) {
+#ifdef WITH_MMAP
+	    if (use_mmap)
+		ctx->iomode = IOMODE_mmap;
+	    else
+#endif				/* WITH_MMAP */
+		ctx->iomode = IOMODE_read, ctx->iomode_fixed = 1;
+
+	    io_sched_add(ctx->io, ctx, (void *) getchecksum, 0, 0);
+	}
     } else
 	reply(ctx, MSG_550_No_such_file_or_directory);
 
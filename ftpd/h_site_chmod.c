@@ -118,9 +118,11 @@ void h_site_chmod(struct context *ctx, char *arg)
 	     !pickystat(ctx, &st, t) &&
 	     (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode)) &&
 	     !chmod(t, numeric ? mode : ((st.st_mode & ~mode_del) | mode_add) | (st.st_mode & (S_ISDIR(st.st_mode)
-											       ? ctx->chmod_dirmask : ctx->chmod_filemask))))
+											       ? ctx->chmod_dirmask : ctx->chmod_filemask)))) {
+	pickystat_flush(ctx);
+	list_cache_flush();
 	reply(ctx, MSG_200_permissions_changed);
-    else
+    } else
 	reply(ctx, MSG_550_Permission_denied);
 
     DebugOut(DEBUG_COMMAND);
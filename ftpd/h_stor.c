@@ -7,6 +7,10 @@
  *
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* fallocate(2) */
+#endif
+
 #include "headers.h"
 #include "misc/base64.h"
 
@@ -109,9 +113,12 @@ static void h_xstor(struct context *ctx, char *arg, int flags)
     struct stat st;
     int stou = 0;
     char tbuf[PATH_MAX + 13];
+    off_t allo_size = ctx->allo_size;
 
     DebugIn(DEBUG_COMMAND);
 
+    ctx->allo_size = 0;
+
     if (ctx->transfer_in_progress) {
 	reply(ctx, MSG_501_Transfer_in_progress);
 	DebugOut(DEBUG_COMMAND);
@@ -177,7 +184,7 @@ static void h_xstor(struct context *ctx, char *arg, int flags)
 	}
 
 	ctx->ffn = f;
-	if (strlen(t) >= sizeof(ctx->filename)) {
+	if (strlen(t) > PATH_MAX) {
 	    logerr("buffer too small in %s:%d (%s/%s)", __FILE__, __LINE__, ctx->user, t);
 	    reply(ctx, MSG_551_Internal_error);
 	    close(f);
@@ -186,7 +193,7 @@ static void h_xstor(struct context *ctx, char *arg, int flags)
 	    DebugOut(DEBUG_COMMAND);
 	    return;
 	}
-	strcpy(ctx->filename, t);
+	ctx_path_set(&ctx->filename, t);
 	ctx->filesize = 0;
 	ctx->bytecount = 0;
 
@@ -220,6 +227,23 @@ static void h_xstor(struct context *ctx, char *arg, int flags)
 		ctx->io_offset = 0;
 	    }
 	}
+#ifdef WITH_FALLOCATE
+	/*
+	 * Preallocate the space announced by ALLO. The file size stays
+	 * unchanged, space not used by the upload is released again by
+	 * cleanup_file().
+	 */
+	if (allo_size > 0 && !ctx->use_ascii && (!ctx->quota_path || ctx->quota_ondisk + allo_size <= ctx->quota_limit)) {
+	    off_t start = lseek(f, 0, (flags & O_APPEND) ? SEEK_END : SEEK_CUR);
+	    if (start > -1 && !fallocate(f, FALLOC_FL_KEEP_SIZE, start, allo_size))
+		ctx->allo_end = start + allo_size;
+	}
+#endif
+	ctx->writebehind = 0;
+#ifdef WITH_SPLICE
+	/* splice(2) fails with EINVAL for files opened with O_APPEND */
+	ctx->use_splice = use_splice && !ctx->use_tls_d && !ctx->use_ascii && ctx->mode != 'z' && !(flags & O_APPEND);
+#endif
 
 	if (io_get_cb_i(ctx->io, ctx->dfn) == (void *) socket2buffer) {
 	    /* already connected */
@@ -51,7 +51,7 @@
 #include <zlib.h>
 #endif
 
-#ifdef WITH_LWRES
+#ifdef WITH_DNS
 #include "misc/io_dns_revmap.h"
 #endif
 
@@ -114,7 +114,7 @@ WHERE char *ssl_capath INITVAL(NULL);
 #define LOG_IDENT	8
 #define LOG_OVERRIDE	16
 
-#ifdef WITH_LWRES
+#ifdef WITH_DNS
 WHERE struct io_dns_ctx *idc INITVAL(NULL);
 #endif
 
@@ -130,6 +130,15 @@ WHERE char logformat_delimiter INITVAL('|');
 WHERE char logformat_substitute INITVAL('_');
 WHERE int die_when_idle INITVAL(0);
 WHERE int nlst_files_only INITVAL(0);
+#define SORT_LISTING_NONE	0
+#define SORT_LISTING_LIST	1
+#define SORT_LISTING_ALL	2
+WHERE int sort_listing INITVAL(SORT_LISTING_LIST);
+WHERE size_t list_cache_size INITVAL(DEFAULT_LIST_CACHE_SIZE);
+WHERE time_t list_cache_timeout INITVAL(DEFAULT_LIST_CACHE_TIMEOUT);
+WHERE int checksum_workers INITVAL(DEFAULT_CHECKSUM_WORKERS);
+WHERE int checksum_cache INITVAL(1);
+WHERE int deflate_workers INITVAL(DEFAULT_DEFLATE_WORKERS);
 WHERE int hide_version INITVAL(0);
 WHERE u_long id_max INITVAL(0);
 WHERE mavis_ctx *mcx INITVAL(NULL);
@@ -157,6 +166,12 @@ WHERE size_t bufsize_mmap INITVAL(BUFSIZE_MMAP);
 WHERE int use_sendfile INITVAL(-1);
 #endif				/* WITH_SENDFILE */
 
+#ifdef WITH_SPLICE
+WHERE int use_splice INITVAL(-1);
+#endif				/* WITH_SPLICE */
+WHERE size_t bufsize_writebehind INITVAL(DEFAULT_WRITEBEHIND);
+WHERE size_t bufsize_readahead INITVAL(DEFAULT_READAHEAD);
+
 struct acl_rule;
 
 struct acl_set {
@@ -189,6 +204,9 @@ struct md_method {
 WHERE struct md_method *md_methods INITVAL(NULL);
 struct md_method *md_method_find(struct md_method *, char *);
 void md_init(void);
+void checksum_cancel(struct context *);
+char *md_cache_get(struct context *, struct md_method *, struct stat *);
+void md_cache_put(struct context *, struct md_method *, char *);
 
 int acl_add(char *, char *, char *, char *, char *, char *);
 void acl_calc(struct context *);
@@ -214,6 +232,8 @@ void read_mimetypes(char *);
 
 #undef MIN
 #define MIN(A,B) (((A) < (B)) ? (A) : (B))
+#undef MAX
+#define MAX(A,B) (((A) > (B)) ? (A) : (B))
 
 #include "misc/buffer.h"
 
@@ -223,6 +243,7 @@ void set_maxfd(int);
 void clr_maxfd(int);
 void setup_signals(void);
 void process_signals(void);
+void setup_worker(int, int);
 int setup_socket(sockaddr_union *, u_int);
 void setup_invalid_callbacks(struct io_context *);
 
@@ -281,6 +302,7 @@ int PCRE_exec(const char *, char *, size_t);
 int convstat(struct context *, struct stat *, char *);
 int pickystat(struct context *, struct stat *, char *);
 int pickystat_path(struct context *, struct stat *, char *);
+void pickystat_flush(struct context *);
 
 void h_site_idle(struct context *, char *);
 void h_site_checkmethod(struct context *, char *);
@@ -315,6 +337,7 @@ void h_rnto(struct context *, char *);
 void h_appe(struct context *, char *);
 void h_stor(struct context *, char *);
 void h_stou(struct context *, char *);
+void h_allo(struct context *, char *);
 void h_rang(struct context *, char *);
 void h_rest(struct context *, char *);
 void h_abor(struct context *, char *);
@@ -362,6 +385,7 @@ void buffer2socket(struct context *, int);
 void socket2buffer(struct context *, int);
 void file2buffer(struct context *, int);
 void buffer2file(struct context *, int);
+void splice_free(struct context *);
 void socket2control(struct context *, int);
 void control2socket(struct context *, int);
 void do_connect_d(struct context *, int);
@@ -386,6 +410,33 @@ enum list_mode {
 void list(struct context *, char *, enum list_mode);
 void list_stat(struct context *, char *);
 void list_mlst(struct context *, char *);
+void list_pull(struct context *);
+void list_free(struct context *);
+
+struct list_cache_entry;
+int list_cache_get(struct context *);
+struct list_cache_entry *list_cache_capture(struct context *);
+void list_cache_append(struct list_cache_entry **, char *, size_t);
+void list_cache_commit(struct list_cache_entry **);
+void list_cache_abort(struct list_cache_entry **);
+void list_cache_flush(void);
+void list_cache_report(int);
+struct hot_file;
+void hot_file_open(struct context *, struct stat *);
+void hot_file_advance(struct context *, off_t);
+void hot_file_close(struct context *);
+#ifdef WITH_MMAP
+char *hot_file_map(struct context *, off_t, size_t);
+#endif
+void hot_file_report(int);
+
+#ifdef WITH_ZLIB
+struct deflate_pool;
+int deflate_pool_start(struct context *);
+int deflate_pool_pull(struct context *);
+void deflate_pool_free(struct context *);
+void deflate_pool_report(int);
+#endif				/* WITH_ZLIB */
 
 #define CONV_NONE	0
 #define CONV_MD5	1
@@ -396,6 +447,7 @@ struct visited_dirs;
 struct context;
 
 struct context *new_context(struct io_context *);
+void ctx_path_set(char **, char *);
 
 #define SC (struct context *)
 
@@ -475,25 +527,32 @@ struct context {
     char *user;			/* user name (from USER command) */
     char *email;		/* email address for anonymous ftp */
     char *ident_user;		/* user name (from RFC 1413 lookup) */
-#ifdef WITH_LWRES
+#ifdef WITH_DNS
     char *reverse;		/* reverse mapping of client IP */
 #endif
     char *vhost;		/* virtual host (HOST vhost/USER user@vhost */
-    char root[PATH_MAX + 1];	/* virtual root directory */
+    char *root;			/* virtual root directory */
     u_int rootlen;		/* length of root */
     dev_t root_dev;		/* device and ... */
     ino_t root_ino;		/* ... inode number of root directory */
-    char cwd[PATH_MAX + 1];	/* current working directory */
-    char home[PATH_MAX + 1];	/* home directory */
+    char *cwd;			/* current working directory */
+    char *home;			/* home directory */
     u_int cwdlen;		/* length of cwd */
     u_int homelen;		/* length of home */
-    char filename[PATH_MAX + 1];
+    char *filename;
     int sctp_fn;		/* sctp socket file number, if any */
     int cfn;			/* control socket file number */
     int dfn;			/* data socket file number */
     int ffn;			/* file file number */
+    int splice_pipe[2];		/* socket to file pipe for uploads */
     int dirfn;			/* directory file number */
+    struct pickystat_cache *pcache;	/* validated directories */
+    struct hot_file *hot;	/* download registry entry */
+    struct context *hot_next;	/* other sessions reading the same file */
+    off_t hot_pos;		/* next read offset, for read-ahead */
     int ifn;			/* data socket for RFC 1413 lookups */
+    int checksum_fn;		/* result pipe of checksum worker */
+    pid_t checksum_pid;		/* checksum worker process */
     off_t filesize;
     off_t bytecount;
     sockaddr_union sa_c_remote;	/* remote cep of control connection */
@@ -508,6 +567,9 @@ struct context {
     off_t io_offset;
     off_t io_offset_start;
     off_t io_offset_end;
+    off_t allo_size;		/* size announced by ALLO */
+    off_t allo_end;		/* end of preallocated file space */
+    off_t writebehind;		/* bytes written since last write-behind */
     off_t remaining;		/* number of bytes still to read */
     off_t offset;		/* where to continue reading */
     char *chunk_start;
@@ -532,6 +594,7 @@ struct context {
     u_int transfer_in_progress:1;
     u_int outgoing_data:1;
     u_int use_ascii:1;
+    u_int use_splice:1;		/* upload may use splice(2) */
     u_int list_to_cc:1;
     u_int is_client:1;
     u_int use_tls_c:1;		/* use ssl on control channel */
@@ -552,6 +615,8 @@ struct context {
     int deflate_level_dfl;
 #endif				/* WITH_ZLIB */
     u_int md_hash:1;
+    u_int md_cacheable:1;	/* checksum covers the whole file */
+    long long md_ctime;		/* inode change time (ns) when the calculation started */
     struct md_method *md_method_hash;
     struct md_method *md_method_checksum;
 
@@ -620,6 +685,8 @@ struct context {
     u_int zcrc32;
     int deflate_level;
     u_int deflate_extra:1;
+    u_int deflate_pooled:1;
+    struct deflate_pool *zpool;	/* parallel compression workers */
 #endif				/* WITH_ZLIB */
     char mode;
 
@@ -632,9 +699,10 @@ struct context {
     uid_t uid;
     gid_t gid;
     int gids_size;
-    gid_t gids[NGROUPS_MAX];
+    gid_t *gids;
     u_int lang;
     regex_t *incoming;
+    u_int incoming_crc;		/* identifies the incoming regex */
 #ifdef WITH_SSL
     char *certsubj;		/* authenticated certificate subject */
     char *certsubjaltname;	/* authenticated subject alternative name */
@@ -646,7 +714,7 @@ struct context {
     size_t protected_buffer_size;
     enum list_mode list_mode;
     struct stat pst;
-    rb_tree_t *filelist;
+    struct list_stream *liststream;
     struct timeval tv_shape;
     char *stat_reply;
     union {
@@ -692,6 +760,7 @@ int get_request_index(struct service_req *, char *);
 #ifdef __MAIN__
 struct service_req requests[] = {
     { "ABOR", h_abor, 0, 0, 0, IDX_ABOR, ACL_LOGIN, },
+    { "ALLO", h_allo, 1, 0, 0, IDX_ALLO, ACL_LOGIN, },
     { "APPE", h_appe, 1, 1, 1, IDX_APPE, ACL_REAL, },
 #ifdef WITH_SSL
     { "AUTH", h_auth, 1, 0, 0, IDX_AUTH, ACL_CONNECT, },
@@ -0,0 +1,323 @@
+/*
+ * hot_file.c
+ *
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ * All rights reserved.
+ *
+ * Per-process registry of files currently being downloaded. Sessions
+ * reading the same file share a single read-ahead horizon, so the page
+ * cache sees POSIX_FADV_WILLNEED requests ahead of the leading and the
+ * slowest session instead of interleaved per-descriptor read-ahead that
+ * is evicted again before it's used. Memory-mapped transfers use
+ * windows of a single mapping of the file.
+ *
+ * $Id$
+ *
+ */
+
+#include "headers.h"
+#include "misc/rb.h"
+
+static const char rcsid[] __attribute__((used)) = "$Id$";
+
+#define HOT_FILE_REPORT 3600	/* seconds between statistics log lines */
+
+struct hot_file_key {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+};
+
+struct hot_file {
+    struct hot_file_key key;
+    int fd;			/* private descriptor for advice and mapping */
+    int readers;
+    int shared;			/* read-ahead is issued by the registry */
+    struct context *reader;	/* sessions reading this file */
+    off_t advised_lead;		/* advised up to here for the leading reader */
+    off_t advised_tail;		/* advised up to here for the slowest reader */
+    off_t slowest;
+#ifdef WITH_MMAP
+    char *map;
+    size_t maplen;
+#endif
+    time_t expires;		/* unused entries only */
+    struct hot_file *prev;	/* LRU list of unused entries */
+    struct hot_file *next;
+};
+
+static rb_tree_t *hot_files = NULL;
+static struct hot_file *idle_head = NULL, *idle_tail = NULL;
+static int idle_count = 0;
+
+static unsigned long long stat_opens = 0, stat_shared = 0, stat_advised = 0, stat_mapped = 0;
+static unsigned long long stat_opens_reported = 0;
+static time_t stat_last_report = 0;
+
+static int compare_key(const void *a, const void *b)
+{
+    return memcmp(&((struct hot_file *) a)->key, &((struct hot_file *) b)->key, sizeof(struct hot_file_key));
+}
+
+static void idle_unlink(struct hot_file *h)
+{
+    if (h->prev)
+	h->prev->next = h->next;
+    else if (idle_head == h)
+	idle_head = h->next;
+    else
+	return;
+    if (h->next)
+	h->next->prev = h->prev;
+    else
+	idle_tail = h->prev;
+    h->prev = h->next = NULL;
+    idle_count--;
+}
+
+static void idle_push(struct hot_file *h)
+{
+    h->expires = io_now.tv_sec + HOT_FILE_LINGER;
+    h->prev = NULL;
+    h->next = idle_head;
+    if (idle_head)
+	idle_head->prev = h;
+    idle_head = h;
+    if (!idle_tail)
+	idle_tail = h;
+    idle_count++;
+}
+
+static void free_entry(void *payload)
+{
+    struct hot_file *h = (struct hot_file *) payload;
+    idle_unlink(h);
+#ifdef WITH_MMAP
+    if (h->map)
+	munmap(h->map, h->maplen);
+#endif
+    close(h->fd);
+    free(h);
+}
+
+static void hot_file_expire(void)
+{
+    while (idle_tail && (idle_count > HOT_FILE_IDLE_MAX || idle_tail->expires <= io_now.tv_sec))
+	RB_search_and_delete(hot_files, idle_tail);
+}
+
+static void willneed(struct hot_file *h, off_t from, off_t to)
+{
+    if (to > h->key.size)
+	to = h->key.size;
+    if (from >= to)
+	return;
+    posix_fadvise(h->fd, from, to - from, POSIX_FADV_WILLNEED);
+    stat_advised += (unsigned long long) (to - from);
+}
+
+/*
+ * With concurrent readers, read-ahead is issued by the registry rather
+ * than per descriptor, where it would be evicted again before slower
+ * sessions get to use it. Single readers are left to the kernel.
+ */
+static void set_advice(struct hot_file *h)
+{
+    struct context *c;
+    int shared = h->readers > 1;
+
+    if (shared == h->shared)
+	return;
+    h->shared = shared;
+
+    for (c = h->reader; c; c = c->hot_next)
+	if (c->ffn > -1)
+	    posix_fadvise(c->ffn, 0, 0, shared ? POSIX_FADV_RANDOM : POSIX_FADV_NORMAL);
+#ifdef WITH_MMAP
+    if (h->map)
+	madvise(h->map, h->maplen, shared ? MADV_RANDOM : MADV_SEQUENTIAL);
+#endif
+}
+
+/*
+ * Registers the file open in ctx->ffn. Called after the file has been
+ * checked by RETR.
+ */
+void hot_file_open(struct context *ctx, struct stat *st)
+{
+    struct hot_file k, *h;
+
+    if (!bufsize_readahead || !S_ISREG(st->st_mode) || st->st_size < (off_t) bufsize_readahead || ctx->hot)
+	return;
+
+    stat_opens++;
+
+    memset(&k.key, 0, sizeof(struct hot_file_key));
+    k.key.dev = st->st_dev;
+    k.key.ino = st->st_ino;
+    k.key.size = st->st_size;
+    k.key.mtime = st->st_mtime;
+
+    if (!hot_files) {
+	hot_files = RB_tree_new(compare_key, free_entry);
+	stat_last_report = io_now.tv_sec;
+    }
+
+    if ((h = RB_lookup(hot_files, &k))) {
+	idle_unlink(h);
+	if (h->readers)
+	    stat_shared++;
+	else
+	    h->advised_lead = h->advised_tail = 0;
+    } else {
+	int fd = fcntl(ctx->ffn, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0)
+	    return;
+	h = Xcalloc(1, sizeof(struct hot_file));
+	h->key = k.key;
+	h->fd = fd;
+	RB_insert(hot_files, h);
+    }
+
+    h->readers++;
+    ctx->hot = h;
+    ctx->hot_pos = 0;
+    ctx->hot_next = h->reader;
+    h->reader = ctx;
+    h->slowest = 0;
+
+    if (h->shared)
+	posix_fadvise(ctx->ffn, 0, 0, POSIX_FADV_RANDOM);
+    else
+	set_advice(h);
+
+    hot_file_expire();
+}
+
+/*
+ * Notes that ctx will read from offset pos next. For files with
+ * concurrent readers, read-ahead is requested in steps of half the
+ * read-ahead window, both ahead of the leading reader and ahead of the
+ * slowest one. The latter keeps data for trailing sessions in flight
+ * even if it was evicted since the leading session passed.
+ */
+void hot_file_advance(struct context *ctx, off_t pos)
+{
+    struct hot_file *h = ctx->hot;
+    off_t window = (off_t) bufsize_readahead;
+    off_t prev = ctx->hot_pos;
+
+    if (!h)
+	return;
+
+    ctx->hot_pos = pos;
+
+    if (!h->shared)
+	return;
+
+    if (pos + window / 2 > h->advised_lead) {
+	willneed(h, MAX(h->advised_lead, pos), pos + window);
+	h->advised_lead = pos + window;
+    }
+
+    if (prev == h->slowest) {
+	struct context *c;
+	h->slowest = pos;
+	for (c = h->reader; c; c = c->hot_next)
+	    if (c->hot_pos < h->slowest)
+		h->slowest = c->hot_pos;
+	if (h->slowest + window / 2 > h->advised_tail) {
+	    willneed(h, MAX(h->advised_tail, h->slowest), h->slowest + window);
+	    h->advised_tail = h->slowest + window;
+	}
+    }
+}
+
+#ifdef WITH_MMAP
+/*
+ * Returns a pointer to offset within the shared mapping of the file, or
+ * NULL. Buffers using it are marked BUFFER_MMAP_SHARED and don't own the
+ * mapping.
+ */
+char *hot_file_map(struct context *ctx, off_t offset, size_t len)
+{
+    struct hot_file *h = ctx->hot;
+
+    if (!h || offset + (off_t) len > h->key.size)
+	return NULL;
+
+    if (!h->map) {
+	char *m = mmap(0, (size_t) h->key.size, PROT_READ, MAP_SHARED, h->fd, 0);
+	if (m == MAP_FAILED)
+	    return NULL;
+	h->map = m;
+	h->maplen = (size_t) h->key.size;
+	madvise(m, h->maplen, h->shared ? MADV_RANDOM : MADV_SEQUENTIAL);
+    } else
+	stat_mapped++;
+
+    return h->map + offset;
+}
+#endif
+
+/*
+ * Detaches ctx from its file. Called when the file in ctx->ffn is closed
+ * and whenever the data buffers are dropped. Buffers still referring to
+ * the shared mapping keep the entry attached until they are released.
+ */
+void hot_file_close(struct context *ctx)
+{
+    struct hot_file *h = ctx->hot;
+    struct context **c;
+
+    if (!h)
+	return;
+
+#ifdef WITH_MMAP
+    {
+	struct buffer *b;
+	for (b = ctx->dbufi; b; b = b->next)
+	    if (b->mmapped == BUFFER_MMAP_SHARED)
+		return;
+    }
+#endif
+
+    for (c = &h->reader; *c && *c != ctx; c = &(*c)->hot_next);
+    if (*c)
+	*c = ctx->hot_next;
+    ctx->hot_next = NULL;
+    ctx->hot = NULL;
+
+    if (--h->readers == 0)
+	idle_push(h);
+    else {
+	if (ctx->hot_pos == h->slowest) {
+	    struct context *r;
+	    h->slowest = h->reader->hot_pos;
+	    for (r = h->reader; r; r = r->hot_next)
+		if (r->hot_pos < h->slowest)
+		    h->slowest = r->hot_pos;
+	}
+	set_advice(h);
+    }
+
+    hot_file_expire();
+}
+
+void hot_file_report(int force)
+{
+    if (hot_files)
+	hot_file_expire();
+
+    if (stat_opens == stat_opens_reported)
+	return;
+    if (!force && stat_last_report + HOT_FILE_REPORT > io_now.tv_sec)
+	return;
+
+    logmsg("hot files: %llu downloads, %llu shared (%llu%%), %llu mapping reuses, %llu bytes read ahead, %d entries",
+	   stat_opens, stat_shared, stat_opens ? 100 * stat_shared / stat_opens : 0ULL, stat_mapped, stat_advised, hot_files ? RB_count(hot_files) : 0);
+
+    stat_opens_reported = stat_opens;
+    stat_last_report = io_now.tv_sec;
+}
@@ -14,6 +14,12 @@
 #include "misc/tokenize.h"
 #include <pwd.h>
 #include <grp.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#ifdef SYS_getdents64
+#define WITH_GETDENTS64
+#endif
+#endif
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
@@ -244,11 +250,134 @@ static char *init_permtable(void)
     return permtable;
 }
 
-static char *list_one(struct context *ctx, char *filename, enum list_mode mode, char *buffer, size_t buflen)
+/*
+ * Field formatting helpers. These replace per-field snprintf(3) and
+ * strftime(3) calls, which dominate listing CPU time for large
+ * directories. Output is truncated at end.
+ */
+
+static char *fmt_chr(char *t, char *end, char c)
+{
+    if (t < end)
+	*t++ = c;
+    return t;
+}
+
+static char *fmt_mem(char *t, char *end, char *s, size_t l)
+{
+    if (l > (size_t) (end - t))
+	l = (size_t) (end - t);
+    memcpy(t, s, l);
+    return t + l;
+}
+
+static char *fmt_ull(char *t, char *end, unsigned long long u, int width)
 {
+    char tmp[24], *p = tmp + sizeof(tmp);
     int l;
+
+    do
+	*--p = '0' + (char) (u % 10);
+    while (u /= 10);
+
+    for (l = (int) (tmp + sizeof(tmp) - p); l < width; l++)
+	t = fmt_chr(t, end, ' ');
+    return fmt_mem(t, end, p, (size_t) (tmp + sizeof(tmp) - p));
+}
+
+static char *fmt_str(char *t, char *end, char *s, int width)
+{
+    size_t l = strlen(s);
+    if (l > 255)
+	l = 255;
+    t = fmt_mem(t, end, s, l);
+    for (; (int) l < width; l++)
+	t = fmt_chr(t, end, ' ');
+    return t;
+}
+
+static char *fmt_lit(char *t, char *end, char *s)
+{
+    while (*s && t < end)
+	*t++ = *s++;
+    return t;
+}
+
+static char *fmt_2d(char *t, char *end, int i)
+{
+    t = fmt_chr(t, end, '0' + (char) (i / 10));
+    return fmt_chr(t, end, '0' + (char) (i % 10));
+}
+
+/*
+ * "%b %e %H:%M " or "%b %e  %Y ", localtime. The date fragment is cached
+ * per hour, as time zone offsets don't change within an hour.
+ */
+static char *fmt_ls_date(char *t, char *end, time_t mtime)
+{
+    static time_t hour_start = 1, hour_end = 0;
+    static int hour, year;
+    static char month_day[16];
+    static size_t month_day_len;
+
+    if (mtime < hour_start || mtime >= hour_end) {
+	struct tm *tm = localtime(&mtime);
+	if (!tm)
+	    return fmt_lit(t, end, "??? ?? ????? ");
+	hour_start = mtime - tm->tm_min * 60 - tm->tm_sec;
+	hour_end = hour_start + 3600;
+	hour = tm->tm_hour;
+	year = tm->tm_year + 1900;
+	month_day_len = strftime(month_day, sizeof(month_day), "%b %e ", tm);
+    }
+
+    t = fmt_mem(t, end, month_day, month_day_len);
+
+    if (mtime + 15552000 < io_now.tv_sec) {
+	t = fmt_chr(t, end, ' ');
+	t = fmt_ull(t, end, (unsigned long long) year, 4);
+    } else {
+	t = fmt_2d(t, end, hour);
+	t = fmt_chr(t, end, ':');
+	t = fmt_2d(t, end, (int) ((mtime - hour_start) / 60));
+    }
+    t = fmt_chr(t, end, ' ');
+    return t;
+}
+
+/* "%Y%m%d%H%M%S", gmtime. The date part is cached per day. */
+static char *fmt_mlst_time(char *t, char *end, time_t when)
+{
+    static time_t day;
+    static int day_valid = 0;
+    static char ymd[16];
+    static size_t ymd_len;
+    time_t d = when / 86400, secs;
+
+    if (when < 0 && d * 86400 != when)
+	d--;
+    secs = when - d * 86400;
+
+    if (!day_valid || d != day) {
+	struct tm *tm = gmtime(&when);
+	if (!tm)
+	    return t;
+	day = d;
+	day_valid = 1;
+	ymd_len = strftime(ymd, sizeof(ymd), "%Y%m%d", tm);
+    }
+
+    t = fmt_mem(t, end, ymd, ymd_len);
+    t = fmt_2d(t, end, (int) (secs / 3600));
+    t = fmt_2d(t, end, (int) (secs / 60 % 60));
+    t = fmt_2d(t, end, (int) (secs % 60));
+    return t;
+}
+
+static char *list_one(struct context *ctx, char *filename, enum list_mode mode, char *buffer, size_t buflen)
+{
     struct stat st;
-    char *t = buffer;
+    char *t = buffer, *end = buffer + buflen - 1;	/* room for the terminating NUL */
 
     Debug((DEBUG_PROC, "+ %s(\"%s\", ...\n", __func__, filename));
 
@@ -264,51 +393,55 @@ static char *list_one(struct context *ctx, char *filename, enum list_mode mode,
 	if (!permtable)
 	    init_permtable();
 
-	l = snprintf(buffer, buflen,
-		     "%c%s %4lu %-8s %-8s %8llu ",
-		     S_ISDIR(st.st_mode) ? 'd' : '-',
-		     permtable + 10 * (st.st_mode & 0777),
-		     (u_long) st.st_nlink, lookup_uid(ctx, st.st_uid), lookup_gid(ctx, st.st_gid), (unsigned long long) st.st_size);
-	strftime(buffer + l, buflen - l, (st.st_mtime + 15552000 < io_now.tv_sec)
-		 ? "%b %e  %Y " : "%b %e %H:%M ", localtime(&st.st_mtime));
+	t = fmt_chr(t, end, S_ISDIR(st.st_mode) ? 'd' : '-');
+	t = fmt_mem(t, end, permtable + 10 * (st.st_mode & 0777), 9);
+	t = fmt_chr(t, end, ' ');
+	t = fmt_ull(t, end, (unsigned long long) st.st_nlink, 4);
+	t = fmt_chr(t, end, ' ');
+	t = fmt_str(t, end, lookup_uid(ctx, st.st_uid), 8);
+	t = fmt_chr(t, end, ' ');
+	t = fmt_str(t, end, lookup_gid(ctx, st.st_gid), 8);
+	t = fmt_chr(t, end, ' ');
+	t = fmt_ull(t, end, (unsigned long long) st.st_size, 8);
+	t = fmt_chr(t, end, ' ');
+	t = fmt_ls_date(t, end, st.st_mtime);
+	*t = 0;
 	break;
     case List_mlsd:
 	if (!(ctx->mlst_facts & MLST_fact_type) && filename[0] == '.' && (!filename[1] || (filename[1] == '.' && !filename[2])))
 	    break;
     case List_mlst:
 	if (ctx->mlst_facts & MLST_fact_type) {
-	    *t++ = 'T';
-	    *t++ = 'y';
-	    *t++ = 'p';
-	    *t++ = 'e';
-	    *t++ = '=';
+	    t = fmt_lit(t, end, "Type=");
 	    if (S_ISDIR(st.st_mode)) {
 		if (filename[0] == '.') {
 		    if (filename[1] == '.' && !filename[2])
-			*t++ = 'p';
+			t = fmt_chr(t, end, 'p');
 		    else if (!filename[1])
-			*t++ = 'c';
+			t = fmt_chr(t, end, 'c');
 		}
-		*t++ = 'd';
-		*t++ = 'i';
-		*t++ = 'r';
-	    } else {
-		*t++ = 'f';
-		*t++ = 'i';
-		*t++ = 'l';
-		*t++ = 'e';
-	    }
-	    *t++ = ';';
+		t = fmt_lit(t, end, "dir;");
+	    } else
+		t = fmt_lit(t, end, "file;");
 	}
 
-	if (ctx->mlst_facts & MLST_fact_size && !S_ISDIR(st.st_mode))
-	    t += snprintf(t, (size_t) (buffer + buflen - t), "Size=%llu;", (unsigned long long) st.st_size);
+	if (ctx->mlst_facts & MLST_fact_size && !S_ISDIR(st.st_mode)) {
+	    t = fmt_lit(t, end, "Size=");
+	    t = fmt_ull(t, end, (unsigned long long) st.st_size, 0);
+	    t = fmt_chr(t, end, ';');
+	}
 
-	if (ctx->mlst_facts & MLST_fact_modify)
-	    t += strftime(t, 30, "Modify=%Y%m%d%H%M%S;", gmtime(&st.st_mtime));
+	if (ctx->mlst_facts & MLST_fact_modify) {
+	    t = fmt_lit(t, end, "Modify=");
+	    t = fmt_mlst_time(t, end, st.st_mtime);
+	    t = fmt_chr(t, end, ';');
+	}
 
-	if (ctx->mlst_facts & MLST_fact_change)
-	    t += strftime(t, 30, "Change=%Y%m%d%H%M%S;", gmtime(&st.st_ctime));
+	if (ctx->mlst_facts & MLST_fact_change) {
+	    t = fmt_lit(t, end, "Change=");
+	    t = fmt_mlst_time(t, end, st.st_ctime);
+	    t = fmt_chr(t, end, ';');
+	}
 
 	if (ctx->mlst_facts & MLST_fact_unique) {
 	    char table[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ" "abcdefghijklmnopqrstuvwxyz0123456789+/";
@@ -316,46 +449,36 @@ static char *list_one(struct context *ctx, char *filename, enum list_mode mode,
 	    u_long l1 = (u_long) st.st_dev;
 	    u_long l2 = (u_long) st.st_ino;
 
-	    *t++ = 'U';
-	    *t++ = 'n';
-	    *t++ = 'i';
-	    *t++ = 'q';
-	    *t++ = 'u';
-	    *t++ = 'e';
-	    *t++ = '=';
+	    t = fmt_lit(t, end, "Unique=");
 
 	    do
-		*t++ = table[l1 & 0x3F];
+		t = fmt_chr(t, end, table[l1 & 0x3F]);
 	    while (l1 >>= 6);
-	    *t++ = '.';
+	    t = fmt_chr(t, end, '.');
 
 	    do
-		*t++ = table[l2 & 0x3F];
+		t = fmt_chr(t, end, table[l2 & 0x3F]);
 	    while (l2 >>= 6);
-	    *t++ = ';';
+	    t = fmt_chr(t, end, ';');
 	}
 
 	if (ctx->mlst_facts & MLST_fact_perm) {
-	    *t++ = 'P';
-	    *t++ = 'e';
-	    *t++ = 'r';
-	    *t++ = 'm';
-	    *t++ = '=';
+	    t = fmt_lit(t, end, "Perm=");
 
 	    if (!S_ISDIR(st.st_mode) && !ctx->anonymous && (ctx->uid == st.st_uid) && (S_IWUSR & st.st_mode))
-		*t++ = 'a';	/* APPE may be applied */
+		t = fmt_chr(t, end, 'a');	/* APPE may be applied */
 
 	    if (S_ISDIR(st.st_mode)) {
 		if (ctx->anonymous) {
 		    if (check_incoming(ctx, filename, 077)) {
-			*t++ = 'c';	/* file creation should succeed */
-			*t++ = 'm';	/* directory creation should succeed */
+			t = fmt_chr(t, end, 'c');	/* file creation should succeed */
+			t = fmt_chr(t, end, 'm');	/* directory creation should succeed */
 		    }
 		} else {
 		    if ((ctx->uid == st.st_uid) && (S_IWUSR & st.st_mode)) {
-			*t++ = 'c';	/* file creation should succeed */
-			*t++ = 'm';	/* directory creation should succeed */
-			*t++ = 'p';	/* directory contents may be removed */
+			t = fmt_chr(t, end, 'c');	/* file creation should succeed */
+			t = fmt_chr(t, end, 'm');	/* directory creation should succeed */
+			t = fmt_chr(t, end, 'p');	/* directory contents may be removed */
 		    }
 		}
 	    }
@@ -363,39 +486,56 @@ static char *list_one(struct context *ctx, char *filename, enum list_mode mode,
 	    if (!ctx->anonymous && ctx->uid == st.st_uid &&
 		(!ctx->pst_valid ||
 		 (ctx->pst.st_mode & S_IWUSR) || (ctx->pst.st_mode & S_IWGRP && check_gids(ctx, ctx->pst.st_gid)) || (ctx->pst.st_mode & S_IWOTH))) {
-		*t++ = 'd';	/* rename should succeed */
-		*t++ = 'f';	/* delete should succeed */
+		t = fmt_chr(t, end, 'd');	/* rename should succeed */
+		t = fmt_chr(t, end, 'f');	/* delete should succeed */
 	    }
 
 	    if (S_ISDIR(st.st_mode) && ((ctx->uid == st.st_uid) || (S_IXGRP & st.st_mode && check_gids(ctx, st.st_gid)) || (S_IXOTH & st.st_mode))) {
-		*t++ = 'e';	/* cwd should succeed */
-		*t++ = 'l';	/* list command may be applied */
+		t = fmt_chr(t, end, 'e');	/* cwd should succeed */
+		t = fmt_chr(t, end, 'l');	/* list command may be applied */
 	    }
 
 	    if (!S_ISDIR(st.st_mode) && ((ctx->uid == st.st_uid) || (S_IRGRP & st.st_mode && check_gids(ctx, st.st_gid)) || (S_IROTH & st.st_mode)))
-		*t++ = 'r';	/* RETR command may be applied */
+		t = fmt_chr(t, end, 'r');	/* RETR command may be applied */
 
 	    if (!S_ISDIR(st.st_mode) && !ctx->anonymous)
-		*t++ = 'w';	/* STOR command may be applied */
+		t = fmt_chr(t, end, 'w');	/* STOR command may be applied */
 
-	    *t++ = ';';
+	    t = fmt_chr(t, end, ';');
 	}
 
 	if (!S_ISDIR(st.st_mode) && (ctx->mlst_facts & MLST_fact_mediatype && mimetypes)) {
 	    char *mt = lookup_mimetype(filename);
-	    if (mt)
-		t += snprintf(t, (size_t) (buffer + buflen - t), "Media-Type=%s;", mt);
+	    if (mt) {
+		t = fmt_lit(t, end, "Media-Type=");
+		t = fmt_str(t, end, mt, 0);
+		t = fmt_chr(t, end, ';');
+	    }
 	}
 
-	if (ctx->mlst_facts & MLST_fact_UNIX_mode)
-	    t += snprintf(t, (size_t) (buffer + buflen - t), "UNIX.mode=%o;", 0777 & (u_int) st.st_mode);
+	if (ctx->mlst_facts & MLST_fact_UNIX_mode) {
+	    u_int m = 0777 & (u_int) st.st_mode;
+	    t = fmt_lit(t, end, "UNIX.mode=");
+	    if (m & 0700)
+		t = fmt_chr(t, end, '0' + (char) (m >> 6));
+	    if (m & 0770)
+		t = fmt_chr(t, end, '0' + (char) (7 & (m >> 3)));
+	    t = fmt_chr(t, end, '0' + (char) (7 & m));
+	    t = fmt_chr(t, end, ';');
+	}
 
-	if (ctx->mlst_facts & MLST_fact_UNIX_owner)
-	    t += snprintf(t, (size_t) (buffer + buflen - t), "UNIX.owner=%s;", lookup_uid(ctx, st.st_uid));
+	if (ctx->mlst_facts & MLST_fact_UNIX_owner) {
+	    t = fmt_lit(t, end, "UNIX.owner=");
+	    t = fmt_str(t, end, lookup_uid(ctx, st.st_uid), 0);
+	    t = fmt_chr(t, end, ';');
+	}
 
-	if (ctx->mlst_facts & MLST_fact_UNIX_group)
-	    t += snprintf(t, (size_t) (buffer + buflen - t), "UNIX.group=%s;", lookup_gid(ctx, st.st_gid));
-	*t++ = ' ';
+	if (ctx->mlst_facts & MLST_fact_UNIX_group) {
+	    t = fmt_lit(t, end, "UNIX.group=");
+	    t = fmt_str(t, end, lookup_gid(ctx, st.st_gid), 0);
+	    t = fmt_chr(t, end, ';');
+	}
+	t = fmt_chr(t, end, ' ');
 	*t = 0;
 
 	break;
@@ -518,6 +658,147 @@ void list(struct context *ctx, char *path, enum list_mode mode)
     DebugOut(DEBUG_PROC);
 }
 
+/*
+ * Directory entries are read in large batches (getdents64(2) on Linux,
+ * readdir(3) elsewhere) and formatted on demand. Unless the listing
+ * needs to be sorted, nothing but the current batch is kept in memory,
+ * and output for data connections is produced by buffer2socket() as the
+ * client consumes it.
+ */
+
+#define LIST_DENTS_BUFSIZE 32768	/* getdents64(2) batch size */
+#define LIST_BATCH 64		/* entries per scheduler run */
+
+#ifdef WITH_GETDENTS64
+struct list_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+#endif
+
+struct list_stream {
+    struct glob_pattern *g;
+    int dotfiles;		/* filter explicitly matches dot files */
+    int toplevel;		/* don't display ".." */
+    rb_tree_t *sorted;		/* names, if sorting is required */
+    struct list_cache_entry *capture;	/* output to be cached */
+#ifdef WITH_GETDENTS64
+    int eof;
+    size_t pos;
+    size_t len;
+    char buf[LIST_DENTS_BUFSIZE];
+#else
+    DIR *dir;
+    struct dirent *de;
+#endif
+};
+
+void list_free(struct context *ctx)
+{
+    struct list_stream *ls = ctx->liststream;
+    if (ls) {
+	if (ls->g)
+	    glob_free(ls->g);
+	RB_tree_delete(ls->sorted);
+	list_cache_abort(&ls->capture);
+#ifndef WITH_GETDENTS64
+	if (ls->dir)
+	    closedir(ls->dir);
+#endif
+	Xfree(&ctx->liststream);
+	if (ctx->dirfn > -1)
+	    close(ctx->dirfn);
+	ctx->dirfn = -1;
+	ctx->pst_valid = 0;
+    }
+}
+
+static int list_accept(struct context *ctx, struct list_stream *ls, char *name)
+{
+    if (name[0] == '.') {
+	if (name[1] == '.' && !name[2]) {
+	    /* don't display ".." in top level root directory */
+	    if (ls->toplevel)
+		return 0;
+	} else if (!ctx->allow_dotfiles)
+	    return 0;
+
+	/* wildcards my not match files starting with a dot */
+	if (ls->g && !ls->dotfiles)
+	    return 0;
+    }
+
+    return !ls->g || glob_exec(ls->g, name);
+}
+
+/* Returns the next matching directory entry without consuming it. */
+static char *list_peek(struct context *ctx, struct list_stream *ls)
+{
+    if (ls->sorted) {
+	rb_node_t *rbn = RB_first(ls->sorted);
+	return rbn ? RB_payload(rbn, char *) : NULL;
+    }
+#ifdef WITH_GETDENTS64
+    while (1) {
+	struct list_dirent64 *de;
+	if (ls->pos >= ls->len) {
+	    long n;
+	    if (ls->eof)
+		return NULL;
+	    n = syscall(SYS_getdents64, ctx->dirfn, ls->buf, sizeof(ls->buf));
+	    if (n <= 0) {
+		ls->eof = 1;
+		return NULL;
+	    }
+	    ls->pos = 0;
+	    ls->len = (size_t) n;
+	}
+	de = (struct list_dirent64 *) (ls->buf + ls->pos);
+	if (list_accept(ctx, ls, de->d_name))
+	    return de->d_name;
+	ls->pos += de->d_reclen;
+    }
+#else
+    while (ls->de || (ls->de = readdir(ls->dir))) {
+	if (list_accept(ctx, ls, ls->de->d_name))
+	    return ls->de->d_name;
+	ls->de = NULL;
+    }
+    return NULL;
+#endif
+}
+
+static void list_next(struct list_stream *ls)
+{
+    if (ls->sorted) {
+	rb_node_t *rbn = RB_first(ls->sorted);
+	if (rbn)
+	    RB_delete(ls->sorted, rbn);
+	return;
+    }
+#ifdef WITH_GETDENTS64
+    if (ls->pos < ls->len)
+	ls->pos += ((struct list_dirent64 *) (ls->buf + ls->pos))->d_reclen;
+#else
+    ls->de = NULL;
+#endif
+}
+
+static int list_sorted(enum list_mode mode)
+{
+    switch (sort_listing) {
+    case SORT_LISTING_ALL:
+	return -1;
+    case SORT_LISTING_LIST:
+	return mode == List_list;
+    default:
+	return 0;
+    }
+}
+
 /* list_dir() return values:
  *  0: OK, Caller should call list_dir_details ()
  *  EINVAL: filter is not a valid globbing expression
@@ -528,9 +809,9 @@ void list(struct context *ctx, char *path, enum list_mode mode)
 
 static int list_dir(struct context *ctx, char *dirname, char *filter)
 {
-    DIR *dir;
-    struct dirent *de;
     struct glob_pattern *g = NULL;
+    struct list_stream *ls;
+    char *name;
 
     Debug((DEBUG_PROC, "+ %s(\"%s\", ...)\n", __func__, dirname));
 
@@ -542,76 +823,97 @@ static int list_dir(struct context *ctx, char *dirname, char *filter)
 	return EINVAL;
     }
 
+    list_free(ctx);
     ctx->pst_valid = 0;
 
     if (pickystat(ctx, &ctx->pst, dirname)) {
+	if (g)
+	    glob_free(g);
 	DebugOut(DEBUG_PROC);
 	return (errno == ENOENT ? ENOENT : EPERM);
     }
 
     ctx->pst_valid = 1;
 
-    if (!(dir = opendir(dirname))) {
-	Debug((DEBUG_PROC, "- %s: opendir failure\n", __func__));
-	return (errno == ENOTDIR ? ENOTDIR : EPERM);
-    }
-
-    RB_tree_delete(ctx->filelist);
-    ctx->filelist = RB_tree_new(NULL, free_payload);
-
-    while ((de = readdir(dir))) {
-	char *copy;
-	if (de->d_name[0] == '.') {
-	    if (de->d_name[1] == '.' && !de->d_name[2]) {
-		/* don't display ".." in top level root directory */
-		if (ctx->pst.st_ino == ctx->root_ino && ctx->pst.st_dev == ctx->root_dev)
-		    continue;
-	    } else if (!ctx->allow_dotfiles)
-		continue;
-
-	    /* wildcards my not match files starting with a dot */
-	    if (filter && filter[0] != '.')
-		continue;
+    if (!filter && !ctx->list_to_cc) {
+	struct stat st;
+	/* the directory may have changed since it was checked */
+	if (!stat(dirname, &st) && st.st_dev == ctx->pst.st_dev && st.st_ino == ctx->pst.st_ino)
+	    ctx->pst = st;
+	if (!list_cache_get(ctx)) {
+	    if (g)
+		glob_free(g);
+	    Debug((DEBUG_PROC, "- %s: cached\n", __func__));
+	    return 0;
 	}
-
-	if (filter && !glob_exec(g, de->d_name))
-	    continue;
-
-	copy = Xstrdup(de->d_name);
-	RB_insert(ctx->filelist, copy);
-	Debug((DEBUG_PROC, "inserted %s\n", copy));
     }
 
-    if (g)
-	glob_free(g);
-
-    if (RB_empty(ctx->filelist)) {
-	closedir(dir);
-	Debug((DEBUG_PROC, "- %s: no files\n", __func__));
-	return ENOENT;
+    ls = Xcalloc(1, sizeof(struct list_stream));
+    ls->g = g;
+    ls->dotfiles = filter && filter[0] == '.';
+    ls->toplevel = ctx->pst.st_ino == ctx->root_ino && ctx->pst.st_dev == ctx->root_dev;
+
+#ifdef WITH_GETDENTS64
+    ctx->dirfn = open(dirname, O_RDONLY | O_DIRECTORY | O_NOCTTY);
+    if (ctx->dirfn < 0) {
+#else
+    if (!(ls->dir = opendir(dirname))) {
+#endif
+	int e = errno;
+	if (g)
+	    glob_free(g);
+	free(ls);
+	Debug((DEBUG_PROC, "- %s: opendir failure\n", __func__));
+	return (e == ENOTDIR ? ENOTDIR : EPERM);
     }
+#ifndef WITH_GETDENTS64
 #ifdef WITH_DIRFD
-    ctx->dirfn = dup(dirfd(dir));
-    closedir(dir);
+    ctx->dirfn = dup(dirfd(ls->dir));
 #else				/* WITH_DIRFD */
-    closedir(dir);
     ctx->dirfn = open(dirname, O_RDONLY);
 #endif				/* WITH_DIRFD */
+#endif				/* WITH_GETDENTS64 */
 
     fcntl(ctx->dirfn, F_SETFD, FD_CLOEXEC);
+    ctx->liststream = ls;
+
+    if (list_sorted(ctx->list_mode)) {
+	rb_tree_t *sorted = RB_tree_new(NULL, free_payload);
+	while ((name = list_peek(ctx, ls))) {
+	    RB_insert(sorted, Xstrdup(name));
+	    list_next(ls);
+	}
+	ls->sorted = sorted;
+    }
+
+    if (!list_peek(ctx, ls)) {
+	list_free(ctx);
+	ctx->pst_valid = 1;
+	Debug((DEBUG_PROC, "- %s: no files\n", __func__));
+	return ENOENT;
+    }
+
+    if (!filter && !ctx->list_to_cc)
+	ls->capture = list_cache_capture(ctx);
 
     DebugOut(DEBUG_PROC);
     return 0;
 }
 
-static void list_dir_details(struct context *ctx, int cur __attribute__((unused)))
+/*
+ * Format up to max entries, or, if limit is non-zero, until limit bytes
+ * are buffered. Returns 0 if the listing is complete.
+ */
+static int list_produce(struct context *ctx, int max, size_t limit)
 {
-    rb_node_t *rbn;
+    struct list_stream *ls = ctx->liststream;
     struct buffer *b;
-    int i = 5;
     struct buffer *(*bf) (struct buffer *, char *, size_t);
+    size_t buffered = 0;
+    char *p;
 
-    DebugIn(DEBUG_PROC);
+    if (!ls)
+	return 0;
 
     if ((ctx->uid != (uid_t) - 1) && (current_uid != ctx->uid || current_gid != ctx->gid || update_ids)) {
 	seteuid(0);
@@ -624,13 +926,11 @@ static void list_dir_details(struct context *ctx, int cur __attribute__((unused)
     }
 
     if (ctx->dirfn < 0 || fchdir(ctx->dirfn)) {
-	RB_tree_delete(ctx->filelist);
-	ctx->filelist = NULL;
+	list_free(ctx);
 	if (chdir("/")) {
 	    // FIXME
 	}
-	DebugOut(DEBUG_PROC);
-	return;
+	return 0;
     }
 
     if (ctx->list_to_cc)
@@ -638,47 +938,82 @@ static void list_dir_details(struct context *ctx, int cur __attribute__((unused)
     else
 	b = ctx->dbufi, bf = buffer_write;
 
-    while (i-- && (rbn = RB_first(ctx->filelist))) {
+    if (limit)
+	buffered = buffer_getlen(b);
+
+    while ((limit ? buffered < limit : max-- > 0) && (p = list_peek(ctx, ls))) {
 	char *u, buffer[1024];
-	char *p;
 
-	if ((u = list_one(ctx, p = RB_payload(rbn, char *), ctx->list_mode, buffer, sizeof(buffer))))
+	if ((u = list_one(ctx, p, ctx->list_mode, buffer, sizeof(buffer)))) {
+	    size_t ulen = strlen(u), plen = strlen(p);
 	    switch (ctx->list_mode) {
 	    case List_mlsd:
 	    case List_list:
-		b = bf(b, u, strlen(u));
+		b = bf(b, u, ulen);
+		list_cache_append(&ls->capture, u, ulen);
+		buffered += ulen;
 	    case List_nlst:
-		b = bf(b, p, strlen(p));
+		b = bf(b, p, plen);
 		b = buffer_write(b, "\r\n", 2);
+		list_cache_append(&ls->capture, p, plen);
+		list_cache_append(&ls->capture, "\r\n", 2);
+		buffered += plen + 2;
 	    default:
 		;
 	    }
-	RB_delete(ctx->filelist, rbn);
+	}
+	list_next(ls);
     }
 
-    /*  Could use
-     *     *(ctx->list_to_cc ? &ctx->cbufo : &ctx->dbufi) = b;
-     *  instead of:
-     */
     if (ctx->list_to_cc)
 	ctx->cbufo = b;
     else
 	ctx->dbufi = b;
 
-    if (RB_empty(ctx->filelist)) {
-	Debug((DEBUG_PROC, "filelist empty\n"));
-	io_sched_pop(ctx->io, ctx);
-	RB_tree_delete(ctx->filelist);
-	ctx->filelist = NULL;
-	close(ctx->dirfn);
-	ctx->dirfn = -1;
-	ctx->pst_valid = 0;
-    } else
-	io_sched_renew_proc(ctx->io, ctx, (void *) list_dir_details);
-
     if (chdir("/")) {
 	//FIXME
     }
 
+    if (!list_peek(ctx, ls)) {
+	Debug((DEBUG_PROC, "filelist empty\n"));
+	list_cache_commit(&ls->capture);
+	list_free(ctx);
+	return 0;
+    }
+    return -1;
+}
+
+/*
+ * Called by buffer2socket() whenever the data connection is ready for
+ * more output.
+ */
+void list_pull(struct context *ctx)
+{
+    DebugIn(DEBUG_PROC);
+    if (!ctx->list_to_cc && !ctx->filename[0])
+	list_produce(ctx, 0, bufsize);
+    DebugOut(DEBUG_PROC);
+}
+
+static void list_dir_details(struct context *ctx, int cur __attribute__((unused)))
+{
+    int more;
+
+    DebugIn(DEBUG_PROC);
+
+    more = list_produce(ctx, LIST_BATCH, 0);
+
+    /*
+     * Listings via the data connection are streamed once the first line
+     * is available. Compressed transfers need the complete listing.
+     */
+    if (more && !ctx->list_to_cc && ctx->mode != 'z' && ctx->dbufi)
+	more = 0;
+
+    if (more)
+	io_sched_renew_proc(ctx->io, ctx, (void *) list_dir_details);
+    else
+	io_sched_pop(ctx->io, ctx);
+
     DebugOut(DEBUG_PROC);
 }
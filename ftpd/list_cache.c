@@ -0,0 +1,255 @@
+/*
+ * list_cache.c
+ *
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ * All rights reserved.
+ *
+ * Per-process cache of rendered directory listings. Entries are keyed
+ * by directory identity and modification time, listing mode, MLST facts
+ * and everything else in the session that influences listing output.
+ *
+ * $Id$
+ *
+ */
+
+#include "headers.h"
+#include "misc/rb.h"
+#include "misc/crc32.h"
+
+static const char rcsid[] __attribute__((used)) = "$Id$";
+
+#define LIST_CACHE_REPORT 3600	/* seconds between statistics log lines */
+
+struct list_cache_key {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    off_t size;
+    dev_t root_dev;
+    ino_t root_ino;
+    uid_t uid;
+    gid_t gid;
+    u_int gids_crc;
+    u_int names_crc;
+    u_int incoming_crc;
+    u_int mlst_facts;
+    u_int flags;
+    int mode;
+};
+
+struct list_cache_entry {
+    struct list_cache_key key;
+    time_t expires;
+    size_t len;
+    size_t size;
+    char *data;
+    struct list_cache_entry *prev;	/* LRU list */
+    struct list_cache_entry *next;
+};
+
+static rb_tree_t *list_cache = NULL;
+static struct list_cache_entry *lru_head = NULL, *lru_tail = NULL;
+static size_t list_cache_bytes = 0;
+
+static unsigned long long stat_lookups = 0, stat_hits = 0, stat_bytes_served = 0;
+static unsigned long long stat_lookups_reported = 0;
+static time_t stat_last_report = 0;
+
+static int compare_key(const void *a, const void *b)
+{
+    return memcmp(&((struct list_cache_entry *) a)->key, &((struct list_cache_entry *) b)->key, sizeof(struct list_cache_key));
+}
+
+static void lru_unlink(struct list_cache_entry *e)
+{
+    if (e->prev)
+	e->prev->next = e->next;
+    else
+	lru_head = e->next;
+    if (e->next)
+	e->next->prev = e->prev;
+    else
+	lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push(struct list_cache_entry *e)
+{
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head)
+	lru_head->prev = e;
+    lru_head = e;
+    if (!lru_tail)
+	lru_tail = e;
+}
+
+static void free_entry(void *payload)
+{
+    struct list_cache_entry *e = (struct list_cache_entry *) payload;
+    lru_unlink(e);
+    list_cache_bytes -= e->len;
+    free(e->data);
+    free(e);
+}
+
+static void list_cache_evict(struct list_cache_entry *e)
+{
+    RB_search_and_delete(list_cache, e);
+}
+
+static int list_cache_key(struct context *ctx, struct list_cache_key *key)
+{
+    /* Modifications within the current second wouldn't be noticed. */
+    if (ctx->pst.st_mtime >= io_now.tv_sec)
+	return -1;
+
+    memset(key, 0, sizeof(struct list_cache_key));
+    key->dev = ctx->pst.st_dev;
+    key->ino = ctx->pst.st_ino;
+    key->mtime = ctx->pst.st_mtime;
+    key->size = ctx->pst.st_size;
+    key->root_dev = ctx->root_dev;
+    key->root_ino = ctx->root_ino;
+    key->uid = ctx->uid;
+    key->gid = ctx->gid;
+    key->gids_crc = crc32_update(INITCRC32, (u_char *) ctx->gids, (off_t) (ctx->gids_size * sizeof(gid_t)));
+    if (!ctx->resolve_ids) {
+	key->names_crc = crc32_update(INITCRC32, (u_char *) ctx->ftpuser, (off_t) strlen(ctx->ftpuser));
+	key->names_crc = crc32_update(key->names_crc, (u_char *) ctx->ftpgroup, (off_t) strlen(ctx->ftpgroup));
+    }
+    key->mode = (int) ctx->list_mode;
+    if (ctx->list_mode == List_mlsd) {
+	key->mlst_facts = ctx->mlst_facts;
+	/* the Perm fact of anonymous sessions depends on the incoming regex */
+	if (ctx->anonymous && ctx->incoming && (ctx->mlst_facts & MLST_fact_perm))
+	    key->incoming_crc = ctx->incoming_crc;
+    }
+    key->flags = ctx->anonymous | ctx->allow_dotfiles << 1 | ctx->resolve_ids << 2
+	| ctx->picky_uidcheck << 3 | ctx->picky_gidcheck << 4 | ctx->picky_permcheck << 5 | ctx->allow_symlinks << 8 | (nlst_files_only ? 1 << 12 : 0);
+    return 0;
+}
+
+/*
+ * Copies a cached listing for the directory in ctx->pst to the data
+ * buffer. Returns 0 on success, -1 if there's no valid cache entry.
+ */
+int list_cache_get(struct context *ctx)
+{
+    struct list_cache_entry k, *e;
+
+    if (!list_cache_size || list_cache_key(ctx, &k.key))
+	return -1;
+
+    stat_lookups++;
+
+    if (!list_cache || !(e = RB_lookup(list_cache, &k)))
+	return -1;
+
+    if (e->expires <= io_now.tv_sec) {
+	list_cache_evict(e);
+	return -1;
+    }
+
+    lru_unlink(e);
+    lru_push(e);
+
+    if (e->len)
+	ctx->dbufi = buffer_write(ctx->dbufi, e->data, e->len);
+
+    stat_hits++;
+    stat_bytes_served += e->len;
+    return 0;
+}
+
+/*
+ * Starts recording listing output for the directory in ctx->pst. The
+ * entry isn't visible to lookups before list_cache_commit().
+ */
+struct list_cache_entry *list_cache_capture(struct context *ctx)
+{
+    struct list_cache_entry *e;
+    struct list_cache_key key;
+
+    if (!list_cache_size || list_cache_key(ctx, &key))
+	return NULL;
+
+    if (!list_cache) {
+	list_cache = RB_tree_new(compare_key, free_entry);
+	stat_last_report = io_now.tv_sec;
+    }
+
+    e = Xcalloc(1, sizeof(struct list_cache_entry));
+    e->key = key;
+    return e;
+}
+
+void list_cache_append(struct list_cache_entry **e, char *data, size_t len)
+{
+    if (!*e)
+	return;
+    if ((*e)->len + len > list_cache_size / 4) {
+	/* too large to be cached */
+	list_cache_abort(e);
+	return;
+    }
+    if ((*e)->len + len > (*e)->size) {
+	(*e)->size = 2 * ((*e)->len + len) + 4096;
+	(*e)->data = Xrealloc((*e)->data, (*e)->size);
+    }
+    memcpy((*e)->data + (*e)->len, data, len);
+    (*e)->len += len;
+}
+
+void list_cache_abort(struct list_cache_entry **e)
+{
+    if (*e) {
+	free((*e)->data);
+	Xfree(e);
+    }
+}
+
+void list_cache_commit(struct list_cache_entry **e)
+{
+    if (!*e)
+	return;
+
+    (*e)->expires = io_now.tv_sec + list_cache_timeout;
+    if ((*e)->size > (*e)->len && (*e)->len)
+	(*e)->data = Xrealloc((*e)->data, (*e)->len);
+    (*e)->size = (*e)->len;
+
+    RB_search_and_delete(list_cache, *e);
+
+    list_cache_bytes += (*e)->len;
+    lru_push(*e);
+    RB_insert(list_cache, *e);
+
+    while (list_cache_bytes > list_cache_size && lru_tail && lru_tail != *e)
+	list_cache_evict(lru_tail);
+
+    *e = NULL;
+}
+
+/* Drops all cached listings. Called on modifying commands. */
+void list_cache_flush(void)
+{
+    if (list_cache)
+	while (lru_tail)
+	    list_cache_evict(lru_tail);
+}
+
+void list_cache_report(int force)
+{
+    if (stat_lookups == stat_lookups_reported)
+	return;
+    if (!force && stat_last_report + LIST_CACHE_REPORT > io_now.tv_sec)
+	return;
+
+    logmsg("listing cache: %llu lookups, %llu hits (%llu%%), %llu bytes served, %d entries, %llu bytes cached",
+	   stat_lookups, stat_hits, stat_lookups ? 100 * stat_hits / stat_lookups : 0ULL,
+	   stat_bytes_served, list_cache ? RB_count(list_cache) : 0, (unsigned long long) list_cache_bytes);
+
+    stat_lookups_reported = stat_lookups;
+    stat_last_report = io_now.tv_sec;
+}
@@ -37,8 +37,19 @@ static void periodics(struct context *ctx, int cur __attribute__((unused)))
     if (!die_when_idle && common_data.scm_send_msg(0, &sd, -1))
 	die_when_idle = -1;
 
+    list_cache_report(0);
+    hot_file_report(0);
+#ifdef WITH_ZLIB
+    deflate_pool_report(0);
+#endif
+
     if (common_data.users_cur == 0 && die_when_idle) {
 	Debug((DEBUG_PROC, "exiting -- process out of use\n"));
+	list_cache_report(1);
+	hot_file_report(1);
+#ifdef WITH_ZLIB
+	deflate_pool_report(1);
+#endif
 	mavis_drop(mcx);
 	logmsg("Terminating, no longer needed.");
 	exit(EX_OK);
@@ -147,9 +158,9 @@ int main(int argc, char **argv, char **envp)
 
     set_proctitle(ACCEPT_YES);
 
-#ifdef WITH_LWRES
+#ifdef WITH_DNS
     idc = io_dns_init(io);
-#endif				/* WITH_LWRES */
+#endif				/* WITH_DNS */
 
     mavis_init(mcx, MAVIS_API_VERSION);
 
@@ -0,0 +1,214 @@
+/*
+ * md_cache.c
+ *
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ * All rights reserved.
+ *
+ * Digest cache for SITE CHECKSUM and HASH. Whole-file digests are kept
+ * in a small per-process table and, where the file system permits, in
+ * an extended attribute of the file itself. Entries are only valid for
+ * the size, modification and inode change time they were calculated
+ * for. Users may reset the modification time with utime(2), but not the
+ * change time.
+ *
+ * The attribute lives in the trusted namespace, which requires
+ * CAP_SYS_ADMIN for both reading and writing, so users can't plant
+ * digests for their own files. Without root privileges only the
+ * in-memory table is used.
+ *
+ * Writing the attribute updates the change time itself, so the record
+ * holds the digests of all methods and is stamped with the time it was
+ * written. It stays valid while the change time doesn't exceed that
+ * stamp by more than MD_CTIME_SLACK.
+ *
+ * $Id$
+ *
+ */
+
+#include "headers.h"
+#ifdef WITH_XATTR
+#include <sys/xattr.h>
+#endif
+
+static const char rcsid[] __attribute__((used)) = "$Id$";
+
+#define MD_CACHE_SLOTS 256
+#define MD_DIGEST_MAX 129	/* hex encoded 512 bit digest */
+#define MD_XATTR_NAME "trusted.ftpd.checksum"
+#define MD_XATTR_MAX 2048
+#define MD_CTIME_SLACK 1000000LL	/* ns */
+
+#ifdef __APPLE__
+#define st_ctim st_ctimespec
+#endif
+
+struct md_cache_entry {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long long ctime;
+    struct md_method *m;
+    char digest[MD_DIGEST_MAX];
+};
+
+static struct md_cache_entry md_cache[MD_CACHE_SLOTS];
+
+static struct md_cache_entry *md_cache_slot(struct stat *st, struct md_method *m)
+{
+    u_long h = (u_long) st->st_ino * 31 + (u_long) st->st_dev;
+    h = h * 31 + (u_long) m;
+    return &md_cache[(h ^ (h >> 16)) % MD_CACHE_SLOTS];
+}
+
+static long long md_ctime(struct stat *st)
+{
+    return (long long) st->st_ctim.tv_sec * 1000000000LL + st->st_ctim.tv_nsec;
+}
+
+static void md_cache_fill(struct md_cache_entry *e, struct stat *st, struct md_method *m, char *digest)
+{
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->size = st->st_size;
+    e->mtime = st->st_mtime;
+    e->ctime = md_ctime(st);
+    e->m = m;
+    strcpy(e->digest, digest);
+}
+
+#ifdef WITH_XATTR
+/*
+ * Reads the record of the file open at fd into val. Returns a pointer
+ * to its "<method> <digest> ..." list if the record is valid for st,
+ * or NULL.
+ */
+static char *md_xattr_get(int fd, struct stat *st, char *val, size_t len)
+{
+    uid_t euid = geteuid();
+    unsigned long long size;
+    long long mtime, stamp;
+    int n = 0;
+    ssize_t l;
+
+    seteuid(0);
+    l = fgetxattr(fd, MD_XATTR_NAME, val, len - 1);
+    seteuid(euid);
+    if (l < 1)
+	return NULL;
+    val[l] = 0;
+
+    if (3 > sscanf(val, "%llu %lld %lld %n", &size, &mtime, &stamp, &n) || !n || (off_t) size != st->st_size
+	|| (time_t) mtime != st->st_mtime || md_ctime(st) > stamp + MD_CTIME_SLACK)
+	return NULL;
+    return val + n;
+}
+
+static int md_xattr_set(int fd, char *val, size_t len)
+{
+    uid_t euid = geteuid();
+    int res;
+
+    seteuid(0);
+    res = fsetxattr(fd, MD_XATTR_NAME, val, len, 0);
+    seteuid(euid);
+    return res;
+}
+
+static void md_xattr_remove(int fd)
+{
+    uid_t euid = geteuid();
+
+    seteuid(0);
+    fremovexattr(fd, MD_XATTR_NAME);
+    seteuid(euid);
+}
+#endif
+
+/*
+ * Returns the cached digest of the file currently open in ctx->ffn, or
+ * NULL.
+ */
+char *md_cache_get(struct context *ctx, struct md_method *m, struct stat *st)
+{
+    struct md_cache_entry *e;
+
+    ctx->md_ctime = md_ctime(st);
+
+    if (!checksum_cache)
+	return NULL;
+
+    e = md_cache_slot(st, m);
+    if (e->m == m && e->ino == st->st_ino && e->dev == st->st_dev && e->size == st->st_size && e->mtime == st->st_mtime
+	&& e->ctime == ctx->md_ctime)
+	return e->digest;
+
+#ifdef WITH_XATTR
+    {
+	char val[MD_XATTR_MAX], *v, *name, *digest;
+
+	if (real_uid || !(v = md_xattr_get(ctx->ffn, st, val, sizeof(val))))
+	    return NULL;
+
+	for (name = strtok(v, " "); name && (digest = strtok(NULL, " ")); name = strtok(NULL, " "))
+	    if (!strcmp(name, m->ftp_name)) {
+		if (strlen(digest) >= MD_DIGEST_MAX)
+		    return NULL;
+		md_cache_fill(e, st, m, digest);
+		return e->digest;
+	    }
+    }
+#endif
+    return NULL;
+}
+
+/*
+ * Stores the digest of the file currently open in ctx->ffn, provided the
+ * file wasn't modified after the calculation started, i.e. after
+ * md_cache_get() was called.
+ */
+void md_cache_put(struct context *ctx, struct md_method *m, char *digest)
+{
+    struct stat st;
+
+    if (!checksum_cache || !ctx->md_cacheable || strlen(digest) >= MD_DIGEST_MAX)
+	return;
+    if (fstat(ctx->ffn, &st) || st.st_mtime >= ctx->transferstart || md_ctime(&st) != ctx->md_ctime || st.st_size != ctx->offset)
+	return;
+
+#ifdef WITH_XATTR
+    if (!real_uid) {
+	char old[MD_XATTR_MAX], val[MD_XATTR_MAX], list[MD_XATTR_MAX], *v, *name, *d;
+	size_t len = 0;
+	struct timespec now;
+	int i, l;
+
+	/* keep the other methods' digests if they're still valid */
+	if ((v = md_xattr_get(ctx->ffn, &st, old, sizeof(old))))
+	    for (name = strtok(v, " "); name && (d = strtok(NULL, " ")); name = strtok(NULL, " "))
+		if (strcmp(name, m->ftp_name) && len + strlen(name) + strlen(d) + 2 < sizeof(list))
+		    len += (size_t) snprintf(list + len, sizeof(list) - len, "%s %s ", name, d);
+	list[len] = 0;
+
+	/* The change time set by the write should be within the slack. */
+	for (i = 0; i < 3; i++) {
+	    clock_gettime(CLOCK_REALTIME, &now);
+	    l = snprintf(val, sizeof(val), "%llu %lld %lld %s%s %s", (unsigned long long) st.st_size, (long long) st.st_mtime,
+			 (long long) now.tv_sec * 1000000000LL + now.tv_nsec, list, m->ftp_name, digest);
+	    /* Failure is expected on file systems without xattr support. */
+	    if (l >= (int) sizeof(val) || md_xattr_set(ctx->ffn, val, (size_t) l))
+		break;
+	    if (fstat(ctx->ffn, &st) || st.st_size != ctx->offset || st.st_mtime >= ctx->transferstart) {
+		md_xattr_remove(ctx->ffn);
+		return;
+	    }
+	    if (md_ctime(&st) <= (long long) now.tv_sec * 1000000000LL + now.tv_nsec + MD_CTIME_SLACK)
+		break;
+	}
+	if (i == 3)
+	    md_xattr_remove(ctx->ffn);
+    }
+#endif
+
+    md_cache_fill(md_cache_slot(&st, m), &st, m, digest);
+}
@@ -931,12 +931,20 @@ char *message[][2] = {
      "501 Unknown algorithm, current selection not changed.\r\n",
      "501 Unbekannter Algorithmus, keine Änderung der aktuellen Auswahl.\r\n",
       },
+    {
+     "ALLO <size>        (reserve storage for the next upload)",
+     "ALLO <Größe>       (Speicherplatz für nächsten Upload reservieren)",
+      },
+    {
+     "200 Reserving %llu bytes for the next upload.\r\n",
+     "200 Reserviere %llu Bytes für den nächsten Upload.\r\n",
+      },
 };
 
 void message_init(void)
 {
     int i, j;
-    for (i = 0; i < 230; i++)
+    for (i = 0; i < 232; i++)
 	for (j = 1; j < 2; j++)
 	    if (!message[i][j])
 		message[i][j] = message[i][0];
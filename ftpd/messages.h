@@ -465,3 +465,7 @@ extern char *message[][2];
 #define MSG_HASH (message[228][ctx->lang])
 #define IDX_501_unknown_checksum_algorithm 229
 #define MSG_501_unknown_checksum_algorithm (message[229][ctx->lang])
+#define IDX_ALLO 230
+#define MSG_ALLO (message[230][ctx->lang])
+#define IDX_200_Allocated 231
+#define MSG_200_Allocated (message[231][ctx->lang])
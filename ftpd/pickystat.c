@@ -12,13 +12,136 @@
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
-static int pickystat_one(struct context *ctx, struct stat *st, char *file)
+#ifdef AT_SYMLINK_NOFOLLOW
+#define WITH_STATAT
+#define Lstatat(D,F,S) fstatat(D, F, S, AT_SYMLINK_NOFOLLOW)
+#define Statat(D,F,S) fstatat(D, F, S, 0)
+#else
+#define AT_FDCWD -100
+#define Lstatat(D,F,S) lstat(F, S)
+#define Statat(D,F,S) stat(F, S)
+#endif
+#ifndef O_DIRECTORY
+#define O_DIRECTORY 0
+#endif
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+/*
+ * Per-session cache of directories that already passed the checks below.
+ * Path validation starts at the deepest cached directory, and the final
+ * component is looked up relative to its parent's file descriptor, so
+ * ancestors are checked once instead of for every file. Entries expire
+ * after PICKYSTAT_TTL seconds, and the cache is flushed on the session's
+ * own modifying commands and on identity changes.
+ */
+#define PICKYSTAT_DIRS 16
+#define PICKYSTAT_TTL 3
+
+struct pickystat_dir {
+    char *path;
+    size_t len;
+    size_t base;		/* checked from this offset downwards */
+    int fd;			/* -1 if not opened yet */
+    time_t expires;
+    u_long used;
+    struct stat st;
+};
+
+struct pickystat_cache {
+    uid_t uid;
+    dev_t root_dev;
+    ino_t root_ino;
+    u_long clock;
+    struct pickystat_dir dir[PICKYSTAT_DIRS];
+};
+
+void pickystat_flush(struct context *ctx)
+{
+    if (ctx->pcache) {
+	int i;
+	for (i = 0; i < PICKYSTAT_DIRS; i++) {
+	    if (ctx->pcache->dir[i].fd > -1)
+		close(ctx->pcache->dir[i].fd);
+	    free(ctx->pcache->dir[i].path);
+	}
+	Xfree(&ctx->pcache);
+    }
+}
+
+static struct pickystat_cache *pcache_get(struct context *ctx)
+{
+    struct pickystat_cache *pc = ctx->pcache;
+
+    if (pc && (pc->uid != ctx->uid || pc->root_dev != ctx->root_dev || pc->root_ino != ctx->root_ino))
+	pickystat_flush(ctx), pc = NULL;
+
+    if (!pc) {
+	int i;
+	pc = ctx->pcache = Xcalloc(1, sizeof(struct pickystat_cache));
+	pc->uid = ctx->uid;
+	pc->root_dev = ctx->root_dev;
+	pc->root_ino = ctx->root_ino;
+	for (i = 0; i < PICKYSTAT_DIRS; i++)
+	    pc->dir[i].fd = -1;
+    }
+    return pc;
+}
+
+static struct pickystat_dir *pcache_lookup(struct pickystat_cache *pc, char *path, size_t len, size_t base)
+{
+    int i;
+    for (i = 0; i < PICKYSTAT_DIRS; i++) {
+	struct pickystat_dir *d = &pc->dir[i];
+	if (d->path && d->expires <= io_now.tv_sec) {
+	    /* don't keep stale directories open */
+	    if (d->fd > -1)
+		close(d->fd);
+	    Xfree(&d->path);
+	    d->fd = -1;
+	    d->len = 0;
+	    continue;
+	}
+	if (d->len == len && d->path && d->base <= base && !strncmp(d->path, path, len)) {
+	    d->used = ++pc->clock;
+	    return d;
+	}
+    }
+    return NULL;
+}
+
+static struct pickystat_dir *pcache_add(struct pickystat_cache *pc, char *path, size_t len, size_t base, struct stat *st)
+{
+    int i;
+    struct pickystat_dir *d = &pc->dir[0];
+
+    for (i = 1; i < PICKYSTAT_DIRS && d->path; i++)
+	if (!pc->dir[i].path || pc->dir[i].used < d->used)
+	    d = &pc->dir[i];
+
+    if (d->fd > -1)
+	close(d->fd);
+    free(d->path);
+
+    d->path = Xcalloc(1, len + 1);
+    memcpy(d->path, path, len);
+    d->len = len;
+    d->base = base;
+    d->fd = -1;
+    d->st = *st;
+    d->expires = io_now.tv_sec + PICKYSTAT_TTL;
+    d->used = ++pc->clock;
+    return d;
+}
+
+static int pickystat_one(struct context *ctx, struct stat *st, int dirfd __attribute__((unused)), char *file)
 {
     struct stat lst;
 
     Debug((DEBUG_PROC, "+ %s(%s)\n", __func__, file));
 
-    if (lstat(file, &lst)) {
+    if (Lstatat(dirfd, file, &lst)) {
 	/* file doesn't exist */
 
 	Debug((DEBUG_PROC, "- %s FAILURE (no such file)\n", __func__));
@@ -28,7 +151,7 @@ static int pickystat_one(struct context *ctx, struct stat *st, char *file)
     if (S_ISLNK(lst.st_mode)) {
 	/* symbolic link */
 
-	if (stat(file, st)) {
+	if (Statat(dirfd, file, st)) {
 	    Debug((DEBUG_PROC, "- %s FAILURE (broken link)\n", __func__));
 	    return -1;
 	}
@@ -67,36 +190,90 @@ static int pickystat_one(struct context *ctx, struct stat *st, char *file)
     return 0;
 }
 
+/*
+ * Check path component p (terminated at path + end) relative to the
+ * validated parent directory d, if any.
+ */
+static int pickystat_component(struct context *ctx, struct stat *st, struct pickystat_dir *d, char *path, size_t end)
+{
+    char c = path[end];
+    int r;
+
+    path[end] = 0;
+    if (d && d->fd > -1)
+	r = pickystat_one(ctx, st, d->fd, path + d->len + 1);
+    else
+	r = pickystat_one(ctx, st, AT_FDCWD, path);
+    path[end] = c;
+    return r;
+}
+
 int pickystat(struct context *ctx, struct stat *st, char *path)
 {
     int r;
+    size_t offset, base, len, i;
+    struct pickystat_cache *pc;
+    struct pickystat_dir *d = NULL;
 
     Debug((DEBUG_PROC, "+ %s (%s)\n", __func__, path));
 
-    if (*path == '/') {
-	int offset;
-	char *t;
-
-	if (strncmp(path, ctx->cwd, ctx->cwdlen) || (path[ctx->cwdlen] && path[ctx->cwdlen] != '/'))
-	    offset = ctx->rootlen;
-	else
-	    offset = ctx->cwdlen;
-
-	offset = offset ? offset : 1;
-
-	for (t = path + offset; *t; t++)
-	    if (*t == '/') {
-		*t = 0;
-		r = pickystat_one(ctx, st, path);
-		*t = '/';
-		if (r) {
-		    DebugOut(DEBUG_PROC);
-		    return r;
-		}
+    if (*path != '/') {
+	r = pickystat_one(ctx, st, AT_FDCWD, path);
+	DebugOut(DEBUG_PROC);
+	return r;
+    }
+
+    if (strncmp(path, ctx->cwd, ctx->cwdlen) || (path[ctx->cwdlen] && path[ctx->cwdlen] != '/'))
+	offset = ctx->rootlen;
+    else
+	offset = ctx->cwdlen;
+
+    offset = offset ? offset : 1;
+    len = strlen(path);
+    pc = pcache_get(ctx);
+
+    /*
+     * Directories from offset downwards need checking. Find the deepest
+     * one that already has been validated.
+     */
+    for (i = len; i >= offset && !d; i--)
+	if (!path[i] || path[i] == '/')
+	    d = pcache_lookup(pc, path, i, offset);
+
+    if (d && d->len == len) {
+	*st = d->st;
+	Debug((DEBUG_PROC, "- %s SUCCESS (cached)\n", __func__));
+	return 0;
+    }
+
+    base = d ? d->base : offset;
+
+    for (i = d ? d->len + 1 : offset; i < len; i++)
+	if (path[i] == '/') {
+	    if ((r = pickystat_component(ctx, st, d, path, i))) {
+		DebugOut(DEBUG_PROC);
+		return r;
 	    }
+	    if (S_ISDIR(st->st_mode))
+		d = pcache_add(pc, path, i, base, st);
+	}
+
+#ifdef WITH_STATAT
+    /* Look up the final component relative to its parent directory. */
+    if (d && d->fd < 0 && path + d->len == strrchr(path, '/')) {
+	d->fd = open(d->path, O_RDONLY | O_DIRECTORY | O_NOCTTY | O_CLOEXEC);
+	if (d->fd > -1 && !O_CLOEXEC)
+	    fcntl(d->fd, F_SETFD, FD_CLOEXEC);
     }
+#endif
+
+    if (d && path + d->len != strrchr(path, '/'))
+	d = NULL;
+
+    r = pickystat_component(ctx, st, d, path, len);
+    if (!r && S_ISDIR(st->st_mode))
+	pcache_add(pc, path, len, base, st);
 
-    r = pickystat_one(ctx, st, path);
     DebugOut(DEBUG_PROC);
     return r;
 }
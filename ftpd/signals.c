@@ -9,6 +9,8 @@
 #include "headers.h"
 #include <signal.h>
 #include <sysexits.h>
+#include <limits.h>
+#include <sys/syscall.h>
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
@@ -47,3 +49,36 @@ void process_signals()
     sigprocmask(SIG_UNBLOCK, &master_set, NULL);
     sigprocmask(SIG_SETMASK, &master_set, NULL);
 }
+
+static void close_fds(int from, int to)
+{
+#ifdef SYS_close_range
+    if (from <= to && !syscall(SYS_close_range, (u_int) from, (u_int) to, 0))
+	return;
+#endif
+    for (; from <= to; from++)
+	close(from);
+}
+
+/*
+ * Prepares a forked worker process: default signal handling with nothing
+ * blocked, so the parent may terminate it, and no descriptors besides
+ * stdio and the two given (other sessions' sockets and files in particular).
+ */
+void setup_worker(int a, int b)
+{
+    sigset_t set;
+    int lo = MIN(a, b), hi = MAX(a, b);
+
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGALRM, SIG_DFL);
+    sigemptyset(&set);
+    sigprocmask(SIG_SETMASK, &set, NULL);
+
+    close_fds(3, lo - 1);
+    close_fds(lo + 1, hi - 1);
+    close_fds(hi + 1, INT_MAX);
+}
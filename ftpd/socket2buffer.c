@@ -7,10 +7,136 @@
  *
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* splice(2), sync_file_range(2) */
+#endif
+
 #include "headers.h"
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
+#define SPLICE_PIPE_SIZE (1 << 20)
+
+/*
+ * Large uploads would otherwise dirty lots of page cache, and sooner or
+ * later the kernel throttles write(2) for a considerable amount of time.
+ * Start writeback once a window is complete, wait for the previous one
+ * (which should be on disk by then) and drop it from the cache.
+ */
+static void writebehind(struct context *ctx, off_t len)
+{
+    off_t pos, w = (off_t) bufsize_writebehind;
+
+    ctx->writebehind += len;
+    if (!w || ctx->writebehind < w)
+	return;
+
+    pos = lseek(ctx->ffn, 0, SEEK_CUR) - ctx->writebehind;
+    if (pos > -1) {
+#ifdef WITH_SYNC_FILE_RANGE
+	sync_file_range(ctx->ffn, pos, ctx->writebehind, SYNC_FILE_RANGE_WRITE);
+	if (pos >= w)
+	    sync_file_range(ctx->ffn, pos - w, w, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+#ifdef POSIX_FADV_DONTNEED
+	if (pos >= w)
+	    posix_fadvise(ctx->ffn, pos - w, w, POSIX_FADV_DONTNEED);
+#endif
+    }
+    ctx->writebehind = 0;
+}
+
+static void file_error(struct context *ctx)
+{
+    if (errno == EDQUOT) {
+	reply(ctx, MSG_451_Transfer_incomplete_quota);
+	logmsg("%s: quota limit reached", ctx->user);
+    } else
+	reply(ctx, MSG_451_Transfer_incomplete);
+
+    ftp_log(ctx, LOG_TRANSFER, "i");
+    cleanup_file(ctx, ctx->ffn);
+    cleanup_data(ctx, ctx->dfn);
+}
+
+void splice_free(struct context *ctx)
+{
+    if (ctx->splice_pipe[0] > -1) {
+	close(ctx->splice_pipe[0]);
+	close(ctx->splice_pipe[1]);
+	ctx->splice_pipe[0] = ctx->splice_pipe[1] = -1;
+    }
+}
+
+#ifdef WITH_SPLICE
+/*
+ * Moves data from the data socket to the file via a pipe, without
+ * copying it to user space. Returns -1 if splice(2) isn't usable, the
+ * caller falls back to read(2)/write(2) in that case.
+ */
+static int socket2file(struct context *ctx)
+{
+    ssize_t l, w = 0;
+
+    if (ctx->splice_pipe[0] < 0) {
+	if (pipe(ctx->splice_pipe)) {
+	    ctx->splice_pipe[0] = ctx->splice_pipe[1] = -1;
+	    ctx->use_splice = 0;
+	    return -1;
+	}
+	fcntl(ctx->splice_pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(ctx->splice_pipe[1], F_SETFD, FD_CLOEXEC);
+#ifdef F_SETPIPE_SZ
+	fcntl(ctx->splice_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+#endif
+    }
+
+    l = splice(ctx->dfn, NULL, ctx->splice_pipe[1], NULL, SPLICE_PIPE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    if (l < 0 && (errno == EINVAL || errno == ENOSYS)) {
+	/* not supported for this socket type */
+	splice_free(ctx);
+	ctx->use_splice = 0;
+	return -1;
+    }
+    if (l < 0 && errno == EAGAIN)
+	return 0;
+    if (l <= 0) {
+	cleanup_data(ctx, ctx->dfn);
+	return 0;
+    }
+
+    ctx->traffic_total += l, ctx->traffic_files += l;
+
+    while (w < l) {
+	ssize_t k = splice(ctx->splice_pipe[0], NULL, ctx->ffn, NULL, (size_t) (l - w), SPLICE_F_MOVE);
+	if (k > 0) {
+	    w += k;
+	    continue;
+	}
+	if (k < 0 && errno == EINVAL) {
+	    /* not supported by the file system, drain the pipe */
+	    char buf[8192];
+	    ctx->bytecount += w;
+	    while (w < l && (k = read(ctx->splice_pipe[0], buf, sizeof(buf))) > 0) {
+		ctx->dbuf = buffer_write(ctx->dbuf, buf, (size_t) k);
+		w += k;
+	    }
+	    splice_free(ctx);
+	    ctx->use_splice = 0;
+	    buffer2file(ctx, ctx->ffn);
+	    return 0;
+	}
+	file_error(ctx);
+	return 0;
+    }
+
+    ctx->bytecount += w;
+    writebehind(ctx, w);
+    return 0;
+}
+#endif				/* WITH_SPLICE */
+
 void buffer2file(struct context *ctx, int cur __attribute__((unused)))
 {
     ssize_t l = 0, len = 0;
@@ -33,27 +159,18 @@ void buffer2file(struct context *ctx, int cur __attribute__((unused)))
 	while (l > 0 && ctx->dbuf);
 
 	if (l <= 0 && errno == EDQUOT) {
-	    reply(ctx, MSG_451_Transfer_incomplete_quota);
-	    logmsg("%s: quota limit reached", ctx->user);
-
-	    ftp_log(ctx, LOG_TRANSFER, "i");
-	    cleanup_file(ctx, ctx->ffn);
-	    cleanup_data(ctx, ctx->dfn);
+	    file_error(ctx);
 	    Debug((DEBUG_PROC, "- %s: quota exceeded\n", __func__));
 	    return;
 	}
 	if (l < 0) {
-	    if (errno != EAGAIN) {
-		reply(ctx, MSG_451_Transfer_incomplete);
-
-		ftp_log(ctx, LOG_TRANSFER, "i");
-		cleanup_file(ctx, ctx->ffn);
-		cleanup_data(ctx, ctx->dfn);
-	    }
+	    if (errno != EAGAIN)
+		file_error(ctx);
 	    Debug((DEBUG_BUFFER, "- %s FAILURE transfer incomplete\n", __func__));
 	    return;
 	}
 	ctx->bytecount += len;
+	writebehind(ctx, len);
     }
     if (ctx->dfn < 0) {		/* socket is closed */
 	if (ctx->cfn < 0) {	/* control connection not available */
@@ -90,6 +207,13 @@ void socket2buffer(struct context *ctx, int cur __attribute__((unused)))
 
     io_sched_renew_proc(ctx->io, ctx, (void *) cleanup);
 
+#ifdef WITH_SPLICE
+    if (ctx->use_splice && !ctx->ssl_d && !ctx->dbuf && !socket2file(ctx)) {
+	DebugOut(DEBUG_NET);
+	return;
+    }
+#endif
+
     if (ctx->dbuf == NULL)
 	ctx->dbuf = buffer_get();
 
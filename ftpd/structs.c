@@ -12,12 +12,33 @@
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
+/*
+ * Session paths are allocated to fit. Unset paths point to a shared
+ * empty string, so they can always be read without further checks.
+ */
+static char path_unset[1];
+
+void ctx_path_set(char **p, char *v)
+{
+    if (v && *p == v)
+	return;
+    if (*p != path_unset)
+	free(*p);
+    *p = (v && *v) ? Xstrdup(v) : path_unset;
+}
+
 struct context *new_context(struct io_context *io)
 {
     struct context *c = Xcalloc(1, sizeof(struct context));
 
     c->io = io;
+    ctx_path_set(&c->root, NULL);
+    ctx_path_set(&c->cwd, NULL);
+    ctx_path_set(&c->home, NULL);
+    ctx_path_set(&c->filename, NULL);
     c->cfn = c->dfn = c->ffn = c->dirfn = c->ifn = c->sctp_fn = -1;
+    c->splice_pipe[0] = c->splice_pipe[1] = -1;
+    c->checksum_fn = -1;
     c->outgoing_data = c->use_ascii = 1;
     c->state = ST_conn;
     c->uid = -1;
@@ -0,0 +1,179 @@
+/*
+ * aead.c
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ * All rights reserved.
+ *
+ * Authenticated encryption (AES-256-GCM) for MAVIS datagrams. The wire
+ * format is nonce || ciphertext || tag. The 96 bit nonce consists of a
+ * random 64 bit prefix, which is regenerated after fork(2) and on counter
+ * wrap-around, followed by a 32 bit message counter. The cipher contexts
+ * are keyed once, so per-datagram cost is limited to the actual
+ * encryption.
+ *
+ * $Id$
+ *
+ */
+
+#include "misc/sysconf.h"
+#include <sys/types.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "misc/memops.h"
+#include "mavis.h"
+#include "aead.h"
+#ifdef WITH_SSL
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+#endif
+
+static const char rcsid[] __attribute__((used)) = "$Id$";
+
+struct aead_ctx {
+#ifdef WITH_SSL
+    EVP_CIPHER_CTX *enc;
+    EVP_CIPHER_CTX *dec;
+#endif
+    pid_t pid;
+    u_int counter;
+    u_char prefix[8];
+};
+
+void aead_free(struct aead_ctx *a)
+{
+    if (a) {
+#ifdef WITH_SSL
+	EVP_CIPHER_CTX_free(a->enc);
+	EVP_CIPHER_CTX_free(a->dec);
+#endif
+	free(a);
+    }
+}
+
+struct aead_ctx *aead_init(char *key __attribute__((unused)), size_t keylen __attribute__((unused)))
+{
+#ifdef WITH_SSL
+    u_char k[32];
+    unsigned int klen = (unsigned int) sizeof(k);
+    struct aead_ctx *a;
+
+    if (!EVP_Digest(key, keylen, k, &klen, EVP_sha256(), NULL))
+	return NULL;
+
+    a = Xcalloc(1, sizeof(struct aead_ctx));
+    a->enc = EVP_CIPHER_CTX_new();
+    a->dec = EVP_CIPHER_CTX_new();
+    if (!a->enc || !a->dec || !EVP_EncryptInit_ex(a->enc, EVP_aes_256_gcm(), NULL, k, NULL)
+	|| !EVP_DecryptInit_ex(a->dec, EVP_aes_256_gcm(), NULL, k, NULL)) {
+	aead_free(a);
+	a = NULL;
+    }
+    OPENSSL_cleanse(k, sizeof(k));
+    return a;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Encrypt len bytes from in to out. out needs to provide room for
+ * len + AEAD_OVERHEAD bytes. Returns the datagram length, or -1.
+ */
+ssize_t aead_seal(struct aead_ctx *a __attribute__((unused)), u_char * out __attribute__((unused)), u_char * in __attribute__((unused)),
+		  size_t len __attribute__((unused)))
+{
+#ifdef WITH_SSL
+    int l, f;
+    pid_t pid = getpid();
+
+    if (a->pid != pid || !++a->counter) {
+	if (RAND_bytes(a->prefix, (int) sizeof(a->prefix)) != 1)
+	    return -1;
+	a->pid = pid;
+	a->counter = 1;
+    }
+    memcpy(out, a->prefix, sizeof(a->prefix));
+    out[8] = (u_char) (a->counter >> 24);
+    out[9] = (u_char) (a->counter >> 16);
+    out[10] = (u_char) (a->counter >> 8);
+    out[11] = (u_char) a->counter;
+
+    if (!EVP_EncryptInit_ex(a->enc, NULL, NULL, NULL, out)
+	|| !EVP_EncryptUpdate(a->enc, out + AEAD_NONCE_LEN, &l, in, (int) len)
+	|| !EVP_EncryptFinal_ex(a->enc, out + AEAD_NONCE_LEN + l, &f)
+	|| !EVP_CIPHER_CTX_ctrl(a->enc, EVP_CTRL_GCM_GET_TAG, AEAD_TAG_LEN, out + AEAD_NONCE_LEN + l + f))
+	return -1;
+    return AEAD_NONCE_LEN + l + f + AEAD_TAG_LEN;
+#else
+    return -1;
+#endif
+}
+
+/*
+ * Decrypt and authenticate a datagram. out needs to provide room for
+ * len - AEAD_OVERHEAD bytes. Returns the plaintext length, or -1 if the
+ * datagram is malformed or fails authentication.
+ */
+ssize_t aead_open(struct aead_ctx *a __attribute__((unused)), u_char * out __attribute__((unused)), u_char * in __attribute__((unused)),
+		  size_t len __attribute__((unused)))
+{
+#ifdef WITH_SSL
+    int l, f;
+
+    if (len < AEAD_OVERHEAD)
+	return -1;
+    len -= AEAD_OVERHEAD;
+
+    if (!EVP_DecryptInit_ex(a->dec, NULL, NULL, NULL, in)
+	|| !EVP_DecryptUpdate(a->dec, out, &l, in + AEAD_NONCE_LEN, (int) len)
+	|| !EVP_CIPHER_CTX_ctrl(a->dec, EVP_CTRL_GCM_SET_TAG, AEAD_TAG_LEN, in + AEAD_NONCE_LEN + len)
+	|| EVP_DecryptFinal_ex(a->dec, out + l, &f) < 1)
+	return -1;
+    return l + f;
+#else
+    return -1;
+#endif
+}
+
+/* aead ( key = <key> | keyfile = <file> ) */
+struct aead_ctx *parse_aead(struct sym *sym)
+{
+    char key[256];
+    ssize_t key_len = 0;
+    struct aead_ctx *a;
+    int fn;
+
+    sym_get(sym);
+    switch (sym->code) {
+    case S_key:
+	sym_get(sym);
+	parse(sym, S_equal);
+	key_len = (ssize_t) strlen(sym->buf);
+	if (key_len > (ssize_t) sizeof(key))
+	    key_len = (ssize_t) sizeof(key);
+	memcpy(key, sym->buf, (size_t) key_len);
+	break;
+    case S_keyfile:
+	sym_get(sym);
+	parse(sym, S_equal);
+	if ((fn = open(sym->buf, O_RDONLY)) < 0)
+	    parse_error(sym, "Can't open AEAD key file '%s'", sym->buf);
+	key_len = read(fn, key, sizeof(key));
+	close(fn);
+	break;
+    default:
+	parse_error_expect(sym, S_key, S_keyfile, S_unknown);
+    }
+    if (key_len < 1)
+	parse_error(sym, "AEAD key must not be empty");
+    if (!(a = aead_init(key, (size_t) key_len)))
+#ifdef WITH_SSL
+	parse_error(sym, "AEAD initialization failed");
+#else
+	parse_error(sym, "AEAD support requires OpenSSL");
+#endif
+    memset(key, 0, sizeof(key));
+    sym_get(sym);
+    return a;
+}
@@ -0,0 +1,27 @@
+/*
+ * aead.h
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ * All rights reserved.
+ *
+ * $Id$
+ *
+ */
+
+#ifndef __AEAD_H__
+#define __AEAD_H__
+#include <sys/types.h>
+
+#define AEAD_NONCE_LEN 12
+#define AEAD_TAG_LEN 16
+#define AEAD_OVERHEAD (AEAD_NONCE_LEN + AEAD_TAG_LEN)
+
+struct aead_ctx;
+struct sym;
+
+struct aead_ctx *aead_init(char *, size_t);
+struct aead_ctx *parse_aead(struct sym *);
+ssize_t aead_seal(struct aead_ctx *, u_char *, u_char *, size_t);
+ssize_t aead_open(struct aead_ctx *, u_char *, u_char *, size_t);
+void aead_free(struct aead_ctx *);
+
+#endif				/* __AEAD_H__ */
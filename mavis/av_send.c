@@ -8,11 +8,16 @@
  *
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* sendmmsg(2), recvmmsg(2) */
+#endif
+
 #include "misc/sysconf.h"
 #include "av_send.h"
 #include "mavis.h"
 #include "debug.h"
 #include "blowfish.h"
+#include "aead.h"
 #include "misc/io.h"
 #include <sys/types.h>
 #include <arpa/inet.h>
@@ -20,26 +25,245 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "misc/memops.h"
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
-int av_send(av_ctx * ac, int sock, sockaddr_union * sa, struct blowfish_ctx *blowfish)
+/*
+ * Serialize and encrypt ac. out needs to hold at least BUFSIZE_MAVIS
+ * bytes plus padding.
+ */
+static ssize_t av_encode(av_ctx * ac, a_char * out, struct blowfish_ctx *blowfish, struct aead_ctx *aead)
+{
+    ssize_t buflen;
+
+    if (aead) {
+	a_char av_buffer[BUFSIZE_MAVIS / sizeof(a_char) + 1];
+	buflen = av_array_to_char(ac, av_buffer->s, BUFSIZE_MAVIS - AEAD_OVERHEAD - 1, NULL);
+	if (buflen < 0)
+	    return -1;
+	return aead_seal(aead, (u_char *) out->s, (u_char *) av_buffer->s, (size_t) buflen);
+    }
+
+    buflen = av_array_to_char(ac, out->s, BUFSIZE_MAVIS - 1, NULL);
+    if (buflen < 0)
+	return -1;
+    out->s[buflen] = 0;
+
+    if (blowfish)
+	buflen = blowfish_enc(blowfish, out, buflen + 1);
+    return buflen;
+}
+
+int av_send(av_ctx * ac, int sock, sockaddr_union * sa, struct blowfish_ctx *blowfish, struct aead_ctx *aead)
 {
     ssize_t result, buflen = 0;
-    a_char av_buffer[BUFSIZE_MAVIS / sizeof(u_long)];
+    a_char av_buffer[BUFSIZE_MAVIS / sizeof(a_char) + 2];
 
     DebugIn(DEBUG_MAVIS);
 
-    buflen = av_array_to_char(ac, av_buffer->s, BUFSIZE_MAVIS - 1, NULL);
+    buflen = av_encode(ac, av_buffer, blowfish, aead);
     if (buflen < 0)
 	return MAVIS_IGNORE;
-    av_buffer->s[buflen] = 0;
-
-    if (blowfish)
-	buflen = blowfish_enc(blowfish, av_buffer, buflen + 1);
 
     result = Sendto(sock, av_buffer->s, buflen, 0, &sa->sa, su_len(sa));
 
     Debug((DEBUG_MAVIS, "- %s = %ld\n", __func__, (long) result));
     return (result == buflen) ? MAVIS_DEFERRED : MAVIS_IGNORE;
 }
+
+struct av_sendq {
+    struct io_context *io;
+    int sock;
+    int count;
+    int scheduled;
+    struct {
+	sockaddr_union sa;
+	size_t len;
+	size_t size;
+	char *buf;
+    } msg[AV_SENDQ_MAX];
+};
+
+struct av_sendq *av_sendq_new(struct io_context *io, int sock)
+{
+    struct av_sendq *q = Xcalloc(1, sizeof(struct av_sendq));
+    q->io = io;
+    q->sock = sock;
+    return q;
+}
+
+void av_sendq_flush(struct av_sendq *q)
+{
+    int i = 0;
+
+    if (q->scheduled) {
+	io_sched_pop(q->io, q);
+	q->scheduled = 0;
+    }
+#ifdef WITH_MMSG
+    if (q->count > 1) {
+	struct mmsghdr mh[AV_SENDQ_MAX];
+	struct iovec iov[AV_SENDQ_MAX];
+	int n;
+
+	memset(mh, 0, q->count * sizeof(struct mmsghdr));
+	for (n = 0; n < q->count; n++) {
+	    iov[n].iov_base = q->msg[n].buf;
+	    iov[n].iov_len = q->msg[n].len;
+	    mh[n].msg_hdr.msg_name = &q->msg[n].sa.sa;
+	    mh[n].msg_hdr.msg_namelen = su_len(&q->msg[n].sa);
+	    mh[n].msg_hdr.msg_iov = &iov[n];
+	    mh[n].msg_hdr.msg_iovlen = 1;
+	}
+	while (i < q->count) {
+	    n = sendmmsg(q->sock, mh + i, (u_int) (q->count - i), 0);
+	    if (n > 0)
+		i += n;
+	    else if (n < 0 && errno == ENOSYS)
+		break;
+	    else if (n < 0 && errno == EINTR)
+		continue;
+	    else		/* skip the datagram that failed */
+		i++;
+	}
+    }
+#endif
+    for (; i < q->count; i++)
+	Sendto(q->sock, q->msg[i].buf, q->msg[i].len, 0, &q->msg[i].sa.sa, su_len(&q->msg[i].sa));
+
+    Debug((DEBUG_MAVIS, "%s: %d datagrams\n", __func__, q->count));
+    q->count = 0;
+}
+
+static void av_sendq_flush_cb(struct av_sendq *q, int cur __attribute__((unused)))
+{
+    av_sendq_flush(q);
+}
+
+int av_sendq_add(struct av_sendq *q, av_ctx * ac, sockaddr_union * sa, struct blowfish_ctx *blowfish, struct aead_ctx *aead)
+{
+    ssize_t buflen;
+    a_char av_buffer[BUFSIZE_MAVIS / sizeof(a_char) + 2];
+
+    if (!q->io)
+	return av_send(ac, q->sock, sa, blowfish, aead);
+
+    buflen = av_encode(ac, av_buffer, blowfish, aead);
+    if (buflen < 0)
+	return MAVIS_IGNORE;
+
+    if (q->count == AV_SENDQ_MAX)
+	av_sendq_flush(q);
+
+    if (q->msg[q->count].size < (size_t) buflen) {
+	q->msg[q->count].size = (size_t) buflen;
+	q->msg[q->count].buf = Xrealloc(q->msg[q->count].buf, buflen);
+    }
+    memcpy(q->msg[q->count].buf, av_buffer->s, (size_t) buflen);
+    q->msg[q->count].len = (size_t) buflen;
+    q->msg[q->count].sa = *sa;
+    q->count++;
+
+    if (!q->scheduled) {
+	io_sched_add(q->io, q, (void *) av_sendq_flush_cb, 0, 0);
+	q->scheduled = 1;
+    }
+    return MAVIS_DEFERRED;
+}
+
+void av_sendq_free(struct av_sendq **q)
+{
+    if (*q) {
+	int i;
+	av_sendq_flush(*q);
+	for (i = 0; i < AV_SENDQ_MAX; i++)
+	    free((*q)->msg[i].buf);
+	free(*q);
+	*q = NULL;
+    }
+}
+
+/* Slots are 8-byte aligned, leaving room for blowfish padding and a NUL byte. */
+#define AV_RECVQ_SLOT (BUFSIZE_MAVIS + 16 - (BUFSIZE_MAVIS & 7))
+
+struct av_recvq {
+    char *buf;
+    ssize_t len[AV_RECVQ_MAX];
+    sockaddr_union sa[AV_RECVQ_MAX];
+};
+
+struct av_recvq *av_recvq_new(void)
+{
+    return Xcalloc(1, sizeof(struct av_recvq));
+}
+
+int av_recvq_read(struct av_recvq *q, int sock)
+{
+    int i;
+
+    if (!q->buf)
+	q->buf = Xcalloc(AV_RECVQ_MAX, AV_RECVQ_SLOT);
+
+#ifdef WITH_MMSG
+    {
+	struct mmsghdr mh[AV_RECVQ_MAX];
+	struct iovec iov[AV_RECVQ_MAX];
+	int n;
+
+	memset(mh, 0, sizeof(mh));
+	for (i = 0; i < AV_RECVQ_MAX; i++) {
+	    iov[i].iov_base = q->buf + i * AV_RECVQ_SLOT;
+	    iov[i].iov_len = BUFSIZE_MAVIS - 1;
+	    mh[i].msg_hdr.msg_name = &q->sa[i].sa;
+	    mh[i].msg_hdr.msg_namelen = (socklen_t) sizeof(sockaddr_union);
+	    mh[i].msg_hdr.msg_iov = &iov[i];
+	    mh[i].msg_hdr.msg_iovlen = 1;
+	}
+	do
+	    n = recvmmsg(sock, mh, AV_RECVQ_MAX, MSG_DONTWAIT, NULL);
+	while (n < 0 && errno == EINTR);
+
+	if (n > -1 || errno != ENOSYS) {
+	    for (i = 0; i < n; i++)
+		q->len[i] = (ssize_t) mh[i].msg_len;
+	    Debug((DEBUG_MAVIS, "%s: %d datagrams\n", __func__, n));
+	    return (n < 0) ? 0 : n;
+	}
+    }
+#endif
+    for (i = 0; i < AV_RECVQ_MAX; i++) {
+	socklen_t salen = (socklen_t) sizeof(sockaddr_union);
+#ifdef MSG_DONTWAIT
+	q->len[i] = Recvfrom(sock, q->buf + i * AV_RECVQ_SLOT, BUFSIZE_MAVIS - 1, i ? MSG_DONTWAIT : 0, &q->sa[i].sa, &salen);
+#else
+	if (i)
+	    break;
+	q->len[i] = Recvfrom(sock, q->buf + i * AV_RECVQ_SLOT, BUFSIZE_MAVIS - 1, 0, &q->sa[i].sa, &salen);
+#endif
+	if (q->len[i] < 0)
+	    break;
+    }
+    return i;
+}
+
+a_char *av_recvq_get(struct av_recvq *q, int i, ssize_t * len, sockaddr_union ** sa)
+{
+    char *buf = q->buf + i * AV_RECVQ_SLOT;
+    buf[q->len[i]] = 0;
+    *len = q->len[i];
+    *sa = &q->sa[i];
+    return (a_char *) buf;
+}
+
+void av_recvq_free(struct av_recvq **q)
+{
+    if (*q) {
+	free((*q)->buf);
+	free(*q);
+	*q = NULL;
+    }
+}
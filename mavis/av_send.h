@@ -12,8 +12,34 @@
 #include <sys/types.h>
 #include "mavis/mavis.h"
 #include "mavis/blowfish.h"
+#include "mavis/aead.h"
 #include "misc/net.h"
+#include "misc/io_sched.h"
 
-int av_send(av_ctx *, int, sockaddr_union *, struct blowfish_ctx *);
+#define AV_SENDQ_MAX 64		/* datagrams per sendmmsg(2) */
+#define AV_RECVQ_MAX 16		/* datagrams per recvmmsg(2) */
+
+int av_send(av_ctx *, int, sockaddr_union *, struct blowfish_ctx *, struct aead_ctx *);
+
+/*
+ * Outgoing datagrams are queued and flushed in one go, either when the
+ * queue is full or at the end of the current event loop iteration.
+ */
+struct av_sendq;
+struct av_sendq *av_sendq_new(struct io_context *, int);
+int av_sendq_add(struct av_sendq *, av_ctx *, sockaddr_union *, struct blowfish_ctx *, struct aead_ctx *);
+void av_sendq_flush(struct av_sendq *);
+void av_sendq_free(struct av_sendq **);
+
+/*
+ * Incoming datagrams are read in batches. av_recvq_read() returns the
+ * number of datagrams available, av_recvq_get() returns the n-th one
+ * (NUL-terminated, modifiable in place).
+ */
+struct av_recvq;
+struct av_recvq *av_recvq_new(void);
+int av_recvq_read(struct av_recvq *, int);
+a_char *av_recvq_get(struct av_recvq *, int, ssize_t *, sockaddr_union **);
+void av_recvq_free(struct av_recvq **);
 
 #endif				/* __AV_SEND_H__ */
@@ -12,6 +12,7 @@
 #include "misc/sysconf.h"
 #include "misc/strops.h"
 #include "misc/memops.h"
+#include "misc/lineindex.h"
 #include "misc/io.h"
 #include "debug.h"
 #include <unistd.h>
@@ -23,6 +24,7 @@ static const char rcsid[] __attribute__((used)) = "$Id$";
 
 #define MAVIS_CTX_PRIVATE	\
 	char *asciiftp_file;	\
+	lineindex_t *asciiftp_index;	\
 	long asciiftp_uid_min;	\
 	long asciiftp_uid_max;	\
 	long asciiftp_gid_min;	\
@@ -96,6 +98,7 @@ static int mavis_parse_in(mavis_ctx * mcx, struct sym *sym)
 static void mavis_drop_in(mavis_ctx * mcx)
 {
     Xfree(&mcx->asciiftp_file);
+    lineindex_free(&mcx->asciiftp_index);
 }
 
 #define HAVE_mavis_send_in
@@ -191,47 +194,27 @@ static int mavis_send_in(mavis_ctx * mcx, av_ctx ** ac)
 
 static char *find_user(mavis_ctx * mcx, av_ctx * ac, char *inbuf, size_t inbuflen, char *user)
 {
-    size_t offset = 0;
-    ssize_t inlength;
-    char *linestart = inbuf;
-    char *lineend;
-    size_t userlen = strlen(user);
-    int fn;
-
-    fn = open(mcx->asciiftp_file, O_RDONLY);
-    if (fn < 0) {
-	av_setf(ac, AV_A_COMMENT, "opening %s failed", mcx->asciiftp_file);
-	av_set(ac, AV_A_RESULT, AV_V_RESULT_ERROR);
-	return NULL;
-    }
-
-    user[userlen] = ':';
-
-    while ((inlength = Read(fn, inbuf + offset, inbuflen - 1 - offset)) > 0) {
-	inlength += offset;
-	inbuf[inlength] = 0;
-	linestart = inbuf;
+    void *cursor = NULL;
+    char *line;
 
-	while ((lineend = strchr(linestart, '\n'))) {
-	    *lineend = 0;
+    if (!mcx->asciiftp_file)
+	return NULL;
 
-	    if (linestart[0] != '#' && !strncmp(user, linestart, userlen + 1)) {
-		user[userlen] = 0;
-		close(fn);
-		return linestart;
-	    }
-	    linestart = lineend + 1;
-	}
+    if (!mcx->asciiftp_index)
+	mcx->asciiftp_index = lineindex_new(mcx->asciiftp_file, LINEINDEX_FIELD | LINEINDEX_COMMENTS);
 
-	offset = inbuf + inlength - linestart;
-	if (offset)
-	    memmove(inbuf, linestart, offset);
+    if (lineindex_refresh(mcx->asciiftp_index)) {
+	av_setf(ac, AV_A_COMMENT, "opening %s failed", mcx->asciiftp_file);
+	av_set(ac, AV_A_RESULT, AV_V_RESULT_ERROR);
+	return NULL;
     }
 
-    user[userlen] = 0;
-    close(fn);
+    if (!(line = lineindex_lookup(mcx->asciiftp_index, user, &cursor)))
+	return NULL;
 
-    return NULL;
+    strncpy(inbuf, line, inbuflen - 1);
+    inbuf[inbuflen - 1] = 0;
+    return inbuf;
 }
 
 #define HAVE_mavis_new
@@ -41,12 +41,16 @@ struct remote_addr_s;
 	int tries;				\
 	int timeout;				\
 	int rebalance;				\
+	int adaptive_timeout;			\
+	int hedge;				\
 	int request_count;			\
 	sockaddr_union *local_addr;		\
 	struct remote_addr_s *remote_addr;	\
 	rb_tree_t *retransmit;			\
 	rb_tree_t *retransmit_by_app_ctx;	\
 	rb_tree_t *outgoing;			\
+	struct av_sendq *sendq;			\
+	struct av_recvq *recvq;			\
 	time_t lastdump;			\
 	time_t startup_time;
 
@@ -55,9 +59,22 @@ struct remote_addr_s;
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
+#define RTT_SAMPLES 64		/* ring size for percentile calculation */
+#define RTT_MIN_SAMPLES 8	/* minimum samples before adapting timeouts */
+#define RTO_MIN 20000		/* usec */
+#define LOSS_SCALE 1024
+#define RETRANSMIT_TICK 10000	/* usec, retransmissions are aligned to this */
+
 struct remote_addr_s {
     sockaddr_union sa;
     struct blowfish_ctx *blowfish;
+    struct aead_ctx *aead;
+    long srtt;			/* smoothed RTT, usec */
+    long rttvar;		/* RTT variation, usec */
+    long rtt_p95;		/* 95th percentile of recent RTT samples, usec */
+    long rtt_sample[RTT_SAMPLES];
+    u_int rtt_samples;
+    u_int loss;			/* loss rate, scaled by LOSS_SCALE */
     u_long backlog;
     u_long backlog_max;
     u_long backlog_max_p;
@@ -71,6 +88,9 @@ struct remote_addr_s {
 struct query {
     mavis_ctx *mcx;
     struct remote_addr_s *ra;
+    struct remote_addr_s *hedge_ra;
+    struct timeval sent;
+    struct timeval hedge_sent;
     av_ctx *ac;
     av_ctx *ac_bak;
     int tries;
@@ -78,6 +98,98 @@ struct query {
     u_int serial_crc;
 };
 
+static long tv_diff(struct timeval *a, struct timeval *b)
+{
+    return (a->tv_sec - b->tv_sec) * 1000000L + a->tv_usec - b->tv_usec;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    if (*(long *) a < *(long *) b)
+	return -1;
+    return *(long *) a > *(long *) b;
+}
+
+/*
+ * Update RTT estimators (RFC 6298 style EWMA) and recalculate the
+ * 95th percentile every 16 samples.
+ */
+static void ra_rtt_update(struct remote_addr_s *ra, long rtt)
+{
+    if (rtt < 0)
+	return;
+    if (ra->rtt_samples) {
+	ra->rttvar = (3 * ra->rttvar + labs(ra->srtt - rtt)) / 4;
+	ra->srtt = (7 * ra->srtt + rtt) / 8;
+    } else {
+	ra->srtt = rtt;
+	ra->rttvar = rtt / 2;
+    }
+    ra->rtt_sample[ra->rtt_samples % RTT_SAMPLES] = rtt;
+    ra->rtt_samples++;
+    if (!(ra->rtt_samples & 15) || ra->rtt_samples == RTT_MIN_SAMPLES) {
+	long s[RTT_SAMPLES];
+	u_int n = ra->rtt_samples < RTT_SAMPLES ? ra->rtt_samples : RTT_SAMPLES;
+	memcpy(s, ra->rtt_sample, n * sizeof(long));
+	qsort(s, n, sizeof(long), cmp_long);
+	ra->rtt_p95 = s[(n * 95) / 100];
+    }
+    ra->loss -= ra->loss / 8;
+}
+
+static void ra_loss_update(struct remote_addr_s *ra)
+{
+    ra->loss += (LOSS_SCALE - ra->loss) / 8;
+}
+
+/*
+ * Expected latency for a new query: RTT scaled by the number of queries
+ * already in flight, plus the expected cost of losing the query.
+ */
+static unsigned long long ra_expected(mavis_ctx * mcx, struct remote_addr_s *ra)
+{
+    return (unsigned long long) ra->srtt * (ra->backlog + 1) + (unsigned long long) ra->loss * mcx->timeout * 1000000 / LOSS_SCALE;
+}
+
+static struct remote_addr_s *select_ra(mavis_ctx * mcx, struct remote_addr_s *exclude)
+{
+    struct remote_addr_s *ra = NULL, *rat;
+    unsigned long long e = 0, et;
+
+    for (rat = mcx->remote_addr; rat; rat = rat->next)
+	if (rat != exclude) {
+	    et = ra_expected(mcx, rat);
+	    if (!ra || et < e || (et == e && rat->backlog < ra->backlog))
+		ra = rat, e = et;
+	}
+    return ra;
+}
+
+/* retransmission timeout in usec */
+static long query_rto(mavis_ctx * mcx, struct remote_addr_s *ra, int tries)
+{
+    long rto, max = mcx->timeout * 1000000L;
+
+    if (!mcx->adaptive_timeout || ra->rtt_samples < RTT_MIN_SAMPLES)
+	return max;
+    rto = ra->srtt + 4 * ra->rttvar;
+    if (rto < 2 * ra->rtt_p95)
+	rto = 2 * ra->rtt_p95;
+    if (rto < RTO_MIN)
+	rto = RTO_MIN;
+    rto <<= (tries < 8) ? tries : 8;
+    return (rto > max) ? max : rto;
+}
+
+static void query_release(struct query *q)
+{
+    if (q->ra && q->ra->backlog > 0)
+	q->ra->backlog--;
+    if (q->hedge_ra && q->hedge_ra->backlog > 0)
+	q->hedge_ra->backlog--;
+    q->hedge_ra = NULL;
+}
+
 static int udp_bind(sockaddr_union * sa)
 {
     int s;
@@ -101,30 +213,48 @@ static int udp_bind(sockaddr_union * sa)
     return s;
 }
 
-static struct remote_addr_s *av_recv(mavis_ctx * mcx, av_ctx * ac, int sock, sockaddr_union * sa)
+static struct remote_addr_s *av_recv_buf(mavis_ctx * mcx, av_ctx * ac, a_char * av_buffer, ssize_t buflen, sockaddr_union * sa)
 {
-    ssize_t buflen;
-    socklen_t salen = (socklen_t) sizeof(sockaddr_union);
     struct remote_addr_s *ra = NULL;
-    a_char av_buffer[BUFSIZE_MAVIS / sizeof(a_char) + 1];
-
-    DebugIn(DEBUG_MAVIS);
 
     av_clear(ac);
-    av_buffer->s[0] = 0;
-
-    buflen = Recvfrom(sock, av_buffer->s, BUFSIZE_MAVIS - 1, 0, &sa->sa, &salen);
 
     if (buflen > 0) {
 	for (ra = mcx->remote_addr; ra && !su_equal(&ra->sa, sa); ra = ra->next);
 
-	if (ra) {
+	if (ra && ra->aead) {
+	    a_char pt[BUFSIZE_MAVIS / sizeof(a_char) + 1];
+	    ssize_t ptlen = aead_open(ra->aead, (u_char *) pt->s, (u_char *) av_buffer->s, (size_t) buflen);
+	    if (ptlen > -1) {
+		pt->s[ptlen] = 0;
+		av_char_to_array(ac, pt->s, NULL);
+	    } else {
+		char buf[INET6_ADDRSTRLEN];
+		logmsg("Alert: unauthenticated reply from %s:%u", su_ntop(sa, buf, (socklen_t) sizeof(buf)), (u_int) su_get_port(sa));
+	    }
+	} else if (ra) {
 	    av_buffer->s[buflen] = 0;
 	    if (ra->blowfish)
 		blowfish_dec(ra->blowfish, av_buffer, buflen);
 	    av_char_to_array(ac, av_buffer->s, NULL);
 	}
     }
+    return ra;
+}
+
+static struct remote_addr_s *av_recv(mavis_ctx * mcx, av_ctx * ac, int sock, sockaddr_union * sa)
+{
+    ssize_t buflen;
+    socklen_t salen = (socklen_t) sizeof(sockaddr_union);
+    struct remote_addr_s *ra;
+    a_char av_buffer[BUFSIZE_MAVIS / sizeof(a_char) + 1];
+
+    DebugIn(DEBUG_MAVIS);
+
+    av_buffer->s[0] = 0;
+    buflen = Recvfrom(sock, av_buffer->s, BUFSIZE_MAVIS - 1, 0, &sa->sa, &salen);
+    ra = av_recv_buf(mcx, ac, av_buffer, buflen, sa);
+
     DebugOut(DEBUG_MAVIS);
     return ra;
 }
@@ -195,6 +325,10 @@ static int mavis_init_in(mavis_ctx * mcx)
 	io_set_cb_e(mcx->io, mcx->sock, (void *) udp_error);
 	io_set_cb_h(mcx->io, mcx->sock, (void *) udp_error);
 	io_set_i(mcx->io, mcx->sock);
+	av_sendq_free(&mcx->sendq);
+	mcx->sendq = av_sendq_new(mcx->io, mcx->sock);
+	if (!mcx->recvq)
+	    mcx->recvq = av_recvq_new();
     }
 
     mcx->retransmit = RB_tree_new(compare_serial, NULL);
@@ -206,6 +340,7 @@ static int mavis_init_in(mavis_ctx * mcx)
 
 struct socket_info {
     struct blowfish_ctx *blowfish;
+    struct aead_ctx *aead;
     mavis_ctx *mcx;
 };
 
@@ -215,6 +350,7 @@ static int add_ra(sockaddr_union * su, void *data)
     struct remote_addr_s *ra = Xcalloc(1, sizeof(struct remote_addr_s));
     ra->next = mcx->remote_addr;
     ra->blowfish = ((struct socket_info *) data)->blowfish;
+    ra->aead = ((struct socket_info *) data)->aead;
     memcpy(&ra->sa, su, sizeof(sockaddr_union));
     mcx->remote_addr = ra;
     return 0;
@@ -223,8 +359,10 @@ static int add_ra(sockaddr_union * su, void *data)
 
 //local address =...
 //  rebalance = <n >
-//   dst = { path =...address =...port =...blowfish(key | file) =... }
+//   dst = { path =...address =...port =...blowfish(key | file) =...aead(key | file) =... }
 //timeout =...tries =...
+//adaptive-timeout = yes | no
+//hedge = yes | no
 #define HAVE_mavis_parse_in
 static int mavis_parse_in(mavis_ctx * mcx, struct sym *sym)
 {
@@ -263,10 +401,21 @@ static int mavis_parse_in(mavis_ctx * mcx, struct sym *sym)
 	    parse(sym, S_equal);
 	    mcx->tries = parse_int(sym);
 	    continue;
+	case S_adaptive_timeout:
+	    sym_get(sym);
+	    parse(sym, S_equal);
+	    mcx->adaptive_timeout = parse_bool(sym);
+	    continue;
+	case S_hedge:
+	    sym_get(sym);
+	    parse(sym, S_equal);
+	    mcx->hedge = parse_bool(sym);
+	    continue;
 	case S_server:
 	case S_dst:{
 		ad = NULL, po = NULL;
 		blowfish_key_len = 0;
+		si.aead = NULL;
 
 		sym_get(sym);
 		if (sym->code == S_equal)
@@ -315,8 +464,11 @@ static int mavis_parse_in(mavis_ctx * mcx, struct sym *sym)
 			    parse_error_expect(sym, S_key, S_keyfile, S_unknown);
 			}
 			continue;
+		    case S_aead:
+			si.aead = parse_aead(sym);
+			continue;
 		    default:
-			parse_error_expect(sym, S_path, S_address, S_port, S_blowfish, S_unknown);
+			parse_error_expect(sym, S_path, S_address, S_port, S_blowfish, S_aead, S_unknown);
 		    }
 		}
 		if (blowfish_key_len > 0)
@@ -345,14 +497,19 @@ static void mavis_drop_in(mavis_ctx * mcx)
 {
     struct remote_addr_s *ra, *rat;
     rb_node_t *rb, *rbn;
+    av_sendq_free(&mcx->sendq);
+    av_recvq_free(&mcx->recvq);
     if (mcx->io)
 	io_close(mcx->io, mcx->sock);
     else if (mcx->sock > -1)
 	close(mcx->sock);
     for (ra = mcx->remote_addr; ra; ra = rat) {
 	rat = ra->next;
-	if (ra->blowfish)
+	/* addresses resolved from the same "dst" share their keys */
+	if (ra->blowfish && (!rat || rat->blowfish != ra->blowfish))
 	    free(ra->blowfish);
+	if (ra->aead && (!rat || rat->aead != ra->aead))
+	    aead_free(ra->aead);
 	free(ra);
     }
 
@@ -381,8 +538,7 @@ static int mavis_cancel_in(mavis_ctx * mcx, void
     if (r) {
 	struct query *qp = RB_payload(r, struct query *);
 	io_sched_pop(mcx->io, qp);
-	if (qp->ra->backlog > 0)
-	    qp->ra->backlog--;
+	query_release(qp);
 	RB_search_and_delete(mcx->retransmit, qp);
 	RB_delete(mcx->retransmit_by_app_ctx, r);
 	av_free(qp->ac);
@@ -392,11 +548,58 @@ static int mavis_cancel_in(mavis_ctx * mcx, void
     return MAVIS_FINAL;
 }
 
+static void retransmit(struct query *, int);
+
+static void hedge(struct query *q, int fd __attribute__((unused)))
+{
+    mavis_ctx *mcx = q->mcx;
+    struct remote_addr_s *ra;
+    long rto = query_rto(mcx, q->ra, 0) - tv_diff(&io_now, &q->sent);
+
+    io_sched_pop(mcx->io, q);
+    if ((ra = select_ra(mcx, q->ra))) {
+	Debug((DEBUG_PROC, "hedging query\n"));
+	ra->count_s++, ra->count_s_p++;
+	if (MAVIS_DEFERRED == av_sendq_add(mcx->sendq, q->ac, &ra->sa, ra->blowfish, ra->aead)) {
+	    q->hedge_ra = ra;
+	    q->hedge_sent = io_now;
+	    ra->backlog++;
+	}
+    }
+    if (rto < 0)
+	rto = 0;
+    io_sched_add(mcx->io, q, (void *) retransmit, rto / 1000000, rto % 1000000);
+}
+
+/*
+ * Arm the retransmission timer. For the first transmission, and if hedging
+ * is enabled, send a second copy to another server once the 95th
+ * percentile of the RTT has passed.
+ *
+ * Retransmissions are rounded up to RETRANSMIT_TICK boundaries, so timers
+ * that expire close to each other fire in the same scheduler run and the
+ * resulting datagrams go out in a single batch.
+ */
+static void query_schedule(struct query *q)
+{
+    mavis_ctx *mcx = q->mcx;
+    long rto = query_rto(mcx, q->ra, q->tries);
+
+    if (mcx->hedge && !q->tries && mcx->remote_addr->next && q->ra->rtt_samples >= RTT_MIN_SAMPLES && q->ra->rtt_p95 < rto)
+	io_sched_add(mcx->io, q, (void *) hedge, q->ra->rtt_p95 / 1000000, q->ra->rtt_p95 % 1000000);
+    else {
+	rto += (RETRANSMIT_TICK - (io_now.tv_usec + rto) % RETRANSMIT_TICK) % RETRANSMIT_TICK;
+	io_sched_add(mcx->io, q, (void *) retransmit, rto / 1000000, rto % 1000000);
+    }
+}
+
 static void retransmit(struct query *q, int fd __attribute__((unused)))
 {
-    struct remote_addr_s *rat, *ra = q->ra;
-    if (ra->backlog > 0)
-	ra->backlog--;
+    struct remote_addr_s *ra;
+    ra_loss_update(q->ra);
+    if (q->hedge_ra)
+	ra_loss_update(q->hedge_ra);
+    query_release(q);
     Debug((DEBUG_PROC, "retransmit-counter is at %d\n", q->tries + 1));
     Debug((DEBUG_PROC, "               max is at %d\n", q->mcx->tries));
     if (++q->tries == q->mcx->tries) {
@@ -405,8 +608,6 @@ static void retransmit(struct query *q, int fd __attribute__((unused)))
 	    rb_tree_t *out;
 	    struct query *qp = RB_payload(r, struct query *);
 	    io_sched_pop(qp->mcx->io, qp);
-	    if (qp->ra->backlog > 0)
-		qp->ra->backlog--;
 	    RB_search_and_delete(q->mcx->retransmit_by_app_ctx, qp);
 	    RB_delete(qp->mcx->retransmit, r);
 	    q->result = MAVIS_TIMEOUT;
@@ -418,14 +619,14 @@ static void retransmit(struct query *q, int fd __attribute__((unused)))
 	    }
 	}
     } else {
-	io_sched_renew(q->mcx->io, q);
-	for (ra = rat = q->mcx->remote_addr; rat; rat = rat->next)
-	    if (ra->backlog > rat->backlog)
-		ra = rat;
+	io_sched_pop(q->mcx->io, q);
+	ra = select_ra(q->mcx, NULL);
 	q->ra = ra;
+	q->sent = io_now;
 	ra->count_s++, ra->count_s_p++;
-	if (MAVIS_DEFERRED == av_send(q->ac, q->mcx->sock, &ra->sa, ra->blowfish))
+	if (MAVIS_DEFERRED == av_sendq_add(q->mcx->sendq, q->ac, &ra->sa, ra->blowfish, ra->aead))
 	    ra->backlog++;
+	query_schedule(q);
     }
 }
 
@@ -446,8 +647,9 @@ static int mavis_send_in(mavis_ctx * mcx, av_ctx ** ac)
 	    su_ntop(&rat->sa, buf, (socklen_t) sizeof(buf));
 	    logmsg
 		("STAT %s: [%s]:%d O=%llu I=%llu B=%lu "
-		 "o=%llu i=%llu b=%lu", MAVIS_name, buf,
-		 su_get_port(&rat->sa), rat->count_s, rat->count_r, rat->backlog_max, rat->count_s_p, rat->count_r_p, rat->backlog_max_p);
+		 "o=%llu i=%llu b=%lu R=%ld P=%ld L=%u", MAVIS_name, buf,
+		 su_get_port(&rat->sa), rat->count_s, rat->count_r, rat->backlog_max, rat->count_s_p, rat->count_r_p, rat->backlog_max_p,
+		 rat->srtt / 1000, rat->rtt_p95 / 1000, rat->loss * 100 / LOSS_SCALE);
 	    count_s += rat->count_s;
 	    count_r += rat->count_r;
 	    backlog_max += rat->backlog_max;
@@ -468,24 +670,22 @@ static int mavis_send_in(mavis_ctx * mcx, av_ctx ** ac)
 
 /*
  * Periodically try to rebalance (and reactivate) peers by resetting
- * all backlog values to 0.
+ * all backlog and loss values to 0.
  */
     if (mcx->rebalance && ++mcx->request_count > mcx->rebalance)
 	for (mcx->request_count = 0, rat = mcx->remote_addr; rat; rat = rat->next)
-	    rat->backlog = 0;
+	    rat->backlog = 0, rat->loss = 0;
     if (mcx->io) {
 	int result;
-	for (ra = rat = mcx->remote_addr; rat; rat = rat->next)
-	    if (ra->backlog > rat->backlog)
-		ra = rat;
-	if (ra) {
+	if ((ra = select_ra(mcx, NULL))) {
 	    ra->count_s++, ra->count_s_p++;
-	    result = av_send(*ac, mcx->sock, &ra->sa, ra->blowfish);
+	    result = av_sendq_add(mcx->sendq, *ac, &ra->sa, ra->blowfish, ra->aead);
 	    if (result == MAVIS_DEFERRED) {
 		struct query *q = Xcalloc(1, sizeof(struct query));
 		char *serial = av_get(*ac, AV_A_SERIAL);
 		q->mcx = mcx;
 		q->ra = ra;
+		q->sent = io_now;
 		q->ac = *ac;
 		if (mcx->ac_bak) {
 		    q->ac_bak = mcx->ac_bak;
@@ -493,7 +693,7 @@ static int mavis_send_in(mavis_ctx * mcx, av_ctx ** ac)
 		}
 		*ac = NULL;
 		q->serial_crc = crc32_update(INITCRC32, (u_char *) serial, strlen(serial));
-		io_sched_add(mcx->io, q, (void *) retransmit, mcx->timeout, 0);
+		query_schedule(q);
 		RB_insert(mcx->retransmit, q);
 		RB_insert(mcx->retransmit_by_app_ctx, q);
 		ra->backlog++;
@@ -519,24 +719,31 @@ static int mavis_send_in(mavis_ctx * mcx, av_ctx ** ac)
 	ufds[0].events = POLLIN;
 	do {
 	    sockaddr_union sa;
-	    for (ra = rat = mcx->remote_addr; rat; rat = rat->next)
-		if (ra->backlog > rat->backlog)
-		    ra = rat;
+	    struct timeval sent;
+	    ra = select_ra(mcx, NULL);
 	    if ((!tries && mcx->tries)
-		|| (ra->backlog++, MAVIS_FINAL == av_send(*ac, mcx->sock, &ra->sa, ra->blowfish))) {
+		|| (ra->backlog++, MAVIS_FINAL == av_send(*ac, mcx->sock, &ra->sa, ra->blowfish, ra->aead))) {
 		av_set(*ac, AV_A_RESULT, AV_V_RESULT_ERROR);
 		av_set(*ac, AV_A_COMMENT, "timed out");
 		Debug((DEBUG_MAVIS, "- %s = 0 (sync)\n", __func__));
 		return MAVIS_TIMEOUT;
 	    }
 
-	    tries--;
-	    if ((1 != poll(ufds, 1, mcx->timeout * 1000))
+	    gettimeofday(&sent, NULL);
+	    if ((1 != poll(ufds, 1, (int) (query_rto(mcx, ra, mcx->tries - tries) / 1000)))
 		|| (!(ufds[0].revents & POLLIN))
 		|| (ra != av_recv(mcx, avc, mcx->sock, &sa))
-		|| (!(v = av_get(avc, AV_A_SERIAL))))
+		|| (!(v = av_get(avc, AV_A_SERIAL)))) {
+		ra_loss_update(ra);
+		tries--;
 		continue;
+	    }
+	    tries--;
 	    if (ra) {
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		if (tries == mcx->tries - 1)
+		    ra_rtt_update(ra, tv_diff(&now, &sent));
 		if (ra->backlog > 0)
 		    ra->backlog--;
 		ra->count_r++, ra->count_r_p++;
@@ -551,13 +758,10 @@ static int mavis_send_in(mavis_ctx * mcx, av_ctx ** ac)
     }
 }
 
-static void mavis_io(mavis_ctx * mcx, int cur __attribute__((unused)))
+static void mavis_io_one(mavis_ctx * mcx, av_ctx * ac, a_char * buf, ssize_t buflen, sockaddr_union * sa)
 {
     struct remote_addr_s *ra;
-    sockaddr_union sa;
-    av_ctx *ac = av_new(NULL, NULL);
-    DebugIn(DEBUG_MAVIS);
-    if ((ra = av_recv(mcx, ac, mcx->sock, &sa))) {
+    if ((ra = av_recv_buf(mcx, ac, buf, buflen, sa))) {
 	struct query q;
 	char *serial;
 	if ((serial = av_get(ac, AV_A_SERIAL))) {
@@ -573,8 +777,11 @@ static void mavis_io(mavis_ctx * mcx, int cur __attribute__((unused)))
 		RB_delete(mcx->retransmit, r);
 		av_move(qp->ac, ac);
 		RB_insert(mcx->outgoing, qp);
-		if (ra->backlog > 0)
-		    ra->backlog--;
+		if (ra == qp->hedge_ra)
+		    ra_rtt_update(ra, tv_diff(&io_now, &qp->hedge_sent));
+		else if (ra == qp->ra && !qp->tries)
+		    ra_rtt_update(ra, tv_diff(&io_now, &qp->sent));
+		query_release(qp);
 		qp->result = MAVIS_FINAL;
 		Debug((DEBUG_MAVIS, "%s:%d\n", __FILE__, __LINE__));
 		while ((r = RB_first(mcx->outgoing))) {
@@ -588,8 +795,24 @@ static void mavis_io(mavis_ctx * mcx, int cur __attribute__((unused)))
 	    }
 	}
     } else {
-	char buf[INET6_ADDRSTRLEN];
-	logmsg("Alert: reply from unknown peer %s:%u", su_ntop(&sa, buf, (socklen_t) sizeof(buf)), (u_int) su_get_port(&sa));
+	char ibuf[INET6_ADDRSTRLEN];
+	logmsg("Alert: reply from unknown peer %s:%u", su_ntop(sa, ibuf, (socklen_t) sizeof(ibuf)), (u_int) su_get_port(sa));
+    }
+}
+
+/* Drain up to AV_RECVQ_MAX replies per wakeup. */
+static void mavis_io(mavis_ctx * mcx, int cur __attribute__((unused)))
+{
+    int i, n;
+    av_ctx *ac = av_new(NULL, NULL);
+    DebugIn(DEBUG_MAVIS);
+    n = av_recvq_read(mcx->recvq, mcx->sock);
+    for (i = 0; i < n; i++) {
+	ssize_t buflen;
+	sockaddr_union *sa;
+	a_char *buf = av_recvq_get(mcx->recvq, i, &buflen, &sa);
+	if (buflen > 0)
+	    mavis_io_one(mcx, ac, buf, buflen, sa);
     }
     av_free(ac);
     DebugOut(DEBUG_MAVIS);
@@ -25,6 +25,7 @@
 #include "misc/io.h"
 #include "groups.h"
 #include "misc/memops.h"
+#include "misc/lineindex.h"
 #include "debug.h"
 #include "log.h"
 
@@ -40,6 +41,10 @@ static const char rcsid[] __attribute__((used)) = "$Id$";
 	char *ssluserspath;		\
 	int require_valid_shell;	\
 	char *shellpath;		\
+	lineindex_t *passwd_index;	\
+	lineindex_t *ftpusers_index;	\
+	lineindex_t *sslusers_index;	\
+	lineindex_t *shells_index;	\
     	struct passwd pw;		\
 	char inbuf[16384];	\
 	void *libcrypt;			\
@@ -176,6 +181,10 @@ static void mavis_drop_in(mavis_ctx * mcx)
     Xfree(&mcx->ftpuserspath);
     Xfree(&mcx->ssluserspath);
     Xfree(&mcx->shellpath);
+    lineindex_free(&mcx->passwd_index);
+    lineindex_free(&mcx->ftpusers_index);
+    lineindex_free(&mcx->sslusers_index);
+    lineindex_free(&mcx->shells_index);
 #ifdef WITH_LIBCRYPT
     if (mcx->libcrypt)
 	dlclose(mcx->libcrypt);
@@ -228,39 +237,17 @@ static struct passwd *parse_pwent(mavis_ctx * mcx, char *s)
     return &mcx->pw;
 }
 
-static struct passwd *get_pwent(mavis_ctx * mcx, int fn, char *s)
+static struct passwd *get_pwent(mavis_ctx * mcx, char *s)
 {
-    size_t offset = 0;
-    ssize_t inlength;
-    char *linestart = mcx->inbuf;
-    char *lineend;
-    ssize_t slen = strlen(s);
-    s[slen++] = ':';		/* replace terminating \0 with : */
-
-    while ((inlength = Read(fn, mcx->inbuf + offset, sizeof(mcx->inbuf) - 1 - offset)) > 0) {
-	inlength += offset;
-	mcx->inbuf[inlength] = 0;
-	linestart = mcx->inbuf;
-
-	while ((lineend = strchr(linestart, '\n'))) {
-	    *lineend = 0;
-
-	    if (!strncmp(s, linestart, slen)) {
-		struct passwd *pw = parse_pwent(mcx, linestart);
-		s[slen - 1] = 0;
-		return pw;
-	    }
-
-	    linestart = lineend + 1;
-	}
+    void *cursor = NULL;
+    char *line = lineindex_lookup(mcx->passwd_index, s, &cursor);
 
-	offset = mcx->inbuf + inlength - linestart;
-	if (offset)
-	    memmove(mcx->inbuf, linestart, offset);
-    }
+    if (!line)
+	return NULL;
 
-    s[slen - 1] = 0;
-    return NULL;
+    strncpy(mcx->inbuf, line, sizeof(mcx->inbuf) - 1);
+    mcx->inbuf[sizeof(mcx->inbuf) - 1] = 0;
+    return parse_pwent(mcx, mcx->inbuf);
 }
 
 #define HAVE_mavis_send_in
@@ -315,16 +302,14 @@ static int mavis_send_in(mavis_ctx * mcx, av_ctx ** ac)
     } else
 #endif				/* HAVE_SHADOWPWD */
     {
-	int f;
-
-	f = open(mcx->passwordfile, O_RDONLY);
-	if (f < 0) {
+	if (!mcx->passwd_index)
+	    mcx->passwd_index = lineindex_new(mcx->passwordfile, LINEINDEX_FIELD);
+	if (lineindex_refresh(mcx->passwd_index)) {
 	    av_set(*ac, AV_A_COMMENT, "error opening password file");
 	    av_set(*ac, AV_A_RESULT, AV_V_RESULT_ERROR);
 	    return MAVIS_DOWN;
 	}
-	pw = get_pwent(mcx, f, u);
-	close(f);
+	pw = get_pwent(mcx, u);
 
 	if (!pw)
 	    return MAVIS_DOWN;
@@ -373,115 +358,61 @@ static int mavis_send_in(mavis_ctx * mcx, av_ctx ** ac)
     return MAVIS_FINAL;
 }
 
-static int find_line(int fn, char *s)
+static int find_line(lineindex_t ** li, char *path, int mode, char *s)
 {
-    char inbuf[8192];
-    size_t offset = 0;
-    ssize_t inlength;
-    char *linestart = inbuf;
-    char *lineend;
-
-    while ((inlength = Read(fn, inbuf + offset, sizeof(inbuf) - 1 - offset)) > 0) {
-	inlength += offset;
-	inbuf[inlength] = 0;
-	linestart = inbuf;
-
-	while ((lineend = strchr(linestart, '\n'))) {
-	    *lineend = 0;
+    void *cursor = NULL;
 
-	    if (!strcmp(s, linestart))
-		return -1;
-
-	    linestart = lineend + 1;
-	}
-
-	offset = inbuf + inlength - linestart;
-	if (offset)
-	    memmove(inbuf, linestart, offset);
-    }
-
-    return 0;
-}
-
-static void find_ssluser(av_ctx * ac, int fn, char *user)
-{
-    char inbuf[8192];
-    size_t offset = 0;
-    ssize_t inlength;
-    char *linestart = inbuf;
-    char *lineend;
-
-    while ((inlength = Read(fn, inbuf + offset, sizeof(inbuf) - 1 - offset)) > 0) {
-	inlength += offset;
-	inbuf[inlength] = 0;
-	linestart = inbuf;
-
-	while ((lineend = strchr(linestart, '\n'))) {
-	    *lineend = 0;
-
-	    if (*linestart != '#') {
-		char *subj = strchr(linestart, ':');
-		if (subj) {
-		    char *s = linestart;
-		    char *t;
-		    *subj++ = 0;
-		    for (t = strtok(s, ","); t; t = strtok(NULL, ","))
-			if (!strcmp(user, t)) {
-			    char *a = av_get(ac, AV_A_DBCERTSUBJ);
-			    if (a)
-				av_setf(ac, AV_A_DBCERTSUBJ, "%s\r%s", a, subj);
-			    else
-				av_set(ac, AV_A_DBCERTSUBJ, subj);
-			    break /* out of for-loop */ ;
-			}
-		}
-	    }
-
-	    linestart = lineend + 1;
-	}
-
-	offset = inbuf + inlength - linestart;
-	if (offset)
-	    memmove(inbuf, linestart, offset);
-    }
+    if (!*li)
+	*li = lineindex_new(path, mode);
+    if (lineindex_refresh(*li))
+	return -1;
+    return lineindex_lookup(*li, s, &cursor) ? 1 : 0;
 }
 
 /* set AV_A_DBCERTSUBJ if user found */
 static void lookup_ssluser(mavis_ctx * mcx, av_ctx * ac, char *user)
 {
-    int fn = open(mcx->ssluserspath, O_RDONLY);
-    if (fn > -1) {
-	find_ssluser(ac, fn, user);
-	close(fn);
-    } else
+    void *cursor = NULL;
+    char *line, *prev = NULL;
+
+    if (!mcx->sslusers_index)
+	mcx->sslusers_index = lineindex_new(mcx->ssluserspath, LINEINDEX_FIELDLIST | LINEINDEX_COMMENTS);
+    if (lineindex_refresh(mcx->sslusers_index)) {
 	logerr("Warning: open(%s)", mcx->ssluserspath);
+	return;
+    }
+
+    while ((line = lineindex_lookup(mcx->sslusers_index, user, &cursor))) {
+	char *subj, *a;
+	if (line == prev)	/* user listed more than once */
+	    continue;
+	prev = line;
+	subj = strchr(line, ':') + 1;
+	a = av_get(ac, AV_A_DBCERTSUBJ);
+	if (a)
+	    av_setf(ac, AV_A_DBCERTSUBJ, "%s\r%s", a, subj);
+	else
+	    av_set(ac, AV_A_DBCERTSUBJ, subj);
+    }
 }
 
 /* return TRUE if user was not found. DEFAULT: TRUE */
 static int valid_user(mavis_ctx * mcx, char *user)
 {
-    int fn, found;
+    int found = find_line(&mcx->ftpusers_index, mcx->ftpuserspath, LINEINDEX_LINE, user);
 
-    fn = open(mcx->ftpuserspath, O_RDONLY);
-    if (fn < 0)
+    if (found < 0)
 	return (errno == ENOENT);
-    found = find_line(fn, user);
-    close(fn);
-
     return !found;
 }
 
 /* return TRUE if shell was found. Default: FALSE */
 static int valid_shell(mavis_ctx * mcx, char *shell)
 {
-    int fn, found;
+    int found = find_line(&mcx->shells_index, mcx->shellpath, LINEINDEX_LINE, shell);
 
-    fn = open(mcx->shellpath, O_RDONLY);
-    if (fn < 0)
+    if (found < 0)
 	return (errno == ENOENT);
-    found = find_line(fn, shell);
-    close(fn);
-
     return found;
 }
 
@@ -3,11 +3,29 @@
  * Caches MAVIS-TACACS+ authentication results to disk for later authorizations.
  * (C)2002-2021 by Marc Huber <Marc.Huber@web.de>
  * All rights reserved.
- * 
+ *
  * $Id$
  *
  */
 
+/*
+ * The cache is a single append-only file, shared between processes:
+ *
+ *   header | record | record | ...
+ *
+ * Each record consists of a record_head (carrying the MD5 key, the payload
+ * length and a CRC32 over both) plus the NUL-terminated payload, padded
+ * to 8 bytes. Newer records supersede older ones with the same key. The
+ * file is mmap(2)ed read-only, each process keeps an in-memory index and
+ * scans records appended by other processes incrementally. Appends and
+ * compaction are serialized by a fcntl(2) write lock. A record that fails
+ * the CRC check (e.g. a partial write after a crash) terminates the scan
+ * and is truncated by the next writer. Readers scan new data under a read
+ * lock, so the file can't shrink beneath their mapping. Compaction writes
+ * the live records to a new file and renames that over the old one, other
+ * processes notice the unlinked inode and reopen.
+ */
+
 #define MAVIS_name "tacinfo_cache"
 
 #include "misc/sysconf.h"
@@ -26,16 +44,25 @@
 #include "debug.h"
 #include "log.h"
 #include "misc/strops.h"
-#include "misc/tohex.h"
+#include "misc/memops.h"
+#include "misc/rb.h"
+#include "misc/crc32.h"
 #include "misc/mymd5.h"
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
 #define MAVIS_CTX_PRIVATE		\
 		char *hashdir;		\
-		char *hashfile;		\
-		char *hashfile_tmp;	\
-		off_t hashfile_offset;	\
+		char *dbfile;		\
+		char *dbfile_tmp;	\
+		int fd;			\
+		u_char *map;		\
+		size_t maplen;		\
+		off_t indexed;		\
+		off_t dead;		\
+		int compaction_pending;	\
+		int locked;		\
+		rb_tree_t *index;	\
 		int cached;		\
 		uid_t uid;		\
 		gid_t gid;		\
@@ -44,6 +71,325 @@ static const char rcsid[] __attribute__((used)) = "$Id$";
 
 #include "mavis.h"
 
+#define DB_NAME "tacinfo.db"
+#define DB_MAGIC "MAVIS-TACINFO-1\n"
+#define DB_HEADLEN 16
+#define RECORD_MAGIC 0x54414331
+#define RECORD_PAD(A) (((A) + 7) & ~7)
+#define COMPACT_MIN (1024 * 1024)
+
+struct record_head {
+    u_int32_t magic;
+    u_int32_t crc;
+    u_char key[16];
+    u_int32_t len;		/* payload length, including trailing NUL */
+    u_int32_t pad;
+};
+
+struct entry {
+    u_char key[16];
+    off_t off;			/* record offset */
+    u_int32_t len;
+};
+
+static int cmp_entry(const void *a, const void *b)
+{
+    return memcmp(((struct entry *) a)->key, ((struct entry *) b)->key, 16);
+}
+
+static void free_entry(void *payload)
+{
+    free(payload);
+}
+
+static u_int record_crc(struct record_head *rh, u_char *data)
+{
+    u_int crc = crc32_update(INITCRC32, rh->key, (off_t) sizeof(rh->key));
+    crc = crc32_update(crc, (u_char *) & rh->len, (off_t) sizeof(rh->len));
+    return crc32_update(crc, data, (off_t) rh->len);
+}
+
+static int db_lock(mavis_ctx * mcx, int locktype)
+{
+    struct flock flock;
+
+    memset(&flock, 0, sizeof(flock));
+    flock.l_type = locktype;
+    flock.l_whence = SEEK_SET;
+    if (fcntl(mcx->fd, F_SETLKW, &flock))
+	return -1;
+    mcx->locked = (locktype != F_UNLCK);
+    return 0;
+}
+
+static void db_close(mavis_ctx * mcx)
+{
+    if (mcx->map)
+	munmap(mcx->map, mcx->maplen);
+    mcx->map = NULL;
+    mcx->maplen = 0;
+    if (mcx->fd > -1)
+	close(mcx->fd);
+    mcx->fd = -1;
+    mcx->locked = 0;
+    if (mcx->index)
+	RB_tree_delete(mcx->index);
+    mcx->index = NULL;
+    mcx->indexed = 0;
+    mcx->dead = 0;
+}
+
+static int db_open(mavis_ctx * mcx)
+{
+    struct stat st;
+
+    db_close(mcx);
+
+    setegid(mcx->gid);
+    seteuid(mcx->uid);
+    mcx->fd = open(mcx->dbfile, O_RDWR | O_CREAT, 0600);
+    seteuid(mcx->euid);
+    setegid(mcx->egid);
+
+    if (mcx->fd < 0) {
+	logerr("module %s: open (%s)", MAVIS_name, mcx->dbfile);
+	return -1;
+    }
+    fcntl(mcx->fd, F_SETFD, FD_CLOEXEC);
+
+    if (!fstat(mcx->fd, &st) && st.st_size < DB_HEADLEN) {
+	db_lock(mcx, F_WRLCK);
+	if (!fstat(mcx->fd, &st) && st.st_size < DB_HEADLEN
+	    && (ftruncate(mcx->fd, 0) || DB_HEADLEN != pwrite(mcx->fd, DB_MAGIC, DB_HEADLEN, 0)))
+	    logerr("module %s: write (%s)", MAVIS_name, mcx->dbfile);
+	db_lock(mcx, F_UNLCK);
+    }
+
+    mcx->index = RB_tree_new(cmp_entry, free_entry);
+    mcx->indexed = DB_HEADLEN;
+    return 0;
+}
+
+/*
+ * Map the file (size from st) and index the records not seen so far.
+ * Returns the file size, or -1 on error.
+ */
+static off_t db_scan(mavis_ctx * mcx, struct stat *st)
+{
+    /* Records we already indexed are gone. Start over. */
+    if (st->st_size < mcx->indexed) {
+	RB_tree_delete(mcx->index);
+	mcx->index = RB_tree_new(cmp_entry, free_entry);
+	mcx->indexed = DB_HEADLEN;
+	mcx->dead = 0;
+    }
+
+    /* Pages past EOF must not be touched (SIGBUS), remap if the file shrank, too. */
+    if ((size_t) st->st_size != mcx->maplen) {
+	if (mcx->map)
+	    munmap(mcx->map, mcx->maplen);
+	mcx->map = NULL;
+	mcx->maplen = 0;
+	if (st->st_size < DB_HEADLEN) {
+	    db_close(mcx);
+	    return -1;
+	}
+	mcx->maplen = (size_t) st->st_size;
+	mcx->map = mmap(NULL, mcx->maplen, PROT_READ, MAP_SHARED, mcx->fd, 0);
+	if (mcx->map == MAP_FAILED) {
+	    logerr("module %s: mmap (%s)", MAVIS_name, mcx->dbfile);
+	    mcx->map = NULL;
+	    db_close(mcx);
+	    return -1;
+	}
+	if (memcmp(mcx->map, DB_MAGIC, DB_HEADLEN)) {
+	    logmsg("module %s: %s has an unknown format", MAVIS_name, mcx->dbfile);
+	    db_close(mcx);
+	    return -1;
+	}
+    }
+
+    while (mcx->indexed + (off_t) sizeof(struct record_head) <= st->st_size) {
+	struct record_head *rh = (struct record_head *) (mcx->map + mcx->indexed);
+	off_t reclen = (off_t) sizeof(struct record_head) + RECORD_PAD(rh->len);
+	struct entry *e;
+	rb_node_t *rbn;
+
+	if (rh->magic != RECORD_MAGIC || rh->len < 1 || rh->len > BUFSIZE_MAVIS
+	    || mcx->indexed + reclen > st->st_size || rh->crc != record_crc(rh, (u_char *) (rh + 1)))
+	    break;
+
+	e = Xcalloc(1, sizeof(struct entry));
+	memcpy(e->key, rh->key, sizeof(e->key));
+	e->off = mcx->indexed;
+	e->len = rh->len;
+	if ((rbn = RB_search(mcx->index, e))) {
+	    mcx->dead += (off_t) sizeof(struct record_head) + RECORD_PAD(RB_payload(rbn, struct entry *)->len);
+	    RB_delete(mcx->index, rbn);
+	}
+	RB_insert(mcx->index, e);
+	mcx->indexed += reclen;
+    }
+
+    return st->st_size;
+}
+
+/*
+ * Bring the index up to date with the file, re-opening it if it has been
+ * replaced by compaction. Returns the file size, or -1 on error.
+ */
+static off_t db_sync(mavis_ctx * mcx)
+{
+    struct stat st;
+    off_t size;
+
+    if ((mcx->fd < 0 || fstat(mcx->fd, &st) || !st.st_nlink) && (db_open(mcx) || fstat(mcx->fd, &st)))
+	return -1;
+
+    /*
+     * Writers truncate torn records while holding the write lock. Unless
+     * there's nothing new, read past the indexed records under a read lock
+     * only, so the file can't shrink below the mapping during the scan.
+     */
+    if (mcx->locked || ((size_t) st.st_size == mcx->maplen && mcx->indexed >= st.st_size))
+	return db_scan(mcx, &st);
+
+    if (db_lock(mcx, F_RDLCK))
+	return -1;
+    size = fstat(mcx->fd, &st) ? -1 : db_scan(mcx, &st);
+    if (mcx->fd > -1)
+	db_lock(mcx, F_UNLCK);
+    return size;
+}
+
+/*
+ * Acquire the write lock on the current file, re-opening it if it was
+ * replaced while waiting. Returns the file size, or -1 on error.
+ */
+static off_t db_lock_current(mavis_ctx * mcx)
+{
+    struct stat st;
+    off_t size;
+
+    do {
+	if (db_sync(mcx) < 0 || db_lock(mcx, F_WRLCK))
+	    return -1;
+	if (!fstat(mcx->fd, &st) && st.st_nlink)
+	    break;
+	db_lock(mcx, F_UNLCK);
+    }
+    while (1);
+
+    if ((size = db_sync(mcx)) < 0)
+	db_lock(mcx, F_UNLCK);
+    return size;
+}
+
+static void db_compact(mavis_ctx * mcx, int cur __attribute__((unused)))
+{
+    rb_node_t *rbn;
+    FILE *f;
+    int fd, res = 0;
+
+    DebugIn(DEBUG_MAVIS);
+
+    if (mcx->io)
+	io_sched_pop(mcx->io, mcx);
+    mcx->compaction_pending = 0;
+
+    if (db_lock_current(mcx) < 0) {
+	DebugOut(DEBUG_MAVIS);
+	return;
+    }
+
+    /* someone else may have been faster */
+    if (mcx->dead < COMPACT_MIN || mcx->dead < mcx->indexed - mcx->dead) {
+	db_lock(mcx, F_UNLCK);
+	DebugOut(DEBUG_MAVIS);
+	return;
+    }
+
+    setegid(mcx->gid);
+    seteuid(mcx->uid);
+    fd = open(mcx->dbfile_tmp, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+    seteuid(mcx->euid);
+    setegid(mcx->egid);
+
+    if (fd < 0 || !(f = fdopen(fd, "w"))) {
+	logerr("module %s: open (%s)", MAVIS_name, mcx->dbfile_tmp);
+	if (fd > -1)
+	    close(fd);
+	db_lock(mcx, F_UNLCK);
+	DebugOut(DEBUG_MAVIS);
+	return;
+    }
+
+    res |= (1 != fwrite(DB_MAGIC, DB_HEADLEN, 1, f));
+    for (rbn = RB_first(mcx->index); rbn && !res; rbn = RB_next(rbn)) {
+	struct entry *e = RB_payload(rbn, struct entry *);
+	res |= (1 != fwrite(mcx->map + e->off, sizeof(struct record_head) + RECORD_PAD(e->len), 1, f));
+    }
+    res |= fflush(f);
+    res |= fsync(fileno(f));
+    res |= fclose(f);
+
+    if (res || rename(mcx->dbfile_tmp, mcx->dbfile)) {
+	logerr("module %s: compaction of %s failed", MAVIS_name, mcx->dbfile);
+	unlink(mcx->dbfile_tmp);
+	db_lock(mcx, F_UNLCK);
+    } else {
+	Debug((DEBUG_MAVIS, "compacted %s, %lld bytes reclaimed\n", mcx->dbfile, (long long) mcx->dead));
+	db_open(mcx);
+	db_sync(mcx);
+    }
+
+    DebugOut(DEBUG_MAVIS);
+}
+
+static void db_store(mavis_ctx * mcx, u_char *key, char *data, size_t len)
+{
+    struct record_head *rh;
+    struct entry e, *ep;
+    size_t reclen = sizeof(struct record_head) + RECORD_PAD(len);
+    off_t size;
+
+    if (db_sync(mcx) < 0)
+	return;
+
+    /* Don't bother to write unchanged data. */
+    memcpy(e.key, key, sizeof(e.key));
+    if ((ep = RB_lookup(mcx->index, &e)) && ep->len == len && !memcmp(mcx->map + ep->off + sizeof(struct record_head), data, len))
+	return;
+
+    rh = alloca(reclen);
+    memset(rh, 0, reclen);
+    rh->magic = RECORD_MAGIC;
+    memcpy(rh->key, key, sizeof(rh->key));
+    rh->len = (u_int32_t) len;
+    memcpy(rh + 1, data, len);
+    rh->crc = record_crc(rh, (u_char *) (rh + 1));
+
+    if ((size = db_lock_current(mcx)) < 0)
+	return;
+
+    /* Drop garbage left over by a crashed writer. */
+    if (size > mcx->indexed && ftruncate(mcx->fd, mcx->indexed))
+	logerr("module %s: ftruncate (%s)", MAVIS_name, mcx->dbfile);
+
+    if ((ssize_t) reclen != pwrite(mcx->fd, rh, reclen, mcx->indexed))
+	logerr("module %s: write (%s)", MAVIS_name, mcx->dbfile);
+
+    db_lock(mcx, F_UNLCK);
+
+    if (db_sync(mcx) > -1 && !mcx->compaction_pending && mcx->dead > COMPACT_MIN && mcx->dead > mcx->indexed - mcx->dead) {
+	mcx->compaction_pending = 1;
+	if (mcx->io)
+	    io_sched_add(mcx->io, mcx, (void *) db_compact, 0, 0);
+	else
+	    db_compact(mcx, -1);
+    }
+}
+
 #define HAVE_mavis_init_in
 static int mavis_init_in(mavis_ctx * mcx)
 {
@@ -56,8 +402,6 @@ static int mavis_init_in(mavis_ctx * mcx)
     if (!mcx->hashdir)
 	logmsg("Warning: %s module lacks directory definition", MAVIS_name);
     else {
-	int fn;
-	pid_t pid;
 	struct stat st;
 	size_t dirlen = strlen(mcx->hashdir);
 	while (dirlen - 1 > 0 && mcx->hashdir[dirlen - 1] == '/')
@@ -79,33 +423,15 @@ static int mavis_init_in(mavis_ctx * mcx)
 	if (stat(mcx->hashdir, &st) || !S_ISDIR(st.st_mode))
 	    logerr("module %s: directory %s doesn not exist", MAVIS_name, mcx->hashdir);
 
-	mcx->hashfile_tmp = calloc(1, dirlen + 39 + 1 + 2 * sizeof(pid) + 10 /* safety margin in case I've messed up counting characters */ );
-	strncpy(mcx->hashfile_tmp, mcx->hashdir, dirlen);
-	mcx->hashfile_tmp[dirlen++] = '/';
-	pid = getpid();
-	mcx->hashfile_tmp[dirlen + 35] = '-';
-	tohex((u_char *) & pid, sizeof(pid), mcx->hashfile_tmp + dirlen + 36);
-	memcpy(mcx->hashfile_tmp + dirlen, mcx->hashfile_tmp + dirlen + 36, 8);
-	setegid(mcx->gid);
-	seteuid(mcx->uid);
-	fn = open(mcx->hashfile_tmp, O_CREAT | O_WRONLY, 0600);
-	if (fn > -1) {
-	    close(fn);
-	    unlink(mcx->hashfile_tmp);
-	} else {
-	    logerr("module %s: can't write to directory %s", MAVIS_name, mcx->hashdir);
-	    free(mcx->hashdir);
-	    mcx->hashdir = NULL;
-	    free(mcx->hashfile_tmp);
-	    mcx->hashfile_tmp = NULL;
+	mcx->dbfile = Xcalloc(1, dirlen + sizeof(DB_NAME) + 1);
+	snprintf(mcx->dbfile, dirlen + sizeof(DB_NAME) + 1, "%s/" DB_NAME, mcx->hashdir);
+	mcx->dbfile_tmp = Xcalloc(1, dirlen + sizeof(DB_NAME) + 20);
+	snprintf(mcx->dbfile_tmp, dirlen + sizeof(DB_NAME) + 20, "%s/" DB_NAME ".%lu", mcx->hashdir, (u_long) getpid());
 
+	if (db_open(mcx)) {
+	    logerr("module %s: can't write to directory %s", MAVIS_name, mcx->hashdir);
+	    Xfree(&mcx->hashdir);
 	}
-	setegid(mcx->gid);
-	seteuid(mcx->uid);
-	mcx->hashfile_tmp[dirlen + 2] = '/';
-	mcx->hashfile = calloc(1, dirlen + 39 + 10 /* safety margin, see above */ );
-	memcpy(mcx->hashfile, mcx->hashfile_tmp, 36);
-	mcx->hashfile_offset = dirlen;
     }
 
     DebugOut(DEBUG_MAVIS);
@@ -158,14 +484,22 @@ static int mavis_parse_in(mavis_ctx * mcx, struct sym *sym)
 #define HAVE_mavis_drop_in
 static void mavis_drop_in(mavis_ctx * mcx)
 {
+    if (mcx->io && mcx->compaction_pending)
+	io_sched_pop(mcx->io, mcx);
+    db_close(mcx);
     Xfree(&mcx->hashdir);
-    Xfree(&mcx->hashfile);
-    Xfree(&mcx->hashfile_tmp);
+    Xfree(&mcx->dbfile);
+    Xfree(&mcx->dbfile_tmp);
 }
 
-static void get_hash(av_ctx * ac, char *buf)
+#define HAVE_mavis_new
+static void mavis_new(mavis_ctx * mcx)
+{
+    mcx->fd = -1;
+}
+
+static void get_hash(av_ctx * ac, u_char *u)
 {
-    u_char u[16];
     char *t;
     myMD5_CTX m;
     DebugIn(DEBUG_MAVIS);
@@ -180,18 +514,17 @@ static void get_hash(av_ctx * ac, char *buf)
 	myMD5Update(&m, (u_char *) t, strlen(t));
 
     myMD5Final(u, &m);
-    tohex(u, 16, buf);
     DebugOut(DEBUG_MAVIS);
 }
 
 #define HAVE_mavis_send_in
 static int mavis_send_in(mavis_ctx * mcx, av_ctx ** ac)
 {
-    int fn;
+    struct entry e, *ep;
     char *t;
 
     DebugIn(DEBUG_MAVIS);
-    if (!mcx->hashfile)
+    if (!mcx->hashdir)
 	return MAVIS_DOWN;
     t = av_get(*ac, AV_A_TYPE);
     if (!t || strcmp(t, AV_V_TYPE_TACPLUS))
@@ -200,24 +533,13 @@ static int mavis_send_in(mavis_ctx * mcx, av_ctx ** ac)
     if (!t || strcmp(t, AV_V_TACTYPE_INFO))
 	return MAVIS_DOWN;
 
-    get_hash(*ac, mcx->hashfile + mcx->hashfile_offset + 3);
-    mcx->hashfile[mcx->hashfile_offset] = mcx->hashfile[mcx->hashfile_offset + 3];
-    mcx->hashfile[mcx->hashfile_offset + 1] = mcx->hashfile[mcx->hashfile_offset + 4];
-    setegid(mcx->gid);
-    seteuid(mcx->uid);
+    get_hash(*ac, e.key);
 
-    fn = open(mcx->hashfile, O_RDONLY);
-    seteuid(mcx->euid);
-    setegid(mcx->egid);
-    if (fn > -1) {
-	char *c;
+    if (db_sync(mcx) > -1 && (ep = RB_lookup(mcx->index, &e))) {
+	char *c = alloca(ep->len);
 	av_ctx *a = av_new(NULL, NULL);
-	struct stat st;
-	fstat(fn, &st);
-	c = alloca(st.st_size + 1);
-	c[st.st_size] = 0;
-	read(fn, c, st.st_size);
-	close(fn);
+	memcpy(c, mcx->map + ep->off + sizeof(struct record_head), ep->len);
+	c[ep->len - 1] = 0;
 	av_char_to_array(a, c, NULL);
 	av_set(*ac, AV_A_TACPROFILE, av_get(a, AV_A_TACPROFILE));
 	av_set(*ac, AV_A_TACCLIENT, av_get(a, AV_A_TACCLIENT));
@@ -243,26 +565,30 @@ static int mavis_send_in(mavis_ctx * mcx, av_ctx ** ac)
     return MAVIS_DOWN;
 }
 
-static int write_av(av_ctx * ac, int fn, int attr)
+/* Appends attr to buf at offset *len. Returns -1 if it doesn't fit. */
+static int write_av(av_ctx * ac, char *buf, size_t buflen, size_t *len, int attr)
 {
-    int res = 0;
     char *t = av_get(ac, attr);
     if (t) {
-	char buf[40];
-	size_t len;
-	len = snprintf(buf, sizeof(buf), "%d ", attr);
-	res |= ((ssize_t) len != write(fn, buf, len));
-	len = strlen(t);
-	res |= ((ssize_t) len != write(fn, t, len));
-	res |= (1 != write(fn, "\n", 1));
+	int l = snprintf(buf + *len, buflen - *len, "%d %s\n", attr, t);
+	if (l < 0 || (size_t) l >= buflen - *len)
+	    return -1;
+	*len += (size_t) l;
     }
-    return res;
+    return 0;
 }
 
+static int cached_attrs[] = {
+    AV_A_TACPROFILE, AV_A_TACCLIENT, AV_A_TACMEMBER, AV_A_UID, AV_A_GID, AV_A_GIDS, AV_A_HOME,
+    AV_A_ROOT, AV_A_SHELL, AV_A_PATH, AV_A_DN, AV_A_MEMBEROF, AV_A_SSHKEYHASH
+};
+
 #define HAVE_mavis_recv_out
 static int mavis_recv_out(mavis_ctx * mcx, av_ctx ** ac)
 {
-    int fn, res = 0;
+    char buf[BUFSIZE_MAVIS];
+    size_t len = 0, i;
+    u_char key[16];
     char *t;
 
     if (mcx->cached) {
@@ -285,44 +611,19 @@ static int mavis_recv_out(mavis_ctx * mcx, av_ctx ** ac)
     if (!t || (strcmp(t, AV_V_TACTYPE_AUTH) && strcmp(t, AV_V_TACTYPE_INFO)))
 	return MAVIS_DOWN;
 
-    get_hash(*ac, mcx->hashfile + mcx->hashfile_offset + 3);
-    mcx->hashfile[mcx->hashfile_offset] = mcx->hashfile[mcx->hashfile_offset + 3];
-    mcx->hashfile[mcx->hashfile_offset + 1] = mcx->hashfile[mcx->hashfile_offset + 4];
-    mcx->hashfile_tmp[mcx->hashfile_offset] = mcx->hashfile[mcx->hashfile_offset + 3];
-    mcx->hashfile_tmp[mcx->hashfile_offset + 1] = mcx->hashfile[mcx->hashfile_offset + 4];
-    memcpy(mcx->hashfile_tmp + mcx->hashfile_offset + 3, mcx->hashfile + mcx->hashfile_offset + 3, 32);
-    mcx->hashfile_tmp[mcx->hashfile_offset + 3] = 0;
-
-    setegid(mcx->gid);
-    seteuid(mcx->uid);
+    get_hash(*ac, key);
 
-    mkdir(mcx->hashfile_tmp, 0700);
-    mcx->hashfile_tmp[mcx->hashfile_offset + 3] = '/';
-
-    fn = open(mcx->hashfile_tmp, O_CREAT | O_WRONLY, 0600);
-    if (fn > -1) {
-	res |= write_av(*ac, fn, AV_A_TACPROFILE);
-	res |= write_av(*ac, fn, AV_A_TACCLIENT);
-	res |= write_av(*ac, fn, AV_A_TACMEMBER);
-	res |= write_av(*ac, fn, AV_A_UID);
-	res |= write_av(*ac, fn, AV_A_GID);
-	res |= write_av(*ac, fn, AV_A_GIDS);
-	res |= write_av(*ac, fn, AV_A_HOME);
-	res |= write_av(*ac, fn, AV_A_ROOT);
-	res |= write_av(*ac, fn, AV_A_SHELL);
-	res |= write_av(*ac, fn, AV_A_PATH);
-	res |= write_av(*ac, fn, AV_A_DN);
-	res |= write_av(*ac, fn, AV_A_MEMBEROF);
-	res |= write_av(*ac, fn, AV_A_SSHKEYHASH);
-	res |= (-1 == close(fn));
-	if (res)
-	    unlink(mcx->hashfile_tmp);
-	else
-	    rename(mcx->hashfile_tmp, mcx->hashfile);
-    }
+    /* a truncated record would hand out partial attributes on cache hits */
+    for (i = 0; i < sizeof(cached_attrs) / sizeof(cached_attrs[0]); i++)
+	if (write_av(*ac, buf, sizeof(buf), &len, cached_attrs[i])) {
+	    t = av_get(*ac, AV_A_USER);
+	    logmsg("module %s: attributes of user %s exceed %d bytes, not cached", MAVIS_name, t ? t : "<unknown>", (int) sizeof(buf));
+	    DebugOut(DEBUG_MAVIS);
+	    return MAVIS_DOWN;
+	}
+    buf[len++] = 0;
 
-    seteuid(mcx->euid);
-    setegid(mcx->egid);
+    db_store(mcx, key, buf, len);
 
     DebugOut(DEBUG_MAVIS);
     return MAVIS_DOWN;
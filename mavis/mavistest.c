@@ -17,7 +17,10 @@
 #include <sysexits.h>
 #include <errno.h>
 #include <ctype.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include "misc/memops.h"
+#include "misc/io_sched.h"
 #include "mavis.h"
 #include "misc/version.h"
 
@@ -26,6 +29,7 @@ static const char rcsid[] __attribute__((used)) = "$Id$";
 extern int optind, opterr;
 extern char *optarg;
 static mavis_ctx *mcx = NULL;
+static struct io_context *io = NULL;
 
 static void myparse(struct sym *sym)
 {
@@ -40,7 +44,7 @@ static void myparse(struct sym *sym)
 	    sym_get(sym);
 	    switch (sym->code) {
 	    case S_module:
-		parse_mavismodule(&mcx, NULL, sym);
+		parse_mavismodule(&mcx, io, sym);
 		continue;
 	    case S_path:
 		parse_mavispath(sym);
@@ -82,20 +86,135 @@ static void usage()
 	    "Options:\n"
 	    "  -P                  (parse only)\n"
 	    "  -d <debuglevel>     (set debug level)\n"
+	    "  -l <count>          (number of queries)\n"
+	    "  -c <concurrency>    (queries in flight, asynchronous mode)\n"
+	    "  -t                  (timing only, no output)\n"
+	    "  -a <attr> -v <val>  (set attribute)\n"
 	    "\n"
 	    "Valid <type> values: %s, %s\n"
 	    "\n" "Sample usage: mavistest -d -1  /usr/local/etc/tac_plus.cfg tac_plus TACPLUS joe p4ssw0rd\n", AV_V_TYPE_FTP, AV_V_TYPE_TACPLUS);
     exit(-1);
 }
 
+static av_ctx *acd = NULL;
+static int q_argc = 0;
+static char **q_argv = NULL;
+
+static av_ctx *query_new(int n)
+{
+    av_ctx *ac = av_new(NULL, NULL);
+    av_copy(ac, acd);
+
+    av_setf(ac, AV_A_TIMESTAMP, "mavistest-%d-%ld-%d", (int) getpid(), (long) time(NULL), n);
+
+    if (!strcasecmp(q_argv[1], AV_V_TYPE_FTP) && q_argc == 4) {
+	char *at = strchr(q_argv[2], '@');
+	av_set(ac, AV_A_TYPE, AV_V_TYPE_FTP);
+	if (at) {
+	    *at = 0;
+	    av_set(ac, AV_A_VHOST, at + 1);
+	    av_set(ac, AV_A_USER, q_argv[2]);
+	    *at = '@';
+	} else
+	    av_set(ac, AV_A_USER, q_argv[2]);
+	av_set(ac, AV_A_PASSWORD, q_argv[3]);
+	av_set(ac, AV_A_IPADDR, "0.0.0.0");
+    } else if (!strcasecmp(q_argv[1], AV_V_TYPE_TACPLUS)) {
+	av_set(ac, AV_A_TYPE, AV_V_TYPE_TACPLUS);
+	av_set(ac, AV_A_USER, q_argv[2]);
+	switch (q_argc) {
+	case 3:
+	    av_set(ac, AV_A_TACTYPE, AV_V_TACTYPE_INFO);
+	    av_set(ac, AV_A_PASSWORD, q_argv[3]);
+	    break;
+	case 4:
+	    av_set(ac, AV_A_TACTYPE, AV_V_TACTYPE_AUTH);
+	    av_set(ac, AV_A_PASSWORD, q_argv[3]);
+	    break;
+	case 5:
+	    av_set(ac, AV_A_TACTYPE, AV_V_TACTYPE_CHPW);
+	    av_set(ac, AV_A_PASSWORD, q_argv[3]);
+	    av_set(ac, AV_A_PASSWORD_NEW, q_argv[4]);
+	    break;
+	default:
+	    mavis_drop(mcx);
+	    exit(EX_USAGE);
+	}
+    } else {
+	mavis_drop(mcx);
+	exit(EX_USAGE);
+    }
+    return ac;
+}
+
+static struct timeval tv_start;
+static struct rusage ru_start;
+
+static void timing_report(int count)
+{
+    struct timeval tv;
+    struct rusage ru;
+    double elapsed, cpu;
+
+    gettimeofday(&tv, NULL);
+    getrusage(RUSAGE_SELF, &ru);
+    elapsed = (tv.tv_sec - tv_start.tv_sec) + (tv.tv_usec - tv_start.tv_usec) / 1e6;
+    cpu = (ru.ru_utime.tv_sec - ru_start.ru_utime.tv_sec) + (ru.ru_utime.tv_usec - ru_start.ru_utime.tv_usec) / 1e6
+	+ (ru.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) + (ru.ru_stime.tv_usec - ru_start.ru_stime.tv_usec) / 1e6;
+    if (count < 1)
+	count = 1;
+    fprintf(stderr, "%d queries in %.3f seconds, %.0f queries/s, %.1f us CPU/query\n", count, elapsed, elapsed > 0 ? count / elapsed : 0, cpu * 1e6 / count);
+}
+
+/*
+ * Asynchronous load generation: keep up to <concurrency> queries in
+ * flight and start a new one whenever a response arrives.
+ */
+static int load_total = 0, load_started = 0, load_done = 0, load_timeout = 0;
+
+static void load_send(int *);
+
+static void load_recv(int *slot)
+{
+    av_ctx *ac = NULL;
+    if (mavis_recv(mcx, &ac, slot) == MAVIS_TIMEOUT)
+	load_timeout++;
+    av_free(ac);
+    load_done++;
+    load_send(slot);
+}
+
+static void load_send(int *slot)
+{
+    while (load_started < load_total) {
+	av_ctx *ac = query_new(load_started++);
+	int result;
+	av_setcb(ac, (void *) load_recv, slot);
+	result = mavis_send(mcx, &ac);
+	if (result == MAVIS_DEFERRED)
+	    return;
+	if (result == MAVIS_TIMEOUT)
+	    load_timeout++;
+	av_free(ac);
+	load_done++;
+    }
+    if (load_done == load_total) {
+	timing_report(load_done);
+	if (load_timeout)
+	    fprintf(stderr, "%d queries timed out\n", load_timeout);
+	mavis_drop(mcx);
+	exit(load_timeout ? EX_UNAVAILABLE : EX_OK);
+    }
+}
+
 int main(int argc, char *argv[])
 {
-    char opt, *optstring = "a:v:d:l:tP";
+    char opt, *optstring = "a:v:c:d:l:tP";
     int loop = 1;
     int timing = 0;
-    time_t start;
-    int avt = -1;
-    av_ctx *acd = av_new(NULL, NULL);
+    int concurrency = 0;
+    int avt = -1, i;
+    acd = av_new(NULL, NULL);
 
     init_common_data();
 
@@ -107,6 +226,9 @@ int main(int argc, char *argv[])
 	case 't':
 	    timing = 1;
 	    break;
+	case 'c':
+	    concurrency = atoi(optarg);
+	    break;
 	case 'P':
 	    common_data.parse_only = 1;
 	    break;
@@ -131,6 +253,9 @@ int main(int argc, char *argv[])
     if (argc < 3)		// config id user
 	usage();
 
+    if (concurrency > 0)
+	io = io_init();
+
     cfg_read_config(argv[0], myparse, argv[1]);
     if (common_data.parse_only)
 	exit(0);
@@ -140,50 +265,24 @@ int main(int argc, char *argv[])
 
     mavis_init(mcx, MAVIS_API_VERSION);
 
-    start = time(NULL);
-    while (loop-- > 0) {
-	av_ctx *ac = av_new(NULL, NULL);
-	av_copy(ac, acd);
-
-	av_setf(ac, AV_A_TIMESTAMP, "mavistest-%d-%ld-%d", (int) getpid(), (long) time(NULL), loop);
-
-	if (!strcasecmp(argv[1], AV_V_TYPE_FTP) && argc == 4) {
-	    char *at = strchr(argv[2], '@');
-	    av_set(ac, AV_A_TYPE, AV_V_TYPE_FTP);
-	    if (at) {
-		*at = 0;
-		av_set(ac, AV_A_VHOST, at + 1);
-		av_set(ac, AV_A_USER, argv[2]);
-		*at = '@';
-	    } else
-		av_set(ac, AV_A_USER, argv[2]);
-	    av_set(ac, AV_A_PASSWORD, argv[3]);
-	    av_set(ac, AV_A_IPADDR, "0.0.0.0");
-	} else if (!strcasecmp(argv[1], AV_V_TYPE_TACPLUS)) {
-	    av_set(ac, AV_A_TYPE, AV_V_TYPE_TACPLUS);
-	    av_set(ac, AV_A_USER, argv[2]);
-	    switch (argc) {
-	    case 3:
-		av_set(ac, AV_A_TACTYPE, AV_V_TACTYPE_INFO);
-		av_set(ac, AV_A_PASSWORD, argv[3]);
-		break;
-	    case 4:
-		av_set(ac, AV_A_TACTYPE, AV_V_TACTYPE_AUTH);
-		av_set(ac, AV_A_PASSWORD, argv[3]);
-		break;
-	    case 5:
-		av_set(ac, AV_A_TACTYPE, AV_V_TACTYPE_CHPW);
-		av_set(ac, AV_A_PASSWORD, argv[3]);
-		av_set(ac, AV_A_PASSWORD_NEW, argv[4]);
-		break;
-	    default:
-		mavis_drop(mcx);
-		exit(EX_USAGE);
-	    }
-	} else {
-	    mavis_drop(mcx);
-	    exit(EX_USAGE);
-	}
+    q_argc = argc;
+    q_argv = argv;
+
+    gettimeofday(&tv_start, NULL);
+    getrusage(RUSAGE_SELF, &ru_start);
+
+    if (concurrency > 0) {
+	int *slot = Xcalloc(concurrency, sizeof(int));
+	load_total = loop;
+	for (i = 0; i < concurrency && load_started < load_total; i++)
+	    load_send(&slot[i]);
+	if (!load_total)
+	    load_send(slot);
+	io_main(io);
+    }
+
+    for (i = 0; i < loop; i++) {
+	av_ctx *ac = query_new(i);
 
 	if (!timing) {
 	    fprintf(stderr, "\nInput ");
@@ -194,10 +293,11 @@ int main(int argc, char *argv[])
 	    fprintf(stderr, "\nOutput ");
 	    av_dump(ac);
 	}
+	av_free(ac);
     }
 
     if (timing)
-	fprintf(stderr, TIME_T_PRINTF " seconds\n", time(NULL) - start);
+	timing_report(loop);
 
     mavis_drop(mcx);
 
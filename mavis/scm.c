@@ -41,6 +41,9 @@ int scm_send_msg(int sock, struct scm_data *sd, int fd)
     case SCM_ACCEPT:
 	vector.iov_len = sizeof(struct scm_data_accept);
 	break;
+    case SCM_TLS_KEYS:
+	vector.iov_len = sizeof(struct scm_data_tls_keys);
+	break;
     default:
 	vector.iov_len = sizeof(struct scm_data);
     }
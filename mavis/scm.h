@@ -12,7 +12,7 @@
 #define __SCM_H__
 
 enum scm_token { SCM_DONE = 0, SCM_KEEPALIVE, SCM_MAY_DIE, SCM_DYING, SCM_BAD_CFG, SCM_MAX,
-    SCM_ACCEPT
+    SCM_ACCEPT, SCM_TLS_KEYS
 };
 
 struct scm_data {
@@ -34,6 +34,19 @@ struct scm_data_accept {
     char realm[SCM_REALM_SIZE];
 };
 
+/*
+ * TLS session ticket key material, distributed by spawnd to all children
+ * so sessions resume no matter which process a connection lands on.
+ * The key is a 32 byte AES key followed by a 16 byte HMAC key, which
+ * matches the libtls key layout.
+ */
+#define SCM_TLS_KEY_SIZE 48
+struct scm_data_tls_keys {
+    enum scm_token type;
+    u_int keyrev;
+    u_char key[SCM_TLS_KEY_SIZE];
+};
+
 int scm_send_msg(int, struct scm_data *, int);
 int scm_recv_msg(int, struct scm_data_accept *, size_t, int *);
 int fakescm_send_msg(int, struct scm_data *, int);
@@ -220,6 +220,12 @@ static void parse_listen(struct sym *sym)
 	    break;
 	case S_tcp:
 	    sym_get(sym);
+	    if (sym->code == S_fastopen) {
+		sym_get(sym);
+		parse(sym, S_equal);
+		ctx->fastopen = parse_int(sym);
+		break;
+	    }
 	    parse(sym, S_keepalive);
 	    switch (sym->code) {
 	    case S_count:
@@ -452,8 +458,15 @@ void spawnd_parse_decls(struct sym *sym)
 			parse_error_expect(sym, S_period, S_size, S_unknown);
 		    }
 		    break;
+		case S_tls:
+		    sym_get(sym);
+		    parse(sym, S_ticket);
+		    parse(sym, S_period);
+		    parse(sym, S_equal);
+		    spawnd_data.tls_ticket_period = parse_int(sym);
+		    break;
 		default:
-		    parse_error_expect(sym, S_exec, S_id, S_config, S_instances, S_users, S_userid, S_groupid, S_ipc, S_unknown);
+		    parse_error_expect(sym, S_exec, S_id, S_config, S_instances, S_users, S_userid, S_groupid, S_ipc, S_tls, S_unknown);
 		}
 	    }
 	    parse(sym, S_closebra);
@@ -79,6 +79,10 @@ struct spawnd_data {
     int keepidle;
     int keepintvl;
     int scm_bufsize;
+    int tls_ticket_period;	/* TLS session ticket key rotation, 0: off */
+    u_int tls_keyrev;
+    int tls_keys;		/* number of keys generated so far */
+    u_char tls_key[2][SCM_TLS_KEY_SIZE];	/* current, previous */
 };
 
 struct spawnd_context {
@@ -112,6 +116,7 @@ struct spawnd_context {
     int keepcnt;
     int keepidle;
     int keepintvl;
+    int fastopen;		/* listener only, TCP Fast Open queue length */
     sockaddr_union sa;
 };
 
@@ -124,6 +129,7 @@ void spawnd_parse_decls(struct sym *);
 int spawnd_send_msg(int, char *, int);
 int spawnd_recv_msg(int, char **, int *);
 void spawnd_add_child(void);
+void spawnd_rotate_tls_keys(struct spawnd_context *, int);
 void spawnd_del_child(int);
 void spawnd_accepted(struct spawnd_context *, int);
 void spawnd_bind_listener(struct spawnd_context *, int);
@@ -18,6 +18,7 @@
 #include <grp.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <netinet/tcp.h>
 
 #ifdef __APPLE__
 #include <mach-o/dyld.h>
@@ -290,6 +291,12 @@ void spawnd_bind_listener(struct spawnd_context *ctx, int cur)
 	return;
     }
 
+#ifdef TCP_FASTOPEN
+    if (ctx->fastopen > 0 && ctx->protocol == IPPROTO_TCP
+	&& setsockopt(ctx->fn, IPPROTO_TCP, TCP_FASTOPEN, (char *) &ctx->fastopen, (socklen_t) sizeof(ctx->fastopen)) < 0)
+	logerr("setsockopt TCP_FASTOPEN (%s:%d)", __FILE__, __LINE__);
+#endif
+
     ctx->is_listener = 1;
 
     ctx->io = common_data.io;
@@ -331,8 +338,8 @@ int spawnd_main(int argc, char **argv, char **envp, char *id)
 #ifdef WITH_SSL
 	"/DES"
 #endif
-#ifdef WITH_LWRES
-	"/LWRES"
+#ifdef WITH_DNS
+	"/DNS"
 #endif
 #ifdef WITH_CURL
 	"/CURL"
@@ -352,6 +359,7 @@ int spawnd_main(int argc, char **argv, char **envp, char *id)
     spawnd_data.keepidle = -1;
     spawnd_data.scm_bufsize = 0;	// leave at system default
     spawnd_data.abandon = 0;
+    spawnd_data.tls_ticket_period = 3600;
 
     if (!getsockopt(0, SOL_SOCKET, SO_TYPE, &socktype, &socktypelen))
 	switch (socktype) {
@@ -536,6 +544,13 @@ int spawnd_main(int argc, char **argv, char **envp, char *id)
 
     spawnd_data.tracking_size = 1024;
 
+    if (spawnd_data.tls_ticket_period > 0) {
+	spawnd_data.tls_keyrev = (u_int) time(NULL);
+	ctx = spawnd_new_context(common_data.io);
+	io_sched_add(common_data.io, ctx, (void *) spawnd_rotate_tls_keys, (time_t) spawnd_data.tls_ticket_period, (suseconds_t) 0);
+	spawnd_rotate_tls_keys(ctx, -1);
+    }
+
     spawnd_setup_signals();
     setup_sig_segv(common_data.coredumpdir, common_data.gcorepath, common_data.debug_cmd);
 
@@ -567,8 +582,8 @@ void scm_main(int argc, char **argv, char **envp)
 #ifdef WITH_SSL
 	"/DES"
 #endif
-#ifdef WITH_LWRES
-	"/LWRES"
+#ifdef WITH_DNS
+	"/DNS"
 #endif
 #ifdef WITH_CURL
 	"/CURL"
@@ -182,6 +182,47 @@ static void recv_childmsg(struct spawnd_context *ctx, int cur)
 	}
 }
 
+static void send_tls_key(struct spawnd_context *ctx, u_int keyrev, u_char *key)
+{
+    struct scm_data_tls_keys sd;
+
+    sd.type = SCM_TLS_KEYS;
+    sd.keyrev = keyrev;
+    memcpy(sd.key, key, SCM_TLS_KEY_SIZE);
+    common_data.scm_send_msg(ctx->fn, (struct scm_data *) &sd, -1);
+    memset(&sd, 0, sizeof(sd));
+}
+
+/*
+ * Session ticket keys are generated here and pushed to all children, so a
+ * TLS session established with one child can be resumed with any other.
+ * Children keep the previous key, too, so tickets stay valid for at least
+ * one rotation period.
+ */
+void spawnd_rotate_tls_keys(struct spawnd_context *ctx, int cur __attribute__((unused)))
+{
+    int i, fd = open("/dev/urandom", O_RDONLY);
+
+    if (ctx)
+	io_sched_renew(ctx->io, ctx);
+
+    memcpy(spawnd_data.tls_key[1], spawnd_data.tls_key[0], SCM_TLS_KEY_SIZE);
+    if (fd < 0 || read(fd, spawnd_data.tls_key[0], SCM_TLS_KEY_SIZE) != SCM_TLS_KEY_SIZE) {
+	logerr("Can't read /dev/urandom, TLS session tickets disabled");
+	spawnd_data.tls_ticket_period = 0;
+	spawnd_data.tls_keys = 0;
+	if (ctx)
+	    io_sched_pop(ctx->io, ctx);
+    } else {
+	spawnd_data.tls_keyrev++;
+	spawnd_data.tls_keys++;
+	for (i = 0; i < common_data.servers_cur; i++)
+	    send_tls_key(spawnd_data.server_arr[i], spawnd_data.tls_keyrev, spawnd_data.tls_key[0]);
+    }
+    if (fd > -1)
+	close(fd);
+}
+
 void spawnd_add_child()
 {
     if (common_data.servers_cur < common_data.servers_max) {
@@ -200,6 +241,10 @@ void spawnd_add_child()
 	    io_clr_cb_o(common_data.io, cur);
 	    io_set_i(common_data.io, cur);
 	    spawnd_data.server_arr[common_data.servers_cur++] = ctx;
+	    if (spawnd_data.tls_keys > 1)
+		send_tls_key(ctx, spawnd_data.tls_keyrev - 1, spawnd_data.tls_key[1]);
+	    if (spawnd_data.tls_keys)
+		send_tls_key(ctx, spawnd_data.tls_keyrev, spawnd_data.tls_key[0]);
 	}
     }
 }
@@ -327,6 +327,7 @@ backoff		S_backoff
 realm		S_realm
 dns		S_dns
 reverse-lookup	S_reverselookup
+forward-lookup	S_forwardlookup
 cleanup		S_cleanup
 context		S_context
 defined		S_defined
@@ -430,3 +431,25 @@ dn		S_dn
 ssh-key		S_ssh_key
 ssh-key-hash	S_ssh_key_hash
 ssh-key-check	S_ssh_key_check
+adaptive-timeout	S_adaptive_timeout
+hedge		S_hedge
+aead		S_aead
+sort-listing	S_sort_listing
+list		S_list
+listing-cache	S_listing_cache
+use-splice	S_usesplice
+write-behind	S_writebehind
+workers		S_workers
+readahead	S_readahead
+high-water	S_highwater
+low-water	S_lowwater
+balance		S_balance
+least-connections	S_leastconnections
+hash		S_hash
+latency		S_latency
+send		S_send
+expect		S_expect
+connect		S_connect
+pool		S_pool
+fast-open	S_fastopen
+ticket		S_ticket
@@ -9,12 +9,14 @@
 #include "mavisd/headers.h"
 #include "misc/memops.h"
 #include "misc/radix.h"
+#include "mavis/av_send.h"
 #include "misc/sysconf.h"
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
 struct socket_info {
     struct blowfish_ctx *blowfish;
+    struct aead_ctx *aead;
     uid_t uid;
     gid_t gid;
     int sock;
@@ -30,6 +32,7 @@ static int init_rcvr(sockaddr_union * su, void *data)
     c->sock = -1;
     c->sock = ((struct socket_info *) data)->sock;
     c->blowfish = ((struct socket_info *) data)->blowfish;
+    c->aead = ((struct socket_info *) data)->aead;
     c->uid = ((struct socket_info *) data)->uid;
     c->gid = ((struct socket_info *) data)->gid;
     c->mode = ((struct socket_info *) data)->mode;
@@ -71,6 +74,7 @@ static int init_rcvr(sockaddr_union * su, void *data)
     io_set_cb_e(io, c->sock, (void *) udp_error);
     io_set_cb_h(io, c->sock, (void *) udp_error);
     io_set_i(io, c->sock);
+    c->sendq = av_sendq_new(io, c->sock);
 
     return 0;
 }
@@ -212,8 +216,11 @@ static void parse_listen(struct sym *sym)
 	    else
 		si.blowfish = NULL;
 	    continue;
+	case S_aead:
+	    si.aead = parse_aead(sym);
+	    continue;
 	default:
-	    parse_error_expect(sym, S_address, S_path, S_port, S_tls, S_userid, S_groupid, S_unknown);
+	    parse_error_expect(sym, S_address, S_path, S_port, S_blowfish, S_aead, S_userid, S_groupid, S_unknown);
 	}
     }
     parse(sym, S_closebra);
@@ -63,6 +63,8 @@ struct context {
     int sock;
     sockaddr_union sa;
     struct blowfish_ctx *blowfish;
+    struct aead_ctx *aead;
+    struct av_sendq *sendq;
     uid_t uid;
     gid_t gid;
     mode_t mode;
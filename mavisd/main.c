@@ -39,6 +39,7 @@ struct query {
     char *serial;
     sockaddr_union sa;
     int fd;
+    int aead;			/* reply with AEAD instead of Blowfish */
     u_int serial_crc;
 };
 
@@ -75,18 +76,23 @@ static void mavis_io(struct context *ctx)
     case MAVIS_TIMEOUT:
 	counter_expired++, counter_p_expired++;
     default:
+	av_free(avc);
 	return;
     }
 
-    if (!(serial = av_get(avc, AV_A_SERIAL)))
+    if (!(serial = av_get(avc, AV_A_SERIAL))) {
+	av_free(avc);
 	return;
+    }
 
     q = alloca(sizeof(struct query));
     q->serial = serial;
     q->serial_crc = crc32_update(INITCRC32, (u_char *) serial, strlen(serial));
 
-    if (!(r = RB_search(deferred_by_serial, q)))
+    if (!(r = RB_search(deferred_by_serial, q))) {
+	av_free(avc);
 	return;
+    }
 
     q = RB_payload(r, struct query *);
 
@@ -97,8 +103,8 @@ static void mavis_io(struct context *ctx)
     }
 
     ctx = io_get_ctx(io, q->fd);
-/* Send answer to client */
-    av_send(avc, q->fd, &q->sa, ctx->blowfish);
+/* Queue answer to client */
+    av_sendq_add(ctx->sendq, avc, &q->sa, q->aead ? NULL : ctx->blowfish, q->aead ? ctx->aead : NULL);
 
 /* Remove query from deferred queue */
     RB_delete(deferred_by_serial, r);
@@ -106,37 +112,46 @@ static void mavis_io(struct context *ctx)
     setproctitle("%s: backlog: %d", common_data.progname, backlog);
 
     counter_answered++, counter_p_answered++;
-    return;
-}				/* if */
+    av_free(avc);
+}
 
-void client_io(struct context *ctx, int cur)
+static void client_query(struct context *ctx, int cur, a_char * buf, ssize_t buflen, sockaddr_union * su)
 {
-/* We have incoming data. */
     char *serial;
     int res;
-    ssize_t buflen;
-    sockaddr_union sa;
-    socklen_t sinlen = (socklen_t) sizeof(sockaddr_union);
+    sockaddr_union sa = *su;
     char *avt;
-    char buf[BUFSIZE_MAVIS];
     av_ctx *avc;
+    int aead = 0;
     static struct query *q = NULL;
+    static a_char *pt = NULL;
 
     if (!q)
 	q = Xcalloc(1, sizeof(struct query));
 
-    Debug((DEBUG_PROC, "client_io\n"));
-
-/* Receive request from client */
-    buflen = recvfrom(cur, buf, sizeof(buf) - 1, 0, &sa.sa, &sinlen);
-    if (buflen <= 0)
-	return;
-
-    buf[buflen] = 0;
-
-/* Decode data, if neccessary */
-    if (ctx->blowfish)
-	blowfish_dec(ctx->blowfish, (a_char *) buf, buflen);
+/*
+ * Decode data, if neccessary. With both AEAD and Blowfish keys configured,
+ * queries that fail authentication are assumed to come from legacy
+ * Blowfish peers.
+ */
+    if (ctx->aead) {
+	ssize_t ptlen;
+	if (!pt)
+	    pt = Xcalloc(1, BUFSIZE_MAVIS + 8);
+	ptlen = aead_open(ctx->aead, (u_char *) pt->s, (u_char *) buf->s, (size_t) buflen);
+	if (ptlen > -1) {
+	    pt->s[ptlen] = 0;
+	    buf = pt;
+	    aead = 1;
+	} else if (!ctx->blowfish) {
+	    char ibuf[INET6_ADDRSTRLEN];
+	    logmsg("Ignoring unauthenticated query from %s", su_ntop(&sa, ibuf, (socklen_t) sizeof(ibuf)));
+	    counter_err++, counter_p_err++;
+	    return;
+	}
+    }
+    if (!aead && ctx->blowfish)
+	blowfish_dec(ctx->blowfish, buf, buflen);
 
 /* Check client IP address */
     res = acl_check(&sa);
@@ -149,7 +164,7 @@ void client_io(struct context *ctx, int cur)
     counter_query++, counter_p_query++;
 
     avc = av_new(NULL, NULL);
-    av_char_to_array(avc, buf, NULL);
+    av_char_to_array(avc, buf->s, NULL);
     serial = av_get(avc, AV_A_SERIAL);
     if (!serial) {
 	char ibuf[INET6_ADDRSTRLEN];
@@ -195,6 +210,7 @@ void client_io(struct context *ctx, int cur)
 	Debug((DEBUG_PROC, "mavis_send yields DEFERRED\n"));
 	q->sa = sa;
 	q->fd = cur;
+	q->aead = aead;
 	q->serial = Xstrdup(serial);
 	RB_insert(deferred_by_serial, q);
 	q = NULL;
@@ -214,13 +230,34 @@ void client_io(struct context *ctx, int cur)
 	    av_unset(avc, AV_A_PASSWORD);
 	    av_unset(avc, AV_A_DBPASSWORD);
 	}
-	av_send(avc, cur, &sa, ctx->blowfish);
+	av_sendq_add(ctx->sendq, avc, &sa, aead ? NULL : ctx->blowfish, aead ? ctx->aead : NULL);
 	counter_answered++, counter_p_answered++;
     }
 
     av_free(avc);
 }
 
+void client_io(struct context *ctx, int cur)
+{
+/* We have incoming data. Process up to AV_RECVQ_MAX queries per wakeup. */
+    static struct av_recvq *recvq = NULL;
+    int i, n;
+
+    Debug((DEBUG_PROC, "client_io\n"));
+
+    if (!recvq)
+	recvq = av_recvq_new();
+
+    n = av_recvq_read(recvq, cur);
+    for (i = 0; i < n; i++) {
+	ssize_t buflen;
+	sockaddr_union *sa;
+	a_char *buf = av_recvq_get(recvq, i, &buflen, &sa);
+	if (buflen > 0)
+	    client_query(ctx, cur, buf, buflen, sa);
+    }
+}
+
 void udp_error(struct context *ctx __attribute__((unused)), int cur)
 {
     /*
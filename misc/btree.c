@@ -0,0 +1,344 @@
+/*
+ * btree.c
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ * All rights reserved.
+ *
+ * Ordered map of 64 bit integer keys to payload pointers, implemented
+ * as a B+tree. Keys are stored inline and compared directly, so a lookup
+ * touches a few nodes of consecutive keys instead of one node and one
+ * payload per level, as with the RB tree. Payloads live in the leaves.
+ *
+ * Iteration is by key: BT_next() returns the payload with the smallest
+ * key larger than the one given, so deleting or inserting elements while
+ * iterating is safe.
+ *
+ * $Id$
+ *
+ */
+
+#include "misc/sysconf.h"
+
+static const char rcsid[] __attribute__((used)) = "$Id$";
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include "misc/memops.h"
+#include "misc/btree.h"
+
+#define BT_MAX 16		/* keys per node */
+#define BT_MIN (BT_MAX / 2)
+
+/*
+ * Leaves hold n keys and n payloads. Inner nodes hold n separator keys
+ * and n + 1 children; child i covers keys below key[i], child i + 1 keys
+ * from key[i] on. One extra slot absorbs the overflow before a split.
+ */
+struct bt_node {
+    int n;
+    int leaf;
+    uint64_t key[BT_MAX + 1];
+    void *ptr[BT_MAX + 2];
+};
+
+struct bt_tree {
+    int count;
+    struct bt_node *root;
+    void (*free)(void *);
+};
+
+#define CHILD(N,I) ((struct bt_node *)(N)->ptr[I])
+
+/* number of keys <= k, i.e. the child to descend into */
+static __inline__ int bt_route(struct bt_node *n, uint64_t k)
+{
+    int i = 0;
+    while (i < n->n && n->key[i] <= k)
+	i++;
+    return i;
+}
+
+/* position of the first key >= k */
+static __inline__ int bt_pos(struct bt_node *n, uint64_t k)
+{
+    int i = 0;
+    while (i < n->n && n->key[i] < k)
+	i++;
+    return i;
+}
+
+static struct bt_node *bt_alloc(int leaf)
+{
+    struct bt_node *n = Xcalloc(1, sizeof(struct bt_node));
+    n->leaf = leaf;
+    return n;
+}
+
+bt_tree_t *BT_tree_new(void (*freepayload)(void *))
+{
+    bt_tree_t *t = Xcalloc(1, sizeof(bt_tree_t));
+    t->root = bt_alloc(1);
+    t->free = freepayload;
+    return t;
+}
+
+/* Splits an overflowing node. Returns the new right sibling. */
+static struct bt_node *bt_split(struct bt_node *n, uint64_t *sep)
+{
+    struct bt_node *r = bt_alloc(n->leaf);
+
+    if (n->leaf) {
+	int m = (n->n + 1) / 2;
+	r->n = n->n - m;
+	memcpy(r->key, n->key + m, r->n * sizeof(uint64_t));
+	memcpy(r->ptr, n->ptr + m, r->n * sizeof(void *));
+	n->n = m;
+	*sep = r->key[0];
+    } else {
+	int m = n->n / 2;
+	r->n = n->n - m - 1;
+	memcpy(r->key, n->key + m + 1, r->n * sizeof(uint64_t));
+	memcpy(r->ptr, n->ptr + m + 1, (r->n + 1) * sizeof(void *));
+	n->n = m;
+	*sep = n->key[m];
+    }
+    return r;
+}
+
+/* 0: inserted, 1: inserted and split, -1: key exists */
+static int bt_insert(struct bt_node *n, uint64_t k, void *payload, uint64_t *sep, struct bt_node **right)
+{
+    int i;
+
+    if (n->leaf) {
+	i = bt_pos(n, k);
+	if (i < n->n && n->key[i] == k)
+	    return -1;
+	memmove(n->key + i + 1, n->key + i, (n->n - i) * sizeof(uint64_t));
+	memmove(n->ptr + i + 1, n->ptr + i, (n->n - i) * sizeof(void *));
+	n->key[i] = k;
+	n->ptr[i] = payload;
+	n->n++;
+    } else {
+	uint64_t s;
+	struct bt_node *r;
+	int res;
+
+	i = bt_route(n, k);
+	res = bt_insert(CHILD(n, i), k, payload, &s, &r);
+	if (res < 1)
+	    return res;
+	memmove(n->key + i + 1, n->key + i, (n->n - i) * sizeof(uint64_t));
+	memmove(n->ptr + i + 2, n->ptr + i + 1, (n->n - i) * sizeof(void *));
+	n->key[i] = s;
+	n->ptr[i + 1] = r;
+	n->n++;
+    }
+
+    if (n->n <= BT_MAX)
+	return 0;
+    *right = bt_split(n, sep);
+    return 1;
+}
+
+/* Returns 0 on success, or -1 if the key is already present. */
+int BT_insert(bt_tree_t * t, uint64_t k, void *payload)
+{
+    uint64_t sep;
+    struct bt_node *right;
+    int res = bt_insert(t->root, k, payload, &sep, &right);
+
+    if (res < 0)
+	return -1;
+    if (res > 0) {
+	struct bt_node *root = bt_alloc(0);
+	root->n = 1;
+	root->key[0] = sep;
+	root->ptr[0] = t->root;
+	root->ptr[1] = right;
+	t->root = root;
+    }
+    t->count++;
+    return 0;
+}
+
+void *BT_lookup(bt_tree_t * t, uint64_t k)
+{
+    struct bt_node *n = t->root;
+    int i;
+
+    while (!n->leaf)
+	n = CHILD(n, bt_route(n, k));
+    i = bt_pos(n, k);
+    if (i < n->n && n->key[i] == k)
+	return n->ptr[i];
+    return NULL;
+}
+
+/* Child i of n has fallen below BT_MIN keys: borrow from a sibling or merge. */
+static void bt_fix(struct bt_node *n, int i)
+{
+    struct bt_node *c = CHILD(n, i);
+    struct bt_node *l = i > 0 ? CHILD(n, i - 1) : NULL;
+    struct bt_node *r = i < n->n ? CHILD(n, i + 1) : NULL;
+
+    if (l && l->n > BT_MIN) {
+	memmove(c->key + 1, c->key, c->n * sizeof(uint64_t));
+	memmove(c->ptr + 1, c->ptr, (c->n + !c->leaf) * sizeof(void *));
+	if (c->leaf) {
+	    c->key[0] = l->key[l->n - 1];
+	    c->ptr[0] = l->ptr[l->n - 1];
+	    n->key[i - 1] = c->key[0];
+	} else {
+	    c->key[0] = n->key[i - 1];
+	    c->ptr[0] = l->ptr[l->n];
+	    n->key[i - 1] = l->key[l->n - 1];
+	}
+	c->n++;
+	l->n--;
+	return;
+    }
+
+    if (r && r->n > BT_MIN) {
+	if (c->leaf) {
+	    c->key[c->n] = r->key[0];
+	    c->ptr[c->n] = r->ptr[0];
+	    memmove(r->key, r->key + 1, (r->n - 1) * sizeof(uint64_t));
+	    memmove(r->ptr, r->ptr + 1, (r->n - 1) * sizeof(void *));
+	    n->key[i] = r->key[0];
+	} else {
+	    c->key[c->n] = n->key[i];
+	    c->ptr[c->n + 1] = r->ptr[0];
+	    n->key[i] = r->key[0];
+	    memmove(r->key, r->key + 1, (r->n - 1) * sizeof(uint64_t));
+	    memmove(r->ptr, r->ptr + 1, r->n * sizeof(void *));
+	}
+	c->n++;
+	r->n--;
+	return;
+    }
+
+    /* merge child j + 1 into child j */
+    if (!r)
+	i--, r = c, c = l;
+
+    if (c->leaf) {
+	memcpy(c->key + c->n, r->key, r->n * sizeof(uint64_t));
+	memcpy(c->ptr + c->n, r->ptr, r->n * sizeof(void *));
+	c->n += r->n;
+    } else {
+	c->key[c->n] = n->key[i];
+	memcpy(c->key + c->n + 1, r->key, r->n * sizeof(uint64_t));
+	memcpy(c->ptr + c->n + 1, r->ptr, (r->n + 1) * sizeof(void *));
+	c->n += r->n + 1;
+    }
+    free(r);
+
+    memmove(n->key + i, n->key + i + 1, (n->n - i - 1) * sizeof(uint64_t));
+    memmove(n->ptr + i + 1, n->ptr + i + 2, (n->n - i - 1) * sizeof(void *));
+    n->n--;
+}
+
+static void *bt_delete(struct bt_node *n, uint64_t k)
+{
+    void *payload = NULL;
+    int i;
+
+    if (n->leaf) {
+	i = bt_pos(n, k);
+	if (i < n->n && n->key[i] == k) {
+	    payload = n->ptr[i];
+	    memmove(n->key + i, n->key + i + 1, (n->n - i - 1) * sizeof(uint64_t));
+	    memmove(n->ptr + i, n->ptr + i + 1, (n->n - i - 1) * sizeof(void *));
+	    n->n--;
+	}
+	return payload;
+    }
+
+    i = bt_route(n, k);
+    payload = bt_delete(CHILD(n, i), k);
+    if (payload && CHILD(n, i)->n < BT_MIN)
+	bt_fix(n, i);
+    return payload;
+}
+
+/* Removes k from the tree and returns its payload, or NULL. */
+void *BT_delete(bt_tree_t * t, uint64_t k)
+{
+    void *payload = bt_delete(t->root, k);
+
+    if (payload) {
+	t->count--;
+	if (!t->root->leaf && !t->root->n) {
+	    struct bt_node *n = t->root;
+	    t->root = CHILD(n, 0);
+	    free(n);
+	}
+    }
+    return payload;
+}
+
+void *BT_first(bt_tree_t * t, uint64_t *k)
+{
+    struct bt_node *n = t->root;
+
+    while (!n->leaf)
+	n = CHILD(n, 0);
+    if (!n->n)
+	return NULL;
+    *k = n->key[0];
+    return n->ptr[0];
+}
+
+/* Returns the payload with the smallest key larger than *k, and sets *k. */
+void *BT_next(bt_tree_t * t, uint64_t *k)
+{
+    struct bt_node *n = t->root, *up = NULL;
+    int i;
+
+    while (!n->leaf) {
+	i = bt_route(n, *k);
+	/* all keys right of this child are larger than *k */
+	if (i < n->n)
+	    up = CHILD(n, i + 1);
+	n = CHILD(n, i);
+    }
+
+    i = bt_route(n, *k);
+    if (i == n->n) {
+	if (!up)
+	    return NULL;
+	for (n = up; !n->leaf; n = CHILD(n, 0));
+	i = 0;
+    }
+    *k = n->key[i];
+    return n->ptr[i];
+}
+
+int BT_count(bt_tree_t * t)
+{
+    return t->count;
+}
+
+static void bt_tree_delete(bt_tree_t * t, struct bt_node *n)
+{
+    int i;
+
+    if (n->leaf) {
+	if (t->free)
+	    for (i = 0; i < n->n; i++)
+		t->free(n->ptr[i]);
+    } else
+	for (i = 0; i <= n->n; i++)
+	    bt_tree_delete(t, CHILD(n, i));
+    free(n);
+}
+
+void BT_tree_delete(bt_tree_t * t)
+{
+    if (t) {
+	bt_tree_delete(t, t->root);
+	free(t);
+    }
+}
@@ -0,0 +1,27 @@
+/*
+ * btree.h
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ *
+ * $Id$
+ *
+ */
+
+#ifndef __BTREE_H__
+#define __BTREE_H__
+#include <sys/types.h>
+#include <stdint.h>
+#include "misc/sysconf.h"
+
+struct bt_tree;
+typedef struct bt_tree bt_tree_t;
+
+bt_tree_t *BT_tree_new(void (*)(void *));
+int BT_insert(bt_tree_t *, uint64_t, void *);
+void *BT_lookup(bt_tree_t *, uint64_t);
+void *BT_delete(bt_tree_t *, uint64_t);
+void *BT_first(bt_tree_t *, uint64_t *);
+void *BT_next(bt_tree_t *, uint64_t *);
+int BT_count(bt_tree_t *);
+void BT_tree_delete(bt_tree_t *);
+
+#endif				/* __BTREE_H__ */
@@ -46,7 +46,7 @@ struct buffer *buffer_free(struct buffer *b)
 	next = b->next;
 #ifdef WITH_MMAP
 	if (b->mmapped) {
-	    if (b->buf != MAP_FAILED) {
+	    if (b->buf != MAP_FAILED && b->mmapped != BUFFER_MMAP_SHARED) {
 		munmap(b->buf, b->size);
 		b->buf = MAP_FAILED;
 	    }
@@ -147,11 +147,11 @@ void buffer_sequential(struct buffer *b, size_t len)
 	Debug((DEBUG_BUFFER, "  sequential %d\n", (int) len));
 	if (len >= b->length - b->offset) {
 	    len -= b->length - b->offset;
-	    if (b->mmapped)
+	    if (b->mmapped == 1)
 		madvise(b->buf, b->length, MADV_SEQUENTIAL);
 	    b = b->next;
 	} else {
-	    if (b->mmapped)
+	    if (b->mmapped == 1)
 		madvise(b->buf, len, MADV_SEQUENTIAL);
 	    len = 0;
 	}
@@ -163,7 +163,7 @@ void buffer_sequential_all(struct buffer *b)
     Debug((DEBUG_BUFFER, "sequential_all\n"));
     for (; b; b = b->next) {
 	Debug((DEBUG_BUFFER, "b=%p next=%p\n", b, b->next));
-	if (b->mmapped)
+	if (b->mmapped == 1)
 	    madvise(b->buf, b->size, MADV_SEQUENTIAL);
     }
 }
@@ -179,7 +179,7 @@ struct buffer *buffer_release(struct buffer *b, off_t * len)
 	} else {
 	    b->offset += (size_t) (*len);
 #ifdef WITH_MMAP
-	    if (b->mmapped)
+	    if (b->mmapped == 1)
 		madvise(b->buf, b->offset, MADV_DONTNEED);
 #endif				/* WITH_MMAP */
 	    *len = 0;
@@ -24,6 +24,8 @@ struct buffer {
     int mmapped;
 };
 
+#define BUFFER_MMAP_SHARED 2	/* refers to a mapping owned elsewhere */
+
 struct buffer *buffer_get(void);
 struct buffer *buffer_free(struct buffer *);
 struct buffer *buffer_free_all(struct buffer *);
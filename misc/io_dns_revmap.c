@@ -1,56 +1,622 @@
 /*
  * io_dns_revmap.c
- * (C) 2002-2011 Marc Huber <Marc.Huber@web.de>
+ * (C) 2002-2026 Marc Huber <Marc.Huber@web.de>
+ *
+ * Non-blocking DNS stub resolver for PTR, A and AAAA lookups. Queries go
+ * to the name servers from /etc/resolv.conf. Every try uses a fresh UDP
+ * socket, so the kernel picks a random source port, and a random DNS id,
+ * which makes off-path spoofing expensive. Truncated answers are retried
+ * over TCP. Answers, including negative ones, are cached for their TTL,
+ * and concurrent lookups for the same name share a single query.
+ *
+ * Cached answers are delivered before io_dns_add() returns, everything
+ * else via the io context.
  *
  */
 
 #include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
 #include "misc/sysconf.h"
+#ifdef WITH_GETRANDOM
+#include <sys/random.h>
+#endif
 #include "misc/io_dns_revmap.h"
 #include "misc/rb.h"
+#include "misc/btree.h"
 #include "misc/net.h"
 #include "misc/memops.h"
 
-#include <lwres/lwres.h>
+#define DNS_RESOLV_CONF "/etc/resolv.conf"
+#define DNS_PORT 53
+#define DNS_MAXSERVERS 3
+#define DNS_TIMEOUT 2		/* seconds per try */
+#define DNS_ATTEMPTS 2		/* rounds over all servers */
+#define DNS_TTL_MAX 86400
+#define DNS_TTL_NEG 300		/* for negative answers without SOA */
+#define DNS_TTL_FAIL 30		/* for server failures and timeouts */
+#define DNS_CACHE_MAX 65536
+#define DNS_SWEEP 60		/* seconds between cache expiry runs */
+#define DNS_UDP_SIZE 1232	/* EDNS0 payload size */
+#define DNS_HDR 12
+#define DNS_NAME_MAX 255
+#define DNS_CNAME 5
+#define DNS_CNAME_MAX 8		/* chain length */
+
+#ifndef MIN
+#define MIN(A,B) ((A) < (B) ? (A) : (B))
+#endif
+
+struct dns_server {
+    sockaddr_union sa;
+};
+
+struct dns_cache {
+    char *qname;		/* key, lower case */
+    int type;			/* key */
+    time_t expires;
+    char *name;			/* PTR answer */
+    struct in6_addr *a;		/* A/AAAA answers, host byte order */
+    int a_count;
+};
+
+struct dns_query;
 
-struct io_dns_item {
+struct dns_waiter {
     void *app_cb;
     void *app_ctx;
-    uint32_t serial;
+    int type;
+    struct dns_query *q;
+    struct dns_waiter *next;	/* same query */
+    struct dns_waiter *ctx_next;	/* same app_ctx */
+};
+
+struct dns_query {
+    char *qname;		/* key, lower case */
+    int type;			/* key */
+    uint16_t id;
+    int server;
+    int tries;
+    int udp;			/* socket of the current try, or -1 */
+    int tcp;			/* TCP fallback socket, or -1 */
+    u_char *tcp_buf;
+    size_t tcp_len;
+    size_t tcp_off;
+    u_char pkt[DNS_NAME_MAX + DNS_HDR + 16];
+    size_t pkt_len;
+    struct dns_waiter *waiters;
+    struct io_dns_ctx *idc;
 };
 
 struct io_dns_ctx {
     struct io_context *io;
-    rb_tree_t *by_serial;
-    rb_tree_t *by_app_ctx;
-    lwres_context_t *ctx;
-    int registered;
+    struct dns_server server[DNS_MAXSERVERS];
+    int servers;
+    int timeout;
+    int attempts;
+    rb_tree_t *queries;		/* outstanding queries, by type and name */
+    rb_tree_t *cache;		/* answers, by type and name */
+    bt_tree_t *by_app_ctx;	/* waiter chains */
 };
 
-static int idi_cmp_serial(const void *v1, const void *v2)
+/* struct dns_query and struct dns_cache both start with qname and type */
+static int cmp_key(const void *a, const void *b)
 {
-    if (((struct io_dns_item *) v1)->serial < ((struct io_dns_item *) v2)->serial)
-	return -1;
-    if (((struct io_dns_item *) v1)->serial > ((struct io_dns_item *) v2)->serial)
-	return +1;
+    const struct dns_cache *x = (const struct dns_cache *) a, *y = (const struct dns_cache *) b;
+    if (x->type != y->type)
+	return x->type - y->type;
+    return strcmp(x->qname, y->qname);
+}
+
+static void free_cache(void *v)
+{
+    struct dns_cache *c = (struct dns_cache *) v;
+    free(c->qname);
+    free(c->name);
+    free(c->a);
+    free(c);
+}
+
+static uint16_t dns_id(void)
+{
+    uint16_t id;
+#if defined(WITH_ARC4RANDOM)
+    arc4random_buf(&id, sizeof(id));
+#else
+#if defined(WITH_GETRANDOM)
+    if (getrandom(&id, sizeof(id), 0) != (ssize_t) sizeof(id))
+#endif
+    {
+	int fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0 || read(fd, &id, sizeof(id)) != (ssize_t) sizeof(id))
+	    id = (uint16_t) (io_now.tv_usec ^ getpid());
+	if (fd > -1)
+	    close(fd);
+    }
+#endif
+    return id;
+}
+
+static void read_resolv_conf(struct io_dns_ctx *idc)
+{
+    char buf[512];
+    FILE *f = fopen(DNS_RESOLV_CONF, "r");
+
+    if (f) {
+	while (fgets(buf, (int) sizeof(buf), f)) {
+	    char *t, *v = strtok(buf, " \t\r\n");
+	    if (!v)
+		continue;
+	    if (!strcmp(v, "nameserver") && (v = strtok(NULL, " \t\r\n")) && idc->servers < DNS_MAXSERVERS) {
+		if ((t = strchr(v, '%')))
+		    *t = 0;	/* scope ids aren't supported */
+		if (!su_pton_p(&idc->server[idc->servers].sa, v, DNS_PORT))
+		    idc->servers++;
+	    } else if (!strcmp(v, "options"))
+		while ((v = strtok(NULL, " \t\r\n"))) {
+		    if (!strncmp(v, "timeout:", 8) && atoi(v + 8) > 0)
+			idc->timeout = atoi(v + 8);
+		    else if (!strncmp(v, "attempts:", 9) && atoi(v + 9) > 0)
+			idc->attempts = atoi(v + 9);
+		}
+	}
+	fclose(f);
+    }
+
+    if (!idc->servers && !su_pton_p(&idc->server[0].sa, "127.0.0.1", DNS_PORT))
+	idc->servers = 1;
+}
+
+static void dns_sweep(struct io_dns_ctx *idc, int cur __attribute__((unused)))
+{
+    rb_node_t *rbn, *next;
+
+    io_sched_renew_proc(idc->io, idc, (void *) dns_sweep);
+
+    for (rbn = RB_first(idc->cache); rbn; rbn = next) {
+	next = RB_next(rbn);
+	if (RB_payload(rbn, struct dns_cache *)->expires <= io_now.tv_sec)
+	    RB_delete(idc->cache, rbn);
+    }
+}
+
+struct io_dns_ctx *io_dns_init(struct io_context *io)
+{
+    struct io_dns_ctx *idc = Xcalloc(1, sizeof(struct io_dns_ctx));
+
+    idc->io = io;
+    idc->timeout = DNS_TIMEOUT;
+    idc->attempts = DNS_ATTEMPTS;
+    read_resolv_conf(idc);
+    idc->queries = RB_tree_new(cmp_key, NULL);
+    idc->cache = RB_tree_new(cmp_key, free_cache);
+    idc->by_app_ctx = BT_tree_new(NULL);
+    io_sched_add(io, idc, (void *) dns_sweep, DNS_SWEEP, 0);
+    return idc;
+}
+
+/*
+ * Writes name in DNS wire format to p. Returns the length, or 0 if name
+ * isn't valid.
+ */
+static size_t encode_name(u_char *p, char *name)
+{
+    u_char *start = p;
+
+    while (*name) {
+	char *dot = strchr(name, '.');
+	size_t l = dot ? (size_t) (dot - name) : strlen(name);
+	if (l < 1 || l > 63 || (size_t) (p - start) + l + 2 > DNS_NAME_MAX)
+	    return 0;
+	*p++ = (u_char) l;
+	memcpy(p, name, l);
+	p += l;
+	name += l;
+	if (*name)
+	    name++;
+    }
+    *p++ = 0;
+    return (size_t) (p - start);
+}
+
+/*
+ * Reads a possibly compressed name at offset *off of msg into name (if
+ * not NULL) and advances *off past it. Returns -1 on malformed input, or
+ * if a label of a name to be returned has anything but letters, digits,
+ * hyphens or underscores in it. Those names end up in logs and ACLs.
+ */
+static int decode_name(u_char *msg, size_t len, size_t *off, char *name)
+{
+    size_t o = *off, n = 0;
+    int jumps = 0, jumped = 0;
+
+    while (1) {
+	u_int l;
+	if (o >= len)
+	    return -1;
+	l = msg[o];
+	if ((l & 0xc0) == 0xc0) {
+	    if (o + 1 >= len || ++jumps > 16)
+		return -1;
+	    if (!jumped)
+		*off = o + 2;
+	    jumped = 1;
+	    o = ((l & 0x3f) << 8) | msg[o + 1];
+	    continue;
+	}
+	if (l & 0xc0)
+	    return -1;
+	o++;
+	if (!l)
+	    break;
+	if (o + l > len || n + l + 1 > DNS_NAME_MAX)
+	    return -1;
+	if (name) {
+	    u_int i;
+	    for (i = 0; i < l; i++)
+		if (!isalnum(msg[o + i]) && msg[o + i] != '-' && msg[o + i] != '_')
+		    return -1;
+	    if (n)
+		name[n++] = '.';
+	    memcpy(name + n, msg + o, l);
+	} else if (n)
+	    n++;
+	n += l;
+	o += l;
+    }
+    if (name)
+	name[n] = 0;
+    if (!jumped)
+	*off = o;
     return 0;
 }
 
-static int idi_cmp_app_ctx(const void *v1, const void *v2)
+static uint16_t get16(u_char *p)
+{
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(u_char *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static void put16(u_char *p, uint16_t v)
 {
-    if (((struct io_dns_item *) v1)->app_ctx < ((struct io_dns_item *) v2)->app_ctx)
+    p[0] = (u_char) (v >> 8);
+    p[1] = (u_char) v;
+}
+
+/*
+ * Reads owner name (if name isn't NULL), type, TTL and data length of the
+ * resource record at *off and advances *off to its data. Returns -1 on
+ * malformed input.
+ */
+static int decode_rr(u_char *msg, size_t len, size_t *off, char *name, uint16_t *type, uint32_t *ttl, uint16_t *rdlen)
+{
+    if (decode_name(msg, len, off, name) || *off + 10 > len)
 	return -1;
-    if (((struct io_dns_item *) v1)->app_ctx > ((struct io_dns_item *) v2)->app_ctx)
-	return +1;
+    *type = get16(msg + *off);
+    *ttl = get32(msg + *off + 4);
+    *rdlen = get16(msg + *off + 8);
+    *off += 10;
+    return *off + *rdlen > len ? -1 : 0;
+}
+
+static void waiter_unlink_ctx(struct io_dns_ctx *idc, struct dns_waiter *w)
+{
+    uint64_t key = (uint64_t) (uintptr_t) w->app_ctx;
+    struct dns_waiter *head = BT_lookup(idc->by_app_ctx, key);
+
+    if (head == w) {
+	BT_delete(idc->by_app_ctx, key);
+	if (w->ctx_next)
+	    BT_insert(idc->by_app_ctx, key, w->ctx_next);
+    } else
+	for (; head; head = head->ctx_next)
+	    if (head->ctx_next == w) {
+		head->ctx_next = w->ctx_next;
+		break;
+	    }
+}
+
+/* c is NULL or a negative answer if the lookup failed */
+static void deliver(struct dns_waiter *w, struct dns_cache *c)
+{
+    if (c && !c->name && !c->a_count)
+	c = NULL;
+    if (w->type == IO_DNS_PTR)
+	((void (*)(void *, char *)) w->app_cb) (w->app_ctx, c ? c->name : NULL);
+    else
+	((void (*)(void *, struct in6_addr *, int)) w->app_cb) (w->app_ctx, c ? c->a : NULL, c ? c->a_count : 0);
+}
+
+static void query_close_udp(struct dns_query *q)
+{
+    if (q->udp > -1) {
+	io_close(q->idc->io, q->udp);
+	q->udp = -1;
+    }
+}
+
+static void query_close_tcp(struct dns_query *q)
+{
+    if (q->tcp > -1) {
+	io_close(q->idc->io, q->tcp);
+	q->tcp = -1;
+    }
+    free(q->tcp_buf);
+    q->tcp_buf = NULL;
+}
+
+/* Caches the answer (c may be NULL) and hands it to all waiters. */
+static void query_done(struct dns_query *q, struct dns_cache *c)
+{
+    struct io_dns_ctx *idc = q->idc;
+    struct dns_waiter *w;
+
+    while (io_sched_pop(idc->io, q));
+    query_close_udp(q);
+    query_close_tcp(q);
+    RB_search_and_delete(idc->queries, q);
+
+    if (c) {
+	RB_search_and_delete(idc->cache, c);
+	if (RB_count(idc->cache) < DNS_CACHE_MAX)
+	    RB_insert(idc->cache, c);
+    }
+
+    /* callbacks may cancel other waiters of this query */
+    while ((w = q->waiters)) {
+	q->waiters = w->next;
+	waiter_unlink_ctx(idc, w);
+	deliver(w, c);
+	free(w);
+    }
+
+    if (c && !RB_lookup(idc->cache, c))
+	free_cache(c);
+    free(q->qname);
+    free(q);
+}
+
+static struct dns_cache *cache_new(struct dns_query *q, uint32_t ttl)
+{
+    struct dns_cache *c = Xcalloc(1, sizeof(struct dns_cache));
+    c->qname = Xstrdup(q->qname);
+    c->type = q->type;
+    c->expires = io_now.tv_sec + (time_t) (ttl > DNS_TTL_MAX ? DNS_TTL_MAX : ttl);
+    return c;
+}
+
+static void query_send(struct dns_query *);
+
+/* Try the next server, or give up. */
+static void query_retry(struct dns_query *q, int cur __attribute__((unused)))
+{
+    struct io_dns_ctx *idc = q->idc;
+
+    while (io_sched_pop(idc->io, q));
+    query_close_tcp(q);
+
+    if (++q->tries < idc->servers * idc->attempts) {
+	q->server = (q->server + 1) % idc->servers;
+	query_send(q);
+    } else
+	query_done(q, cache_new(q, DNS_TTL_FAIL));
+}
+
+/*
+ * Parses a response to q. Returns 1 if truncated, 0 otherwise. Only
+ * answers for qname, or for the end of the CNAME chain starting there,
+ * are accepted.
+ */
+static int parse_answer(struct dns_query *q, u_char *msg, size_t len)
+{
+    char name[DNS_NAME_MAX + 1], owner[DNS_NAME_MAX + 1], target[DNS_NAME_MAX + 1];
+    size_t off = DNS_HDR, an_off;
+    uint16_t flags, qd, an, ns, i, type, rdlen;
+    uint32_t rttl;
+    int hops;
+    uint32_t ttl = DNS_TTL_MAX, neg_ttl = DNS_TTL_NEG;
+    struct dns_cache *c;
+    int rcode;
+
+    if (len < DNS_HDR)
+	return 0;
+    flags = get16(msg + 2);
+    qd = get16(msg + 4);
+    an = get16(msg + 6);
+    ns = get16(msg + 8);
+
+    /* response to our question? */
+    if (!(flags & 0x8000) || qd != 1 || decode_name(msg, len, &off, name) || off + 4 > len || strcasecmp(name, q->qname)
+	|| get16(msg + off) != q->type || get16(msg + off + 2) != 1)
+	return 0;
+    off += 4;
+
+    if (flags & 0x0200)
+	return 1;
+
+    rcode = flags & 0xf;
+    if (rcode != 0 && rcode != 3) {
+	query_retry(q, -1);
+	return 0;
+    }
+
+    c = cache_new(q, 0);
+
+    /* follow the CNAME chain, its records may come in any order */
+    an_off = off;
+    strcpy(name, q->qname);
+    for (hops = 0; hops < DNS_CNAME_MAX; hops++) {
+	int found = 0;
+	off = an_off;
+	for (i = 0; i < an && !found && !decode_rr(msg, len, &off, owner, &type, &rttl, &rdlen); i++) {
+	    size_t o = off;
+	    if (type == DNS_CNAME && get16(msg + off - 8) == 1 && !strcasecmp(owner, name)
+		&& !decode_name(msg, len, &o, target) && *target) {
+		strcpy(name, target);
+		ttl = MIN(ttl, rttl);
+		found = 1;
+	    }
+	    off += rdlen;
+	}
+	if (!found)
+	    break;
+    }
+
+    off = an_off;
+    for (i = 0; i < an + ns; i++) {
+	if (decode_rr(msg, len, &off, owner, &type, &rttl, &rdlen))
+	    break;
+
+	if (i < an && type == q->type && get16(msg + off - 8) == 1 && !strcasecmp(owner, name)) {
+	    if (type == IO_DNS_PTR && !c->name) {
+		size_t o = off;
+		if (!decode_name(msg, len, &o, target) && *target) {
+		    c->name = Xstrdup(target);
+		    ttl = MIN(ttl, rttl);
+		}
+	    } else if ((type == IO_DNS_A && rdlen == 4) || (type == IO_DNS_AAAA && rdlen == 16)) {
+		struct in6_addr *a;
+		c->a = Xrealloc(c->a, (c->a_count + 1) * sizeof(struct in6_addr));
+		a = &c->a[c->a_count++];
+		memset(a, 0, sizeof(struct in6_addr));
+		if (type == IO_DNS_A) {
+		    a->s6_addr32[2] = 0x0000FFFF;
+		    a->s6_addr32[3] = get32(msg + off);
+		} else {
+		    int j;
+		    for (j = 0; j < 4; j++)
+			a->s6_addr32[j] = get32(msg + off + 4 * j);
+		}
+		ttl = MIN(ttl, rttl);
+	    }
+	} else if (i >= an && type == 6) {
+	    /* negative TTL from SOA, RFC 2308 */
+	    size_t o = off;
+	    if (!decode_name(msg, len, &o, NULL) && !decode_name(msg, len, &o, NULL) && o + 20 <= off + rdlen)
+		neg_ttl = MIN(rttl, get32(msg + o + 16));
+	}
+	off += rdlen;
+    }
+
+    if (!c->name && !c->a_count)
+	ttl = neg_ttl;
+    c->expires = io_now.tv_sec + (time_t) MIN(ttl, DNS_TTL_MAX);
+    query_done(q, c);
     return 0;
 }
 
-static void free_payload(void *v)
+static void tcp_read(struct dns_query *q, int cur)
+{
+    ssize_t l;
+
+    if (!q->tcp_buf) {
+	u_char h[2];
+	l = recv(cur, h, 2, MSG_PEEK);
+	if (l < 0 && errno == EAGAIN)
+	    return;
+	if (l < 2) {
+	    if (l == 1)
+		return;
+	    query_retry(q, -1);
+	    return;
+	}
+	if (recv(cur, h, 2, 0) != 2) {
+	    query_retry(q, -1);
+	    return;
+	}
+	q->tcp_len = get16(h);
+	q->tcp_off = 0;
+	q->tcp_buf = Xcalloc(1, q->tcp_len + 1);
+    }
+
+    l = recv(cur, q->tcp_buf + q->tcp_off, q->tcp_len - q->tcp_off, 0);
+    if (l < 0 && errno == EAGAIN)
+	return;
+    if (l <= 0) {
+	query_retry(q, -1);
+	return;
+    }
+    q->tcp_off += (size_t) l;
+    if (q->tcp_off == q->tcp_len) {
+	u_char *buf = q->tcp_buf;
+	size_t len = q->tcp_len;
+	q->tcp_buf = NULL;
+	if (len < 2 || get16(buf) != q->id || parse_answer(q, buf, len))
+	    query_retry(q, -1);
+	free(buf);
+    }
+}
+
+static void tcp_write(struct dns_query *q, int cur)
+{
+    u_char buf[sizeof(q->pkt) + 2];
+
+    put16(buf, (uint16_t) q->pkt_len);
+    memcpy(buf + 2, q->pkt, q->pkt_len);
+
+    /* the query is small enough to fit into an empty send buffer */
+    if (send(cur, buf, q->pkt_len + 2, 0) != (ssize_t) (q->pkt_len + 2)) {
+	query_retry(q, -1);
+	return;
+    }
+    io_clr_o(q->idc->io, cur);
+    io_set_cb_i(q->idc->io, cur, (void *) tcp_read);
+    io_set_i(q->idc->io, cur);
+}
+
+static void tcp_error(struct dns_query *q, int cur __attribute__((unused)))
 {
-    free(v);
+    query_retry(q, -1);
 }
 
-static void io_dns_cb(struct io_dns_ctx *, int);
+static void query_tcp(struct dns_query *q, int server)
+{
+    struct io_dns_ctx *idc = q->idc;
+    sockaddr_union *sa = &idc->server[server].sa;
+    int s = su_socket(sa->sa.sa_family, SOCK_STREAM, 0);
+
+    while (io_sched_pop(idc->io, q));
+    query_close_udp(q);
+    query_close_tcp(q);
+    q->server = server;
+
+    if (s < 0 || (su_connect(s, &idc->server[server].sa) < 0 && errno != EINPROGRESS)) {
+	if (s > -1)
+	    close(s);
+	query_retry(q, -1);
+	return;
+    }
+    q->tcp = s;
+    io_register(idc->io, s, q);
+    io_set_cb_o(idc->io, s, (void *) tcp_write);
+    io_set_cb_e(idc->io, s, (void *) tcp_error);
+    io_set_cb_h(idc->io, s, (void *) tcp_error);
+    io_set_o(idc->io, s);
+    io_sched_add(idc->io, q, (void *) query_retry, (time_t) idc->timeout, 0);
+}
+
+static void udp_read(struct dns_query *q, int cur)
+{
+    u_char msg[DNS_UDP_SIZE + 1];
+    ssize_t l;
+
+    while ((l = recv(cur, msg, sizeof(msg), 0)) >= 0)
+	if (l >= DNS_HDR && get16(msg) == q->id) {
+	    /* q may be gone afterwards */
+	    if (parse_answer(q, msg, (size_t) l))
+		query_tcp(q, q->server);
+	    return;
+	}
+}
 
 static void udp_error(void *ctx __attribute__((unused)), int cur)
 {
@@ -59,56 +625,142 @@ static void udp_error(void *ctx __attribute__((unused)), int cur)
     getsockopt(cur, SOL_SOCKET, SO_ERROR, (char *) &sockerr, &sockerrlen);
 }
 
-static void lwres_register(struct io_dns_ctx *idc)
+static void query_send(struct dns_query *q)
 {
-    int s = lwres_context_getsocket(idc->ctx);
+    struct io_dns_ctx *idc = q->idc;
+    struct dns_server *srv = &idc->server[q->server];
+    int s;
+
+    query_close_udp(q);
+    q->id = dns_id();
+    put16(q->pkt, q->id);
 
-    if (s > -1) {
-	io_register(idc->io, s, idc);
-	io_set_cb_i(idc->io, s, (void *) io_dns_cb);
-	io_set_cb_h(idc->io, s, (void *) udp_error);
-	io_set_cb_e(idc->io, s, (void *) udp_error);
-	io_clr_o(idc->io, s);
-	io_set_i(idc->io, s);
-	idc->registered = 1;
+    /* send errors are treated like timeouts */
+    if ((s = su_socket(srv->sa.sa.sa_family, SOCK_DGRAM, 0)) > -1) {
+	if (su_connect(s, &srv->sa) < 0)
+	    close(s);
+	else {
+	    q->udp = s;
+	    io_register(idc->io, s, q);
+	    io_set_cb_i(idc->io, s, (void *) udp_read);
+	    io_set_cb_h(idc->io, s, (void *) udp_error);
+	    io_set_cb_e(idc->io, s, (void *) udp_error);
+	    io_clr_o(idc->io, s);
+	    io_set_i(idc->io, s);
+	    send(s, q->pkt, q->pkt_len, 0);
+	}
     }
+    io_sched_add(idc->io, q, (void *) query_retry, (time_t) idc->timeout, 0);
 }
 
-struct io_dns_ctx *io_dns_init(struct io_context *io)
+void io_dns_add_name(struct io_dns_ctx *idc, char *name, int type, void *app_cb, void *app_ctx)
 {
-    struct io_dns_ctx *idc = Xcalloc(1, sizeof(struct io_dns_ctx));
-    if (LWRES_R_SUCCESS == lwres_context_create(&idc->ctx, NULL, NULL, NULL, 0)) {
-	idc->io = io;
-	idc->by_serial = RB_tree_new(idi_cmp_serial, NULL);
-	idc->by_app_ctx = RB_tree_new(idi_cmp_app_ctx, free_payload);
-	lwres_register(idc);
-    } else {
-	free(idc);
-	idc = NULL;
+    struct dns_cache k, *c;
+    struct dns_query *q;
+    struct dns_waiter *w;
+    char qname[DNS_NAME_MAX + 1];
+    size_t i, l = strlen(name);
+    u_char *p;
+
+    w = Xcalloc(1, sizeof(struct dns_waiter));
+    w->app_cb = app_cb;
+    w->app_ctx = app_ctx;
+    w->type = type;
+
+    if (l && name[l - 1] == '.')
+	l--;
+    if (l > DNS_NAME_MAX - 2) {
+	deliver(w, NULL);
+	free(w);
+	return;
     }
-    return idc;
-}
+    for (i = 0; i < l; i++)
+	qname[i] = tolower((u_char) name[i]);
+    qname[l] = 0;
 
-void io_dns_cancel(struct io_dns_ctx *idc, void *app_ctx)
-{
-    struct io_dns_item i;
-    rb_node_t *r;
-    i.app_ctx = app_ctx;
-    if ((r = RB_search(idc->by_app_ctx, &i))) {
-	RB_search_and_delete(idc->by_serial, RB_payload(r, void *));
-	RB_delete(idc->by_app_ctx, r);
+    k.qname = qname;
+    k.type = type;
+
+    if ((c = RB_lookup(idc->cache, &k))) {
+	if (c->expires > io_now.tv_sec) {
+	    deliver(w, c);
+	    free(w);
+	    return;
+	}
+	RB_search_and_delete(idc->cache, c);
+    }
+
+    if (!(q = RB_lookup(idc->queries, &k))) {
+	q = Xcalloc(1, sizeof(struct dns_query));
+	q->qname = Xstrdup(qname);
+	q->type = type;
+	q->idc = idc;
+	q->udp = -1;
+	q->tcp = -1;
+
+	p = q->pkt;
+	put16(p + 2, 0x0100);	/* recursion desired */
+	put16(p + 4, 1);
+	put16(p + 6, 0);
+	put16(p + 8, 0);
+	put16(p + 10, 1);
+	p += DNS_HDR;
+	if (!(l = encode_name(p, qname))) {
+	    free(q->qname);
+	    free(q);
+	    deliver(w, NULL);
+	    free(w);
+	    return;
+	}
+	p += l;
+	put16(p, (uint16_t) type);
+	put16(p + 2, 1);
+	p += 4;
+	/* EDNS0 OPT record */
+	*p++ = 0;
+	put16(p, 41);
+	put16(p + 2, DNS_UDP_SIZE);
+	memset(p + 4, 0, 6);
+	p += 10;
+	q->pkt_len = (size_t) (p - q->pkt);
+
+	RB_insert(idc->queries, q);
+	query_send(q);
     }
+
+    w->q = q;
+    w->next = q->waiters;
+    q->waiters = w;
+    w->ctx_next = BT_delete(idc->by_app_ctx, (uint64_t) (uintptr_t) app_ctx);
+    BT_insert(idc->by_app_ctx, (uint64_t) (uintptr_t) app_ctx, w);
 }
 
-void io_dns_destroy(struct io_dns_ctx *idc)
+void io_dns_add(struct io_dns_ctx *idc, sockaddr_union * su, void *app_cb, void *app_ctx)
 {
-    int sock = lwres_context_getsocket(idc->ctx);
-    if (idc->registered && sock > -1)
-	io_unregister(idc->io, sock);
-    RB_tree_delete(idc->by_serial);
-    RB_tree_delete(idc->by_app_ctx);
-    lwres_context_destroy(&idc->ctx);
-    free(idc);
+    char qname[80], *t = qname;
+    u_char *a;
+    int i;
+
+    switch (su->sa.sa_family) {
+#ifdef AF_INET
+    case AF_INET:
+	a = (u_char *) & su->sin.sin_addr;
+	snprintf(qname, sizeof(qname), "%u.%u.%u.%u.in-addr.arpa", a[3], a[2], a[1], a[0]);
+	break;
+#endif				/* AF_INET */
+#ifdef AF_INET6
+    case AF_INET6:
+	a = (u_char *) & su->sin6.sin6_addr;
+	for (i = 15; i > -1; i--)
+	    t += snprintf(t, 5, "%x.%x.", a[i] & 0xf, a[i] >> 4);
+	strcpy(t, "ip6.arpa");
+	break;
+#endif				/* AF_INET6 */
+    default:
+	((void (*)(void *, char *)) app_cb) (app_ctx, NULL);
+	return;
+    }
+    io_dns_add_name(idc, qname, IO_DNS_PTR, app_cb, app_ctx);
 }
 
 void io_dns_add_addr(struct io_dns_ctx *idc, struct in6_addr *a, void *app_cb, void *app_ctx)
@@ -135,111 +787,94 @@ void io_dns_add_addr(struct io_dns_ctx *idc, struct in6_addr *a, void *app_cb, v
     io_dns_add(idc, &su, app_cb, app_ctx);
 }
 
-void io_dns_add(struct io_dns_ctx *idc, sockaddr_union * su, void *app_cb, void *app_ctx)
+void io_dns_cancel(struct io_dns_ctx *idc, void *app_ctx)
 {
-    lwres_gnbarequest_t req;
-    lwres_lwpacket_t pkt;
-    lwres_buffer_t b;
-    uint32_t serial;
-
-    b.base = NULL;
+    struct dns_waiter *w = BT_delete(idc->by_app_ctx, (uint64_t) (uintptr_t) app_ctx);
 
-    req.flags = 0;
-    switch (su->sa.sa_family) {
-#ifdef AF_INET
-    case AF_INET:
-	req.addr.family = LWRES_ADDRTYPE_V4;
-	req.addr.length = 4;
-	memcpy(req.addr.address, &su->sin.sin_addr, 4);
-	break;
-#endif				/* AF_INET */
-#ifdef AF_INET6
-    case AF_INET6:
-	req.addr.family = LWRES_ADDRTYPE_V6;
-	req.addr.length = 16;
-	memcpy(req.addr.address, &su->sin6.sin6_addr, 16);
-#endif				/* AF_INET6 */
+    while (w) {
+	struct dns_waiter *next = w->ctx_next, **wp;
+	/* the query stays outstanding, its answer will be cached */
+	for (wp = &w->q->waiters; *wp; wp = &(*wp)->next)
+	    if (*wp == w) {
+		*wp = w->next;
+		break;
+	    }
+	free(w);
+	w = next;
     }
-    pkt.result = 0;
-    pkt.pktflags = 0;
-    pkt.serial = serial = lwres_context_nextserial(idc->ctx);
-    pkt.recvlength = LWRES_RECVLENGTH;
-
-    if (LWRES_R_SUCCESS == lwres_gnbarequest_render(idc->ctx, &req, &pkt, &b)) {
-	if (LWRES_R_SUCCESS == lwres_context_send(idc->ctx, b.base, b.length)) {
-	    struct io_dns_item *i = Xcalloc(1, sizeof(struct io_dns_item));
-	    i->serial = serial;
-	    i->app_cb = app_cb;
-	    i->app_ctx = app_ctx;
-	    RB_insert(idc->by_serial, i);
-	    RB_insert(idc->by_app_ctx, i);
+}
 
-	    if (!idc->registered)
-		lwres_register(idc);
+void io_dns_destroy(struct io_dns_ctx *idc)
+{
+    rb_node_t *rbn, *next;
 
+    for (rbn = RB_first(idc->queries); rbn; rbn = next) {
+	struct dns_query *q = RB_payload(rbn, struct dns_query *);
+	struct dns_waiter *w;
+	next = RB_next(rbn);
+	while (io_sched_pop(idc->io, q));
+	query_close_udp(q);
+	query_close_tcp(q);
+	while ((w = q->waiters)) {
+	    q->waiters = w->next;
+	    free(w);
 	}
-	free(b.base);
-    }
-}
-
-static void io_dns_cb(struct io_dns_ctx *idc, int sock __attribute__((unused)))
-{
-    lwres_buffer_t b;
-    lwres_lwpacket_t pkt;
-    struct io_dns_item i;
-    rb_node_t *r;
-    char buffer[LWRES_RECVLENGTH];
-    int rlen;
-    b.base = NULL;
-
-    if (LWRES_R_SUCCESS == lwres_context_recv(idc->ctx, buffer, LWRES_RECVLENGTH, &rlen)) {
-	lwres_buffer_init(&b, buffer, rlen);
-	b.used = rlen;
-
-	if (LWRES_R_SUCCESS == lwres_lwpacket_parseheader(&b, &pkt) && LWRES_OPCODE_GETNAMEBYADDR == pkt.opcode) {
-	    i.serial = pkt.serial;
-	    r = RB_search(idc->by_serial, &i);
-	    if (r) {
-		struct io_dns_item *p = RB_payload(r, struct io_dns_item *);
-		switch (pkt.result) {
-		case LWRES_R_SUCCESS:{
-			lwres_gnbaresponse_t *response = NULL;
-			if (LWRES_R_SUCCESS == lwres_gnbaresponse_parse(idc->ctx, &b, &pkt, &response)) {
-			    if (response->realnamelen > 0)
-				((void (*)(void *, char *)) p->app_cb)
-				    (p->app_ctx, response->realname);
-			    lwres_gnbaresponse_free(idc->ctx, &response);
-			}
-			break;
-		    }
-		default:	// Failure. Tell the caller by returning a NULL pointer.
-		    ((void (*)(void *, char *)) p->app_cb) (p->app_ctx, NULL);
-		}
-		RB_search_and_delete(idc->by_app_ctx, p);
-		RB_delete(idc->by_serial, r);
-	    }
-	}
+	free(q->qname);
+	free(q);
     }
+    while (io_sched_pop(idc->io, idc));
+    RB_tree_delete(idc->queries);
+    RB_tree_delete(idc->cache);
+    BT_tree_delete(idc->by_app_ctx);
+    free(idc);
 }
 
-#if 0
-static void testcb(void *ctx __attribute__((unused)), char *hostname)
+struct dns_resolve {
+    struct in6_addr *res;
+    int max;
+    int count;
+    int pending;
+};
+
+static void resolve_cb(struct dns_resolve *r, struct in6_addr *a, int n)
 {
-    fprintf(stderr, "%s\n", hostname);
-    exit(0);
+    int i;
+    for (i = 0; i < n && r->count < r->max; i++)
+	r->res[r->count++] = a[i];
+    r->pending--;
 }
 
-int main(int argc, char **argv)
+/*
+ * Looks up the A and AAAA records of name, waiting up to timeout seconds.
+ * Returns the number of addresses stored in res.
+ */
+int io_dns_resolve(char *name, struct in6_addr *res, int max, int timeout)
 {
     struct io_context *io = io_init();
     struct io_dns_ctx *idc;
-    sockaddr_union su;
-
-    su_pton(&su, argv[1]);
+    struct dns_resolve r;
+    time_t deadline;
 
+    gettimeofday(&io_now, NULL);
+    deadline = io_now.tv_sec + timeout;
     idc = io_dns_init(io);
 
-    io_dns_add(idc, &su, testcb, &su);
-    io_main(io);
+    memset(&r, 0, sizeof(r));
+    r.res = res;
+    r.max = max;
+    r.pending = 2;
+    io_dns_add_name(idc, name, IO_DNS_A, (void *) resolve_cb, &r);
+    io_dns_add_name(idc, name, IO_DNS_AAAA, (void *) resolve_cb, &r);
+
+    while (r.pending > 0 && io_now.tv_sec < deadline) {
+	int t = io_sched_exec(io);
+	if (t < 0 || t > 1000)
+	    t = 1000;
+	io_poll(io, t);
+	gettimeofday(&io_now, NULL);
+    }
+
+    io_dns_destroy(idc);
+    io_destroy(io, NULL);
+    return r.count;
 }
-#endif
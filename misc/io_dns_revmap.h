@@ -1,6 +1,6 @@
 /*
  * io_dns_revmap.h
- * (C)2002-2011 Marc Huber <Marc.Huber@web.de>
+ * (C)2002-2026 Marc Huber <Marc.Huber@web.de>
  *
  * All rights reserved.
  */
@@ -11,11 +11,23 @@
 #include "misc/io_sched.h"
 #include "misc/net.h"
 
+#define IO_DNS_A	1
+#define IO_DNS_PTR	12
+#define IO_DNS_AAAA	28
+
 struct io_dns_ctx;
 struct io_dns_ctx *io_dns_init(struct io_context *);
 void io_dns_cancel(struct io_dns_ctx *, void *);
 void io_dns_destroy(struct io_dns_ctx *);
+
+/* reverse lookups, callback: void (*)(void *app_ctx, char *hostname) */
 void io_dns_add(struct io_dns_ctx *, sockaddr_union *, void *, void *);
 void io_dns_add_addr(struct io_dns_ctx *, struct in6_addr *, void *, void *);
 
+/* forward lookups, callback: void (*)(void *app_ctx, struct in6_addr *, int) */
+void io_dns_add_name(struct io_dns_ctx *, char *, int, void *, void *);
+
+/* blocking A and AAAA lookup, for use at configuration time */
+int io_dns_resolve(char *, struct in6_addr *, int, int);
+
 #endif				/* _IO_DNS_REVMAP_H_ */
@@ -0,0 +1,371 @@
+/*
+ * io_dns_revmap_test.c
+ * (C) 2026 Marc Huber <Marc.Huber@web.de>
+ *
+ * Exercises the stub resolver against a small UDP/TCP responder on the
+ * loopback interface that runs in the same io context. The resolver is
+ * included verbatim so its name server list can be pointed at the
+ * responder's port.
+ *
+ * Covers PTR, A and AAAA answers, PTR names with stray bytes, CNAME
+ * chains, records for foreign owner names, replies with a wrong id, TCP fallback on truncation,
+ * negative caching, a fresh source port per try, deduplication of
+ * concurrent lookups, timeouts and io_dns_cancel().
+ *
+ */
+
+#include "misc/io_dns_revmap.c"
+
+#include <stdlib.h>
+#include <sysexits.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define NEG_TTL 60
+
+struct rr {
+    char *owner;		/* NULL: same as the question */
+    int type;
+    char *data;
+};
+
+struct zone {
+    char *qname;
+    int type;
+    int rcode;
+    int mode;
+#define Z_ANSWER 0
+#define Z_TRUNCATE 1		/* TC over UDP, answer over TCP */
+#define Z_DROP 2		/* never answer */
+#define Z_DROP_FIRST 3		/* ignore the first try */
+#define Z_SPOOF 4		/* send a reply with a wrong id first */
+    struct rr rr[5];
+    int queries;
+    int tcp_queries;
+    uint16_t port[2];		/* source ports of the first two tries */
+};
+
+static struct zone zone[] = {
+    { "1.0.0.127.in-addr.arpa", IO_DNS_PTR, 0, Z_ANSWER, { { NULL, IO_DNS_PTR, "localhost.test" } }, 0, 0, { 0 } },
+    { "2.0.0.127.in-addr.arpa", IO_DNS_PTR, 0, Z_ANSWER, { { NULL, IO_DNS_PTR, "evil host\n.test" } }, 0, 0, { 0 } },
+    { "host.test", IO_DNS_A, 0, Z_ANSWER, { { NULL, IO_DNS_A, "192.0.2.1" }, { NULL, IO_DNS_A, "192.0.2.2" } }, 0, 0, { 0 } },
+    { "host.test", IO_DNS_AAAA, 0, Z_ANSWER, { { NULL, IO_DNS_AAAA, "2001:db8::1" } }, 0, 0, { 0 } },
+    { "alias.test", IO_DNS_A, 0, Z_ANSWER,
+     { { "evil.test", IO_DNS_A, "198.51.100.66" }, { "alias2.test", IO_DNS_A, "192.0.2.7" }, { "host.test", IO_DNS_A, "192.0.2.1" },
+      { "alias2.test", 5, "host.test" }, { NULL, 5, "alias2.test" } }, 0, 0, { 0 } },
+    { "big.test", IO_DNS_A, 0, Z_TRUNCATE, { { NULL, IO_DNS_A, "192.0.2.3" }, { NULL, IO_DNS_A, "192.0.2.4" }, { NULL, IO_DNS_A, "192.0.2.5" } }, 0,
+     0, { 0 } },
+    { "nx.test", IO_DNS_A, 3, Z_ANSWER, { { 0 } }, 0, 0, { 0 } },
+    { "slow.test", IO_DNS_A, 0, Z_DROP, { { 0 } }, 0, 0, { 0 } },
+    { "retry.test", IO_DNS_A, 0, Z_DROP_FIRST, { { NULL, IO_DNS_A, "192.0.2.9" } }, 0, 0, { 0 } },
+    { "spoof.test", IO_DNS_A, 0, Z_SPOOF, { { NULL, IO_DNS_A, "192.0.2.10" } }, 0, 0, { 0 } },
+    { "cancel.test", IO_DNS_A, 0, Z_ANSWER, { { NULL, IO_DNS_A, "192.0.2.11" } }, 0, 0, { 0 } },
+    { NULL, 0, 0, 0, { { 0 } }, 0, 0, { 0 } }
+};
+
+struct result {
+    int calls;
+    char *name;
+    struct in6_addr a[8];
+    int count;
+};
+
+static int failed = 0;
+static int pending = 0;
+
+static void check(int ok, char *what)
+{
+    printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+    if (!ok)
+	failed++;
+}
+
+static struct zone *zone_find(char *qname, int type)
+{
+    struct zone *z;
+    for (z = zone; z->qname; z++)
+	if (z->type == type && !strcasecmp(z->qname, qname))
+	    return z;
+    return NULL;
+}
+
+/* Builds the reply to query m into r. Returns its length, or 0 to drop the query. */
+static size_t respond(u_char *m, size_t len, u_char *r, int tcp, uint16_t port)
+{
+    char qname[DNS_NAME_MAX + 1];
+    size_t off = DNS_HDR, qend;
+    struct zone *z;
+    u_char *p;
+    int i, an = 0;
+
+    if (len < DNS_HDR || decode_name(m, len, &off, qname) || off + 4 > len)
+	return 0;
+    qend = off + 4;
+    if (!(z = zone_find(qname, get16(m + off))))
+	return 0;
+
+    if (tcp)
+	z->tcp_queries++;
+    else if (z->queries++ < 2)
+	z->port[z->queries - 1] = port;
+
+    if (z->mode == Z_DROP || (z->mode == Z_DROP_FIRST && z->queries == 1 && !tcp))
+	return 0;
+
+    memcpy(r, m, qend);
+    put16(r + 2, (uint16_t) (0x8180 | z->rcode));
+    put16(r + 6, 0);
+    put16(r + 8, 0);
+    put16(r + 10, 0);
+    p = r + qend;
+
+    if (z->mode == Z_TRUNCATE && !tcp) {
+	put16(r + 2, 0x8380);
+	return qend;
+    }
+
+    for (i = 0; i < 5 && z->rr[i].type; i++, an++) {
+	struct rr *rr = &z->rr[i];
+	u_char *rdlen;
+	if (rr->owner)
+	    p += encode_name(p, rr->owner);
+	else {
+	    put16(p, 0xc000 | DNS_HDR);
+	    p += 2;
+	}
+	put16(p, (uint16_t) rr->type);
+	put16(p + 2, 1);
+	put16(p + 4, 0);
+	put16(p + 6, 3600);
+	rdlen = p + 8;
+	p += 10;
+	switch (rr->type) {
+	case IO_DNS_A:
+	    inet_pton(AF_INET, rr->data, p);
+	    p += 4;
+	    break;
+	case IO_DNS_AAAA:
+	    inet_pton(AF_INET6, rr->data, p);
+	    p += 16;
+	    break;
+	default:
+	    p += encode_name(p, rr->data);
+	}
+	put16(rdlen, (uint16_t) (p - rdlen - 2));
+    }
+    put16(r + 6, (uint16_t) an);
+
+    if (z->rcode == 3) {
+	/* SOA with the negative TTL, RFC 2308 */
+	u_char *rdlen;
+	put16(p, 0xc000 | DNS_HDR);
+	put16(p + 2, 6);
+	put16(p + 4, 1);
+	put16(p + 6, 0);
+	put16(p + 8, 3600);
+	rdlen = p + 10;
+	p += 12;
+	p += encode_name(p, "ns.test");
+	p += encode_name(p, "hostmaster.test");
+	memset(p, 0, 20);
+	put16(p + 18, NEG_TTL);
+	p += 20;
+	put16(rdlen, (uint16_t) (p - rdlen - 2));
+	put16(r + 8, 1);
+    }
+    return (size_t) (p - r);
+}
+
+static void udp_respond(struct io_context *io __attribute__((unused)), int cur)
+{
+    u_char m[1024], r[1024];
+    sockaddr_union from;
+    socklen_t fromlen = sizeof(from);
+    ssize_t l;
+
+    while ((l = recvfrom(cur, m, sizeof(m), 0, &from.sa, &fromlen)) > 0) {
+	size_t rl = respond(m, (size_t) l, r, 0, ntohs(from.sin.sin_port));
+	if (rl) {
+	    char qname[DNS_NAME_MAX + 1];
+	    size_t off = DNS_HDR;
+	    decode_name(m, (size_t) l, &off, qname);
+	    if (zone_find(qname, get16(m + off))->mode == Z_SPOOF) {
+		u_char s[1024];
+		memcpy(s, r, rl);
+		put16(s, get16(s) ^ 0x5555);
+		s[rl - 4] = 198, s[rl - 3] = 51, s[rl - 2] = 100, s[rl - 1] = 66;
+		sendto(cur, s, rl, 0, &from.sa, fromlen);
+	    }
+	    sendto(cur, r, rl, 0, &from.sa, fromlen);
+	}
+	fromlen = sizeof(from);
+    }
+}
+
+static void tcp_respond(struct io_context *io, int cur)
+{
+    u_char m[1024], r[1026];
+    ssize_t l;
+
+    /* loopback, the query arrives in one piece */
+    if ((l = recv(cur, m, sizeof(m), 0)) > 2) {
+	size_t rl = respond(m + 2, (size_t) l - 2, r + 2, 1, 0);
+	if (rl) {
+	    put16(r, (uint16_t) rl);
+	    send(cur, r, rl + 2, 0);
+	}
+    }
+    io_close(io, cur);
+}
+
+static void tcp_accept(struct io_context *io, int cur)
+{
+    int s = accept(cur, NULL, NULL);
+
+    if (s > -1) {
+	io_register(io, s, io);
+	io_set_cb_i(io, s, (void *) tcp_respond);
+	io_set_cb_h(io, s, (void *) io_close);
+	io_set_cb_e(io, s, (void *) io_close);
+	io_set_i(io, s);
+    }
+}
+
+static void ptr_cb(struct result *res, char *name)
+{
+    res->calls++;
+    res->name = name ? Xstrdup(name) : NULL;
+    pending--;
+}
+
+static void a_cb(struct result *res, struct in6_addr *a, int n)
+{
+    res->calls++;
+    res->count = MIN(n, 8);
+    if (a)
+	memcpy(res->a, a, res->count * sizeof(struct in6_addr));
+    pending--;
+}
+
+static int has_v4(struct result *res, char *addr)
+{
+    struct in_addr in;
+    int i;
+
+    inet_pton(AF_INET, addr, &in);
+    for (i = 0; i < res->count; i++)
+	if (res->a[i].s6_addr32[2] == 0x0000FFFF && res->a[i].s6_addr32[3] == ntohl(in.s_addr))
+	    return 1;
+    return 0;
+}
+
+static void lookup(struct io_dns_ctx *idc, char *name, int type, struct result *res)
+{
+    memset(res, 0, sizeof(struct result));
+    pending++;
+    if (type == IO_DNS_PTR)
+	io_dns_add_name(idc, name, type, ptr_cb, res);
+    else
+	io_dns_add_name(idc, name, type, a_cb, res);
+}
+
+static void run(struct io_context *io, int seconds)
+{
+    time_t deadline;
+
+    gettimeofday(&io_now, NULL);
+    deadline = io_now.tv_sec + seconds;
+    while (pending > 0 && io_now.tv_sec < deadline) {
+	io_poll(io, MIN(io_sched_exec(io), 100));
+	gettimeofday(&io_now, NULL);
+    }
+}
+
+int main(int argc __attribute__((unused)), char **argv __attribute__((unused)))
+{
+    struct io_context *io;
+    struct io_dns_ctx *idc;
+    struct result ptr, badptr, a1, a2, aaaa, alias, big, nx, nx2, slow, retry, spoof, cancelled, cancel2;
+    struct dns_cache k, *c;
+    sockaddr_union sa;
+    socklen_t salen = sizeof(sa);
+    int u, t, one = 1;
+    struct in6_addr v6;
+
+    gettimeofday(&io_now, NULL);
+    io = io_init();
+
+    /* responder */
+    su_pton_p(&sa, "127.0.0.1", 0);
+    if ((u = su_socket(AF_INET, SOCK_DGRAM, 0)) < 0 || su_bind(u, &sa) || getsockname(u, &sa.sa, &salen)) {
+	perror("udp");
+	exit(EX_OSERR);
+    }
+    if ((t = su_socket(AF_INET, SOCK_STREAM, 0)) < 0 || setsockopt(t, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) || su_bind(t, &sa)
+	|| listen(t, 8)) {
+	perror("tcp");
+	exit(EX_OSERR);
+    }
+    io_register(io, u, io);
+    io_set_cb_i(io, u, (void *) udp_respond);
+    io_set_i(io, u);
+    io_register(io, t, io);
+    io_set_cb_i(io, t, (void *) tcp_accept);
+    io_set_i(io, t);
+
+    idc = io_dns_init(io);
+    idc->server[0].sa = sa;
+    idc->servers = 1;
+    idc->timeout = 1;
+    idc->attempts = 2;
+
+    lookup(idc, "1.0.0.127.in-addr.arpa", IO_DNS_PTR, &ptr);
+    lookup(idc, "2.0.0.127.in-addr.arpa", IO_DNS_PTR, &badptr);
+    lookup(idc, "host.test", IO_DNS_A, &a1);
+    lookup(idc, "HOST.test.", IO_DNS_A, &a2);
+    lookup(idc, "host.test", IO_DNS_AAAA, &aaaa);
+    lookup(idc, "alias.test", IO_DNS_A, &alias);
+    lookup(idc, "big.test", IO_DNS_A, &big);
+    lookup(idc, "nx.test", IO_DNS_A, &nx);
+    lookup(idc, "slow.test", IO_DNS_A, &slow);
+    lookup(idc, "retry.test", IO_DNS_A, &retry);
+    lookup(idc, "spoof.test", IO_DNS_A, &spoof);
+    lookup(idc, "cancel.test", IO_DNS_A, &cancelled);
+    io_dns_cancel(idc, &cancelled);
+    pending--;
+
+    run(io, 10);
+
+    check(ptr.calls == 1 && ptr.name && !strcmp(ptr.name, "localhost.test"), "PTR");
+    check(badptr.calls == 1 && !badptr.name, "PTR name with stray bytes rejected");
+    check(a1.calls == 1 && a1.count == 2 && has_v4(&a1, "192.0.2.1") && has_v4(&a1, "192.0.2.2"), "A");
+    inet_pton(AF_INET6, "2001:db8::1", &v6);
+    v6_ntoh(&v6, &v6);
+    check(aaaa.calls == 1 && aaaa.count == 1 && !memcmp(&aaaa.a[0], &v6, sizeof(v6)), "AAAA");
+    check(a2.calls == 1 && a2.count == 2 && zone_find("host.test", IO_DNS_A)->queries == 1, "concurrent lookups share a query");
+    check(alias.calls == 1 && alias.count == 1 && has_v4(&alias, "192.0.2.1"), "CNAME chain, foreign owners ignored");
+    check(big.calls == 1 && big.count == 3 && zone_find("big.test", IO_DNS_A)->tcp_queries == 1, "TCP fallback on truncation");
+    check(nx.calls == 1 && nx.count == 0, "NXDOMAIN");
+    check(slow.calls == 1 && slow.count == 0 && zone_find("slow.test", IO_DNS_A)->queries == 2, "timeout");
+    check(retry.calls == 1 && retry.count == 1 && zone_find("retry.test", IO_DNS_A)->queries == 2
+	  && zone_find("retry.test", IO_DNS_A)->port[0] != zone_find("retry.test", IO_DNS_A)->port[1], "retry from a fresh source port");
+    check(spoof.calls == 1 && spoof.count == 1 && has_v4(&spoof, "192.0.2.10"), "reply with wrong id ignored");
+    check(cancelled.calls == 0, "cancelled lookup not delivered");
+
+    /* cached answers are delivered synchronously */
+    lookup(idc, "nx.test", IO_DNS_A, &nx2);
+    k.qname = "nx.test";
+    k.type = IO_DNS_A;
+    c = RB_lookup(idc->cache, &k);
+    check(nx2.calls == 1 && nx2.count == 0 && zone_find("nx.test", IO_DNS_A)->queries == 1 && c && c->expires <= io_now.tv_sec + NEG_TTL,
+	  "negative answer cached for the SOA TTL");
+    lookup(idc, "cancel.test", IO_DNS_A, &cancel2);
+    check(cancel2.calls == 1 && cancel2.count == 1 && zone_find("cancel.test", IO_DNS_A)->queries == 1, "cancelled lookup still cached");
+
+    io_dns_destroy(idc);
+    io_close(io, u);
+    io_close(io, t);
+
+    return failed ? EX_SOFTWARE : EX_OK;
+}
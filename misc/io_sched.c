@@ -26,7 +26,7 @@
 #include <limits.h>
 
 #include "misc/io_sched.h"
-#include "misc/rb.h"
+#include "misc/btree.h"
 #include "mavis/debug.h"
 #include "mavis/log.h"
 #include "misc/memops.h"
@@ -151,8 +151,8 @@ struct event_cache {
 
 struct io_context {
     struct io_handler *handler;
-    rb_tree_t *events_by_data;
-    rb_tree_t *events_by_time;
+    bt_tree_t *events_by_data;	/* keyed by data pointer */
+    bt_tree_t *events_by_time;	/* keyed by time_when, in microseconds */
     void *io_invalid_i;
     void *io_invalid_o;
     void *io_invalid_h;
@@ -225,33 +225,8 @@ static __inline__ int MAXIMUM(int a, int b)
     return (a < b) ? b : a;
 }
 
-#define SIOS(A) ((struct io_sched *)(A))
-
-static int cmp_tv(const void *a, const void *b)
-{
-    if (SIOS(a)->time_when.tv_sec < SIOS(b)->time_when.tv_sec)
-	return -1;
-    if (SIOS(a)->time_when.tv_sec > SIOS(b)->time_when.tv_sec)
-	return +1;
-    if (SIOS(a)->time_when.tv_usec < SIOS(b)->time_when.tv_usec)
-	return -1;
-    if (SIOS(a)->time_when.tv_usec > SIOS(b)->time_when.tv_usec)
-	return +1;
-    if (a < b)
-	return -1;
-    if (a > b)
-	return +1;
-    return 0;
-}
-
-static int cmp_data(const void *a, const void *b)
-{
-    if (SIOS(a)->data < SIOS(b)->data)
-	return -1;
-    if (SIOS(a)->data > SIOS(b)->data)
-	return +1;
-    return 0;
-}
+#define TV_KEY(A) ((uint64_t) (A).tv_sec * 1000000 + (uint64_t) (A).tv_usec)
+#define DATA_KEY(A) ((uint64_t) (uintptr_t) (A))
 
 static void io_invalid_i(void *v __attribute__((unused)), int cur)
 {
@@ -342,8 +317,8 @@ int io_poll(struct io_context *io, int poll_timeout)
 struct io_context *io_destroy(struct io_context *io, void (*freeproc)(void *))
 {
     if (io) {
-	RB_tree_delete(io->events_by_data);
-	RB_tree_delete(io->events_by_time);
+	BT_tree_delete(io->events_by_data);
+	BT_tree_delete(io->events_by_time);
 
 	if (freeproc) {
 	    int i;
@@ -1456,9 +1431,10 @@ static void port_io_destroy(struct io_context *io)
 }
 #endif
 
-static void insert_isc(rb_tree_t * t, struct io_sched *isc)
+/* Timer keys are unique; colliding events are delayed by a microsecond. */
+static void insert_isc(bt_tree_t * t, struct io_sched *isc)
 {
-    while (!RB_insert(t, isc)) {
+    while (BT_insert(t, TV_KEY(isc->time_when), isc)) {
 	isc->time_when.tv_usec++;
 	if (isc->time_when.tv_usec > 1000000)
 	    isc->time_when.tv_usec -= 1000000, isc->time_when.tv_sec++;
@@ -1469,29 +1445,26 @@ static void insert_isc(rb_tree_t * t, struct io_sched *isc)
 
 void io_sched_add(struct io_context *io, void *data, void *proc, time_t tv_sec, suseconds_t tv_usec)
 {
-    rb_node_t *rbn;
     struct io_event *ioe = Xcalloc(1, sizeof(struct io_event));
-    struct io_sched *isc, is;
+    struct io_sched *isc;
 
     Debug((DEBUG_PROC, "io_sched_add %p %ld.%ld\n", data, (long) tv_sec, (long) tv_usec));
 
     gettimeofday(&io_now, NULL);
 
-    is.data = data;
-    rbn = RB_search(io->events_by_data, &is);
+    isc = BT_lookup(io->events_by_data, DATA_KEY(data));
 
     ioe->proc = proc;
     ioe->time_wait.tv_sec = tv_sec;
     ioe->time_wait.tv_usec = tv_usec;
 
-    if (rbn) {
-	isc = RB_payload(rbn, struct io_sched *);
+    if (isc) {
 	ioe->next = isc->event;
-	RB_search_and_delete(io->events_by_time, isc);
+	BT_delete(io->events_by_time, TV_KEY(isc->time_when));
     } else {
 	isc = Xcalloc(1, sizeof(struct io_sched));
 	isc->data = data;
-	RB_insert(io->events_by_data, isc);
+	BT_insert(io->events_by_data, DATA_KEY(data), isc);
     }
     isc->event = ioe;
     isc->time_when.tv_sec = io_now.tv_sec + ioe->time_wait.tv_sec;
@@ -1505,26 +1478,23 @@ void io_sched_add(struct io_context *io, void *data, void *proc, time_t tv_sec,
 
 void io_sched_app(struct io_context *io, void *data, void *proc, time_t tv_sec, suseconds_t tv_usec)
 {
-    rb_node_t *rbn;
     struct io_event *ioe = Xcalloc(1, sizeof(struct io_event));
-    struct io_sched is;
+    struct io_sched *isc;
 
     DebugIn(DEBUG_PROC);
 
-    is.data = data;
-    rbn = RB_search(io->events_by_data, &is);
+    isc = BT_lookup(io->events_by_data, DATA_KEY(data));
 
     ioe->proc = proc;
     ioe->time_wait.tv_sec = tv_sec;
     ioe->time_wait.tv_usec = tv_usec;
 
-    if (rbn) {
-	struct io_event *i = RB_payload(rbn, struct io_sched *)->event;
+    if (isc) {
+	struct io_event *i = isc->event;
 	while (i->next)
 	    i = i->next;
 	i->next = ioe;
     } else {
-	struct io_sched *isc;
 	isc = Xcalloc(1, sizeof(struct io_sched));
 	isc->data = data;
 	isc->event = ioe;
@@ -1534,7 +1504,7 @@ void io_sched_app(struct io_context *io, void *data, void *proc, time_t tv_sec,
 	    isc->time_when.tv_usec -= 1000000, isc->time_when.tv_sec++;
 	isc->time_real.tv_sec = isc->time_when.tv_sec;
 	isc->time_real.tv_usec = isc->time_when.tv_usec;
-	RB_insert(io->events_by_data, isc);
+	BT_insert(io->events_by_data, DATA_KEY(data), isc);
 	insert_isc(io->events_by_time, isc);
     }
 
@@ -1543,21 +1513,18 @@ void io_sched_app(struct io_context *io, void *data, void *proc, time_t tv_sec,
 
 void *io_sched_pop(struct io_context *io, void *data)
 {
-    rb_node_t *rbn;
-    struct io_sched is;
+    struct io_sched *isc;
     void *result = NULL;
 
     DebugIn(DEBUG_PROC);
 
-    is.data = data;
-    rbn = RB_search(io->events_by_data, &is);
-    if (rbn) {
-	struct io_sched *isc = RB_payload(rbn, struct io_sched *);
+    isc = BT_lookup(io->events_by_data, DATA_KEY(data));
+    if (isc) {
 	struct io_event *i = isc->event;
 
 	isc->event = i->next;
 	free(i);
-	RB_search_and_delete(io->events_by_time, isc);
+	BT_delete(io->events_by_time, TV_KEY(isc->time_when));
 	if (isc->event) {
 	    isc->time_when.tv_sec = io_now.tv_sec + isc->event->time_wait.tv_sec;
 	    isc->time_when.tv_usec = io_now.tv_usec + isc->event->time_wait.tv_usec;
@@ -1568,7 +1535,7 @@ void *io_sched_pop(struct io_context *io, void *data)
 	    insert_isc(io->events_by_time, isc);
 	    result = isc->event->proc;
 	} else {
-	    RB_delete(io->events_by_data, rbn);
+	    BT_delete(io->events_by_data, DATA_KEY(data));
 	    free(isc);
 	}
     }
@@ -1579,15 +1546,12 @@ void *io_sched_pop(struct io_context *io, void *data)
 int io_sched_del(struct io_context *io, void *data, void *proc)
 {
     int result = 0;
-    struct io_sched is;
-    rb_node_t *rbn;
+    struct io_sched *isc;
 
     DebugIn(DEBUG_PROC);
 
-    is.data = data;
-    rbn = RB_search(io->events_by_data, &is);
-    if (rbn) {
-	struct io_sched *isc = RB_payload(rbn, struct io_sched *);
+    isc = BT_lookup(io->events_by_data, DATA_KEY(data));
+    if (isc) {
 	struct io_event *i = isc->event;
 	if (i) {
 	    if (i->proc == proc)
@@ -1611,14 +1575,11 @@ int io_sched_del(struct io_context *io, void *data, void *proc)
 
 int io_sched_renew_proc(struct io_context *io, void *data, void *proc)
 {
-    struct io_sched is;
-    rb_node_t *rbn;
+    struct io_sched *isc;
     Debug((DEBUG_PROC, "io_sched_renew_proc %p\n", data));
-    is.data = data;
-    rbn = RB_search(io->events_by_data, &is);
-    if (rbn) {
-	struct io_sched *isc = RB_payload(rbn, struct io_sched *);
-	if (isc && isc->event && (!proc || isc->event->proc == proc)) {
+    isc = BT_lookup(io->events_by_data, DATA_KEY(data));
+    if (isc) {
+	if (isc->event && (!proc || isc->event->proc == proc)) {
 	    isc->time_real.tv_sec = io_now.tv_sec + isc->event->time_wait.tv_sec;
 	    isc->time_real.tv_usec = io_now.tv_usec + isc->event->time_wait.tv_usec;
 	    if (isc->time_real.tv_usec > 1000000)
@@ -1632,42 +1593,28 @@ int io_sched_renew_proc(struct io_context *io, void *data, void *proc)
 
 void *io_sched_peek(struct io_context *io, void *data)
 {
-    struct io_event *ioe;
-    rb_node_t *rbn;
-    struct io_sched is;
-    is.data = data;
-    rbn = RB_search(io->events_by_data, &is);
-    if (rbn && (ioe = RB_payload(rbn, struct io_sched *)->event))
-	 return (void *) (ioe->proc);
+    struct io_sched *ios = BT_lookup(io->events_by_data, DATA_KEY(data));
+    if (ios && ios->event)
+	return (void *) (ios->event->proc);
     return NULL;
 }
 
 struct timeval *io_sched_peek_time(struct io_context *io, void *data)
 {
-    struct io_sched *ios;
-    rb_node_t *rbn;
-    struct io_sched is;
-    is.data = data;
-    rbn = RB_search(io->events_by_data, &is);
-    if (rbn && (ios = RB_payload(rbn, struct io_sched *))->event)
-	 return &ios->time_real;
+    struct io_sched *ios = BT_lookup(io->events_by_data, DATA_KEY(data));
+    if (ios && ios->event)
+	return &ios->time_real;
     return NULL;
 }
 
 static void io_reschedule(struct io_context *io)
 {
-    rb_node_t *rbn, *rbnext;
     struct io_sched *ios;
+    uint64_t key;
 
-    for (rbn = RB_first(io->events_by_time);
-	 rbn &&
-	 ((ios =
-	   RB_payload(rbn,
-		      struct io_sched *))->time_when.tv_sec < io_now.tv_sec
-	  || (ios->time_when.tv_sec == io_now.tv_sec && ios->time_when.tv_usec <= io_now.tv_usec)); rbn = rbnext) {
-	rbnext = RB_next(rbn);
+    for (ios = BT_first(io->events_by_time, &key); ios && key <= TV_KEY(io_now); ios = BT_next(io->events_by_time, &key)) {
 	if (ios->time_when.tv_sec != ios->time_real.tv_sec || ios->time_when.tv_usec != ios->time_real.tv_usec) {
-	    RB_delete(io->events_by_time, rbn);
+	    BT_delete(io->events_by_time, key);
 	    ios->time_when.tv_sec = ios->time_real.tv_sec;
 	    ios->time_when.tv_usec = ios->time_real.tv_usec;
 	    insert_isc(io->events_by_time, ios);
@@ -1679,21 +1626,15 @@ static void io_reschedule(struct io_context *io)
 
 int io_sched_exec(struct io_context *io)
 {
-    rb_node_t *rbn, *rbnext;
     int poll_timeout;
     struct io_sched *ios;
+    uint64_t key;
 
     Debug((DEBUG_PROC, "io_sched_exec (%p)\n", io));
 
     io_reschedule(io);
 
-    for (rbn = RB_first(io->events_by_time);
-	 rbn &&
-	 ((ios =
-	   RB_payload(rbn,
-		      struct io_sched *))->time_when.tv_sec < io_now.tv_sec
-	  || (ios->time_when.tv_sec == io_now.tv_sec && ios->time_when.tv_usec <= io_now.tv_usec)); rbn = rbnext) {
-	rbnext = RB_next(rbn);
+    for (ios = BT_first(io->events_by_time, &key); ios && key <= TV_KEY(io_now); ios = BT_next(io->events_by_time, &key)) {
 	Debug((DEBUG_PROC, " executing ...\n"));
 	((void (*)(void *, int)) (ios->event->proc)) (ios->data, -1);
 	Debug((DEBUG_PROC, "... done.\n"));
@@ -1701,9 +1642,8 @@ int io_sched_exec(struct io_context *io)
 
     io_reschedule(io);
 
-    rbn = RB_first(io->events_by_time);
-    if (rbn) {
-	ios = RB_payload(rbn, struct io_sched *);
+    ios = BT_first(io->events_by_time, &key);
+    if (ios) {
 	poll_timeout = 1 + (int) ((ios->time_when.tv_sec - io_now.tv_sec) * 1000) + (int) ((ios->time_when.tv_usec - io_now.tv_usec) / 1000);
 
 	Debug((DEBUG_PROC, "poll_timeout = %dms\n", poll_timeout));
@@ -1915,8 +1855,8 @@ struct io_context *io_init()
 
     mech_io_init(io);
 
-    io->events_by_time = RB_tree_new(cmp_tv, NULL);
-    io->events_by_data = RB_tree_new(cmp_data, NULL);
+    io->events_by_time = BT_tree_new(NULL);
+    io->events_by_data = BT_tree_new(NULL);
     io->io_invalid_i = (void *) io_invalid_i;
     io->io_invalid_o = (void *) io_invalid_o;
     io->io_invalid_e = (void *) io_invalid_e;
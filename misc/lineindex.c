@@ -0,0 +1,213 @@
+/*
+ * lineindex.c
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ * All rights reserved.
+ *
+ * In-memory hash index for line-oriented text files (password files and
+ * friends). The file is read once and re-read only if its inode, size or
+ * modification time changes.
+ *
+ * $Id$
+ *
+ */
+
+#include "misc/sysconf.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include "misc/memops.h"
+#include "misc/crc32.h"
+#include "misc/lineindex.h"
+
+static const char rcsid[] __attribute__((used)) = "$Id$";
+
+struct lineindex_entry {
+    u_int hash;
+    size_t keylen;
+    char *key;
+    char *line;
+    struct lineindex_entry *next;
+};
+
+struct lineindex {
+    char *path;
+    int mode;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    int racy;			/* modified within the second it was read */
+    char *buf;
+    struct lineindex_entry *entries;
+    struct lineindex_entry **bucket;
+    u_int bucket_mask;
+};
+
+lineindex_t *lineindex_new(char *path, int mode)
+{
+    lineindex_t *li = Xcalloc(1, sizeof(lineindex_t));
+    li->path = Xstrdup(path);
+    li->mode = mode;
+    return li;
+}
+
+static void lineindex_clear(lineindex_t * li)
+{
+    Xfree(&li->buf);
+    Xfree(&li->entries);
+    Xfree(&li->bucket);
+    li->bucket_mask = 0;
+    li->ino = 0;
+    li->size = -1;
+}
+
+void lineindex_free(lineindex_t ** li)
+{
+    if (*li) {
+	lineindex_clear(*li);
+	free((*li)->path);
+	free(*li);
+	*li = NULL;
+    }
+}
+
+static u_int lineindex_hash(char *key, size_t keylen)
+{
+    return crc32_update(INITCRC32, (u_char *) key, (off_t) keylen);
+}
+
+static void lineindex_add(struct lineindex_entry **e, char *key, size_t keylen, char *line)
+{
+    (*e)->hash = lineindex_hash(key, keylen);
+    (*e)->key = key;
+    (*e)->keylen = keylen;
+    (*e)->line = line;
+    (*e)++;
+}
+
+static int lineindex_load(lineindex_t * li, int fn, struct stat *st)
+{
+    char *linestart, *lineend, *t;
+    size_t keys = 0, buckets;
+    ssize_t len = 0, l;
+    struct lineindex_entry *e;
+
+    lineindex_clear(li);
+
+    li->buf = Xcalloc(1, (size_t) st->st_size + 2);
+    while (len < st->st_size && (l = read(fn, li->buf + len, (size_t) (st->st_size - len))) > 0)
+	len += l;
+    if (len && li->buf[len - 1] != '\n')
+	li->buf[len++] = '\n';
+    li->buf[len] = 0;
+
+    /* Upper bound for the number of keys: lines plus list separators. */
+    for (t = li->buf; *t; t++)
+	if (*t == '\n' || (*t == ',' && (li->mode & LINEINDEX_FIELDLIST)))
+	    keys++;
+
+    e = li->entries = Xcalloc(keys + 1, sizeof(struct lineindex_entry));
+
+    for (linestart = li->buf; (lineend = strchr(linestart, '\n')); linestart = lineend + 1) {
+	*lineend = 0;
+	if ((li->mode & LINEINDEX_COMMENTS) && *linestart == '#')
+	    continue;
+	if (li->mode & (LINEINDEX_FIELD | LINEINDEX_FIELDLIST)) {
+	    char *colon = strchr(linestart, ':');
+	    if (!colon)
+		continue;
+	    if (li->mode & LINEINDEX_FIELDLIST) {
+		char *k = linestart;
+		while (k < colon) {
+		    char *comma = memchr(k, ',', (size_t) (colon - k));
+		    if (!comma)
+			comma = colon;
+		    if (comma > k)
+			lineindex_add(&e, k, (size_t) (comma - k), linestart);
+		    k = comma + 1;
+		}
+	    } else
+		lineindex_add(&e, linestart, (size_t) (colon - linestart), linestart);
+	} else
+	    lineindex_add(&e, linestart, (size_t) (lineend - linestart), linestart);
+    }
+
+    for (buckets = 16; buckets < 2 * keys; buckets <<= 1);
+    li->bucket = Xcalloc(buckets, sizeof(struct lineindex_entry *));
+    li->bucket_mask = (u_int) buckets - 1;
+
+    /* Insert in reverse order so that chains preserve file order. */
+    while (e > li->entries) {
+	struct lineindex_entry **b;
+	e--;
+	b = &li->bucket[e->hash & li->bucket_mask];
+	e->next = *b;
+	*b = e;
+    }
+
+    li->dev = st->st_dev;
+    li->ino = st->st_ino;
+    li->size = st->st_size;
+    li->mtime = st->st_mtime;
+    li->racy = (st->st_mtime >= time(NULL));
+    return 0;
+}
+
+/*
+ * Make sure the index reflects the current file contents. Returns 0 on
+ * success, -1 (with errno set) if the file isn't accessible.
+ */
+int lineindex_refresh(lineindex_t * li)
+{
+    struct stat st;
+    int fn, res;
+
+    if (stat(li->path, &st)) {
+	int e = errno;
+	lineindex_clear(li);
+	errno = e;
+	return -1;
+    }
+
+    if (li->bucket && !li->racy && st.st_ino == li->ino && st.st_dev == li->dev && st.st_size == li->size && st.st_mtime == li->mtime)
+	return 0;
+
+    if ((fn = open(li->path, O_RDONLY)) < 0) {
+	int e = errno;
+	lineindex_clear(li);
+	errno = e;
+	return -1;
+    }
+    res = fstat(fn, &st) ? -1 : lineindex_load(li, fn, &st);
+    close(fn);
+    return res;
+}
+
+/*
+ * Returns the next line matching key, or NULL. *cursor needs to be
+ * initialized to NULL for the first call. The line returned is owned by
+ * the index and must not be modified.
+ */
+char *lineindex_lookup(lineindex_t * li, char *key, void **cursor)
+{
+    struct lineindex_entry *e = *cursor;
+    size_t keylen = strlen(key);
+    u_int hash = lineindex_hash(key, keylen);
+
+    if (!li->bucket)
+	return NULL;
+
+    for (e = e ? e->next : li->bucket[hash & li->bucket_mask]; e; e = e->next)
+	if (e->hash == hash && e->keylen == keylen && !memcmp(e->key, key, keylen)) {
+	    *cursor = e;
+	    return e->line;
+	}
+
+    *cursor = NULL;
+    return NULL;
+}
@@ -0,0 +1,26 @@
+/*
+ * lineindex.h
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ * All rights reserved.
+ *
+ * $Id$
+ *
+ */
+
+#ifndef __LINEINDEX_H__
+#define __LINEINDEX_H__
+#include <sys/types.h>
+
+#define LINEINDEX_LINE		0	/* key is the complete line */
+#define LINEINDEX_FIELD		1	/* key is the text before the first ':' */
+#define LINEINDEX_FIELDLIST	2	/* keys are the ','-separated items before the first ':' */
+#define LINEINDEX_COMMENTS	4	/* skip lines starting with '#' */
+
+struct lineindex;
+typedef struct lineindex lineindex_t;
+
+lineindex_t *lineindex_new(char *, int);
+int lineindex_refresh(lineindex_t *);
+char *lineindex_lookup(lineindex_t *, char *, void **);
+void lineindex_free(lineindex_t **);
+#endif				/* __LINEINDEX_H__ */
@@ -71,8 +71,8 @@ static u_char PADDING[64] = {
 
 /* F, G, H and I are basic MD5 functions.
  */
-#define F(x, y, z) (((x) & (y)) | ((~x) & (z)))
-#define G(x, y, z) (((x) & (z)) | ((y) & (~z)))
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
 #define H(x, y, z) ((x) ^ (y) ^ (z))
 #define I(x, y, z) ((y) ^ ((x) | (~z)))
 
@@ -307,8 +307,13 @@ u_int *output;
 u_char *input;
 u_int len;
 {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /* byte order already matches */
+    myMD5_memcpy(output, input, len);
+#else
     u_int i, j;
 
     for (i = 0, j = 0; j < len; i++, j += 4)
 	output[i] = ((u_int) input[j]) | (((u_int) input[j + 1]) << 8) | (((u_int) input[j + 2]) << 16) | (((u_int) input[j + 3]) << 24);
+#endif
 }
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <netinet/in.h>
@@ -35,8 +36,11 @@ struct radixnode_array {
     struct radixnode_array *next;
 };
 
+struct radix_compiled;
+
 struct radixtree {
     struct radixnode *root;
+    struct radix_compiled *compiled;	/* read-only copy, see radix_compile() */
     void (*free)(void * /* payload */ , void * /* data */ );
     int (*cmp)(void * /* payload 1 */ , void * /* payload 2 */ );
 };
@@ -72,11 +76,16 @@ static void radixnode_free(struct radixnode *n)
 #define v6_bitset(a,b) ((b > 0) && ((b) < 129) && \
 	((a).s6_addr32[(b-1)>>5] & (0x80000000 >> ((b-1)&0x1f))))
 
+static void radix_compiled_free(struct radix_compiled **);
+static void *radix_compiled_lookup(struct radix_compiled *, struct in6_addr *);
+
 void *radix_add(struct radixtree *rt, struct in6_addr *a, int m, void *d)
 {
     struct radixnode *r, *n, **rp;
     struct in6_addr bca;	/* broadcast addresses */
 
+    radix_compiled_free(&rt->compiled);
+
     v6_network(a, a, m);
 
     if (!rt->root) {
@@ -158,6 +167,9 @@ void *radix_lookup(struct radixtree *rt, struct in6_addr *a, void **arr)
 {
     void *match = NULL;
 
+    if (rt && rt->compiled && !arr)
+	return radix_compiled_lookup(rt->compiled, a);
+
     if (rt) {
 	struct radixnode *rn = rt->root;
 	while (rn) {
@@ -203,6 +215,7 @@ static void radix_dropnode(struct radixtree *rt, struct radixnode *rn, void *dat
 void radix_drop(struct radixtree **rt, void *data)
 {
     if (*rt) {
+	radix_compiled_free(&(*rt)->compiled);
 	radix_dropnode(*rt, (*rt)->root, data);
 	free(*rt);
 	*rt = NULL;
@@ -258,3 +271,297 @@ void *radix_lookup_str(struct radixtree *rt, char *addr, void **arr)
 
     return v6_ptoh(&a, NULL, addr) ? NULL : radix_lookup(rt, &a, arr);
 }
+
+/*
+ * Read-optimized copy of a radix tree, built by radix_compile() once the
+ * tree is complete. This is a multibit trie with direct pointing at the
+ * top and 6 bit strides below. Child nodes and leaves are stored in
+ * arrays and indexed by popcount over per-node bitmaps, with runs of
+ * identical leaves compressed (Poptrie, Asai & Ohara, SIGCOMM 2015).
+ * IPv4-mapped addresses get a trie of their own over the 32 bit IPv4
+ * address, which resolves in at most four array accesses. Adding to the
+ * tree drops the compiled copy.
+ */
+
+#define RADIX_STRIDE 6
+#define RADIX_LEAF 0x80000000
+
+struct radix_pnode {
+    uint64_t vector;		/* slots with child nodes */
+    uint64_t leafvec;		/* slots starting a new run of leaves */
+    uint32_t base0;		/* first leaf */
+    uint32_t base1;		/* first child node */
+};
+
+struct radix_ptrie {
+    int direct_bits;
+    uint32_t *direct;		/* node index, or leaf index | RADIX_LEAF */
+    struct radix_pnode *node;
+    uint32_t node_len;
+    uint32_t node_max;
+    void **leaf;
+    uint32_t leaf_len;
+    uint32_t leaf_max;
+};
+
+struct radix_compiled {
+    struct radix_ptrie v4;	/* ::ffff:0:0/96 */
+    struct radix_ptrie v6;	/* everything else */
+};
+
+struct radix_prefix {
+    uint64_t hi;
+    uint64_t lo;
+    int len;
+    void *d;
+};
+
+struct radix_collect {
+    struct radix_prefix *v4, *v6;
+    int v4_len, v6_len;
+    int v4_default_len;
+    void *v4_default;
+};
+
+/* n (1..32) bits of the 128 bit key hi:lo, starting at bit off */
+static __inline__ uint32_t key_bits(uint64_t hi, uint64_t lo, int off, int n)
+{
+    uint64_t w;
+    if (off >= 64)
+	w = lo << (off - 64);
+    else if (off == 0)
+	w = hi;
+    else
+	w = (hi << off) | (lo >> (64 - off));
+    return (uint32_t) (w >> (64 - n));
+}
+
+static __inline__ int is_v4mapped(struct in6_addr *a)
+{
+    return !a->s6_addr32[0] && !a->s6_addr32[1] && a->s6_addr32[2] == 0x0000FFFF;
+}
+
+static uint32_t ptrie_leaf(struct radix_ptrie *t, void *d)
+{
+    if (t->leaf_len == t->leaf_max) {
+	t->leaf_max = t->leaf_max ? 2 * t->leaf_max : 64;
+	t->leaf = Xrealloc(t->leaf, t->leaf_max * sizeof(void *));
+    }
+    t->leaf[t->leaf_len] = d;
+    return t->leaf_len++;
+}
+
+static uint32_t ptrie_nodes(struct radix_ptrie *t, uint32_t n)
+{
+    uint32_t res = t->node_len;
+    if (t->node_len + n > t->node_max) {
+	while (t->node_len + n > t->node_max)
+	    t->node_max = t->node_max ? 2 * t->node_max : 64;
+	t->node = Xrealloc(t->node, t->node_max * sizeof(struct radix_pnode));
+    }
+    t->node_len += n;
+    return res;
+}
+
+/*
+ * Splits prefixes p[0..n) for the 2^width slots at bit offset off. On
+ * return, leaf[s] holds the longest match within slot s among prefixes
+ * not longer than off + width, and first[s]/cnt[s] give the range of
+ * longer prefixes falling into slot s. Prefixes are sorted by address,
+ * then length, so covering prefixes are seen before covered ones.
+ */
+static void ptrie_split(struct radix_prefix *p, int n, int off, int width, void *dflt, void **leaf, int *first, int *cnt)
+{
+    int i, s, slots = 1 << width;
+
+    for (s = 0; s < slots; s++)
+	leaf[s] = dflt, cnt[s] = 0;
+
+    for (i = 0; i < n; i++) {
+	if (p[i].len <= off + width) {
+	    int start = width ? (int) key_bits(p[i].hi, p[i].lo, off, width) : 0;
+	    int count = 1 << (off + width - p[i].len);
+	    for (s = start; s < start + count; s++)
+		leaf[s] = p[i].d;
+	} else {
+	    s = width ? (int) key_bits(p[i].hi, p[i].lo, off, width) : 0;
+	    if (!cnt[s])
+		first[s] = i;
+	    cnt[s]++;
+	}
+    }
+}
+
+static void ptrie_node(struct radix_ptrie *t, uint32_t ni, struct radix_prefix *p, int n, int off, void *dflt)
+{
+    void *leaf[1 << RADIX_STRIDE];
+    int first[1 << RADIX_STRIDE], cnt[1 << RADIX_STRIDE];
+    uint64_t vector = 0, leafvec = 0;
+    uint32_t base0, base1, k;
+    int s, prev = -1;
+
+    ptrie_split(p, n, off, RADIX_STRIDE, dflt, leaf, first, cnt);
+
+    base0 = t->leaf_len;
+    for (s = 0; s < (1 << RADIX_STRIDE); s++)
+	if (cnt[s])
+	    vector |= 1ULL << s;
+	else if (prev < 0 || leaf[s] != leaf[prev]) {
+	    leafvec |= 1ULL << s;
+	    ptrie_leaf(t, leaf[s]);
+	    prev = s;
+	} else
+	    prev = s;
+
+    base1 = ptrie_nodes(t, (uint32_t) __builtin_popcountll(vector));
+    t->node[ni].vector = vector;
+    t->node[ni].leafvec = leafvec;
+    t->node[ni].base0 = base0;
+    t->node[ni].base1 = base1;
+
+    for (k = 0, s = 0; s < (1 << RADIX_STRIDE); s++)
+	if (cnt[s])
+	    ptrie_node(t, base1 + k++, p + first[s], cnt[s], off + RADIX_STRIDE, leaf[s]);
+}
+
+static void ptrie_build(struct radix_ptrie *t, struct radix_prefix *p, int n, void *dflt)
+{
+    int d, s, slots, *first, *cnt;
+    void **leaf;
+
+    /* direct pointing only pays off for larger tables */
+    d = n < 64 ? 0 : (n < 4096 ? 8 : 16);
+    slots = 1 << d;
+
+    t->direct_bits = d;
+    t->direct = Xcalloc(slots, sizeof(uint32_t));
+    leaf = Xcalloc(slots, sizeof(void *));
+    first = Xcalloc(slots, sizeof(int));
+    cnt = Xcalloc(slots, sizeof(int));
+
+    ptrie_split(p, n, 0, d, dflt, leaf, first, cnt);
+
+    for (s = 0; s < slots; s++)
+	if (cnt[s]) {
+	    t->direct[s] = ptrie_nodes(t, 1);
+	    ptrie_node(t, t->direct[s], p + first[s], cnt[s], d, leaf[s]);
+	} else if (s && leaf[s] == leaf[s - 1] && !cnt[s - 1])
+	    t->direct[s] = t->direct[s - 1];
+	else
+	    t->direct[s] = RADIX_LEAF | ptrie_leaf(t, leaf[s]);
+
+    free(leaf);
+    free(first);
+    free(cnt);
+}
+
+static void *ptrie_lookup(struct radix_ptrie *t, uint64_t hi, uint64_t lo)
+{
+    uint32_t e = t->direct[t->direct_bits ? key_bits(hi, lo, 0, t->direct_bits) : 0];
+    struct radix_pnode *n;
+    int off = t->direct_bits;
+
+    if (e & RADIX_LEAF)
+	return t->leaf[e & ~RADIX_LEAF];
+
+    n = t->node + e;
+    while (1) {
+	uint64_t bit = 1ULL << key_bits(hi, lo, off, RADIX_STRIDE);
+	uint64_t mask = (bit << 1) - 1;
+	if (!(n->vector & bit))
+	    return t->leaf[n->base0 + __builtin_popcountll(n->leafvec & mask) - 1];
+	n = t->node + n->base1 + __builtin_popcountll(n->vector & mask) - 1;
+	off += RADIX_STRIDE;
+    }
+}
+
+static void radix_compiled_free(struct radix_compiled **c)
+{
+    if (*c) {
+	struct radix_ptrie *t[2] = { &(*c)->v4, &(*c)->v6 };
+	int i;
+	for (i = 0; i < 2; i++) {
+	    free(t[i]->direct);
+	    free(t[i]->node);
+	    free(t[i]->leaf);
+	}
+	free(*c);
+	*c = NULL;
+    }
+}
+
+static void *radix_compiled_lookup(struct radix_compiled *c, struct in6_addr *a)
+{
+    if (is_v4mapped(a))
+	return ptrie_lookup(&c->v4, (uint64_t) a->s6_addr32[3] << 32, 0);
+    return ptrie_lookup(&c->v6, ((uint64_t) a->s6_addr32[0] << 32) | a->s6_addr32[1], ((uint64_t) a->s6_addr32[2] << 32) | a->s6_addr32[3]);
+}
+
+static void radix_collect(struct in6_addr *a, int m, void *d, void *data)
+{
+    struct radix_collect *rc = (struct radix_collect *) data;
+    struct radix_prefix *p;
+
+    if (m >= 96 && is_v4mapped(a)) {
+	p = &rc->v4[rc->v4_len++];
+	p->hi = (uint64_t) a->s6_addr32[3] << 32;
+	p->lo = 0;
+	p->len = m - 96;
+    } else {
+	struct in6_addr v4net = {.s6_addr32 = { 0, 0, 0x0000FFFF, 0 } }, n;
+	p = &rc->v6[rc->v6_len++];
+	p->hi = ((uint64_t) a->s6_addr32[0] << 32) | a->s6_addr32[1];
+	p->lo = ((uint64_t) a->s6_addr32[2] << 32) | a->s6_addr32[3];
+	p->len = m;
+	/* shorter prefixes covering ::ffff:0:0/96 apply to IPv4 as well */
+	v6_network(&n, &v4net, m);
+	if (!v6_cmp(&n, a) && m > rc->v4_default_len) {
+	    rc->v4_default_len = m;
+	    rc->v4_default = d;
+	}
+    }
+    p->d = d;
+}
+
+static void radix_count(struct in6_addr *a __attribute__((unused)), int m __attribute__((unused)), void *d __attribute__((unused)), void *data)
+{
+    (*(int *) data)++;
+}
+
+static int compare_prefix(const void *a, const void *b)
+{
+    const struct radix_prefix *x = (const struct radix_prefix *) a, *y = (const struct radix_prefix *) b;
+    if (x->hi != y->hi)
+	return x->hi < y->hi ? -1 : 1;
+    if (x->lo != y->lo)
+	return x->lo < y->lo ? -1 : 1;
+    return x->len - y->len;
+}
+
+void radix_compile(struct radixtree *rt)
+{
+    struct radix_collect rc;
+    int n = 0;
+
+    if (!rt)
+	return;
+
+    radix_compiled_free(&rt->compiled);
+    radix_walk(rt, radix_count, &n);
+
+    memset(&rc, 0, sizeof(rc));
+    rc.v4 = Xcalloc(n + 1, sizeof(struct radix_prefix));
+    rc.v6 = Xcalloc(n + 1, sizeof(struct radix_prefix));
+    rc.v4_default_len = -1;
+    radix_walk(rt, radix_collect, &rc);
+
+    qsort(rc.v4, rc.v4_len, sizeof(struct radix_prefix), compare_prefix);
+    qsort(rc.v6, rc.v6_len, sizeof(struct radix_prefix), compare_prefix);
+
+    rt->compiled = Xcalloc(1, sizeof(struct radix_compiled));
+    ptrie_build(&rt->compiled->v4, rc.v4, rc.v4_len, rc.v4_default);
+    ptrie_build(&rt->compiled->v6, rc.v6, rc.v6_len, NULL);
+
+    free(rc.v4);
+    free(rc.v6);
+}
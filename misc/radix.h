@@ -21,4 +21,5 @@ void *radix_lookup_str(radixtree_t *, char *, void **);
 void radix_drop(radixtree_t **, void *);
 radixtree_t *radix_new(void (*)(void *, void *), int(*)(void *, void *));
 void radix_walk(radixtree_t *, void (*f)(struct in6_addr *, int, void *, void *), void *);
+void radix_compile(radixtree_t *);
 #endif
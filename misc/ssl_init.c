@@ -14,6 +14,10 @@
 #include <sysexits.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+#include <openssl/core_names.h>
+#endif
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
@@ -75,6 +79,10 @@ SSL_CTX *ssl_init(char *cert_file, char *key_file, char *pem_phrase, char *ciphe
 	    logssl("SSL_CTX_set_tmp_rsa");
 	RSA_free(rsa);
     }
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    /* hand record encryption to the kernel after the handshake, if supported */
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
     if (ciphers && !SSL_CTX_set_cipher_list(ctx, ciphers))
 	logssl("SSL_CTX_set_cipher_list");
     if (pem_phrase) {
@@ -88,7 +96,115 @@ SSL_CTX *ssl_init(char *cert_file, char *key_file, char *pem_phrase, char *ciphe
     if (!SSL_CTX_check_private_key(ctx))
 	logssl("SSL_CTX_check_private_key");
     SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    /* required for resuming sessions with verified client certificates */
+    SSL_CTX_set_session_id_context(ctx, (u_char *) "ssl_init", 8);
 
     DebugOut(DEBUG_PROC);
     return ctx;
 }
+
+/*
+ * Non-zero if the kernel encrypts data written to the socket of s (kTLS).
+ * Plain write(2), writev(2) and sendfile(2) may be used on the socket then,
+ * with the result being a valid TLS record stream.
+ */
+int ssl_ktls_send(SSL * s)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    return BIO_get_ktls_send(SSL_get_wbio(s));
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Session ticket keys as distributed by spawnd: a 32 byte AES key followed
+ * by a 16 byte HMAC key. The key name is derived from the key revision.
+ * The current and the previous key are accepted for decryption; tickets
+ * encrypted with the latter get renewed.
+ */
+static struct ssl_ticket_key {
+    u_char name[16];
+    u_char aes[32];
+    u_char hmac[16];
+} ssl_ticket_keys[2];
+static int ssl_ticket_keys_count = 0;
+
+static struct ssl_ticket_key *ssl_ticket_key_find(u_char *name)
+{
+    int i;
+    for (i = 0; i < ssl_ticket_keys_count; i++)
+	if (!memcmp(name, ssl_ticket_keys[i].name, 16))
+	    return &ssl_ticket_keys[i];
+    return NULL;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+static int ssl_ticket_key_cb(SSL * s __attribute__((unused)), u_char *name, u_char *iv, EVP_CIPHER_CTX * cctx, EVP_MAC_CTX * hctx, int enc)
+{
+    struct ssl_ticket_key *k = enc ? &ssl_ticket_keys[0] : ssl_ticket_key_find(name);
+    OSSL_PARAM params[3];
+
+    if (!k)
+	return 0;
+    params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, k->hmac, sizeof(k->hmac));
+    params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "sha256", 0);
+    params[2] = OSSL_PARAM_construct_end();
+    if (enc) {
+	memcpy(name, k->name, 16);
+	if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1
+	    || !EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, k->aes, iv) || !EVP_MAC_CTX_set_params(hctx, params))
+	    return -1;
+	return 1;
+    }
+    if (!EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, k->aes, iv) || !EVP_MAC_CTX_set_params(hctx, params))
+	return -1;
+    return (k == &ssl_ticket_keys[0]) ? 1 : 2;
+}
+#else
+static int ssl_ticket_key_cb(SSL * s __attribute__((unused)), u_char *name, u_char *iv, EVP_CIPHER_CTX * cctx, HMAC_CTX * hctx, int enc)
+{
+    struct ssl_ticket_key *k = enc ? &ssl_ticket_keys[0] : ssl_ticket_key_find(name);
+
+    if (!k)
+	return 0;
+    if (enc) {
+	memcpy(name, k->name, 16);
+	if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1
+	    || !EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, k->aes, iv)
+	    || !HMAC_Init_ex(hctx, k->hmac, sizeof(k->hmac), EVP_sha256(), NULL))
+	    return -1;
+	return 1;
+    }
+    if (!EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, k->aes, iv) || !HMAC_Init_ex(hctx, k->hmac, sizeof(k->hmac), EVP_sha256(), NULL))
+	return -1;
+    return (k == &ssl_ticket_keys[0]) ? 1 : 2;
+}
+#endif
+
+void ssl_add_ticket_key(SSL_CTX * ctx, u_int keyrev, u_char *key, size_t keylen)
+{
+    struct ssl_ticket_key *k = &ssl_ticket_keys[0];
+
+    if (keylen != sizeof(k->aes) + sizeof(k->hmac))
+	return;
+    if (!ssl_ticket_keys_count) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+	SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ssl_ticket_key_cb);
+#else
+	SSL_CTX_set_tlsext_ticket_key_cb(ctx, ssl_ticket_key_cb);
+#endif
+    } else
+	ssl_ticket_keys[1] = ssl_ticket_keys[0];
+    if (ssl_ticket_keys_count < 2)
+	ssl_ticket_keys_count++;
+
+    memset(k->name, 0, sizeof(k->name));
+    memcpy(k->name, "spawnd", 6);
+    k->name[12] = (keyrev >> 24) & 0xff;
+    k->name[13] = (keyrev >> 16) & 0xff;
+    k->name[14] = (keyrev >> 8) & 0xff;
+    k->name[15] = keyrev & 0xff;
+    memcpy(k->aes, key, sizeof(k->aes));
+    memcpy(k->hmac, key + sizeof(k->aes), sizeof(k->hmac));
+}
@@ -10,4 +10,6 @@
 SSL_CTX *ssl_init(char *, char *, char *, char *);
 SSL_CTX *ssl_init_verify(SSL_CTX *, int, char *, char *);
 void ssl_set_verify(SSL_CTX *, void *);
+int ssl_ktls_send(SSL *);
+void ssl_add_ticket_key(SSL_CTX *, u_int, u_char *, size_t);
 #endif				/* __SSL_INIT_H__ */
@@ -94,7 +94,7 @@
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <fcntl.h>
-#if defined(__linux__)
+#if defined(__linux__) && !defined(_GNU_SOURCE)
 /* need to #include this before the openssl stuff ... */
 #define __USE_XOPEN
 #include <unistd.h>
@@ -373,6 +373,40 @@
 #if defined(__DragonFly__)
 #define WITH_SENDFILE
 #endif
+/*******************************************************************************
+ * sendmmsg(2)/recvmmsg(2):
+ */
+#if defined(__linux__) && OSLEVEL >= 0x03000000
+#define WITH_MMSG
+#endif
+#if defined(__FreeBSD__) && OSLEVEL >= 0x0b000000
+#define WITH_MMSG
+#endif
+/*******************************************************************************
+ * splice(2), sync_file_range(2), fallocate(2):
+ */
+#if defined(__linux__) && OSLEVEL >= 0x02060011
+#define WITH_SPLICE
+#define WITH_SYNC_FILE_RANGE
+#endif
+#if defined(__linux__) && OSLEVEL >= 0x02060017
+#define WITH_FALLOCATE
+#endif
+/*******************************************************************************
+ * getrandom(2), arc4random_buf(3):
+ */
+#if defined(__linux__) && OSLEVEL >= 0x03110000
+#define WITH_GETRANDOM
+#endif
+#if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__APPLE__) || defined(__DragonFly__)
+#define WITH_ARC4RANDOM
+#endif
+/*******************************************************************************
+ * Extended attributes, fgetxattr(2)/fsetxattr(2) with Linux semantics:
+ */
+#if defined(__linux__) && OSLEVEL >= 0x02040000
+#define WITH_XATTR
+#endif
 /*******************************************************************************
  * alloca(3) prototype:
  */
@@ -1373,6 +1373,111 @@ static void do_sshkeyhash(tac_session * session)
 }
 #endif
 
+#ifdef WITH_DNS
+struct io_dns_ctx *idc = NULL;
+
+static void set_revmap_nac(tac_session * session, char *hostname)
+{
+    report(session, LOG_DEBUG, DEBUG_LWRES_FLAG, "NAC revmap(%s) = %s", session->nac_address_ascii, hostname ? hostname : "(not found)");
+
+    if (hostname) {
+	session->nac_dns_name = memlist_strdup(session->memlist, hostname);
+	session->nac_dns_name_len = strlen(hostname);
+    }
+
+    session->revmap_pending = 0;
+
+    if (!session->ctx->revmap_pending && session->resumefn)
+	resume_session(session, -1);
+}
+
+static void set_revmap_nas(struct context *ctx, char *hostname)
+{
+    tac_session *session;
+    uint64_t id;
+
+    report(NULL, LOG_DEBUG, DEBUG_LWRES_FLAG, "NAS revmap(%s) = %s", ctx->nas_address_ascii, hostname ? hostname : "(not found)");
+
+    if (hostname) {
+	ctx->nas_dns_name = mempool_strdup(ctx->pool, hostname);
+	ctx->nas_dns_name_len = strlen(hostname);
+    }
+
+    ctx->revmap_pending = 0;
+
+    for (session = BT_first(ctx->sessions, &id); session; session = BT_next(ctx->sessions, &id))
+	if (!session->revmap_pending && session->resumefn)
+	    resume_session(session, -1);
+}
+#endif
+
+void get_revmap_nac(tac_session * session)
+{
+    if (!session->nac_address_valid)
+	return;
+    session->nac_dns_name = radix_lookup(dns_tree_ptr_static, &session->nac_address, NULL);
+    if (session->nac_dns_name)
+	session->nac_dns_name_len = strlen(session->nac_dns_name);
+#ifdef WITH_DNS
+    else if (config.dns_reverse_lookup) {
+	if (!idc)
+	    idc = io_dns_init(session->ctx->io);
+	session->revmap_pending = 1;
+	report(session, LOG_DEBUG, DEBUG_LWRES_FLAG, "Querying NAC revmap (%s)", session->nac_address_ascii);
+	/* cached answers are delivered right away */
+	io_dns_add_addr(idc, &session->nac_address, (void *) set_revmap_nac, session);
+    }
+#endif
+}
+
+void get_revmap_nas(struct context *ctx)
+{
+    ctx->nas_dns_name = radix_lookup(dns_tree_ptr_static, &ctx->nas_address, NULL);
+    if (ctx->nas_dns_name)
+	ctx->nas_dns_name_len = strlen(ctx->nas_dns_name);
+#ifdef WITH_DNS
+    else if (config.dns_reverse_lookup) {
+	if (!idc)
+	    idc = io_dns_init(ctx->io);
+	ctx->revmap_pending = 1;
+	report(NULL, LOG_DEBUG, DEBUG_LWRES_FLAG, "Querying NAS revmap (%s)", ctx->nas_address_ascii);
+	io_dns_add_addr(idc, &ctx->nas_address, (void *) set_revmap_nas, ctx);
+    }
+#endif
+}
+
+void resume_session(tac_session * session, int cur __attribute__((unused)))
+{
+    void (*resumefn)(tac_session *) = session->resumefn;
+    report(session, LOG_DEBUG, DEBUG_LWRES_FLAG, "resuming");
+    session->resumefn = NULL;
+#ifdef WITH_DNS
+    if (session->revmap_pending) {
+	io_dns_cancel(idc, session);
+	session->revmap_pending = 0;
+	session->revmap_timedout = 1;
+    }
+#endif
+    if (session->ctx->revmap_pending)
+	session->ctx->revmap_timedout = 1;
+    io_sched_del(session->ctx->io, session, (void *) resume_session);
+    resumefn(session);
+}
+
+/*
+ * Defers fn until pending reverse lookups for NAS and NAC have finished,
+ * for at most "dns timeout" seconds. Returns 0 if there's nothing to wait
+ * for, and fn should be called right away.
+ */
+int wait_revmap(tac_session * session, void (*fn)(tac_session *))
+{
+    if (!config.dns_timeout || !(session->revmap_pending || (session->ctx->revmap_pending && !session->ctx->revmap_timedout)))
+	return 0;
+    session->resumefn = fn;
+    io_sched_add(session->ctx->io, session, (void *) resume_session, (time_t) config.dns_timeout, 0);
+    return -1;
+}
+
 void authen(tac_session * session, tac_pak_hdr * hdr)
 {
     int username_required = 1;
@@ -1460,10 +1565,7 @@ void authen(tac_session * session, tac_pak_hdr * hdr)
 	    session->nac_address_ascii = memlist_strndup(session->memlist, p, start->rem_addr_len);
 	    session->nac_address_ascii_len = start->rem_addr_len;
 	    session->nac_address_valid = v6_ptoh(&session->nac_address, NULL, session->nac_address_ascii) ? 0 : 1;
-	    if (session->nac_address_valid)
-		session->nac_dns_name = radix_lookup(dns_tree_ptr_static, &session->nac_address, NULL);
-	    if (session->nac_dns_name)
-		session->nac_dns_name_len = strlen(session->nac_dns_name);
+	    get_revmap_nac(session);
 	    p += start->rem_addr_len;
 	    session->authen_data->data = (u_char *) memlist_strndup(session->memlist, p, start->data_len);
 	    session->authen_data->data_len = start->data_len;
@@ -1502,7 +1604,7 @@ void authen(tac_session * session, tac_pak_hdr * hdr)
     if (session->authen_data->authfn) {
 	if (username_required && !session->username[0])
 	    send_authen_error(session, "No username in packet");
-	else
+	else if (!wait_revmap(session, session->authen_data->authfn))
 	    session->authen_data->authfn(session);
     } else
 	send_authen_error(session, "Invalid or unsupported AUTHEN/START (action=%d authen_type=%d)", start->action, start->type);
@@ -76,6 +76,7 @@ void author(tac_session * session, tac_pak_hdr * hdr)
     u_char *p, *argsizep;
     char **cmd_argp;
     int i;
+    size_t len;
     struct author *pak = tac_payload(hdr, struct author *);
     struct author_data *data;
     enum token res = S_unknown;
@@ -123,18 +124,20 @@ void author(tac_session * session, tac_pak_hdr * hdr)
     session->nac_address_ascii_len = (size_t) pak->rem_addr_len;
     p += pak->rem_addr_len;
 
+    /* The input buffer is reused for the next packet, but evaluation may be deferred. */
     session->arg_cnt = pak->arg_cnt;
-    session->argp = p;
-    session->arg_len = argsizep;
+    for (i = 0, len = pak->arg_cnt; i < (int) pak->arg_cnt; i++)
+	len += argsizep[i];
+    session->arg_len = memlist_malloc(session->memlist, len);
+    memcpy(session->arg_len, argsizep, pak->arg_cnt);
+    session->argp = session->arg_len + pak->arg_cnt;
+    memcpy(session->argp, p, len - pak->arg_cnt);
 
     session->priv_lvl = pak->priv_lvl;
     session->privlvl_len = snprintf(session->privlvl, sizeof(session->privlvl), "%u", session->priv_lvl);
 
     session->nac_address_valid = v6_ptoh(&session->nac_address, NULL, session->nac_address_ascii) ? 0 : 1;
-    if (session->nac_address_valid)
-	session->nac_dns_name = radix_lookup(dns_tree_ptr_static, &session->nac_address, NULL);
-    if (session->nac_dns_name)
-	session->nac_dns_name_len = strlen(session->nac_dns_name);
+    get_revmap_nac(session);
 
     data = memlist_malloc(session->memlist, sizeof(struct author_data));
     data->in_cnt = pak->arg_cnt;
@@ -149,9 +152,10 @@ void author(tac_session * session, tac_pak_hdr * hdr)
 
     data->in_args = cmd_argp;	/* input command arguments */
     session->author_data = data;
-    session->in_length = session->ctx->in->length;
+    session->in_length = TAC_PLUS_HDR_SIZE + ntohl(hdr->datalength);
 
-    do_author(session);
+    if (!wait_revmap(session, do_author))
+	do_author(session);
 }
 
 #define is_separator(A) ((A) == '=' || (A) == '*')
@@ -277,6 +277,20 @@ void complete_realm(tac_realm * r)
 		report(NULL, LOG_ERR, ~0, "realm %s: tls_config_set_cert_mem failed", r->name);
 		exit(EX_CONFIG);
 	    }
+	    /*
+	     * Session tickets are encrypted with keys distributed by spawnd, so
+	     * the session id context needs to be identical across processes.
+	     */
+	    if (tls_config_set_session_lifetime(r->tls_cfg, TAC_TLS_SESSION_LIFETIME)) {
+		const char *terr = tls_config_error(r->tls_cfg);
+		report(NULL, LOG_ERR, ~0, "realm %s: tls_config_set_session_lifetime failed%s%s", r->name, terr ? ": " : "", terr ? terr : "");
+		exit(EX_CONFIG);
+	    }
+	    if (tls_config_set_session_id(r->tls_cfg, (u_char *) r->name, minimum((int) strlen(r->name), TLS_MAX_SESSION_ID_LENGTH))) {
+		const char *terr = tls_config_error(r->tls_cfg);
+		report(NULL, LOG_ERR, ~0, "realm %s: tls_config_set_session_id failed%s%s", r->name, terr ? ": " : "", terr ? terr : "");
+		exit(EX_CONFIG);
+	    }
 	    if (!(r->tls_ctx = tls_server())) {
 		report(NULL, LOG_ERR, ~0, "realm %s: tls_server() returned NULL", r->name);
 		exit(EX_CONFIG);
@@ -301,6 +315,13 @@ void complete_realm(tac_realm * r)
 	    r->caching_period = 0;
 
     }
+    /* host and net lookups happen per connection and per request */
+    radix_compile(r->hosttree);
+    if (r->nettable) {
+	rb_node_t *rbn;
+	for (rbn = RB_first(r->nettable); rbn; rbn = RB_next(rbn))
+	    radix_compile(RB_payload(rbn, tac_net *)->nettree);
+    }
     if (r->realms) {
 	rb_node_t *rbn;
 	for (rbn = RB_first(r->realms); rbn; rbn = RB_next(rbn))
@@ -408,6 +429,20 @@ void drop_mcx(tac_realm * r)
 	    drop_mcx(RB_payload(rbn, tac_realm *));
 }
 
+#ifdef WITH_TLS
+void add_tls_ticket_key(tac_realm * r, u_int keyrev, u_char * key, size_t keylen)
+{
+    rb_node_t *rbn;
+    if (r->tls_ctx && tls_config_add_ticket_key(r->tls_cfg, keyrev, key, keylen)) {
+	const char *terr = tls_config_error(r->tls_cfg);
+	report(NULL, LOG_ERR, ~0, "realm %s: tls_config_add_ticket_key failed%s%s", r->name, terr ? ": " : "", terr ? terr : "");
+    }
+    if (r->realms)
+	for (rbn = RB_first(r->realms); rbn; rbn = RB_next(rbn))
+	    add_tls_ticket_key(RB_payload(rbn, tac_realm *), keyrev, key, keylen);
+}
+#endif
+
 void expire_dynamic_users(tac_realm * r)
 {
     rb_node_t *rbn;
@@ -599,6 +634,32 @@ static void dns_add_a(rb_tree_t ** t, struct in6_addr *a, char *name)
     RB_insert(*t, dn);
 }
 
+#ifdef WITH_DNS
+/*
+ * Resolves a host or net name that isn't covered by "dns preload". The
+ * addresses go to the top-level realm, so each name is queried only once.
+ */
+static struct dns_forward_mapping *dns_resolve_a(char *name)
+{
+    struct dns_forward_mapping dn;
+    struct in6_addr a[16];
+    int i, count;
+    tac_realm *r = config.default_realm;
+
+    if (!strchr(name, '.') || strpbrk(name, "=/ "))
+	return NULL;
+
+    count = io_dns_resolve(name, a, 16, config.dns_timeout ? config.dns_timeout : 5);
+    report(NULL, LOG_DEBUG, DEBUG_LWRES_FLAG, "DNS lookup for %s: %d address(es)", name, count);
+    if (count < 1)
+	return NULL;
+    for (i = 0; i < count; i++)
+	dns_add_a(&r->dns_tree_a, &a[i], name);
+    dn.name = name;
+    return (struct dns_forward_mapping *) RB_lookup(r->dns_tree_a, &dn);
+}
+#endif
+
 static struct dns_forward_mapping *dns_lookup_a(tac_realm * r, char *name, int recurse)
 {
     while (r) {
@@ -610,9 +671,13 @@ static struct dns_forward_mapping *dns_lookup_a(tac_realm * r, char *name, int r
 		return res;
 	}
 	if (!recurse)
-	    return NULL;
+	    break;
 	r = r->parent;
     }
+#ifdef WITH_DNS
+    if (config.dns_forward_lookup)
+	return dns_resolve_a(name);
+#endif
     return NULL;
 }
 
@@ -975,8 +1040,23 @@ void parse_decls_real(struct sym *sym, tac_realm * r)
 		default:
 		    parse_error_expect(sym, S_address, S_file, S_unknown);
 		}
+	    case S_reverselookup:
+		sym_get(sym);
+		parse(sym, S_equal);
+		config.dns_reverse_lookup = parse_bool(sym) ? 1 : 0;
+		continue;
+	    case S_forwardlookup:
+		sym_get(sym);
+		parse(sym, S_equal);
+		config.dns_forward_lookup = parse_bool(sym) ? 1 : 0;
+		continue;
+	    case S_timeout:
+		sym_get(sym);
+		parse(sym, S_equal);
+		config.dns_timeout = parse_seconds(sym);
+		continue;
 	    default:
-		parse_error_expect(sym, S_preload, S_unknown);
+		parse_error_expect(sym, S_preload, S_reverselookup, S_forwardlookup, S_timeout, S_unknown);
 	    }
 	    continue;
 	case S_cache:
@@ -2736,6 +2816,7 @@ void cfg_init(void)
     init_timespec();
     memset(&config, 0, sizeof(struct config));
     config.mask = 0644;
+    config.dns_timeout = 5;
 
     {
 	struct utsname utsname;
@@ -239,7 +239,7 @@ void dump_nas_pak(tac_session * session, int bogus)
 {
     char *p;
     unsigned char *argsizep;
-    tac_pak_hdr *hdr = &session->ctx->in->hdr;
+    tac_pak_hdr *hdr = session->ctx->in;
 
     report(session, LOG_DEBUG, DEBUG_PACKET_FLAG, "---<start packet>---");
     dump_header(session, hdr, bogus);
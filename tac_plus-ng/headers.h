@@ -93,12 +93,16 @@
 
 #include "misc/radix.h"
 #include "misc/rb.h"
+#include "misc/btree.h"
 #include "misc/io_sched.h"
 #include "misc/sig_segv.h"
 #include "misc/setproctitle.h"
 #include "mavis/set_proctitle.h"
 #include "mavis/mavis.h"
 #include "misc/net.h"
+#ifdef WITH_DNS
+#include "misc/io_dns_revmap.h"
+#endif
 
 #define MD5_LEN           16
 #define MSCHAP_DIGEST_LEN 49
@@ -258,6 +262,9 @@ struct config {
     int retire;			/* die after <retire> invocations */
     time_t suicide;		/* when to commit suicide */
     tac_realm *default_realm;	/* actually the one called "default" */
+    int dns_timeout;		/* maximum wait for reverse lookups */
+     BISTATE(dns_reverse_lookup);	/* resolve NAS and NAC addresses */
+     BISTATE(dns_forward_lookup);	/* resolve unknown host and net names */
 };
 
 struct rewrite_expr {
@@ -650,6 +657,7 @@ struct tac_session {
     struct upwdat *passwdp;
     struct pwdat *enable;
     tac_profile *profile;
+    void (*resumefn)(tac_session *);	/* continuation after reverse lookup */
      BISTATE(nac_address_valid);
      BISTATE(flag_mavis_info);
      BISTATE(flag_mavis_auth);
@@ -692,11 +700,12 @@ struct context {
     int sock;			/* socket for this connection */
     io_context_t *io;
     tac_host *host;
-    tac_pak *in;
+    tac_pak_hdr *in;		/* packet being processed, points into inbuf */
     tac_pak *out;
+    tac_pak *out_last;		/* tail of the output queue */
     tac_pak *delayed;
     rb_tree_t *pool;		/* memory pool */
-    rb_tree_t *sessions;
+    bt_tree_t *sessions;	/* keyed by session_id */
     rb_tree_t *shellctxcache;
     tac_realm *realm;
     char *nas_dns_name;
@@ -705,13 +714,16 @@ struct context {
     size_t nas_address_ascii_len;
     struct in6_addr nas_address;	/* host byte order */
     u_char flags;		/* TAC_PLUS_SINGLE_CONNECT_FLAG */
-    tac_pak_hdr hdr;
-    ssize_t hdroff;
+    u_char *inbuf;		/* input buffer */
+    size_t inbuf_size;
+    size_t inbuf_off;		/* start of unprocessed data */
+    size_t inbuf_len;		/* end of valid data */
     struct tac_key *key;
     struct pwdat *enable[TAC_PLUS_PRIV_LVL_MAX + 1];	/* enable passwords */
     time_t last_io;
 #ifdef WITH_TLS
     struct tls *tls_ctx;
+    u_char *tls_outbuf;		/* coalesced output, one TLS record */
     const char *tls_conn_version;
     size_t tls_conn_version_len;
     const char *tls_conn_cipher;
@@ -859,8 +871,10 @@ radixtree_t *lookup_hosttree(tac_realm *);
 
 #define LOG_ACCESS 0x80000000
 
-void get_revmap_nac(tac_session *, tac_host **, int, int);
+void get_revmap_nac(tac_session *);
 void get_revmap_nas(struct context *);
+int wait_revmap(tac_session *, void (*)(tac_session *));
+void resume_session(tac_session *, int);
 void get_pkt_data(tac_session *, struct authen_start *, struct author *);
 
 enum token tac_script_eval_r(tac_session *, struct tac_script_action *);
@@ -875,12 +889,19 @@ void expire_dynamic_users(tac_realm *);
 void drop_mcx(tac_realm *);
 void init_mcx(tac_realm *);
 void complete_realm(tac_realm *);
+#ifdef WITH_TLS
+#define TAC_TLS_SESSION_LIFETIME 7200
+void add_tls_ticket_key(tac_realm *, u_int, u_char *, size_t);
+#endif
 
 #ifdef TPNG_EXPERIMENTAL
 enum token validate_ssh_hash(tac_session *, char *);
 #endif
 
 extern radixtree_t *dns_tree_ptr_static;
+#ifdef WITH_DNS
+extern struct io_dns_ctx *idc;
+#endif
 extern struct config config;
 extern int die_when_idle;
 
@@ -84,11 +84,6 @@ static void cleanup_spawnd(struct context *ctx __attribute__((unused)), int cur
     set_proctitle(ACCEPT_NEVER);
 }
 
-static int compare_session(const void *a, const void *b)
-{
-    return ((tac_session *) a)->session_id - ((tac_session *) b)->session_id;
-}
-
 static u_int context_id = 0;
 
 struct context *new_context(struct io_context *io, tac_realm * r)
@@ -98,7 +93,7 @@ struct context *new_context(struct io_context *io, tac_realm * r)
     c->pool = mempool_create();
     RB_insert(c->pool, c);
     if (r) {
-	c->sessions = RB_tree_new(compare_session, NULL);
+	c->sessions = BT_tree_new(NULL);
 	c->id = context_id++;
 	c->realm = r;
 	c->debug = r->debug;
@@ -147,23 +142,21 @@ static void periodics(struct context *ctx, int cur __attribute__((unused)))
 
 static void periodics_ctx(struct context *ctx, int cur __attribute__((unused)))
 {
-    rb_node_t *rbn, *rbnext;
+    tac_session *s;
+    uint64_t id;
 
     if (!ctx->out && !ctx->delayed && (ctx->host->tcp_timeout || ctx->dying) && (ctx->last_io + ctx->host->tcp_timeout < io_now.tv_sec)) {
 	cleanup(ctx, ctx->sock);
 	return;
     }
 
-    for (rbn = RB_first(ctx->sessions); rbn; rbn = rbnext) {
-	tac_session *s = RB_payload(rbn, tac_session *);
-	rbnext = RB_next(rbn);
+    for (s = BT_first(ctx->sessions, &id); s; s = BT_next(ctx->sessions, &id))
 	if (s->session_timeout < io_now.tv_sec)
 	    cleanup_session(s);
-    }
 
     tac_script_expire_exec_context(ctx);
 
-    if (ctx->cleanup_when_idle && !ctx->out && !ctx->delayed && !RB_first(ctx->sessions) && !RB_first(ctx->shellctxcache))
+    if (ctx->cleanup_when_idle && !ctx->out && !ctx->delayed && !BT_count(ctx->sessions) && !RB_first(ctx->shellctxcache))
 	cleanup(ctx, ctx->sock);
     else
 	io_sched_renew_proc(ctx->io, ctx, (void *) periodics_ctx);
@@ -212,6 +205,7 @@ int main(int argc, char **argv, char **envp)
     }
     cfg_read_config(common_data.conffile, parse_decls, common_data.id ? common_data.id : common_data.progname);
     complete_realm(config.default_realm);
+    radix_compile(dns_tree_ptr_static);
 
     if (common_data.parse_only)
 	tac_exit(EX_OK);
@@ -265,7 +259,8 @@ int main(int argc, char **argv, char **envp)
 
 void cleanup(struct context *ctx, int cur)
 {
-    rb_node_t *t, *u;
+    tac_session *s;
+    uint64_t id;
 
     if (ctx == ctx_spawnd) {
 	cleanup_spawnd(ctx, cur);
@@ -293,17 +288,20 @@ void cleanup(struct context *ctx, int cur)
     while (io_sched_pop(ctx->io, ctx));
     io_close(ctx->io, ctx->sock);
 
-    for (t = RB_first(ctx->sessions); t; t = u) {
-	u = RB_next(t);
-	cleanup_session(RB_payload(t, tac_session *));
-    }
+    for (s = BT_first(ctx->sessions, &id); s; s = BT_next(ctx->sessions, &id))
+	cleanup_session(s);
 
     if (ctx->sessions)
-	RB_tree_delete(ctx->sessions);
+	BT_tree_delete(ctx->sessions);
 
     if (ctx->shellctxcache)
 	RB_tree_delete(ctx->shellctxcache);
 
+#ifdef WITH_DNS
+    if (ctx->revmap_pending)
+	io_dns_cancel(idc, ctx);
+#endif
+
     mempool_destroy(ctx->pool);
 
     if (ctx_spawnd) {
@@ -849,7 +847,9 @@ static void accept_control_common(int s, struct scm_data_accept *sd, sockaddr_un
     }
 
     ctx->nas_address = addr;	// FIXME, use origin
-    ctx->nas_dns_name = radix_lookup(dns_tree_ptr_static, &addr, NULL);	// FIXME
+    ctx->nas_address_ascii = ctx->peer_addr_ascii;	//  FIXME, use origin
+    ctx->nas_address_ascii_len = strlen(ctx->peer_addr_ascii);	// FIXME, use origin
+    get_revmap_nas(ctx);
     if (vrf_len)
 	ctx->vrf = mempool_strndup(ctx->pool, (u_char *) vrf, vrf_len);
     ctx->vrf_len = vrf_len;
@@ -893,9 +893,6 @@ static void accept_control_final(struct context *ctx)
 	report(&session, LOG_DEBUG, DEBUG_PACKET_FLAG, "connection request from %s (realm: %s%s%s)", ctx->peer_addr_ascii, ctx->realm->name,
 	       ctx->vrf ? ", vrf: " : "", ctx->vrf ? ctx->vrf : "");
 
-    ctx->nas_address_ascii = ctx->peer_addr_ascii;	//  FIXME, use origin
-    ctx->nas_address_ascii_len = strlen(ctx->peer_addr_ascii);	// FIXME, use origin
-
     io_register(ctx->io, ctx->sock, ctx);
     io_set_cb_i(ctx->io, ctx->sock, (void *) tac_read);
     io_set_cb_o(ctx->io, ctx->sock, (void *) tac_write);
@@ -922,13 +919,16 @@ static void accept_control_final(struct context *ctx)
 static void accept_control(struct context *ctx, int cur)
 {
     int s, one = 1;
-    struct scm_data_accept sd;
+    union {
+	struct scm_data_accept sd;
+	struct scm_data_tls_keys tk;
+    } u;
 
-    if (common_data.scm_recv_msg(cur, &sd, sizeof(sd), &s)) {
+    if (common_data.scm_recv_msg(cur, &u.sd, sizeof(u), &s)) {
 	cleanup_spawnd(ctx, cur);
 	return;
     }
-    switch (sd.type) {
+    switch (u.sd.type) {
     case SCM_MAY_DIE:
 	cleanup_spawnd(ctx, cur);
 	return;
@@ -937,11 +937,17 @@ static void accept_control(struct context *ctx, int cur)
 	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char *) &one, (socklen_t) sizeof(one));
 	common_data.users_cur++;
 	set_proctitle(die_when_idle ? ACCEPT_NEVER : ACCEPT_YES);
-	if (sd.haproxy)
-	    accept_control_px(s, &sd);
+	if (u.sd.haproxy)
+	    accept_control_px(s, &u.sd);
 	else
-	    accept_control_raw(s, &sd);
+	    accept_control_raw(s, &u.sd);
+	return;
+#ifdef WITH_TLS
+    case SCM_TLS_KEYS:
+	add_tls_ticket_key(config.default_realm, u.tk.keyrev, u.tk.key, sizeof(u.tk.key));
+	memset(&u, 0, sizeof(u));
 	return;
+#endif
     default:
 	if (s > -1)
 	    close(s);
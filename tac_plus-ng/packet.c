@@ -58,9 +58,14 @@
 
 #include "headers.h"
 #include "misc/mymd5.h"
+#include <sys/uio.h>
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
+#define TAC_INBUF_SIZE 4096	/* initial input buffer size per connection */
+#define TAC_WRITEV_MAX 64	/* packets per writev(2) */
+#define TAC_TLS_RECORD 16384	/* maximum TLS record payload */
+
 static void write_packet(struct context *, tac_pak *);
 static tac_session *new_session(struct context *, tac_pak_hdr *);
 
@@ -336,8 +341,6 @@ static void delay_packet(struct context *ctx, tac_pak * p, int delay)
 /* write a packet to the wire, encrypting it */
 static void write_packet(struct context *ctx, tac_pak * p)
 {
-    tac_pak **pp;
-
     if ((common_data.debug | ctx->debug) & DEBUG_PACKET_FLAG) {
 	tac_session dummy_session;
 	memset(&dummy_session, 0, sizeof(dummy_session));
@@ -355,8 +358,13 @@ static void write_packet(struct context *ctx, tac_pak * p)
     if (!ctx->unencrypted_flag && ctx->key)
 	md5_xor(&p->hdr, ctx->key->key, ctx->key->len);
 
-    for (pp = &ctx->out; *pp; pp = &(*pp)->next);
-    *pp = p;
+    /* queued only, tac_write() flushes all replies of this loop iteration at once */
+    p->next = NULL;
+    if (ctx->out)
+	ctx->out_last->next = p;
+    else
+	ctx->out = p;
+    ctx->out_last = p;
 
     io_set_o(ctx->io, ctx->sock);
 }
@@ -414,139 +422,85 @@ static int accounting_pak_looks_bogus(tac_pak_hdr * hdr)
 }
 
 
-static __inline__ tac_session *RB_lookup_session(rb_tree_t * rbt, int session_id)
-{
-    tac_session s;
-    s.session_id = session_id;
-    return RB_lookup(rbt, &s);
-}
-
-void tac_read(struct context *ctx, int cur)
+/*
+ * Processes a single complete packet. The packet is decrypted in place.
+ * Returns -1 if the context is gone.
+ */
+static int tac_process(struct context *ctx, int cur, tac_pak_hdr * hdr)
 {
-    ssize_t len;
     tac_session *session;
     char msg[80];
-    u_int data_len;
     int more_keys = 0;
-    int min_len = 1;
 
-    ctx->last_io = io_now.tv_sec;
-
-    if (ctx->hdroff != TAC_PLUS_HDR_SIZE) {
-#ifdef WITH_TLS
-	if (ctx->tls_ctx)
-	    len = io_TLS_read(ctx->tls_ctx, ((u_char *) & ctx->hdr) + ctx->hdroff, TAC_PLUS_HDR_SIZE - ctx->hdroff, ctx->io, cur, (void *) tac_read);
-	else
-#endif
-	    len = read(cur, ((u_char *) & ctx->hdr) + ctx->hdroff, TAC_PLUS_HDR_SIZE - ctx->hdroff);
-	if (len <= 0) {
-	    cleanup(ctx, cur);
-	    return;
-	}
-	ctx->hdroff += len;
-	min_len = 0;
-    }
-    if (ctx->hdroff != TAC_PLUS_HDR_SIZE)
-	return;
-    if ((ctx->hdr.version & TAC_PLUS_MAJOR_VER_MASK) != TAC_PLUS_MAJOR_VER) {
-	report(NULL, LOG_ERR, ~0, "%s: Illegal major version specified: found %d wanted %d", ctx->nas_address_ascii, ctx->hdr.version, TAC_PLUS_MAJOR_VER);
-	cleanup(ctx, cur);
-	return;
-    }
-    data_len = ntohl(ctx->hdr.datalength);
-
-    if (data_len & ~0xffffUL) {
-	report(NULL, LOG_ERR, ~0, "%s: Illegal data size: %u", ctx->nas_address_ascii, data_len);
-	cleanup(ctx, cur);
-	return;
-    }
-    if (!ctx->in)
-	ctx->in = mempool_malloc(ctx->pool, sizeof(tac_pak) + data_len);
-    memcpy(&ctx->in->hdr, &ctx->hdr, TAC_PLUS_HDR_SIZE);
-    ctx->in->offset = TAC_PLUS_HDR_SIZE;
-    ctx->in->length = TAC_PLUS_HDR_SIZE + data_len;
-#ifdef WITH_TLS
-    if (ctx->tls_ctx)
-	len = io_TLS_read(ctx->tls_ctx, (u_char *) & ctx->in->hdr + ctx->in->offset, ctx->in->length - ctx->in->offset, ctx->io, cur, (void *) tac_read);
-    else
-#endif
-	len = read(cur, (u_char *) & ctx->in->hdr + ctx->in->offset, ctx->in->length - ctx->in->offset);
-    if (len < min_len && min_len) {
-	cleanup(ctx, cur);
-	return;
-    }
-    ctx->in->offset += len;
-    if (ctx->in->offset != ctx->in->length)
-	return;
-
-    session = RB_lookup_session(ctx->sessions, ctx->hdr.session_id);
+    session = BT_lookup(ctx->sessions, (uint32_t) hdr->session_id);
 
     if (session) {
 	session->seq_no++;
 	if (!session->user_is_session_specific)
 	    session->user = NULL;	/* may be outdated */
-	if (session->seq_no != ctx->hdr.seq_no) {
+	if (session->seq_no != hdr->seq_no) {
 	    report(session, LOG_ERR, ~0,
 		   "%s: Illegal sequence number %d (!= %d) for session %.8x",
-		   ctx->nas_address_ascii, (int) ctx->hdr.seq_no, (int) session->seq_no, ntohl(ctx->hdr.session_id));
+		   ctx->nas_address_ascii, (int) hdr->seq_no, (int) session->seq_no, ntohl(hdr->session_id));
 	    cleanup(ctx, cur);
-	    return;
+	    return -1;
 	}
     } else {
-	if (ctx->hdr.seq_no != 1) {
+	if (hdr->seq_no != 1) {
 	    report(NULL, LOG_ERR, ~0,
-		   "%s: %s packet (sequence number: %d) for session %.8x", "Stray", ctx->nas_address_ascii, (int) ctx->hdr.seq_no,
-		   ntohl(ctx->hdr.session_id));
+		   "%s: %s packet (sequence number: %d) for session %.8x", "Stray", ctx->nas_address_ascii, (int) hdr->seq_no, ntohl(hdr->session_id));
 	    cleanup(ctx, cur);
-	    return;
+	    return -1;
 	}
-	session = new_session(ctx, &ctx->hdr);
+	session = new_session(ctx, hdr);
     }
 
-    if ((ctx->in->hdr.flags & TAC_PLUS_UNENCRYPTED_FLAG)) {
+    if ((hdr->flags & TAC_PLUS_UNENCRYPTED_FLAG)) {
 #ifdef WITH_TLS
 	if (!ctx->tls_ctx) {
 #endif
 	    report(NULL, LOG_ERR, ~0,
-		   "%s: %s packet (sequence number: %d) for session %.8x", "Unencrypted", ctx->nas_address_ascii, (int) ctx->hdr.seq_no,
-		   ntohl(ctx->hdr.session_id));
+		   "%s: %s packet (sequence number: %d) for session %.8x", "Unencrypted", ctx->nas_address_ascii, (int) hdr->seq_no,
+		   ntohl(hdr->session_id));
 	    cleanup(ctx, cur);
-	    return;
+	    return -1;
 #ifdef WITH_TLS
 	}
 	ctx->unencrypted_flag = 1;
 #endif
     }
 
-    if ((ctx->in->hdr.flags & TAC_PLUS_SINGLE_CONNECT_FLAG) && (ctx->host->single_connection == TRISTATE_YES)) {
+    if ((hdr->flags & TAC_PLUS_SINGLE_CONNECT_FLAG) && (ctx->host->single_connection == TRISTATE_YES)) {
 	ctx->flags |= TAC_PLUS_SINGLE_CONNECT_FLAG;
 	ctx->single_connection_flag = 1;
     }
 
-    snprintf(msg, sizeof msg, "Illegal packet (version=0x%.2x type=0x%.2x)", ctx->in->hdr.version, ctx->in->hdr.type);
+    snprintf(msg, sizeof msg, "Illegal packet (version=0x%.2x type=0x%.2x)", hdr->version, hdr->type);
+
+    ctx->in = hdr;
 
     do {
 	int bogus = 0;
 
 	if (!ctx->unencrypted_flag) {
 	    if (more_keys) {
-		md5_xor(&ctx->in->hdr, ctx->key->key, ctx->key->len);
+		md5_xor(hdr, ctx->key->key, ctx->key->len);
 		ctx->key = ctx->key->next;
 		more_keys = 0;
 	    }
 	    if (ctx->key)
-		md5_xor(&ctx->in->hdr, ctx->key->key, ctx->key->len);
+		md5_xor(hdr, ctx->key->key, ctx->key->len);
 	}
 
-	switch (ctx->hdr.type) {
+	switch (hdr->type) {
 	case TAC_PLUS_AUTHEN:
-	    bogus = authen_pak_looks_bogus(&ctx->in->hdr);
+	    bogus = authen_pak_looks_bogus(hdr);
 	    break;
 	case TAC_PLUS_AUTHOR:
-	    bogus = author_pak_looks_bogus(&ctx->in->hdr);
+	    bogus = author_pak_looks_bogus(hdr);
 	    break;
 	case TAC_PLUS_ACCT:
-	    bogus = accounting_pak_looks_bogus(&ctx->in->hdr);
+	    bogus = accounting_pak_looks_bogus(hdr);
 	    break;
 	default:
 	    // Unknown header type, there's no gain in checking secondary keys.
@@ -559,25 +513,25 @@ void tac_read(struct context *ctx, int cur)
 	if ((common_data.debug | ctx->debug) & DEBUG_PACKET_FLAG)
 	    dump_nas_pak(session, bogus);
 
-	switch (ctx->hdr.type) {
+	switch (hdr->type) {
 
 	case TAC_PLUS_AUTHEN:
-	    if (!bogus && (ctx->in->hdr.version == TAC_PLUS_VER_DEFAULT || ctx->in->hdr.version == TAC_PLUS_VER_ONE))
-		authen(session, &ctx->in->hdr);
+	    if (!bogus && (hdr->version == TAC_PLUS_VER_DEFAULT || hdr->version == TAC_PLUS_VER_ONE))
+		authen(session, hdr);
 	    else
 		send_authen_error(session, "%s", msg);
 	    break;
 
 	case TAC_PLUS_AUTHOR:
-	    if (!bogus && (ctx->in->hdr.version == TAC_PLUS_VER_DEFAULT || (session->ctx->bug_compatibility & CLIENT_BUG_BAD_VERSION)))
-		author(session, &ctx->in->hdr);
+	    if (!bogus && (hdr->version == TAC_PLUS_VER_DEFAULT || (session->ctx->bug_compatibility & CLIENT_BUG_BAD_VERSION)))
+		author(session, hdr);
 	    else
 		send_author_reply(session, TAC_PLUS_AUTHOR_STATUS_ERROR, msg, NULL, 0, NULL);
 	    break;
 
 	case TAC_PLUS_ACCT:
-	    if (!bogus && (ctx->in->hdr.version == TAC_PLUS_VER_DEFAULT || (session->ctx->bug_compatibility & CLIENT_BUG_BAD_VERSION)))
-		accounting(session, &ctx->in->hdr);
+	    if (!bogus && (hdr->version == TAC_PLUS_VER_DEFAULT || (session->ctx->bug_compatibility & CLIENT_BUG_BAD_VERSION)))
+		accounting(session, hdr);
 	    else
 		send_acct_reply(session, TAC_PLUS_ACCT_STATUS_ERROR, msg, NULL);
 	    break;
@@ -592,8 +546,93 @@ void tac_read(struct context *ctx, int cur)
 	report(NULL, LOG_INFO, ~0, "%s uses deprecated key (line %d)", ctx->nas_address_ascii, ctx->key->line);
 
     ctx->key_fixed = 1;
-    mempool_free(ctx->pool, &ctx->in);
-    ctx->hdroff = 0;
+    ctx->in = NULL;
+
+    if (ctx->dying && !ctx->out && !ctx->delayed) {
+	/* cleanup_session() deferred this while the packet was being processed */
+	cleanup(ctx, cur);
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * Reads as much as is available into the connection's input buffer, then
+ * processes every complete packet in it. Only an incomplete trailing packet
+ * is moved to the start of the buffer before the next read, so a NAS that
+ * multiplexes many sessions over a single connection costs one read(2) per
+ * wakeup instead of two per packet.
+ */
+void tac_read(struct context *ctx, int cur)
+{
+    ssize_t len;
+    size_t room;
+
+    ctx->last_io = io_now.tv_sec;
+
+    do {
+	if (ctx->inbuf_off) {
+	    ctx->inbuf_len -= ctx->inbuf_off;
+	    memmove(ctx->inbuf, ctx->inbuf + ctx->inbuf_off, ctx->inbuf_len);
+	    ctx->inbuf_off = 0;
+	}
+	if (!ctx->inbuf) {
+	    ctx->inbuf_size = TAC_INBUF_SIZE;
+	    ctx->inbuf = mempool_malloc(ctx->pool, ctx->inbuf_size);
+	}
+
+	room = ctx->inbuf_size - ctx->inbuf_len;
+#ifdef WITH_TLS
+	if (ctx->tls_ctx)
+	    len = io_TLS_read(ctx->tls_ctx, ctx->inbuf + ctx->inbuf_len, room, ctx->io, cur, (void *) tac_read);
+	else
+#endif
+	    len = read(cur, ctx->inbuf + ctx->inbuf_len, room);
+	if (len <= 0) {
+	    if (len < 0 && errno == EAGAIN)
+		return;
+	    cleanup(ctx, cur);
+	    return;
+	}
+	ctx->inbuf_len += len;
+
+	while (!ctx->dying && ctx->inbuf_len - ctx->inbuf_off >= TAC_PLUS_HDR_SIZE) {
+	    tac_pak_hdr *hdr = (tac_pak_hdr *) (ctx->inbuf + ctx->inbuf_off);
+	    u_int data_len = ntohl(hdr->datalength);
+	    size_t pak_len;
+
+	    if ((hdr->version & TAC_PLUS_MAJOR_VER_MASK) != TAC_PLUS_MAJOR_VER) {
+		report(NULL, LOG_ERR, ~0, "%s: Illegal major version specified: found %d wanted %d", ctx->nas_address_ascii, hdr->version,
+		       TAC_PLUS_MAJOR_VER);
+		cleanup(ctx, cur);
+		return;
+	    }
+	    if (data_len & ~0xffffUL) {
+		report(NULL, LOG_ERR, ~0, "%s: Illegal data size: %u", ctx->nas_address_ascii, data_len);
+		cleanup(ctx, cur);
+		return;
+	    }
+
+	    pak_len = TAC_PLUS_HDR_SIZE + data_len;
+	    if (ctx->inbuf_len - ctx->inbuf_off < pak_len) {
+		if (pak_len > ctx->inbuf_size) {
+		    /* grow the buffer for the next read, the packet will be moved to its start first */
+		    ctx->inbuf_size = pak_len;
+		    ctx->inbuf = mempool_realloc(ctx->pool, ctx->inbuf, ctx->inbuf_size);
+		}
+		break;
+	    }
+
+	    ctx->inbuf_off += pak_len;
+	    if (tac_process(ctx, cur, hdr))
+		return;
+	}
+
+	if (ctx->inbuf_off == ctx->inbuf_len)
+	    ctx->inbuf_off = ctx->inbuf_len = 0;
+
+	/* a full buffer may leave data behind, in particular inside the TLS layer */
+    } while (!ctx->dying && (size_t) len == room);
 }
 
 #ifdef WITH_TLS
@@ -609,6 +648,49 @@ static void tls_shutdown_sock(struct context *ctx, int cur)
 }
 #endif
 
+/* Drops len written bytes from the output queue. */
+static void tac_written(struct context *ctx, size_t len)
+{
+    while (len) {
+	size_t l = (size_t) minimum((int) (ctx->out->length - ctx->out->offset), (int) len);
+	ctx->out->offset += l;
+	len -= l;
+	if (ctx->out->offset == ctx->out->length) {
+	    tac_pak *n = ctx->out->next;
+	    mempool_free(ctx->pool, &ctx->out);
+	    ctx->out = n;
+	}
+    }
+}
+
+#ifdef WITH_TLS
+/*
+ * Copies queued packets into the TLS output buffer, so they go out as a
+ * single record. Unwritten data stays at the start of the buffer, as the
+ * TLS layer expects on retries.
+ */
+static size_t tac_tls_gather(struct context *ctx)
+{
+    tac_pak *p;
+    size_t len = 0;
+
+    if (!ctx->tls_outbuf)
+	ctx->tls_outbuf = mempool_malloc(ctx->pool, TAC_TLS_RECORD);
+
+    for (p = ctx->out; p && len < TAC_TLS_RECORD; p = p->next) {
+	size_t l = (size_t) minimum((int) (p->length - p->offset), (int) (TAC_TLS_RECORD - len));
+	memcpy(ctx->tls_outbuf + len, (u_char *) & p->hdr + p->offset, l);
+	len += l;
+    }
+    return len;
+}
+#endif
+
+/*
+ * Writes all queued replies with a single writev(2), or as one TLS record.
+ * Replies are only queued by write_packet(), so everything that sessions on a
+ * single connection produced during one event loop iteration leaves together.
+ */
 void tac_write(struct context *ctx, int cur)
 {
     ctx->last_io = io_now.tv_sec;
@@ -616,24 +698,26 @@ void tac_write(struct context *ctx, int cur)
 	ssize_t len;
 #ifdef WITH_TLS
 	if (ctx->tls_ctx)
-	    len =
-		io_TLS_write(ctx->tls_ctx, (u_char *) & ctx->out->hdr + ctx->out->offset, ctx->out->length - ctx->out->offset, ctx->io, cur,
-			     (void *) tac_write);
+	    len = io_TLS_write(ctx->tls_ctx, ctx->tls_outbuf, tac_tls_gather(ctx), ctx->io, cur, (void *) tac_write);
 	else
 #endif
-	    len = write(cur, (u_char *) & ctx->out->hdr + ctx->out->offset, ctx->out->length - ctx->out->offset);
+	{
+	    struct iovec iov[TAC_WRITEV_MAX];
+	    int iovcnt;
+	    tac_pak *p;
+
+	    for (p = ctx->out, iovcnt = 0; p && iovcnt < TAC_WRITEV_MAX; p = p->next, iovcnt++) {
+		iov[iovcnt].iov_base = (u_char *) & p->hdr + p->offset;
+		iov[iovcnt].iov_len = (size_t) (p->length - p->offset);
+	    }
+	    len = writev(cur, iov, iovcnt);
+	}
 	if (len < 0) {
 	    if (errno != EAGAIN)
 		cleanup(ctx, cur);
 	    return;
 	}
-
-	ctx->out->offset += len;
-	if (ctx->out->offset == ctx->out->length) {
-	    tac_pak *n = ctx->out->next;
-	    mempool_free(ctx->pool, &ctx->out);
-	    ctx->out = n;
-	}
+	tac_written(ctx, (size_t) len);
     }
     io_clr_o(ctx->io, cur);
 
@@ -674,7 +758,7 @@ static tac_session *new_session(struct context *ctx, tac_pak_hdr * hdr)
     session->session_timeout = io_now.tv_sec + ctx->host->session_timeout;
     session->type = types[hdr->type & 3].str;
     session->type_len = types[hdr->type & 3].str_len;
-    RB_insert(ctx->sessions, session);
+    BT_insert(ctx->sessions, (uint32_t) session->session_id, session);
 
     if ((ctx->host->single_connection == TRISTATE_YES) && !ctx->single_connection_flag) {
 	if (ctx->single_connection_test)
@@ -695,23 +779,28 @@ static tac_session *new_session(struct context *ctx, tac_pak_hdr * hdr)
 void cleanup_session(tac_session * session)
 {
     struct context *ctx = session->ctx;
-    tac_session s;
     mavis_ctx *mcx = lookup_mcx(session->ctx->realm);
 
     if (session->user && session->user_is_session_specific)
 	free_user(session->user);
 
-    s.session_id = session->session_id;
-    RB_search_and_delete(ctx->sessions, &s);
+    if (session->resumefn)
+	io_sched_del(ctx->io, session, (void *) resume_session);
+
+    BT_delete(ctx->sessions, (uint32_t) session->session_id);
 
     if (session->mavis_pending && mcx)
 	mavis_cancel(mcx, session);
+#ifdef WITH_DNS
+    if (session->revmap_pending)
+	io_dns_cancel(idc, session);
+#endif
 
     memlist_destroy(session->memlist);
     mempool_free(ctx->pool, &session);
     if ((ctx->cleanup_when_idle == TRISTATE_YES)
-	&& (!ctx->single_connection_flag || (die_when_idle && !RB_first(ctx->sessions) && !RB_first(ctx->shellctxcache)))) {
-	if (ctx->out || ctx->delayed)	// pending output
+	&& (!ctx->single_connection_flag || (die_when_idle && !BT_count(ctx->sessions) && !RB_first(ctx->shellctxcache)))) {
+	if (ctx->out || ctx->delayed || ctx->in)	// pending output, or tac_process() still uses the input buffer
 	    ctx->dying = 1;
 	else
 	    cleanup(ctx, ctx->sock);
@@ -93,7 +93,7 @@ static void do_accept_c(struct context *ctx, int cur)
 void accepted_raw(int s, struct scm_data_accept *sd __attribute__((unused)))
 {
     static u_long id = 0;
-    int bufsize = BUFSIZE + 512;
+    int bufsize = (int) window_high;
     int one = 1;
     struct context *ctx;
 
@@ -107,6 +107,12 @@ void accepted_raw(int s, struct scm_data_accept *sd __attribute__((unused)))
     io_register(ctx->io, s, ctx);
     ctx->ifn = s;
     ctx->is_client = 1;
+    if (balance == BALANCE_HASH) {
+	sockaddr_union su;
+	socklen_t sulen = (socklen_t) sizeof(su);
+	if (!getpeername(s, &su.sa, &sulen))
+	    ctx->client_hash = balance_hash(&su);
+    }
     io_set_cb_i(ctx->io, s, (void *) socket2buffer);
     io_set_cb_o(ctx->io, s, (void *) buffer2socket);
     io_set_cb_e(ctx->io, s, (void *) cleanup_error);
@@ -0,0 +1,278 @@
+/*
+ * balance.c
+ *
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ * All rights reserved.
+ *
+ * Peer selection. Available peers are kept in a binary min-heap ordered
+ * by their current score, so selecting, releasing and (de)activating a
+ * peer is O(log n). Hashing on the client address uses a ring of virtual
+ * nodes that is searched in O(log n) as well.
+ *
+ * $Id$
+ *
+ */
+
+#include "headers.h"
+
+static const char rcsid[] __attribute__((used)) = "$Id$";
+
+#define BALANCE_VNODES 64	/* ring entries per unit of weight */
+
+static int *heap = NULL;	/* con_arr indices */
+static int heap_len = 0;
+
+struct ring {
+    uint32_t hash;
+    int idx;
+};
+
+static struct ring *ring = NULL;
+static int ring_len = 0;
+
+static uint32_t fnv(uint32_t h, void *data, size_t len)
+{
+    u_char *p = (u_char *) data;
+    while (len--) {
+	h ^= *p++;
+	h *= 16777619;
+    }
+    return h;
+}
+
+#define FNV_INIT 2166136261U
+
+static u_long score(int i)
+{
+    struct connect_address_s *c = &con_arr[i];
+    if (balance == BALANCE_LATENCY)
+	return (u_long) ((c->latency + 1) * (c->use + 1) / c->weight);
+    return ((u_long) c->use << 8) / c->weight;
+}
+
+/* equally loaded peers are used in turn */
+static int less(int a, int b)
+{
+    u_long sa = score(a), sb = score(b);
+    return sa < sb || (sa == sb && con_arr[a].seq < con_arr[b].seq);
+}
+
+static void heap_set(int pos, int i)
+{
+    heap[pos] = i;
+    con_arr[i].heap_pos = pos;
+}
+
+static void sift_up(int pos)
+{
+    int i = heap[pos];
+    while (pos > 0) {
+	int parent = (pos - 1) / 2;
+	if (!less(i, heap[parent]))
+	    break;
+	heap_set(pos, heap[parent]);
+	pos = parent;
+    }
+    heap_set(pos, i);
+}
+
+static void sift_down(int pos)
+{
+    int i = heap[pos];
+    while (1) {
+	int child = 2 * pos + 1;
+	if (child >= heap_len)
+	    break;
+	if (child + 1 < heap_len && less(heap[child + 1], heap[child]))
+	    child++;
+	if (!less(heap[child], i))
+	    break;
+	heap_set(pos, heap[child]);
+	pos = child;
+    }
+    heap_set(pos, i);
+}
+
+static void heap_update(int i)
+{
+    int pos = con_arr[i].heap_pos;
+    if (pos < 0)
+	return;
+    sift_up(pos);
+    sift_down(con_arr[i].heap_pos);
+}
+
+static void heap_insert(int i)
+{
+    if (con_arr[i].heap_pos > -1)
+	return;
+    heap_set(heap_len++, i);
+    sift_up(heap_len - 1);
+}
+
+static void heap_remove(int i)
+{
+    int pos = con_arr[i].heap_pos;
+    if (pos < 0)
+	return;
+    con_arr[i].heap_pos = -1;
+    if (pos == --heap_len)
+	return;
+    heap_set(pos, heap[heap_len]);
+    heap_update(heap[pos]);
+}
+
+static void update(int i)
+{
+    if (con_arr[i].dead || con_arr[i].down)
+	heap_remove(i);
+    else if (con_arr[i].heap_pos < 0)
+	heap_insert(i);
+    else
+	heap_update(i);
+}
+
+static int compare_ring(const void *a, const void *b)
+{
+    uint32_t x = ((struct ring *) a)->hash, y = ((struct ring *) b)->hash;
+    return (x > y) - (x < y);
+}
+
+static int ring_lookup(uint32_t hash)
+{
+    int lo = 0, hi = ring_len, n;
+
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+	if (ring[mid].hash < hash)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    /* first available peer clockwise from hash */
+    for (n = 0; n < ring_len; n++, lo++) {
+	struct connect_address_s *c;
+	if (lo == ring_len)
+	    lo = 0;
+	c = &con_arr[ring[lo].idx];
+	if (!c->dead && !c->down)
+	    return ring[lo].idx;
+    }
+    return -1;
+}
+
+void balance_init(void)
+{
+    int i;
+
+    heap = Xcalloc(con_arr_len, sizeof(int));
+    for (i = 0; i < con_arr_len; i++) {
+	con_arr[i].heap_pos = -1;
+	update(i);
+    }
+
+    if (balance == BALANCE_HASH) {
+	for (i = 0; i < con_arr_len; i++)
+	    ring_len += con_arr[i].weight * BALANCE_VNODES;
+	ring = Xcalloc(ring_len, sizeof(struct ring));
+	ring_len = 0;
+	for (i = 0; i < con_arr_len; i++) {
+	    struct in6_addr a;
+	    uint16_t port = su_get_port(&con_arr[i].sa);
+	    uint32_t h, v;
+	    su_ptoh(&con_arr[i].sa, &a);
+	    h = fnv(fnv(FNV_INIT, &a, sizeof(a)), &port, sizeof(port));
+	    for (v = 0; v < con_arr[i].weight * BALANCE_VNODES; v++) {
+		ring[ring_len].hash = fnv(h, &v, sizeof(v));
+		ring[ring_len++].idx = i;
+	    }
+	}
+	qsort(ring, ring_len, sizeof(struct ring), compare_ring);
+    }
+}
+
+uint32_t balance_hash(sockaddr_union *sa)
+{
+    struct in6_addr a;
+    su_ptoh(sa, &a);
+    return fnv(FNV_INIT, &a, sizeof(a));
+}
+
+int balance_select(struct context *ctx)
+{
+    static long count = 0;
+    static u_long seq = 0;
+    int i;
+
+    Debug((DEBUG_PROC, "balance_select\n"));
+
+    if (rebalance && (count == rebalance))
+	for (count = 0, i = 0; i < con_arr_len; i++)
+	    if (con_arr[i].dead) {
+		con_arr[i].dead = 0;
+		update(i);
+	    }
+    count++;
+
+    if (balance == BALANCE_HASH)
+	i = ring_lookup(ctx->client_hash);
+    else
+	i = heap_len ? heap[0] : -1;
+
+    if (i < 0) {
+	if (!ctx->failed) {
+	    /* all peers are dead -- try re-enabling ... */
+	    ctx->failed = 1;
+	    count = rebalance;
+	    return balance_select(ctx);
+	}
+	return -1;
+    }
+
+    Debug((DEBUG_PROC, "selected peer %d\n", i));
+    ctx->con_arr_idx = i;
+    con_arr[i].use++;
+    con_arr[i].seq = ++seq;
+    update(i);
+    return 0;
+}
+
+void balance_release(int i)
+{
+    con_arr[i].use--;
+    update(i);
+}
+
+void balance_dead(int i)
+{
+    con_arr[i].dead = 1;
+    update(i);
+}
+
+/*
+ * Health check result. A passing check also revives a peer that has been
+ * marked dead after a failed connection attempt.
+ */
+void balance_check(int i, int up)
+{
+    con_arr[i].down = !up;
+    if (up)
+	con_arr[i].dead = 0;
+    update(i);
+}
+
+/* Feeds the observed connect latency into a moving average. */
+void balance_latency(int i, struct timeval *start)
+{
+    struct connect_address_s *c = &con_arr[i];
+    long long usec = (io_now.tv_sec - start->tv_sec) * 1000000LL + io_now.tv_usec - start->tv_usec;
+
+    if (usec < 0)
+	usec = 0;
+    if (c->latency)
+	c->latency = (c->latency * 7 + (u_long) usec) / 8;
+    else
+	c->latency = (u_long) usec + 1;
+    update(i);
+}
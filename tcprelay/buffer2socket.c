@@ -8,24 +8,28 @@
  */
 
 #include "headers.h"
+#if defined(WITH_SSL) && !defined(WITH_TLS)
+#include "misc/ssl_init.h"
+#endif
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
 void buffer2socket(struct context *ctx, int cur)
 {
-    size_t l;
+    ssize_t l;
     off_t o;
     int fd_in;
     struct buffer *b;
+    size_t *queued;
 
     DebugIn(DEBUG_BUFFER);
 
     io_sched_renew_proc(ctx->io, ctx, (void *) cleanup);
 
     if (cur == ctx->ifn)	/* read from bufi, write to ifn */
-	fd_in = ctx->ofn, b = ctx->bufi;
+	fd_in = ctx->ofn, b = ctx->bufi, queued = &ctx->bufi_len;
     else			/* read from bufo, write to ofn */
-	fd_in = ctx->ifn, b = ctx->bufo;
+	fd_in = ctx->ifn, b = ctx->bufo, queued = &ctx->bufo_len;
 
     if (!b) {			/* should not happen ... */
 	cleanup(ctx, cur);
@@ -38,21 +42,34 @@ void buffer2socket(struct context *ctx, int cur)
     else
 #else
 #ifdef WITH_SSL
-    if (cur == ctx->ifn && ctx->ssl)
+    /* with kTLS, the kernel encrypts, and buffers can be gathered */
+    if (cur == ctx->ifn && ctx->ssl && !ssl_ktls_send(ctx->ssl))
 	l = io_SSL_write(ctx->ssl, b->buf + b->offset, b->length - b->offset, ctx->io, cur, (void *) buffer2socket);
     else
 #endif
 #endif
-	l = write(cur, b->buf + b->offset, b->length - b->offset);
+    {
+	struct iovec v[64];
+	int count = 64;
+	buffer_setv(b, v, &count, 0);
+	l = writev(cur, v, count);
+	if (l > 0 && cur == ctx->ofn && ctx->fastopen)
+	    connect_out_sent(ctx, cur, v, (size_t) l);
+    }
 
     if (l <= 0) {
-	if (errno != EAGAIN)
+	if (errno == EAGAIN)
+	    ;
+	else if (cur == ctx->ofn && ctx->fastopen)
+	    connect_out_failed(ctx, cur);
+	else
 	    cleanup(ctx, cur);
 	Debug((DEBUG_BUFFER, "- %s: Write error (%d)\n", __func__, cur));
 	return;
     }
     o = (off_t) l;
     b = buffer_release(b, &o);
+    *queued -= (size_t) l;
 
     if (cur == ctx->ifn)	/* read from bufi, write to ifn */
 	ctx->bufi = b;
@@ -61,11 +78,15 @@ void buffer2socket(struct context *ctx, int cur)
 
     if (!b) {
 	io_clr_o(ctx->io, cur);
-	if (fd_in < 0)
+	if (fd_in < 0) {
 	    cleanup(ctx, cur);
-	else
-	    io_set_i(ctx->io, fd_in);
+	    DebugOut(DEBUG_BUFFER);
+	    return;
+	}
     }
 
+    if (fd_in > -1 && *queued <= window_low)
+	io_set_i(ctx->io, fd_in);
+
     DebugOut(DEBUG_BUFFER);
 }
@@ -0,0 +1,167 @@
+/*
+ * check.c
+ *
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ * All rights reserved.
+ *
+ * Active health checks for remote peers. Each check connects to its peer
+ * every interval seconds, optionally sends a probe string and compares
+ * the response with an expected prefix. Peers failing the check are
+ * excluded from balancing until it succeeds again. Successful checks
+ * also keep the connect latency of idle peers current.
+ *
+ * $Id$
+ *
+ */
+
+#include "headers.h"
+
+static const char rcsid[] __attribute__((used)) = "$Id$";
+
+static void check_start(struct check_s *, int);
+
+static char *peer_name(int i, char *buf, size_t len)
+{
+    char a[INET6_ADDRSTRLEN];
+    snprintf(buf, len, "%s:%u", su_ntop(&con_arr[i].sa, a, sizeof(a)) ? a : "?", su_get_port(&con_arr[i].sa));
+    return buf;
+}
+
+static void check_done(struct check_s *chk, int up)
+{
+    struct io_context *io = common_data.io;
+    struct connect_address_s *c = &con_arr[chk->idx];
+
+    if (chk->fd > -1) {
+	io_close(io, chk->fd);
+	chk->fd = -1;
+    }
+    while (io_sched_pop(io, chk));
+
+    if (up ? c->down : !c->down) {
+	char buf[INET6_ADDRSTRLEN + 10];
+	logmsg("remote %s is %s", peer_name(chk->idx, buf, sizeof(buf)), up ? "up" : "down (health check failed)");
+    }
+    balance_check(chk->idx, up);
+
+    io_sched_add(io, chk, (void *) check_start, (time_t) chk->interval, 0);
+}
+
+static void check_timeout(struct check_s *chk, int cur __attribute__((unused)))
+{
+    check_done(chk, 0);
+}
+
+static void check_read(struct check_s *chk, int cur)
+{
+    ssize_t l = read(cur, chk->buf + chk->got, chk->expect_len - chk->got);
+
+    if (l < 0 && errno == EAGAIN)
+	return;
+    if (l <= 0 || memcmp(chk->buf + chk->got, chk->expect + chk->got, (size_t) l)) {
+	check_done(chk, 0);
+	return;
+    }
+    chk->got += (size_t) l;
+    if (chk->got == chk->expect_len)
+	check_done(chk, 1);
+}
+
+static void check_write(struct check_s *chk, int cur)
+{
+    struct io_context *io = common_data.io;
+
+    if (chk->sent < chk->send_len) {
+	ssize_t l = write(cur, chk->send + chk->sent, chk->send_len - chk->sent);
+	if (l < 0 && errno == EAGAIN)
+	    return;
+	if (l < 0) {
+	    check_done(chk, 0);
+	    return;
+	}
+	chk->sent += (size_t) l;
+	if (chk->sent < chk->send_len)
+	    return;
+    }
+
+    io_clr_o(io, cur);
+    if (!chk->expect_len) {
+	check_done(chk, 1);
+	return;
+    }
+    chk->got = 0;
+    io_set_cb_i(io, cur, (void *) check_read);
+    io_set_i(io, cur);
+}
+
+static void check_connected(struct check_s *chk, int cur)
+{
+    int err = 0;
+    socklen_t len = (socklen_t) sizeof(err);
+
+    if (getsockopt(cur, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+	check_done(chk, 0);
+	return;
+    }
+    balance_latency(chk->idx, &chk->start);
+    chk->sent = 0;
+    io_set_cb_o(common_data.io, cur, (void *) check_write);
+    check_write(chk, cur);
+}
+
+static void check_failed(struct check_s *chk, int cur __attribute__((unused)))
+{
+    check_done(chk, 0);
+}
+
+static void check_start(struct check_s *chk, int cur __attribute__((unused)))
+{
+    struct io_context *io = common_data.io;
+    struct connect_address_s *c = &con_arr[chk->idx];
+    int s;
+
+    while (io_sched_pop(io, chk));
+
+    s = su_socket(c->sa.sa.sa_family, SOCK_STREAM, c->protocol);
+    if (s < 0) {
+	logerr("socket (%s:%d)", __FILE__, __LINE__);
+	io_sched_add(io, chk, (void *) check_start, (time_t) chk->interval, 0);
+	return;
+    }
+    if (lcladdr && 0 > su_bind(s, lcladdr)) {
+	logerr("bind (%s:%d)", __FILE__, __LINE__);
+	close(s);
+	io_sched_add(io, chk, (void *) check_start, (time_t) chk->interval, 0);
+	return;
+    }
+
+    chk->fd = s;
+    chk->start = io_now;
+    io_register(io, s, chk);
+    io_sched_add(io, chk, (void *) check_timeout, (time_t) chk->timeout, 0);
+
+    if (su_connect(s, &c->sa) < 0 && errno != EINPROGRESS) {
+	check_done(chk, 0);
+	return;
+    }
+    io_set_cb_o(io, s, (void *) check_connected);
+    io_set_cb_e(io, s, (void *) check_failed);
+    io_set_cb_h(io, s, (void *) check_failed);
+    io_set_o(io, s);
+}
+
+void check_init(void)
+{
+    int i;
+
+    for (i = 0; i < con_arr_len; i++) {
+	struct check_s *chk = con_arr[i].check;
+	if (chk) {
+	    chk->idx = i;
+	    chk->fd = -1;
+	    if (chk->expect_len)
+		chk->buf = Xcalloc(1, chk->expect_len);
+	    io_sched_add(common_data.io, chk, (void *) check_start, 0, 0);
+	}
+    }
+}
@@ -33,11 +33,13 @@ static void cleanup_context(struct context *ctx, int cur)
     Debug((DEBUG_PROC, "cleanup_context(%d)\n", cur));
 
     if (ctx->con_arr_idx > -1) {
-	con_arr[ctx->con_arr_idx].use--;
+	balance_release(ctx->con_arr_idx);
 	ctx->con_arr_idx = -1;
     }
 
     while (io_sched_pop(ctx->io, ctx));
+    io_sched_pop(ctx->io, &ctx->ct);
+    buffer_free_all(ctx->fastopen_data);
 
     if (ctx->is_client)
 	common_data.users_cur--;
@@ -178,12 +180,14 @@ void cleanup(struct context *ctx, int cur)
 	Debug((DEBUG_PROC, "line %d\n", __LINE__));
 
 	ctx->bufo = buffer_free_all(ctx->bufo);
+	ctx->bufo_len = 0;
 	cleanup_finish_o(ctx, cur);
     } else {			/* cur == ifn */
 
 	Debug((DEBUG_PROC, "line %d\n", __LINE__));
 
 	ctx->bufi = buffer_free_all(ctx->bufi);
+	ctx->bufi_len = 0;
 
 #ifdef WITH_TLS
 	if (ctx->ssl)
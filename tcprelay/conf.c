@@ -11,6 +11,78 @@
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
+static size_t parse_size(struct sym *sym)
+{
+    char c;
+    int b;
+    size_t res;
+
+    if (2 == sscanf(sym->buf, "%d%c", &b, &c)) {
+	res = (size_t) b;
+	switch (c) {
+	case 'k':
+	case 'K':
+	    res <<= 10;
+	    break;
+	case 'm':
+	case 'M':
+	    res <<= 20;
+	    break;
+	}
+	sym_get(sym);
+    } else
+	res = (size_t) parse_int(sym);
+    return res;
+}
+
+static struct check_s *parse_check(struct sym *sym)
+{
+    struct check_s *chk = Xcalloc(1, sizeof(struct check_s));
+
+    chk->interval = 10;
+    chk->timeout = 3;
+
+    sym_get(sym);
+    parse(sym, S_equal);
+    parse(sym, S_openbra);
+    while (sym->code != S_closebra && sym->code != S_eof)
+	switch (sym->code) {
+	case S_interval:
+	    sym_get(sym);
+	    parse(sym, S_equal);
+	    chk->interval = (u_long) parse_int(sym);
+	    continue;
+	case S_timeout:
+	    sym_get(sym);
+	    parse(sym, S_equal);
+	    chk->timeout = (u_long) parse_int(sym);
+	    continue;
+	case S_send:
+	    sym_get(sym);
+	    parse(sym, S_equal);
+	    strset(&chk->send, sym->buf);
+	    chk->send_len = strlen(chk->send);
+	    sym_get(sym);
+	    continue;
+	case S_expect:
+	    sym_get(sym);
+	    parse(sym, S_equal);
+	    strset(&chk->expect, sym->buf);
+	    chk->expect_len = strlen(chk->expect);
+	    sym_get(sym);
+	    continue;
+	default:
+	    parse_error_expect(sym, S_interval, S_timeout, S_send, S_expect, S_unknown);
+	}
+    parse(sym, S_closebra);
+
+    if (chk->interval < 1)
+	chk->interval = 1;
+    if (chk->timeout < 1)
+	chk->timeout = 1;
+    return chk;
+}
+
 void parse_decls(struct sym *sym)
 {
     /* Top level of parser */
@@ -49,6 +121,65 @@ void parse_decls(struct sym *sym)
 		parse_error_expect(sym, S_cert_file, S_key_file, S_passphrase, S_unknown);
 	    }
 #endif
+	case S_buffer:
+	    // buffer (high-water|low-water) = ...
+	    sym_get(sym);
+	    switch (sym->code) {
+	    case S_highwater:
+		sym_get(sym);
+		parse(sym, S_equal);
+		window_high = parse_size(sym);
+		break;
+	    case S_lowwater:
+		sym_get(sym);
+		parse(sym, S_equal);
+		window_low = parse_size(sym);
+		break;
+	    default:
+		parse_error_expect(sym, S_highwater, S_lowwater, S_unknown);
+	    }
+	    continue;
+	case S_balance:
+	    sym_get(sym);
+	    parse(sym, S_equal);
+	    switch (sym->code) {
+	    case S_leastconnections:
+		balance = BALANCE_LEASTCONN;
+		break;
+	    case S_hash:
+		balance = BALANCE_HASH;
+		break;
+	    case S_latency:
+		balance = BALANCE_LATENCY;
+		break;
+	    default:
+		parse_error_expect(sym, S_leastconnections, S_hash, S_latency, S_unknown);
+	    }
+	    sym_get(sym);
+	    continue;
+	case S_connect:
+	    sym_get(sym);
+	    parse(sym, S_timeout);
+	    parse(sym, S_equal);
+	    connect_timeout = (u_long) parse_int(sym);
+	    continue;
+	case S_pool:
+	    sym_get(sym);
+	    switch (sym->code) {
+	    case S_size:
+		sym_get(sym);
+		parse(sym, S_equal);
+		pool_size = (u_long) parse_int(sym);
+		break;
+	    case S_timeout:
+		sym_get(sym);
+		parse(sym, S_equal);
+		pool_timeout = (u_long) parse_int(sym);
+		break;
+	    default:
+		parse_error_expect(sym, S_size, S_timeout, S_unknown);
+	    }
+	    continue;
 	case S_rebalance:
 	    sym_get(sym);
 	    parse(sym, S_equal);
@@ -71,6 +202,9 @@ void parse_decls(struct sym *sym)
 		char *ad = NULL, *po = NULL;
 		int protocol = 0;
 		int weight = 1;
+		u_long timeout = 0;
+		struct check_s *chk = NULL;
+		int fastopen = 0;
 		uint16_t p;
 
 		sym_get(sym);
@@ -117,8 +251,25 @@ void parse_decls(struct sym *sym)
 			parse(sym, S_equal);
 			weight = parse_int(sym);
 			continue;
+		    case S_connect:
+			sym_get(sym);
+			parse(sym, S_timeout);
+			parse(sym, S_equal);
+			timeout = (u_long) parse_int(sym);
+			continue;
+		    case S_tcp:
+			sym_get(sym);
+			parse(sym, S_fastopen);
+			parse(sym, S_equal);
+			fastopen = parse_bool(sym);
+			continue;
+		    case S_check:
+			if (chk)
+			    parse_error(sym, "Only one check per remote, please.");
+			chk = parse_check(sym);
+			continue;
 		    default:
-			parse_error_expect(sym, S_address, S_port, S_protocol, S_weight, S_unknown);
+			parse_error_expect(sym, S_address, S_port, S_protocol, S_weight, S_connect, S_tcp, S_check, S_unknown);
 		    }
 		}
 		parse(sym, S_closebra);
@@ -137,6 +288,9 @@ void parse_decls(struct sym *sym)
 		con_arr[con_arr_len].weight = weight;
 		if (con_arr[con_arr_len].weight < 1)
 		    con_arr[con_arr_len].weight = 1;
+		con_arr[con_arr_len].conntimeout = timeout;
+		con_arr[con_arr_len].check = chk;
+		con_arr[con_arr_len].fastopen = fastopen;
 		con_arr_len++;
 		Xfree(&ad);
 		Xfree(&po);
@@ -11,63 +11,18 @@
 
 static const char rcsid[] __attribute__((used)) = "$Id$";
 
-static int select_peer(struct context *ctx, int cur)
-{
-    static long count = 0;
-    int i = 0;
-
-    Debug((DEBUG_PROC, "select_peer\n"));
-
-    if (rebalance && (count == rebalance))
-	for (count = 0, i = 0; i < con_arr_len; i++)
-	    con_arr[i].dead = 0;
-    count++;
-
-    for (i = 0; con_arr[i].dead && i < con_arr_len; i++)
-	/* empty */ ;
-
-    Debug((DEBUG_PROC, "#A i = %d\n", i));
-
-    if (i < con_arr_len) {
-	int min = i;
-	int prio_min = (con_arr[i].use << 8) / con_arr[i].weight;
-	Debug((DEBUG_PROC, "#  min == %d prio == %d\n", min, prio_min));
-	i++;
-	for (; i < con_arr_len; i++) {
-	    int prio_cur = (con_arr[i].use << 8) / con_arr[i].weight;
-	    Debug((DEBUG_PROC, "#B i == %d prio == %d\n", i, prio_cur));
-	    if (prio_cur > -1 && prio_min > prio_cur) {
-		min = i;
-		prio_min = prio_cur;
-	    }
-	}
-	Debug((DEBUG_PROC, "#C i = %d\n", min));
-	ctx->con_arr_idx = min;
-	con_arr[min].use++;
-	return 0;
-    }
-
-    if (!ctx->failed) {
-	/* all peers are dead -- try re-enabling ... */
-	ctx->failed = 1;
-	count = rebalance;
-	return select_peer(ctx, cur);
-    }
-
-    return -1;
-}
-
 static void deactivate_peer(struct context *ctx, int cur __attribute__((unused)))
 {
     if (ctx->con_arr_idx > -1) {
-	con_arr[ctx->con_arr_idx].use--;
-	con_arr[ctx->con_arr_idx].dead = 1;
+	balance_release(ctx->con_arr_idx);
+	balance_dead(ctx->con_arr_idx);
 	ctx->con_arr_idx = -1;
     }
 }
 
 static void peer_died(struct context *ctx, int cur)
 {
+    io_sched_pop(ctx->io, &ctx->ct);
     deactivate_peer(ctx, cur);
     if (ctx->ifn > -1) {
 	int ifn = ctx->ifn;
@@ -78,11 +33,89 @@ static void peer_died(struct context *ctx, int cur)
 	cleanup(ctx, cur);
 }
 
+static void connect_timed_out(struct connect_timer *ct, int cur __attribute__((unused)))
+{
+    Debug((DEBUG_NET, "connect timeout\n"));
+    peer_died(ct->ctx, ct->ctx->ofn);
+}
+
+/*
+ * With TCP Fast Open, connect(2) returns before the handshake, so a refused
+ * or unreachable peer only shows up as the first I/O error. Treat that like
+ * a failed connect, and hand the data that went out with the SYN to the
+ * next peer.
+ */
+void connect_out_failed(struct context *ctx, int cur)
+{
+    Debug((DEBUG_NET, "fast open connect failed\n"));
+    ctx->fastopen = 0;
+    if (ctx->fastopen_data) {
+	ctx->bufo_len += buffer_getlen(ctx->fastopen_data);
+	ctx->bufo = buffer_append(ctx->fastopen_data, ctx->bufo);
+	ctx->fastopen_data = NULL;
+    }
+    peer_died(ctx, cur);
+}
+
+/* The peer completed the handshake. */
+void connect_out_confirmed(struct context *ctx, int cur)
+{
+    ctx->fastopen = 0;
+    ctx->fastopen_data = buffer_free_all(ctx->fastopen_data);
+    io_set_cb_e(ctx->io, cur, (void *) cleanup_error);
+    io_set_cb_h(ctx->io, cur, (void *) cleanup_error);
+}
+
+/*
+ * Called after len bytes of v were written to an unconfirmed Fast Open
+ * connection. The first write goes out with the SYN and is kept for
+ * connect_out_failed(). Later writes only succeed once connected.
+ */
+void connect_out_sent(struct context *ctx, int cur, struct iovec *v, size_t len)
+{
+    if (ctx->fastopen_data) {
+	connect_out_confirmed(ctx, cur);
+	return;
+    }
+    for (; len; v++) {
+	size_t n = MIN(len, v->iov_len);
+	ctx->fastopen_data = buffer_write(ctx->fastopen_data, v->iov_base, n);
+	len -= n;
+    }
+}
+
+void connect_out_done(struct context *ctx)
+{
+    io_sched_pop(ctx->io, &ctx->ct);
+    if (ctx->con_arr_idx > -1 && ctx->tv.tv_sec)
+	balance_latency(ctx->con_arr_idx, &ctx->tv);
+}
+
+/* Returns an unconnected socket for peer i, sized and bound. */
+int connect_socket(int i)
+{
+    int bufsize = (int) window_high;
+    int s = su_socket(con_arr[i].sa.sa.sa_family, SOCK_STREAM, con_arr[i].protocol);
+
+    if (s < 0) {
+	logerr("socket (%s:%d)", __FILE__, __LINE__);
+	return -1;
+    }
+
+    setsockopt(s, SOL_SOCKET, SO_SNDBUF, (char *) &bufsize, (socklen_t) sizeof(bufsize));
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, (char *) &bufsize, (socklen_t) sizeof(bufsize));
+
+    if (lcladdr && 0 > su_bind(s, &(*lcladdr))) {
+	logerr("bind (%s:%d)", __FILE__, __LINE__);
+	close(s);
+	return -1;
+    }
+    return s;
+}
 
 void connect_out(struct context *ctx, int cur)
 {
     int s = -1;
-    int bufsize = BUFSIZE + 512;
 
     DebugIn(DEBUG_COMMAND);
 
@@ -93,37 +126,45 @@ void connect_out(struct context *ctx, int cur)
 	s = -1;
     }
 
-    if (select_peer(ctx, cur) || ctx->con_arr_idx < 0) {
+    if (balance_select(ctx) || ctx->con_arr_idx < 0) {
 	cleanup(ctx, cur);
 	DebugOut(DEBUG_COMMAND);
 	return;
     }
 
-    s = su_socket(con_arr[ctx->con_arr_idx].sa.sa.sa_family, SOCK_STREAM, con_arr[ctx->con_arr_idx].protocol);
-
-    if (s < 0) {
-	logerr("socket (%s:%d)", __FILE__, __LINE__);
-	if (ctx->ifn > -1)
-	    cleanup(ctx, ctx->ifn);
+    if ((s = pool_get(ctx->con_arr_idx)) > -1) {
+	io_register(ctx->io, s, ctx);
+	ctx->ofn = s;
+	ctx->tv.tv_sec = 0;
+	connected(ctx, s);
 	DebugOut(DEBUG_COMMAND);
 	return;
     }
 
-    setsockopt(s, SOL_SOCKET, SO_SNDBUF, (char *) &bufsize, (socklen_t) sizeof(bufsize));
-    setsockopt(s, SOL_SOCKET, SO_RCVBUF, (char *) &bufsize, (socklen_t) sizeof(bufsize));
+    s = connect_socket(ctx->con_arr_idx);
 
-    if (lcladdr && 0 > su_bind(s, &(*lcladdr))) {
-	logerr("bind (%s:%d)", __FILE__, __LINE__);
-	close(s);
+    if (s < 0) {
 	if (ctx->ifn > -1)
 	    cleanup(ctx, ctx->ifn);
 	DebugOut(DEBUG_COMMAND);
 	return;
     }
+#ifdef TCP_FASTOPEN_CONNECT
+    if (con_arr[ctx->con_arr_idx].fastopen) {
+	int one = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, (char *) &one, (socklen_t) sizeof(one));
+    }
+#endif
 
     if (su_connect(s, &con_arr[ctx->con_arr_idx].sa) < 0)
 	switch (errno) {
 	case EINPROGRESS:
+	    {
+		u_long t = con_arr[ctx->con_arr_idx].conntimeout;
+		ctx->tv = io_now;
+		if (t)
+		    io_sched_add(ctx->io, &ctx->ct, (void *) connect_timed_out, (time_t) t, 0);
+	    }
 	    io_register(ctx->io, s, ctx);
 	    io_clr_cb_i(ctx->io, s);
 	    io_set_cb_o(ctx->io, s, (void *) connected);
@@ -137,10 +178,14 @@ void connect_out(struct context *ctx, int cur)
 	    deactivate_peer(ctx, cur);
 	    goto again;
     } else {
-	/* connected */
+	/* connected, or deferred until the first write (TCP Fast Open) */
 
 	io_register(ctx->io, s, ctx);
 	ctx->ofn = s;
+	ctx->tv.tv_sec = 0;
+#ifdef TCP_FASTOPEN_CONNECT
+	ctx->fastopen = con_arr[ctx->con_arr_idx].fastopen ? 1 : 0;
+#endif
 	connected(ctx, s);
     }
     DebugOut(DEBUG_COMMAND);
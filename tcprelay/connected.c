@@ -15,10 +15,17 @@ void connected(struct context *ctx, int cur)
 {
     DebugIn(DEBUG_NET);
 
+    connect_out_done(ctx);
+
     io_set_cb_o(ctx->io, cur, (void *) buffer2socket);
     io_set_cb_i(ctx->io, cur, (void *) socket2buffer);
-    io_set_cb_e(ctx->io, cur, (void *) cleanup_error);
-    io_set_cb_h(ctx->io, cur, (void *) cleanup_error);
+    if (ctx->fastopen) {
+	io_set_cb_e(ctx->io, cur, (void *) connect_out_failed);
+	io_set_cb_h(ctx->io, cur, (void *) connect_out_failed);
+    } else {
+	io_set_cb_e(ctx->io, cur, (void *) cleanup_error);
+	io_set_cb_h(ctx->io, cur, (void *) cleanup_error);
+    }
 
     io_clr_i(ctx->io, cur);
     io_clr_o(ctx->io, cur);
@@ -26,6 +33,8 @@ void connected(struct context *ctx, int cur)
     if (ctx->ifn > -1) {
 	io_set_i(ctx->io, ctx->ifn);
 	io_set_i(ctx->io, cur);
+	if (ctx->bufo)		/* client data arrived while connecting */
+	    io_set_o(ctx->io, cur);
     } else
 	cleanup(ctx, cur);
 
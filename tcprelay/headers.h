@@ -12,6 +12,7 @@
 #include <sys/socket.h>
 #include <limits.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/time.h>
 #include <netinet/in.h>
 #include <unistd.h>
@@ -79,9 +80,18 @@ WHERE int nfds_max;
 WHERE struct timeval now;
 WHERE struct context *ctx_spawnd INITVAL(NULL);
 
-#define BUFSIZE 16000
 #include "misc/buffer.h"
 
+/*
+ * Per-direction relay window. Reading from a peer stops once this much
+ * data is queued for the other one, and resumes when the queue has been
+ * drained down to the low-water mark.
+ */
+#define WINDOW_HIGH (256 << 10)
+#define WINDOW_LOW (64 << 10)
+WHERE size_t window_high INITVAL(WINDOW_HIGH);
+WHERE size_t window_low INITVAL(WINDOW_LOW);
+
 struct context;
 
 void parse_decls(struct sym *);
@@ -99,6 +109,10 @@ struct buffer *write2buffer(struct buffer *, char *, int);
 
 void connected(struct context *, int);
 void connect_out(struct context *, int);
+void connect_out_done(struct context *);
+void connect_out_failed(struct context *, int);
+void connect_out_confirmed(struct context *, int);
+void connect_out_sent(struct context *, int, struct iovec *, size_t);
 void accepted(struct context *, int);
 void accept_in(struct context *, int);
 void buffer2socket(struct context *, int);
@@ -113,15 +127,57 @@ void accepted_raw(int, struct scm_data_accept *);
 #undef MIN
 #define MIN(A,B) ((A) < (B) ? (A) : (B))
 
+struct check_s {
+    int idx;			/* con_arr index */
+    int fd;
+    struct timeval start;
+    u_long interval;
+    u_long timeout;
+    char *send;			/* probe string, optional */
+    size_t send_len;
+    size_t sent;
+    char *expect;		/* expected response prefix, optional */
+    size_t expect_len;
+    size_t got;
+    char *buf;
+};
+
+struct pool_conn;
+
+struct pool {
+    struct pool_conn *idle;	/* oldest first */
+    struct pool_conn *idle_tail;
+    int idle_count;
+    int pending;		/* connects in progress */
+    u_long demand;		/* connections requested since last tick */
+    u_long rate;		/* average demand per tick, scaled by 256 */
+};
+
 struct connect_address_s {
     sockaddr_union sa;
     int sock;
     int protocol;
-    u_int dead;
+    u_int dead;			/* connect failed */
+    u_int down;			/* health check failed */
     u_int weight;		/* current_connects/weight == current_priority */
     u_int use;
+    u_long seq;			/* last selection */
+    int heap_pos;		/* position in balancing heap, -1 if unavailable */
+    u_long latency;		/* average connect latency (us) */
+    u_long conntimeout;		/* connect timeout (s) */
+    struct check_s *check;
+    struct pool pool;
+    int fastopen;		/* TCP Fast Open on connect */
 };
 
+#define BALANCE_LEASTCONN 0
+#define BALANCE_HASH 1
+#define BALANCE_LATENCY 2
+WHERE int balance INITVAL(BALANCE_LEASTCONN);
+WHERE u_long connect_timeout INITVAL(0);
+WHERE u_long pool_size INITVAL(0);	/* max. idle connections per peer */
+WHERE u_long pool_timeout INITVAL(30);	/* max. idle time (s) */
+
 WHERE int con_arr_len INITVAL(0);
 
 WHERE struct connect_address_s *con_arr INITVAL(NULL);
@@ -130,20 +186,45 @@ WHERE int rebalance INITVAL(0);
 
 struct context *new_context(struct io_context *);
 
+void balance_init(void);
+uint32_t balance_hash(sockaddr_union *);
+int balance_select(struct context *);
+void balance_release(int);
+void balance_dead(int);
+void balance_check(int, int);
+void balance_latency(int, struct timeval *);
+void check_init(void);
+int connect_socket(int);
+int pool_get(int);
+void pool_init(void);
+
 /* shortcuts ... */
 #define SC (struct context *)
 
+struct context;
+
+/* io_sched key of the outgoing connect timeout, apart from the idle timeout */
+struct connect_timer {
+    struct context *ctx;
+};
+
 struct context {
     struct io_context *io;
     struct buffer *bufi;
     struct buffer *bufo;
+    size_t bufi_len;		/* bytes queued in bufi */
+    size_t bufo_len;		/* bytes queued in bufo */
     int ifn;
     int ofn;
-    struct timeval tv;
+    struct timeval tv;		/* outgoing connect started */
+    struct connect_timer ct;
+    struct buffer *fastopen_data;	/* client data sent with the SYN, replayed on failover */
     int con_arr_idx;
+    uint32_t client_hash;
     u_int listener:1;
     u_int failed:1;
     u_int is_client:1;
+    u_int fastopen:1;		/* TCP Fast Open connect not yet confirmed by the peer */
 #ifdef WITH_TLS
     struct tls *ssl;
 #else
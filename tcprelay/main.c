@@ -50,6 +50,7 @@ int main(int argc, char **argv, char **envp)
     struct io_context *io;
     struct rlimit rlim;
     struct scm_data_max sd;
+    int i;
 
     scm_main(argc, argv, envp);
 
@@ -69,6 +70,15 @@ int main(int argc, char **argv, char **envp)
 	exit(EX_USAGE);
     }
 
+    for (i = 0; i < con_arr_len; i++)
+	if (!con_arr[i].conntimeout)
+	    con_arr[i].conntimeout = connect_timeout;
+
+    if (window_high < 1)
+	window_high = 1;
+    if (window_low >= window_high)
+	window_low = window_high - 1;
+
     logmsg("startup (version " VERSION ")");
 
     mavis_detach();
@@ -152,6 +162,10 @@ int main(int argc, char **argv, char **envp)
     common_data.scm_send_msg(0, (struct scm_data *) &sd, -1);
     io_sched_add(io, new_context(io), (void *) periodics, 60, 0);
 
+    balance_init();
+    check_init();
+    pool_init();
+
     set_proctitle(ACCEPT_YES);
 
     io_main(io);
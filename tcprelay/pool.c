@@ -0,0 +1,257 @@
+/*
+ * pool.c
+ *
+ * (C)2026 by Marc Huber <Marc.Huber@web.de>
+ * All rights reserved.
+ *
+ * Pre-established backend connections. For each peer, a few idle
+ * connections are kept open, so clients don't have to wait for the
+ * backend handshake. The pool size follows the recent connection rate
+ * and the observed connect latency, bounded by "pool size". The oldest
+ * connection is handed out first, which gives servers that speak first
+ * the most time to do so. Connections taken from the pool are replaced
+ * right away.
+ *
+ * $Id$
+ *
+ */
+
+#include "headers.h"
+
+static const char rcsid[] __attribute__((used)) = "$Id$";
+
+#define POOL_TICK 1		/* seconds between pool adjustments */
+#define POOL_REPORT 3600	/* seconds between statistics log lines */
+
+struct pool_conn {
+    int fd;
+    int idx;			/* con_arr index */
+    struct timeval start;
+    struct pool_conn *next;
+};
+
+static int pool_key;		/* io_sched key for pool_tick */
+static unsigned long long stat_hits = 0, stat_misses = 0, stat_hits_reported = 0, stat_misses_reported = 0;
+static time_t stat_last_report = 0;
+
+/*
+ * Idle connections needed to bridge twice the connect latency at the
+ * current rate, plus one.
+ */
+static int pool_target(struct connect_address_s *c)
+{
+    u_long t;
+    if (!c->pool.rate || c->dead || c->down)
+	return 0;
+    t = 1 + (u_long) (((unsigned long long) c->pool.rate * (c->latency + 1) * 2 / 1000000) >> 8);
+    return (int) MIN(t, pool_size);
+}
+
+static void pool_close(struct pool_conn *pc)
+{
+    io_close(common_data.io, pc->fd);
+    free(pc);
+}
+
+static void pool_unlink(struct pool_conn *pc)
+{
+    struct pool *p = &con_arr[pc->idx].pool;
+    struct pool_conn **c = &p->idle, *prev = NULL;
+    while (*c && *c != pc) {
+	prev = *c;
+	c = &(*c)->next;
+    }
+    if (*c) {
+	*c = pc->next;
+	if (p->idle_tail == pc)
+	    p->idle_tail = prev;
+	p->idle_count--;
+    }
+}
+
+static struct pool_conn *pool_shift(struct pool *p)
+{
+    struct pool_conn *pc = p->idle;
+    if (pc) {
+	p->idle = pc->next;
+	if (!p->idle)
+	    p->idle_tail = NULL;
+	p->idle_count--;
+    }
+    return pc;
+}
+
+/* An idle connection became readable: either data or EOF from the peer. */
+static void pool_idle_input(struct pool_conn *pc, int cur)
+{
+    char c;
+    ssize_t l = recv(cur, &c, 1, MSG_PEEK);
+
+    if (l < 0 && errno == EAGAIN)
+	return;
+    if (l > 0) {
+	/* server speaks first -- keep the data for the client */
+	io_clr_i(common_data.io, cur);
+	return;
+    }
+    pool_unlink(pc);
+    pool_close(pc);
+}
+
+static void pool_idle_error(struct pool_conn *pc, int cur __attribute__((unused)))
+{
+    pool_unlink(pc);
+    pool_close(pc);
+}
+
+static void pool_connect_failed(struct pool_conn *pc, int cur __attribute__((unused)))
+{
+    io_sched_pop(common_data.io, pc);
+    con_arr[pc->idx].pool.pending--;
+    balance_dead(pc->idx);
+    pool_close(pc);
+}
+
+static void pool_connected(struct pool_conn *pc, int cur)
+{
+    struct io_context *io = common_data.io;
+    struct pool *p = &con_arr[pc->idx].pool;
+    int err = 0;
+    socklen_t len = (socklen_t) sizeof(err);
+
+    if (getsockopt(cur, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+	pool_connect_failed(pc, cur);
+	return;
+    }
+
+    io_sched_pop(io, pc);
+    p->pending--;
+    balance_latency(pc->idx, &pc->start);
+
+    pc->start = io_now;
+    pc->next = NULL;
+    if (p->idle_tail)
+	p->idle_tail->next = pc;
+    else
+	p->idle = pc;
+    p->idle_tail = pc;
+    p->idle_count++;
+
+    io_clr_o(io, cur);
+    io_clr_cb_o(io, cur);
+    io_set_cb_i(io, cur, (void *) pool_idle_input);
+    io_set_cb_e(io, cur, (void *) pool_idle_error);
+    io_set_cb_h(io, cur, (void *) pool_idle_error);
+    io_set_i(io, cur);
+}
+
+static void pool_fill(int i)
+{
+    struct io_context *io = common_data.io;
+    struct connect_address_s *c = &con_arr[i];
+    int target = pool_target(c);
+
+    while (c->pool.idle_count + c->pool.pending < target) {
+	struct pool_conn *pc;
+	int s = connect_socket(i);
+	if (s < 0)
+	    return;
+	if (su_connect(s, &c->sa) < 0 && errno != EINPROGRESS) {
+	    close(s);
+	    balance_dead(i);
+	    return;
+	}
+	pc = Xcalloc(1, sizeof(struct pool_conn));
+	pc->fd = s;
+	pc->idx = i;
+	pc->start = io_now;
+	c->pool.pending++;
+	io_register(io, s, pc);
+	io_set_cb_o(io, s, (void *) pool_connected);
+	io_set_cb_e(io, s, (void *) pool_connect_failed);
+	io_set_cb_h(io, s, (void *) pool_connect_failed);
+	io_set_o(io, s);
+	if (c->conntimeout)
+	    io_sched_add(io, pc, (void *) pool_connect_failed, (time_t) c->conntimeout, 0);
+    }
+}
+
+/*
+ * Returns an established connection to peer i, or -1. The descriptor is
+ * no longer registered with the io context.
+ */
+int pool_get(int i)
+{
+    struct pool *p = &con_arr[i].pool;
+    int fd = -1;
+
+    if (!pool_size)
+	return -1;
+
+    p->demand++;
+
+    while (p->idle && fd < 0) {
+	struct pool_conn *pc = pool_shift(p);
+	char c;
+	ssize_t l = recv(pc->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	if (l > 0 || (l < 0 && errno == EAGAIN)) {
+	    io_unregister(common_data.io, pc->fd);
+	    fd = pc->fd;
+	    free(pc);
+	} else
+	    pool_close(pc);
+    }
+
+    if (fd < 0)
+	stat_misses++;
+    else
+	stat_hits++;
+
+    pool_fill(i);
+    return fd;
+}
+
+static void pool_report(void)
+{
+    unsigned long long hits = stat_hits - stat_hits_reported, misses = stat_misses - stat_misses_reported;
+    if (stat_last_report + POOL_REPORT > io_now.tv_sec || !(hits + misses))
+	return;
+    logmsg("connection pool: %llu of %llu connections (%llu%%) served from pool", hits, hits + misses, 100 * hits / (hits + misses));
+    stat_hits_reported = stat_hits;
+    stat_misses_reported = stat_misses;
+    stat_last_report = io_now.tv_sec;
+}
+
+static void pool_tick(void *key, int cur __attribute__((unused)))
+{
+    int i;
+
+    io_sched_renew(common_data.io, key);
+
+    for (i = 0; i < con_arr_len; i++) {
+	struct pool *p = &con_arr[i].pool;
+	int target;
+
+	/* connects per POOL_TICK, moving average, scaled by 256 */
+	p->rate = (p->rate * 3 + (p->demand << 8)) / 4;
+	p->demand = 0;
+
+	target = pool_target(&con_arr[i]);
+
+	/* drop surplus and expired connections, oldest first */
+	while (p->idle && (p->idle_count > target || p->idle->start.tv_sec + (time_t) pool_timeout <= io_now.tv_sec))
+	    pool_close(pool_shift(p));
+
+	pool_fill(i);
+    }
+
+    pool_report();
+}
+
+void pool_init(void)
+{
+    if (pool_size) {
+	stat_last_report = io_now.tv_sec;
+	io_sched_add(common_data.io, &pool_key, (void *) pool_tick, POOL_TICK, 0);
+    }
+}
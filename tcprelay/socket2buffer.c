@@ -23,7 +23,6 @@ void socket2buffer(struct context *ctx, int cur)
     DebugIn(DEBUG_NET);
 
     fd_out = (cur == ctx->ifn) ? ctx->ofn : ctx->ifn;
-    io_clr_i(ctx->io, cur);
     b = buffer_get();
 
 #ifdef WITH_TLS
@@ -40,18 +39,31 @@ void socket2buffer(struct context *ctx, int cur)
 	l = read(cur, b->buf, b->size);
 
     if (l > 0) {
+	size_t queued;
 	b->length = l;
-	if (cur == ctx->ifn)	/* read from ifn, write to bufo */
+	if (cur == ctx->ifn) {	/* read from ifn, write to bufo */
 	    ctx->bufo = buffer_append(ctx->bufo, b);
-	else			/* read from ofn, write to bufi */
+	    queued = ctx->bufo_len += l;
+	} else {		/* read from ofn, write to bufi */
+	    if (ctx->fastopen)
+		connect_out_confirmed(ctx, cur);
 	    ctx->bufi = buffer_append(ctx->bufi, b);
+	    queued = ctx->bufi_len += l;
+	}
+	/* stop reading once the window towards the other peer is full */
+	if (queued >= window_high)
+	    io_clr_i(ctx->io, cur);
 	io_set_o(ctx->io, fd_out);
     } else
 	buffer_free(b);
 
 
-    if (l <= 0 && errno != EAGAIN && errno != EINTR)
-	cleanup(ctx, cur);
+    if (l <= 0 && errno != EAGAIN && errno != EINTR) {
+	if (cur == ctx->ofn && ctx->fastopen)
+	    connect_out_failed(ctx, cur);
+	else
+	    cleanup(ctx, cur);
+    }
 
     DebugOut(DEBUG_NET);
 }
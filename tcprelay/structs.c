@@ -17,6 +17,7 @@ struct context *new_context(struct io_context *io)
     c->io = io;
     c->ifn = c->ofn = -1;
     c->con_arr_idx = -1;
+    c->ct.ctx = c;
 
     return c;
 }
@@ -0,0 +1,217 @@
+/*
+ * tcprelay_test.c
+ * (C) 2026 Marc Huber <Marc.Huber@web.de>
+ *
+ * Runs ./tcprelay against two loopback backends: one that never
+ * completes the TCP handshake (its accept queue is full), and one that
+ * answers "ok" and then keeps the connection open. Checks that the
+ * connect timeout fails over to the second backend and that the idle
+ * timeout still applies, for both orderings of the two timeouts. Also
+ * checks that a refused TCP Fast Open connect fails over with the client
+ * data intact. The connect is only deferred to the first write if the
+ * kernel has a Fast Open cookie for 127.0.0.1 cached.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sysexits.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int failed = 0;
+
+static void check(int ok, char *what, double t)
+{
+    printf("%s: %s (%.2fs)\n", ok ? "ok" : "FAILED", what, t);
+    if (!ok)
+	failed++;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1e6;
+}
+
+static int listener(int backlog, int *port)
+{
+    struct sockaddr_in sin;
+    socklen_t sinlen = sizeof(sin);
+    int one = 1, s = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (s < 0 || bind(s, (struct sockaddr *) &sin, sizeof(sin)) || listen(s, backlog) || getsockname(s, (struct sockaddr *) &sin, &sinlen)) {
+	perror("listener");
+	exit(EX_OSERR);
+    }
+    *port = ntohs(sin.sin_port);
+    return s;
+}
+
+static int connect_to(int port, int nonblocking)
+{
+    struct sockaddr_in sin;
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons((uint16_t) port);
+    if (nonblocking)
+	fcntl(s, F_SETFL, O_NONBLOCK);
+    if (connect(s, (struct sockaddr *) &sin, sizeof(sin)) && errno != EINPROGRESS) {
+	close(s);
+	return -1;
+    }
+    return s;
+}
+
+/* Answers "ok" to the first byte and holds the connection until the peer closes it. */
+static pid_t backend(int s)
+{
+    pid_t pid = fork();
+
+    if (!pid) {
+	while (1) {
+	    char buf[64];
+	    int c = accept(s, NULL, NULL);
+	    if (c < 0)
+		continue;
+	    if (read(c, buf, 1) == 1 && write(c, "ok", 2) == 2)
+		while (read(c, buf, sizeof(buf)) > 0);
+	    close(c);
+	}
+    }
+    return pid;
+}
+
+/* The first remote is tried first, with the given options. */
+static pid_t relay(int port, int first, char *opts, int good, int idle)
+{
+    char cfg[] = "/tmp/tcprelay_test.XXXXXX";
+    int fd = mkstemp(cfg);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "w");
+    pid_t pid;
+
+    if (!f) {
+	perror("config");
+	exit(EX_OSERR);
+    }
+    fprintf(f, "id = spawnd { listen = { address = 127.0.0.1 port = %d } spawn = { instances min = 1 instances max = 1 } background = no }\n"
+	    "id = tcprelay {\n"
+	    "\tidle timeout = %d\n"
+	    "\tremote = { address = 127.0.0.1 port = %d %s }\n"
+	    "\tremote = { address = 127.0.0.1 port = %d }\n" "}\n", port, idle, first, opts, good);
+    fclose(f);
+
+    if (!(pid = fork())) {
+	int null = open("/dev/null", O_WRONLY);
+	setpgid(0, 0);
+	dup2(null, 1);
+	dup2(null, 2);
+	execl("./tcprelay", "tcprelay", cfg, (char *) NULL);
+	_exit(EX_OSERR);
+    }
+    sleep(1);
+    unlink(cfg);
+    return pid;
+}
+
+static void relay_stop(pid_t pid)
+{
+    kill(-pid, SIGTERM);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+/*
+ * Connects through the relay and sends a byte. Returns the time until
+ * "ok" arrives in *t_ok (-1 if it doesn't) and the time until the relay
+ * closes the connection in *t_eof. A close with the byte still unread
+ * shows up as a reset.
+ */
+static void session(int port, double *t_ok, double *t_eof)
+{
+    char buf[8];
+    struct timeval tv = { 10, 0 };
+    double t0 = now();
+    ssize_t l;
+    int s = connect_to(port, 0);
+
+    *t_ok = *t_eof = -1;
+    if (s < 0)
+	return;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (write(s, "x", 1) != 1) {
+	close(s);
+	return;
+    }
+    while ((l = read(s, buf, sizeof(buf))) > 0)
+	if (*t_ok < 0)
+	    *t_ok = now() - t0;
+    if (!l || errno == ECONNRESET)
+	*t_eof = now() - t0;
+    close(s);
+}
+
+int main(int argc __attribute__((unused)), char **argv __attribute__((unused)))
+{
+    int hole_port, good_port, closed_port, relay_port, i, l;
+    pid_t be, pid;
+    double t_ok, t_eof;
+
+    be = backend(listener(16, &good_port));
+
+    /* fill the accept queue, further SYNs are dropped */
+    listener(0, &hole_port);
+    for (i = 0; i < 4; i++)
+	connect_to(hole_port, 1);
+
+    close(listener(1, &closed_port));
+    close(listener(1, &relay_port));
+
+    /* connect timeout shorter than idle timeout */
+    pid = relay(relay_port, hole_port, "connect timeout = 1", good_port, 30);
+    session(relay_port, &t_ok, &t_eof);
+    check(t_ok > 0.8 && t_ok < 2.5, "failover at connect timeout with idle timeout set", t_ok);
+    relay_stop(pid);
+
+    /* idle timeout after failover */
+    pid = relay(relay_port, hole_port, "connect timeout = 1", good_port, 3);
+    session(relay_port, &t_ok, &t_eof);
+    check(t_ok > 0.8 && t_ok < 2.5, "failover at connect timeout with short idle timeout", t_ok);
+    l = t_eof > 0 && t_eof - t_ok > 2.5 && t_eof - t_ok < 5;
+    check(l, "idle timeout after failover", t_eof - t_ok);
+    relay_stop(pid);
+
+    /* idle timeout shorter than connect timeout */
+    pid = relay(relay_port, hole_port, "connect timeout = 5", good_port, 1);
+    session(relay_port, &t_ok, &t_eof);
+    check(t_ok < 0 && t_eof > 0.8 && t_eof < 2.5, "idle timeout while connecting", t_eof);
+    relay_stop(pid);
+
+    /* the refusal shows up on the first write */
+    pid = relay(relay_port, closed_port, "tcp fast-open = yes", good_port, 30);
+    session(relay_port, &t_ok, &t_eof);
+    check(t_ok > 0 && t_ok < 1, "failover after refused fast open connect", t_ok);
+    relay_stop(pid);
+
+    kill(be, SIGKILL);
+    waitpid(be, NULL, 0);
+
+    return failed ? EX_SOFTWARE : EX_OK;
+}